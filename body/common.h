@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
@@ -20,6 +21,7 @@
 // body hardware , and network interface definitios
 #include <body.h>
 #include <body_network_intfc.h>
+#include <flight_rec.h>
 
 // utils
 #include <gpio.h>
@@ -65,8 +67,10 @@ oled_strs_t *oled_get_strs(void);
 // drive.c
 int drive_init(void);
 void drive_run(struct msg_drive_proc_s *dpm);
+void drive_run_path(struct msg_drive_path_s *dpm);
 void drive_emer_stop(void);
 bool drive_emer_stop_occurred(void);
+int drive_get_proc_id(void);
 
 // drive.c routines called from drive_procs.c
 int drive_straight_cal(double cal_feet);
@@ -76,8 +80,50 @@ int drive_rev(double feet, double mph);
 int drive_rotate(double degrees, double fudge);
 int drive_rotate_to_heading(double heading, double fudge);
 int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_flag, double fudge);
+int drive_goto(double x, double y, double mph);
+int drive_home(double mph);
+int drive_path(struct drive_path_seg_s *seg, int max_seg);
+struct msg_drive_path_s *drive_get_path(void);
+
+// drive.c routines called from wheel_ctlr.c
+void drive_cal_mph_to_mtr_speeds(double mph, double *lspeed, double *rspeed);
+
+// drive.c routines called from main.c
+void drive_cal_get_confidence(double *confidence, int *updates);
 
 // drive_procs.c
 int drive_proc(struct msg_drive_proc_s *dpm);
 
+// wheel_ctlr.c
+int wheel_ctlr_init(void);
+void wheel_ctlr_enable(void);
+void wheel_ctlr_disable(void);
+bool wheel_ctlr_is_enabled(void);
+void wheel_ctlr_set_target(double left_mph, double right_mph);
+void wheel_ctlr_get_target(double *left_mph, double *right_mph);
+void wheel_ctlr_set_accel(double mph_per_sec);
+double wheel_ctlr_get_accel(void);
+bool wheel_ctlr_is_stopped(void);
+void wheel_ctlr_reset_avg_mtr_speeds(void);
+void wheel_ctlr_get_avg_mtr_speeds(int *lspeed, int *rspeed);
+void wheel_ctlr_get_state(int id, double *ramped_mph, double *measured_mph, int *mtr_speed);
+
+// pose.c
+typedef struct {
+    double   x;              // feet
+    double   y;              // feet
+    double   heading;        // degrees clockwise from +y, range 0 to 360
+    double   speed;          // feet/sec
+    double   rotation_rate;  // degrees/sec
+    uint64_t time_us;
+} pose_t;
+int pose_init(void);
+void pose_get(pose_t *pose);
+void pose_reset(double x, double y, double heading);
+void pose_get_bearing(double x, double y, double *distance, double *bearing);
+
+// flight_rec.c
+int flight_rec_init(void);
+void flight_rec_trigger(char *reason);
+
 #endif
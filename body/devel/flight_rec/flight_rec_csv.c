@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <body.h>
+#include <flight_rec.h>
+
+// Notes:
+// - Converts a flight recorder file, either a dump file (flight_rec.<n>.frd)
+//   or the ring file (flight_rec.ring, flight_rec.prev.frd), to csv.
+// - usage: flight_rec_csv <file> [csv_file]
+//   the csv is written to stdout if csv_file is not supplied
+// - The time column is in ms, relative to the trigger for a dump file, and
+//   relative to the first record for a ring file that was not triggered.
+
+int main(int argc, char **argv)
+{
+    FILE *fp, *ofp;
+    flight_rec_hdr_t hdr;
+    flight_rec_t r;
+    uint64_t n, first, time0_us;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: flight_rec_csv <file> [csv_file]\n");
+        return 1;
+    }
+
+    // read and validate the header
+    fp = fopen(argv[1], "r");
+    if (fp == NULL) {
+        fprintf(stderr, "failed to open %s, %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+        fprintf(stderr, "failed to read header of %s\n", argv[1]);
+        return 1;
+    }
+    if (hdr.magic != FLIGHT_REC_MAGIC || hdr.version != FLIGHT_REC_VERSION) {
+        fprintf(stderr, "%s is not a flight recorder file, magic=0x%x version=%d\n",
+                argv[1], hdr.magic, hdr.version);
+        return 1;
+    }
+    if (hdr.rec_size != sizeof(flight_rec_t)) {
+        fprintf(stderr, "%s rec_size %d, expected %zd\n", argv[1], hdr.rec_size, sizeof(flight_rec_t));
+        return 1;
+    }
+    if (hdr.max_rec == 0 || hdr.head == 0) {
+        fprintf(stderr, "%s has no records\n", argv[1]);
+        return 1;
+    }
+
+    // open the csv file
+    if (argc == 3) {
+        ofp = fopen(argv[2], "w");
+        if (ofp == NULL) {
+            fprintf(stderr, "failed to open %s, %s\n", argv[2], strerror(errno));
+            return 1;
+        }
+    } else {
+        ofp = stdout;
+    }
+
+    // determine the range of valid records, and the time origin
+    first = (hdr.head > hdr.max_rec ? hdr.head - hdr.max_rec : 0);
+    if (hdr.trigger_time_us != 0) {
+        time0_us = hdr.trigger_time_us;
+    } else {
+        fseek(fp, FLIGHT_REC_DATA_OFFSET + (first % hdr.max_rec) * sizeof(r), SEEK_SET);
+        if (fread(&r, sizeof(r), 1, fp) != 1) {
+            fprintf(stderr, "failed to read %s\n", argv[1]);
+            return 1;
+        }
+        time0_us = r.time_us;
+    }
+    hdr.reason[sizeof(hdr.reason)-1] = '\0';
+    fprintf(stderr, "%s: %lld records, reason '%s'\n",
+            argv[1], (long long)(hdr.head - first), hdr.reason);
+
+    // write the csv
+    fprintf(ofp, "time_ms,"
+                 "enc_count_l,enc_count_r,enc_mph_l,enc_mph_r,"
+                 "mc_target_speed_l,mc_target_speed_r,wheel_target_mph_l,wheel_target_mph_r,"
+                 "rotation,heading,prox_sig_front,prox_sig_rear,"
+                 "motors_current,electronics_current,drive_proc_id,mc_state,flags\n");
+    for (n = first; n < hdr.head; n++) {
+        fseek(fp, FLIGHT_REC_DATA_OFFSET + (n % hdr.max_rec) * sizeof(r), SEEK_SET);
+        if (fread(&r, sizeof(r), 1, fp) != 1) {
+            fprintf(stderr, "failed to read %s record %lld\n", argv[1], (long long)n);
+            return 1;
+        }
+        fprintf(ofp, "%0.3f,%d,%d,%0.3f,%0.3f,%d,%d,%0.3f,%0.3f,%0.2f,%0.2f,%0.3f,%0.3f,%0.3f,%0.3f,%d,%d,0x%02x\n",
+                ((int64_t)r.time_us - (int64_t)time0_us) / 1000.,
+                r.enc_count[0], r.enc_count[1],
+                ENC_SPEED_TO_MPH(r.enc_speed[0]), ENC_SPEED_TO_MPH(r.enc_speed[1]),
+                r.mc_target_speed[0], r.mc_target_speed[1],
+                r.wheel_target_mph[0], r.wheel_target_mph[1],
+                r.rotation, r.heading,
+                r.prox_sig[0], r.prox_sig[1],
+                r.motors_current, r.electronics_current,
+                r.drive_proc_id, r.mc_state, r.flags);
+    }
+
+    // done
+    fclose(fp);
+    if (ofp != stdout) {
+        fclose(ofp);
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <misc.h>
+#include <i2c.h>
+
+// Notes:
+// - tests the i2c bus manager using the fake bus backend, runs on a PC
+// - simulates the body's i2c load: imu reads every 1 ms at realtime priority,
+//   adc reads every 10 ms, env reads, and continuous oled frame writes;
+//   and a device that is not present, which is read every 5 ms
+
+#define IMU_ADDR   0x68
+#define ADC_ADDR   0x04
+#define ENV_ADDR   0x77
+#define OLED_ADDR  0x3c
+#define NO_ADDR    0x50
+
+#define TEST_SECS  3
+
+static volatile bool done;
+static int errors;
+static int no_dev_reads;
+
+static void * imu_thread(void *cx);
+static void * adc_thread(void *cx);
+static void * env_thread(void *cx);
+static void * oled_thread(void *cx);
+static void * no_dev_thread(void *cx);
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAILED: %s\n", #cond); \
+            errors++; \
+        } \
+    } while (0)
+
+// -----------------  MAIN  ---------------------------------------------
+
+int main(int argc, char **argv)
+{
+    pthread_t tid[5];
+    uint8_t data[8], regs[8] = {1,2,3,4,5,6,7,8};
+    i2c_stats_t imu_stats, oled_stats, adc_stats, no_stats;
+    int i;
+
+    // init i2c with the fake backend, at 400 khz
+    i2c_set_backend(&i2c_fake_backend);
+    i2c_fake_set_bus_speed(400000);
+    i2c_fake_add_device(IMU_ADDR);
+    i2c_fake_add_device(ADC_ADDR);
+    i2c_fake_add_device(ENV_ADDR);
+    i2c_fake_add_device(OLED_ADDR);
+    if (i2c_init() < 0) {
+        printf("FAILED: i2c_init\n");
+        return 1;
+    }
+    i2c_set_priority(IMU_ADDR, I2C_PRIO_REALTIME);
+    i2c_set_priority(ADC_ADDR, I2C_PRIO_HIGH);
+
+    // basic read and write
+    i2c_fake_set_regs(IMU_ADDR, 0x3b, regs, 8);
+    CHECK(i2c_read(IMU_ADDR, 0x3b, data, 8) == 0);
+    CHECK(memcmp(data, regs, 8) == 0);
+    CHECK(i2c_write(ENV_ADDR, 0x10, regs, 4) == 0);
+    i2c_fake_get_regs(ENV_ADDR, 0x10, data, 4);
+    CHECK(memcmp(data, regs, 4) == 0);
+
+    // a device that is not present returns an error
+    CHECK(i2c_read(NO_ADDR, 0, data, 1) < 0);
+
+    // run the simulated load
+    i2c_reset_stats();
+    pthread_create(&tid[0], NULL, imu_thread, NULL);
+    pthread_create(&tid[1], NULL, adc_thread, NULL);
+    pthread_create(&tid[2], NULL, env_thread, NULL);
+    pthread_create(&tid[3], NULL, oled_thread, NULL);
+    pthread_create(&tid[4], NULL, no_dev_thread, NULL);
+    sleep(TEST_SECS);
+    done = true;
+    for (i = 0; i < 5; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    i2c_print_stats();
+
+    // check results:
+    // - no errors, except for the device that is not present; its requests,
+    //   which are queued concurrently with the others, are not merged so
+    //   they do not cause errors for the other devices
+    // - requests were merged, so there are fewer ioctls than requests
+    // - the imu latency is bounded by a small batch, not by an oled frame
+    i2c_get_stats(IMU_ADDR, &imu_stats);
+    i2c_get_stats(ADC_ADDR, &adc_stats);
+    i2c_get_stats(OLED_ADDR, &oled_stats);
+    i2c_get_stats(NO_ADDR, &no_stats);
+    CHECK(imu_stats.count > 0 && imu_stats.errors == 0);
+    CHECK(oled_stats.count > 0 && oled_stats.errors == 0);
+    CHECK(adc_stats.errors == 0);
+    CHECK(no_dev_reads > 0 && no_stats.count == no_dev_reads && no_stats.errors == no_dev_reads);
+    CHECK(i2c_fake_get_transfer_count() <
+          imu_stats.count + adc_stats.count + oled_stats.count + no_stats.count);
+    CHECK(imu_stats.total_latency_us / imu_stats.count < 
+          oled_stats.total_latency_us / oled_stats.count);
+
+    printf("%s\n", errors == 0 ? "PASSED" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
+
+// -----------------  SIMULATED DEVICE THREADS  -------------------------
+
+static void * imu_thread(void *cx)
+{
+    uint8_t data[14];
+
+    while (!done) {
+        if (i2c_read(IMU_ADDR, 0x3b, data, 14) < 0) {
+            printf("FAILED: imu read\n");
+        }
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static void * adc_thread(void *cx)
+{
+    uint8_t data[2];
+
+    while (!done) {
+        i2c_read(ADC_ADDR, 0x20, data, 2);
+        usleep(10000);
+    }
+    return NULL;
+}
+
+static void * env_thread(void *cx)
+{
+    uint8_t data[6];
+
+    while (!done) {
+        i2c_read(ENV_ADDR, 0xf7, data, 6);
+        usleep(100000);
+    }
+    return NULL;
+}
+
+static void * oled_thread(void *cx)
+{
+    uint8_t data[31];
+    int i;
+
+    // a 128x32 frame is 512 bytes, written in 32 byte chunks
+    memset(data, 0x55, sizeof(data));
+    while (!done) {
+        for (i = 0; i < 512; i += sizeof(data)) {
+            i2c_write(OLED_ADDR, 0x40, data, sizeof(data));
+        }
+        usleep(100000);
+    }
+    return NULL;
+}
+
+static void * no_dev_thread(void *cx)
+{
+    uint8_t data[1];
+
+    while (!done) {
+        if (i2c_read(NO_ADDR, 0, data, 1) == 0) {
+            printf("FAILED: no_dev read succeeded\n");
+        }
+        no_dev_reads++;
+        usleep(5000);
+    }
+    return NULL;
+}
@@ -0,0 +1,279 @@
+#include "common.h"
+
+#include "sim.h"
+
+// Notes:
+// - Runs the body drive procs against the simulated hardware, and checks
+//   the robot's final pose. Runs on a PC.
+// - usage: drive_sim [-s time_scale] [test ...]
+//   with no test args all tests are run; the simulated time runs as fast as
+//   the host allows, or at most time_scale times real time
+// - The results are deterministic, see sim_time.c; each run starts from the
+//   default drive straight and gyro calibrations.
+// - Each test sets the initial pose of both the simulator and the body's
+//   pose estimate; the pose is in feet, with heading in degrees clockwise
+//   from the +y axis.
+
+//
+// defines
+//
+
+#define DEFAULT_TIME_SCALE  0     // unpaced
+#define PROC_TIMEOUT_SECS   300   // simulated secs
+
+//
+// typedefs
+//
+
+typedef struct {
+    char   *name;
+    int     proc_id;
+    double  arg[8];
+    double  x0, y0, heading0;  // initial pose
+    bool    expect_succ;
+    double  x, y, heading;     // expected final pose
+    double  pos_tol, hdg_tol;
+    double  obstacle[3];       // x, y, radius; radius 0 for none
+} test_t;
+
+//
+// variables
+//
+
+static test_t test_tbl[] = {
+    // name   proc_id     args           x0   y0   hdg0  succ   x     y     hdg   pos   hdg   obstacle
+    { "fwd",  DRIVE_FWD,  {5, 0.5},      0,   0,   0,    true,  0,    5,    0,    0.25, 3 },
+    { "rev",  DRIVE_REV,  {5, 0.5},      0,   0,   0,    true,  0,   -5,    0,    0.25, 3 },
+    { "rot",  DRIVE_ROT,  {180},         0,   0,   0,    true,  0,    0,    180,  0.25, 3 },
+    { "hdg",  DRIVE_HDG,  {90},          0,   0,   0,    true,  0,    0,    90,   0.25, 3 },
+    { "rad",  DRIVE_RAD,  {360, 1},      0,   0,   0,    true,  0,    0,    0,    0.5,  5 },
+    { "goto", DRIVE_GOTO, {3, 4},        0,   0,   0,    true,  3,    4,    37,   0.25, 5 },
+    { "home", DRIVE_HOME, {},            -2,  3,   135,  true,  0,    0,    0,    0.25, 3 },
+    { "tst2", DRIVE_TST2, {},            0,   0,   0,    true,  0,    0,    0,    0.5,  5 },
+    { "tst3", DRIVE_TST3, {},            0,   0,   0,    true,  0,    0,    0,    0.5,  5 },
+    { "tst4", DRIVE_TST4, {},            0,   0,   0,    true,  0,    0,    0,    0.75, 10 },
+    { "tst5", DRIVE_TST5, {},            0,   0,   0,    true,  0,    0,    0,    0.75, 10 },
+    { "tst6", DRIVE_TST6, {},            0,   0,   0,    true,  0,    0,    0,    0.75, 10 },
+    { "tst7", DRIVE_TST7, {},            0,   0,   0,    true,  0,    0,    0,    0.75, 10 },
+    { "prox", DRIVE_FWD,  {5, 0.5},      0,   0,   0,    false, 0,    2,    0,    0.5,  3,    {0, 3, 0.25} },
+};
+
+#define MAX_TEST (sizeof(test_tbl) / sizeof(test_tbl[0]))
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int             complete_unique_id;
+static bool            complete_succ;
+static char            complete_reason[200];
+
+//
+// prototypes
+//
+
+static void initialize(double time_scale);
+static int run_test(test_t *t);
+static double heading_diff(double a, double b);
+static uint64_t real_time_us(void);
+
+// -----------------  MAIN  -----------------------------------------------
+
+int main(int argc, char **argv)
+{
+    double time_scale = DEFAULT_TIME_SCALE;
+    int i, j, n, failed = 0;
+
+    // the test results are interleaved with the log msgs
+    setlinebuf(stdout);
+
+    // parse options
+    while (true) {
+        int ch = getopt(argc, argv, "s:");
+        if (ch == -1) {
+            break;
+        }
+        switch (ch) {
+        case 's':
+            if (sscanf(optarg, "%lf", &time_scale) != 1 || time_scale < 0) {
+                fprintf(stderr, "invalid time_scale '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: drive_sim [-s time_scale] [test ...]\n");
+            return 1;
+        }
+    }
+
+    // check the test args
+    for (i = optind; i < argc; i++) {
+        for (j = 0; j < MAX_TEST; j++) {
+            if (strcmp(argv[i], test_tbl[j].name) == 0) break;
+        }
+        if (j == MAX_TEST) {
+            fprintf(stderr, "invalid test '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // start from the default calibrations; the cal files are updated by each
+    // run, and would otherwise make the results depend on the prior runs
+    unlink("drive_straight.cal");
+    unlink("imu_gyro.cal");
+
+    // init the simulator and the body drivers
+    initialize(time_scale);
+
+    // run the tests
+    for (n = 0, j = 0; j < MAX_TEST; j++) {
+        if (optind < argc) {
+            for (i = optind; i < argc; i++) {
+                if (strcmp(argv[i], test_tbl[j].name) == 0) break;
+            }
+            if (i == argc) continue;
+        }
+        if (run_test(&test_tbl[j]) < 0) {
+            failed++;
+        }
+        n++;
+    }
+
+    printf("\n%s: %d of %d tests failed\n", failed ? "FAILED" : "PASSED", failed, n);
+    return failed ? 1 : 0;
+}
+
+static void initialize(double time_scale)
+{
+    #define CALL(routine,args) \
+        do { \
+            int rc = routine args; \
+            if (rc < 0) { \
+                fprintf(stderr, "FATAL: %s failed\n", #routine); \
+                exit(1); \
+            } \
+        } while (0)
+
+    // defer logmsg output, as in body main.c
+    logmsg_init();
+
+    // the simulator must be initialized first, it sets the hal backend
+    CALL(sim_init, (time_scale));
+
+    // init devices, as in body main.c
+    CALL(gpio_init, ());
+    CALL(timer_init, ());
+    CALL(mc_init, (2, LEFT_MOTOR, RIGHT_MOTOR));
+    CALL(encoder_init, (2, ENCODER_GPIO_LEFT_B, ENCODER_GPIO_LEFT_A,
+                           ENCODER_GPIO_RIGHT_B, ENCODER_GPIO_RIGHT_A));
+    CALL(proximity_init, (2, PROXIMITY_FRONT_GPIO_SIG, PROXIMITY_FRONT_GPIO_ENABLE,
+                             PROXIMITY_REAR_GPIO_SIG,  PROXIMITY_REAR_GPIO_ENABLE));
+    CALL(button_init, (2, BUTTON_LEFT, BUTTON_RIGHT));
+    CALL(current_init, (1, CURRENT_ADC_CHAN));
+    CALL(imu_init, (0));
+
+    // init body program functions
+    CALL(wheel_ctlr_init, ());
+    CALL(pose_init, ());
+    CALL(drive_init, ());
+    CALL(flight_rec_init, ());
+}
+
+// -----------------  RUN TEST  -------------------------------------------
+
+static int run_test(test_t *t)
+{
+    static int unique_id;
+    struct msg_drive_proc_s dpm;
+    uint64_t sim_start_us, real_start_us;
+    double x, y, heading;
+    bool completed, pass;
+    char result[300];
+
+    printf("\n----- %s -----\n", t->name);
+
+    // set the initial pose and the obstacles
+    sim_set_pose(t->x0, t->y0, t->heading0);
+    sim_clear_obstacles();
+    if (t->obstacle[2] > 0) {
+        sim_add_obstacle(t->obstacle[0], t->obstacle[1], t->obstacle[2]);
+    }
+
+    // allow time for the smoothed magnetometer heading to settle, and
+    // set the body's pose estimate to the initial pose
+    sleep(2);
+    pose_reset(t->x0, t->y0, t->heading0);
+
+    // run the drive proc, and wait for it to complete
+    memset(&dpm, 0, sizeof(dpm));
+    dpm.proc_id = t->proc_id;
+    dpm.unique_id = ++unique_id;
+    memcpy(dpm.arg, t->arg, sizeof(dpm.arg));
+
+    sim_start_us = sim_time_us();
+    real_start_us = real_time_us();
+    drive_run(&dpm);
+
+    while (true) {
+        pthread_mutex_lock(&mutex);
+        completed = (complete_unique_id == dpm.unique_id);
+        pthread_mutex_unlock(&mutex);
+        if (completed || sim_time_us() - sim_start_us > PROC_TIMEOUT_SECS * 1000000ULL) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    // wait for the robot to come to rest, and check the final pose
+    sleep(1);
+    sim_get_pose(&x, &y, &heading);
+
+    pass = completed &&
+           complete_succ == t->expect_succ &&
+           hypot(x - t->x, y - t->y) <= t->pos_tol &&
+           fabs(heading_diff(heading, t->heading)) <= t->hdg_tol;
+
+    if (!completed) {
+        sprintf(result, "timed out");
+    } else {
+        sprintf(result, "%s%s%s",
+                complete_succ ? "succ" : "fail",
+                complete_succ ? "" : " - ",
+                complete_succ ? "" : complete_reason);
+    }
+    printf("%s: %s: %s\n", pass ? "PASS" : "FAIL", t->name, result);
+    printf("  pose     x=%6.2f  y=%6.2f  heading=%7.1f\n", x, y, fmod(heading+360*100, 360));
+    printf("  expected x=%6.2f  y=%6.2f  heading=%7.1f  (tolerance %0.2f ft, %0.0f deg)\n",
+           t->x, t->y, t->heading, t->pos_tol, t->hdg_tol);
+    printf("  sim_time=%0.1f secs  real_time=%0.1f secs\n",
+           (sim_time_us() - sim_start_us) / 1000000.,
+           (real_time_us() - real_start_us) / 1000000.);
+
+    return pass ? 0 : -1;
+}
+
+static double heading_diff(double a, double b)
+{
+    double d = fmod(a - b, 360);
+
+    if (d > 180) d -= 360;
+    if (d < -180) d += 360;
+    return d;
+}
+
+// CLOCK_MONOTONIC_RAW is not simulated by sim_time.c
+static uint64_t real_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// -----------------  STUBS FOR BODY MAIN.C  ------------------------------
+
+void send_drive_proc_complete_msg(int unique_id, bool succ, char *failure_reason)
+{
+    pthread_mutex_lock(&mutex);
+    complete_unique_id = unique_id;
+    complete_succ = succ;
+    strncpy(complete_reason, failure_reason, sizeof(complete_reason)-1);
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+
+#include <body.h>
+#include <misc.h>
+
+#include "sim.h"
+
+// Notes:
+// - The physics thread integrates the model at SIM_STEP_US of simulated time.
+// - Encoder edges are produced when the gpios are read: each read advances the
+//   emitted encoder count by at most one toward the wheel's actual count, so
+//   the quadrature sequence is never skipped, even when the sampler is slow
+//   relative to the wheel speed.
+// - Motor ctlr cmds supported: EXIT_SAFE_START, MOTOR_FORWARD, MOTOR_REVERSE,
+//   STOP_MOTOR, GET_VARIABLE, SET_MOTOR_LIMIT, GET_FW_VER; each is followed
+//   by its crc byte, and responses are returned with a crc byte.
+
+//
+// defines
+//
+
+#define SIM_STEP_US           1000
+#define SIM_FD_BASE           1000
+
+#define COUNTS_PER_FOOT       (2248.86 / FEET_PER_REV)
+#define MTR_LAG_SECS          0.05
+#define MTR_GAIN_LEFT         0.90      // loaded motor speed relative to MTR_SPEED_TO_MPH
+#define MTR_GAIN_RIGHT        0.86
+
+#define GYRO_LSB_PER_DPS      131.
+#define GYRO_BIAS_LSB         (0.0689 * 131.)
+#define ACCEL_LSB_PER_G       16384.
+#define MAG_FIELD             200.
+
+#define PROX_RANGE_FEET       0.5
+#define PROX_OFFSET_FEET      0.4       // sensor distance from center of robot
+
+#define MAX_OBSTACLE          10
+#define MAX_RESP              256
+
+//
+// variables
+//
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// robot state
+static double x, y, heading;              // feet, feet, degrees
+static double wheel_mph[2];
+static double wheel_feet[2];
+static double accel_fps2;
+static int    enc_emitted[2];
+
+// motor ctlrs, [0] = left, [1] = right
+static struct smc_s {
+    bool          safe_start;
+    int           error_status;
+    int           target_speed;
+    double        current_speed;
+    int           max_accel;
+    int           max_decel;
+    unsigned char resp[MAX_RESP];
+    int           resp_len;
+} smc[2];
+
+// gpio outputs
+static unsigned int gpio_out;
+
+// obstacles
+static struct obstacle_s {
+    double x, y, radius;
+} obstacle[MAX_OBSTACLE];
+static int max_obstacle;
+
+//
+// prototypes
+//
+
+static void *physics_thread(void *cx);
+static void physics_step(double dt);
+
+static uint64_t sim_timer_get(void);
+static unsigned int sim_gpio_read_all(void);
+static int sim_gpio_read(int pin);
+static void sim_gpio_write(int pin, int value);
+static unsigned int gpio_levels(bool advance_encoders);
+static bool proximity_detect(double offset);
+
+static int sim_mc_open(const char *devname);
+static int sim_mc_write(int fd, const uint8_t *buffer, size_t size);
+static ssize_t sim_mc_read(int fd, uint8_t *buffer, size_t size);
+static void sim_mc_flush(int fd);
+static int smc_var(struct smc_s *m, int id);
+static void smc_resp(struct smc_s *m, unsigned char *resp, int len);
+static unsigned char crc7(unsigned char *msg, int len);
+
+static int sim_imu_init(int dev_addr);
+static int sim_imu_get_rotation(int *rx, int *ry, int *rz);
+static int sim_imu_get_accel_and_rot(int *ax, int *ay, int *az, int *rx, int *ry, int *rz);
+static int sim_imu_get_magnetometer(int *mx, int *my, int *mz);
+static int sim_imu_get_temperature(double *degc);
+
+static int sim_adc_init(int dev_addr);
+static int sim_adc_read(int chan, double *voltage);
+
+hal_backend_t sim_backend = {
+    .name                  = "sim",
+    .timer_get             = sim_timer_get,
+    .gpio_read_all         = sim_gpio_read_all,
+    .gpio_read             = sim_gpio_read,
+    .gpio_write            = sim_gpio_write,
+    .mc_open               = sim_mc_open,
+    .mc_write              = sim_mc_write,
+    .mc_read               = sim_mc_read,
+    .mc_flush              = sim_mc_flush,
+    .imu_init              = sim_imu_init,
+    .imu_get_rotation      = sim_imu_get_rotation,
+    .imu_get_accel_and_rot = sim_imu_get_accel_and_rot,
+    .imu_get_magnetometer  = sim_imu_get_magnetometer,
+    .imu_get_temperature   = sim_imu_get_temperature,
+    .adc_init              = sim_adc_init,
+    .adc_read              = sim_adc_read,
+};
+
+// -----------------  API  ------------------------------------------------
+
+int sim_init(double time_scale)
+{
+    pthread_t tid;
+
+    sim_time_init(time_scale);
+
+    for (int id = 0; id < 2; id++) {
+        smc[id].safe_start   = true;
+        smc[id].error_status = 1;   // safe start violation
+        smc[id].max_accel    = 3;
+        smc[id].max_decel    = 3;
+    }
+
+    hal_set_backend(&sim_backend);
+    pthread_create(&tid, NULL, physics_thread, NULL);
+
+    if (time_scale > 0) {
+        INFO("time_scale = %0.1f\n", time_scale);
+    } else {
+        INFO("time_scale = unpaced\n");
+    }
+    return 0;
+}
+
+void sim_get_pose(double *x_arg, double *y_arg, double *heading_arg)
+{
+    pthread_mutex_lock(&mutex);
+    *x_arg = x;
+    *y_arg = y;
+    *heading_arg = heading;
+    pthread_mutex_unlock(&mutex);
+}
+
+void sim_set_pose(double x_arg, double y_arg, double heading_arg)
+{
+    pthread_mutex_lock(&mutex);
+    x = x_arg;
+    y = y_arg;
+    heading = heading_arg;
+    pthread_mutex_unlock(&mutex);
+}
+
+void sim_add_obstacle(double x_arg, double y_arg, double radius)
+{
+    pthread_mutex_lock(&mutex);
+    if (max_obstacle < MAX_OBSTACLE) {
+        obstacle[max_obstacle++] = (struct obstacle_s){x_arg, y_arg, radius};
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void sim_clear_obstacles(void)
+{
+    pthread_mutex_lock(&mutex);
+    max_obstacle = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+// -----------------  PHYSICS  --------------------------------------------
+
+static void *physics_thread(void *cx)
+{
+    uint64_t t_last = sim_time_us(), t_now;
+    double dt;
+
+    while (true) {
+        usleep(SIM_STEP_US);
+
+        // integrate in steps of no more than SIM_STEP_US, so that the
+        // model is unaffected by the scheduling of this thread
+        t_now = sim_time_us();
+        pthread_mutex_lock(&mutex);
+        while (t_now > t_last) {
+            dt = (t_now - t_last > SIM_STEP_US ? SIM_STEP_US : t_now - t_last);
+            physics_step(dt / 1000000.);
+            t_last += dt;
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    return NULL;
+}
+
+static void physics_step(double dt)
+{
+    static const double gain[2] = { MTR_GAIN_LEFT, MTR_GAIN_RIGHT };
+    double v_last, v, omega, h;
+
+    v_last = (wheel_mph[0] + wheel_mph[1]) / 2 * FPS_PER_MPH;
+
+    for (int id = 0; id < 2; id++) {
+        struct smc_s *m = &smc[id];
+        double target = (m->safe_start ? 0 : m->target_speed);
+        double max_delta, mph;
+
+        // the mtr ctlr ramps its speed toward the target, the accel/decel
+        // limits are the change in speed per 1 ms update period
+        max_delta = (fabs(target) > fabs(m->current_speed) ? m->max_accel : m->max_decel) * (dt * 1000);
+        if (target > m->current_speed + max_delta) {
+            m->current_speed += max_delta;
+        } else if (target < m->current_speed - max_delta) {
+            m->current_speed -= max_delta;
+        } else {
+            m->current_speed = target;
+        }
+
+        // the wheel speed lags the motor ctlr speed
+        mph = MTR_SPEED_TO_MPH(m->current_speed) * gain[id];
+        wheel_mph[id] += (mph - wheel_mph[id]) * (dt / (MTR_LAG_SECS + dt));
+        wheel_feet[id] += wheel_mph[id] * FPS_PER_MPH * dt;
+    }
+
+    // differential drive kinematics; heading increases clockwise
+    v     = (wheel_mph[0] + wheel_mph[1]) / 2 * FPS_PER_MPH;
+    omega = (wheel_mph[0] - wheel_mph[1]) * FPS_PER_MPH / WHEEL_BASE_FEET;   // rad/sec
+    h = heading * (M_PI/180);
+    x += v * sin(h) * dt;
+    y += v * cos(h) * dt;
+    heading += omega * (180/M_PI) * dt;
+    accel_fps2 = (v - v_last) / dt;
+}
+
+// -----------------  TIMER AND GPIO  -------------------------------------
+
+static uint64_t sim_timer_get(void)
+{
+    return sim_time_us();
+}
+
+static unsigned int sim_gpio_read_all(void)
+{
+    unsigned int levels;
+
+    pthread_mutex_lock(&mutex);
+    levels = gpio_levels(true);
+    pthread_mutex_unlock(&mutex);
+    return levels;
+}
+
+static int sim_gpio_read(int pin)
+{
+    unsigned int levels;
+
+    pthread_mutex_lock(&mutex);
+    levels = gpio_levels(false);
+    pthread_mutex_unlock(&mutex);
+    return (levels >> pin) & 1;
+}
+
+static void sim_gpio_write(int pin, int value)
+{
+    pthread_mutex_lock(&mutex);
+    if (value) {
+        gpio_out |= (1 << pin);
+    } else {
+        gpio_out &= ~(1 << pin);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+// caller must hold mutex
+static unsigned int gpio_levels(bool advance_encoders)
+{
+    // quadrature sequence for increasing count, val = (a << 1) | b
+    static const int quad[4] = { 0, 1, 3, 2 };
+    // encoder a and b gpios, wired as in body main.c
+    static const int enc_gpio[2][2] = { { ENCODER_GPIO_LEFT_B,  ENCODER_GPIO_LEFT_A  },
+                                        { ENCODER_GPIO_RIGHT_B, ENCODER_GPIO_RIGHT_A } };
+    unsigned int levels;
+
+    // inputs default high: buttons not pressed, and no proximity return;
+    // the outputs read back their written value
+    levels = ~0u;
+    levels &= ~((1 << PROXIMITY_FRONT_GPIO_ENABLE) | (1 << PROXIMITY_REAR_GPIO_ENABLE));
+    levels |= gpio_out;
+
+    // encoders
+    for (int id = 0; id < 2; id++) {
+        int count = nearbyint(wheel_feet[id] * COUNTS_PER_FOOT);
+        int val;
+
+        if (advance_encoders) {
+            if (enc_emitted[id] < count) enc_emitted[id]++;
+            else if (enc_emitted[id] > count) enc_emitted[id]--;
+        }
+        val = quad[enc_emitted[id] & 3];
+        levels &= ~((1 << enc_gpio[id][0]) | (1 << enc_gpio[id][1]));
+        levels |= ((val >> 1) << enc_gpio[id][0]) | ((val & 1) << enc_gpio[id][1]);
+    }
+
+    // proximity sensors, the sig is active low when the sensor is enabled
+    if ((gpio_out & (1 << PROXIMITY_FRONT_GPIO_ENABLE)) && proximity_detect(PROX_OFFSET_FEET)) {
+        levels &= ~(1 << PROXIMITY_FRONT_GPIO_SIG);
+    }
+    if ((gpio_out & (1 << PROXIMITY_REAR_GPIO_ENABLE)) && proximity_detect(-PROX_OFFSET_FEET)) {
+        levels &= ~(1 << PROXIMITY_REAR_GPIO_SIG);
+    }
+
+    return levels;
+}
+
+// caller must hold mutex;
+// offset is the distance of the sensor along the robot's heading, negative for rear
+static bool proximity_detect(double offset)
+{
+    double h = heading * (M_PI/180);
+    double dir = (offset > 0 ? 1 : -1);
+
+    for (double d = 0; d <= PROX_RANGE_FEET; d += PROX_RANGE_FEET / 10) {
+        double px = x + (offset + dir * d) * sin(h);
+        double py = y + (offset + dir * d) * cos(h);
+        for (int i = 0; i < max_obstacle; i++) {
+            struct obstacle_s *o = &obstacle[i];
+            if (hypot(px - o->x, py - o->y) < o->radius) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// -----------------  MOTOR CTLR  -----------------------------------------
+
+static int sim_mc_open(const char *devname)
+{
+    if (strcmp(devname, LEFT_MOTOR) == 0) {
+        return SIM_FD_BASE + 0;
+    } else if (strcmp(devname, RIGHT_MOTOR) == 0) {
+        return SIM_FD_BASE + 1;
+    }
+    ERROR("invalid devname %s\n", devname);
+    return -1;
+}
+
+static int sim_mc_write(int fd, const uint8_t *buffer, size_t size)
+{
+    struct smc_s *m = &smc[fd - SIM_FD_BASE];
+    unsigned char cmd[8];
+    int i = 0, len;
+
+    pthread_mutex_lock(&mutex);
+
+    while (i < size) {
+        // determine the length of the cmd, excluding the crc
+        switch (buffer[i]) {
+        case 0x83: case 0xe0: case 0xc2: len = 1; break;
+        case 0xa1:                       len = 2; break;
+        case 0x85: case 0x86:            len = 3; break;
+        case 0xa2:                       len = 4; break;
+        default:
+            ERROR("unsupported cmd 0x%x\n", buffer[i]);
+            m->error_status |= 4;   // serial error
+            pthread_mutex_unlock(&mutex);
+            return 0;
+        }
+        if (i + len + 1 > size) {
+            break;
+        }
+        memcpy(cmd, buffer+i, len);
+        if (crc7(cmd, len) != buffer[i+len]) {
+            ERROR("crc error, cmd 0x%x\n", cmd[0]);
+            m->error_status |= 4;   // serial error
+            break;
+        }
+        i += len + 1;
+
+        // process the cmd
+        switch (cmd[0]) {
+        case 0x83:  // exit safe start
+            m->safe_start = false;
+            m->error_status = 0;
+            break;
+        case 0x85:  // motor forward
+        case 0x86:  // motor reverse
+            m->target_speed = (cmd[1] + 32 * cmd[2]) * (cmd[0] == 0x85 ? 1 : -1);
+            break;
+        case 0xe0:  // stop motor
+            m->target_speed = 0;
+            m->safe_start = true;
+            m->error_status |= 1;
+            break;
+        case 0xa1: {  // get variable
+            int v = smc_var(m, cmd[1]);
+            smc_resp(m, (unsigned char []){v & 0xff, (v >> 8) & 0xff}, 2);
+            break; }
+        case 0xa2: {  // set motor limit
+            int v = cmd[2] + 128 * cmd[3];
+            if (cmd[1] == 1) m->max_accel = v;
+            if (cmd[1] == 2) m->max_decel = v;
+            smc_resp(m, (unsigned char []){0}, 1);
+            break; }
+        case 0xc2:  // get fw version
+            smc_resp(m, (unsigned char []){0xa1, 0x00, 0x04, 0x01}, 4);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+static ssize_t sim_mc_read(int fd, uint8_t *buffer, size_t size)
+{
+    struct smc_s *m = &smc[fd - SIM_FD_BASE];
+    int len;
+
+    pthread_mutex_lock(&mutex);
+    len = (size < m->resp_len ? size : m->resp_len);
+    memcpy(buffer, m->resp, len);
+    memmove(m->resp, m->resp+len, m->resp_len-len);
+    m->resp_len -= len;
+    pthread_mutex_unlock(&mutex);
+
+    return len;
+}
+
+static void sim_mc_flush(int fd)
+{
+    pthread_mutex_lock(&mutex);
+    smc[fd - SIM_FD_BASE].resp_len = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+// caller must hold mutex
+static int smc_var(struct smc_s *m, int id)
+{
+    switch (id) {
+    case 0:  return m->error_status;                           // VAR_ERROR_STATUS
+    case 20: return m->target_speed & 0xffff;                  // VAR_TARGET_SPEED
+    case 21: return (int)nearbyint(m->current_speed) & 0xffff; // VAR_CURRENT_SPEED
+    case 23: return 12000;                                     // VAR_INPUT_VOLTAGE, mV
+    case 31: return m->max_accel;                              // VAR_MAX_ACCEL_FORWARD
+    case 32: return m->max_decel;                              // VAR_MAX_DECEL_FORWARD
+    case 44: return 100 + fabs(m->current_speed) / 4;          // VAR_CURRENT, mA
+    default: return 0;
+    }
+}
+
+// caller must hold mutex
+static void smc_resp(struct smc_s *m, unsigned char *resp, int len)
+{
+    if (m->resp_len + len + 1 > MAX_RESP) {
+        ERROR("resp buffer full\n");
+        return;
+    }
+    memcpy(m->resp + m->resp_len, resp, len);
+    m->resp[m->resp_len + len] = crc7(resp, len);
+    m->resp_len += len + 1;
+}
+
+// the motor ctlr's crc7, see mc.c
+static unsigned char crc7(unsigned char *msg, int len)
+{
+    unsigned char crc = 0;
+
+    for (int i = 0; i < len; i++) {
+        crc ^= msg[i];
+        for (int j = 0; j < 8; j++) {
+            if (crc & 1) crc ^= 0x91;
+            crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+// -----------------  IMU  ------------------------------------------------
+
+static int sim_imu_init(int dev_addr)
+{
+    return 0;
+}
+
+static int sim_imu_get_rotation(int *rx, int *ry, int *rz)
+{
+    double omega_dps;
+
+    pthread_mutex_lock(&mutex);
+    omega_dps = (wheel_mph[0] - wheel_mph[1]) * FPS_PER_MPH / WHEEL_BASE_FEET * (180/M_PI);
+    pthread_mutex_unlock(&mutex);
+
+    // imu.c converts rz to deg/sec by (rz - bias) * (-1/131)
+    *rx = *ry = 0;
+    *rz = nearbyint(-omega_dps * GYRO_LSB_PER_DPS + GYRO_BIAS_LSB);
+    return 0;
+}
+
+static int sim_imu_get_accel_and_rot(int *ax, int *ay, int *az, int *rx, int *ry, int *rz)
+{
+    double a;
+
+    pthread_mutex_lock(&mutex);
+    a = accel_fps2;
+    pthread_mutex_unlock(&mutex);
+
+    *ax = nearbyint(a / 32.174 * ACCEL_LSB_PER_G);
+    *ay = 0;
+    *az = ACCEL_LSB_PER_G;
+    return sim_imu_get_rotation(rx, ry, rz);
+}
+
+static int sim_imu_get_magnetometer(int *mx, int *my, int *mz)
+{
+    double h;
+
+    pthread_mutex_lock(&mutex);
+    h = heading * (M_PI/180);
+    pthread_mutex_unlock(&mutex);
+
+    // imu.c computes heading = atan2(-(my-my_cal), mx-mx_cal), with cal = 0
+    *mx = nearbyint(MAG_FIELD * cos(h));
+    *my = nearbyint(-MAG_FIELD * sin(h));
+    *mz = 0;
+
+    // the magnetometer is read at 100 hz
+    usleep(10000);
+    return 0;
+}
+
+static int sim_imu_get_temperature(double *degc)
+{
+    *degc = 30;
+    return 0;
+}
+
+// -----------------  CURRENT SENSOR ADC  ---------------------------------
+
+static int sim_adc_init(int dev_addr)
+{
+    return 0;
+}
+
+static int sim_adc_read(int chan, double *voltage)
+{
+    // current.c converts to amps by (v - 0.322) / 0.264
+    *voltage = 0.322 + 0.264 * 0.5;
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <hal.h>
+
+// Notes:
+// - sim_backend is a hal backend that simulates the body hardware:
+//   . differential drive kinematics, with a motor lag model, and left/right
+//     motors that are slower than MTR_SPEED_TO_MPH, and unequal
+//   . the motor ctlrs' serial protocol
+//   . quadrature encoder edges, on the encoder gpios
+//   . gyro and magnetometer readings, from the simulated heading
+//   . proximity sensor returns, from circular obstacles
+// - The pose is in feet, with heading in degrees clockwise from the +y axis.
+// - sim_init must be called before the drivers are initialized; it calls
+//   hal_set_backend.
+
+// sim.c
+extern hal_backend_t sim_backend;
+int sim_init(double time_scale);
+void sim_get_pose(double *x, double *y, double *heading);
+void sim_set_pose(double x, double y, double heading);
+void sim_add_obstacle(double x, double y, double radius);
+void sim_clear_obstacles(void);
+
+// sim_time.c
+void sim_time_init(double time_scale);
+uint64_t sim_time_us(void);
+
+#endif
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "sim.h"
+
+// Notes:
+// - The program is linked with -Wl,--wrap for the routines below, so that
+//   the calls made by the body and device code are redirected here.
+// - The simulated clock is a virtual clock, it is not derived from the wall
+//   clock. It advances only when all of the program's threads are sleeping,
+//   and then it jumps to the earliest wakeup time. So the code runs in zero
+//   simulated time, and each sleep ends exactly on time, regardless of how
+//   the threads are scheduled on the host; a loaded host makes the
+//   simulation slower, but not different.
+// - The threads are counted by wrapping pthread_create. A thread that blocks
+//   other than in a wrapped sleep, such as on a mutex or condition variable,
+//   is counted as running; this is okay provided that it is waiting on a
+//   thread that is running, and not on a thread that is sleeping.
+// - The sleeping threads are woken one at a time, in order of wakeup time
+//   and then thread id, so after initialization only one thread runs at a
+//   time, and the simulation is repeatable.
+// - When time_scale is not 0 the simulated time is paced to run at most
+//   time_scale times faster than real time.
+// - Realtime scheduling and cpu affinity are not needed when simulating,
+//   and usually not permitted, so those calls are ignored.
+
+//
+// defines
+//
+
+#define MAX_THREAD 64
+
+//
+// typedefs
+//
+
+typedef struct {
+    void *(*start_routine)(void *);
+    void *arg;
+    int   id;
+} thread_start_t;
+
+//
+// variables
+//
+
+static pthread_mutex_t vt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t        vt_ns;               // simulated time since the program started
+static int             running = 1;         // threads not sleeping, the main thread is running
+static double          time_scale;
+static uint64_t        real_start_ns[2];    // [0] = CLOCK_MONOTONIC, [1] = CLOCK_REALTIME
+static uint64_t        pace_start_ns;       // real CLOCK_MONOTONIC when pacing started
+static uint64_t        pace_start_vt_ns;
+
+static int             max_thread = 1;      // thread ids, in order of creation
+static __thread int    thread_id;           // 0 for the main thread
+
+static struct thread_s {
+    bool           asleep;
+    uint64_t       wake_ns;
+    pthread_cond_t cond;
+} thread_tbl[MAX_THREAD];
+
+//
+// prototypes
+//
+
+int __real_clock_gettime(clockid_t clk_id, struct timespec *ts);
+int __real_clock_nanosleep(clockid_t clk_id, int flags, const struct timespec *req, struct timespec *rem);
+int __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                          void *(*start_routine)(void *), void *arg);
+
+static void sim_time_constructor(void) __attribute__ ((constructor));
+static void *thread_start(void *cx);
+static void sleep_until(uint64_t wake_ns);
+static void sleep_for(uint64_t ns);
+static void advance(void);
+static uint64_t ts_to_ns(const struct timespec *ts);
+static void ns_to_ts(uint64_t ns, struct timespec *ts);
+static uint64_t real_ns(clockid_t clk_id);
+
+// -----------------  API  ------------------------------------------------
+
+void sim_time_init(double time_scale_arg)
+{
+    pthread_mutex_lock(&vt_mutex);
+    time_scale = (time_scale_arg > 0 ? time_scale_arg : 0);
+    pace_start_ns = real_ns(CLOCK_MONOTONIC);
+    pace_start_vt_ns = vt_ns;
+    pthread_mutex_unlock(&vt_mutex);
+}
+
+uint64_t sim_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_to_ns(&ts) / 1000;
+}
+
+// -----------------  WRAPPERS  -------------------------------------------
+
+int __wrap_clock_gettime(clockid_t clk_id, struct timespec *ts)
+{
+    if (clk_id != CLOCK_MONOTONIC && clk_id != CLOCK_REALTIME) {
+        return __real_clock_gettime(clk_id, ts);
+    }
+
+    pthread_mutex_lock(&vt_mutex);
+    ns_to_ts(real_start_ns[clk_id == CLOCK_REALTIME] + vt_ns, ts);
+    pthread_mutex_unlock(&vt_mutex);
+    return 0;
+}
+
+unsigned int __wrap_sleep(unsigned int seconds)
+{
+    sleep_for(seconds * 1000000000ULL);
+    return 0;
+}
+
+int __wrap_usleep(useconds_t usec)
+{
+    sleep_for(usec * 1000ULL);
+    return 0;
+}
+
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    sleep_for(ts_to_ns(req));
+    if (rem) {
+        rem->tv_sec = rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
+int __wrap_clock_nanosleep(clockid_t clk_id, int flags, const struct timespec *req, struct timespec *rem)
+{
+    if (clk_id != CLOCK_MONOTONIC && clk_id != CLOCK_REALTIME) {
+        return __real_clock_nanosleep(clk_id, flags, req, rem);
+    }
+
+    if (flags & TIMER_ABSTIME) {
+        uint64_t start = real_start_ns[clk_id == CLOCK_REALTIME];
+        uint64_t abs_ns = ts_to_ns(req);
+        sleep_until(abs_ns > start ? abs_ns - start : 0);
+    } else {
+        sleep_for(ts_to_ns(req));
+        if (rem) {
+            rem->tv_sec = rem->tv_nsec = 0;
+        }
+    }
+    return 0;
+}
+
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                          void *(*start_routine)(void *), void *arg)
+{
+    thread_start_t *ts;
+    int rc;
+
+    ts = malloc(sizeof(thread_start_t));
+    if (ts == NULL) {
+        return -1;
+    }
+    ts->start_routine = start_routine;
+    ts->arg = arg;
+
+    // the new thread is counted as running before it is created, so that
+    // the time does not advance before it has started
+    pthread_mutex_lock(&vt_mutex);
+    if (max_thread == MAX_THREAD) {
+        fprintf(stderr, "FATAL: too many threads\n");
+        exit(1);
+    }
+    ts->id = max_thread++;
+    running++;
+    pthread_mutex_unlock(&vt_mutex);
+
+    rc = __real_pthread_create(thread, attr, thread_start, ts);
+    if (rc != 0) {
+        pthread_mutex_lock(&vt_mutex);
+        running--;
+        pthread_mutex_unlock(&vt_mutex);
+        free(ts);
+    }
+    return rc;
+}
+
+int __wrap_sched_setscheduler(pid_t pid, int policy, const struct sched_param *param)
+{
+    return 0;
+}
+
+int __wrap_sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask)
+{
+    return 0;
+}
+
+// -----------------  VIRTUAL CLOCK  --------------------------------------
+
+static void sim_time_constructor(void)
+{
+    real_start_ns[0] = real_ns(CLOCK_MONOTONIC);
+    real_start_ns[1] = real_ns(CLOCK_REALTIME);
+    for (int i = 0; i < MAX_THREAD; i++) {
+        pthread_cond_init(&thread_tbl[i].cond, NULL);
+    }
+}
+
+static void *thread_start(void *cx)
+{
+    thread_start_t ts = *(thread_start_t*)cx;
+    void *ret;
+
+    free(cx);
+    thread_id = ts.id;
+    ret = ts.start_routine(ts.arg);
+
+    pthread_mutex_lock(&vt_mutex);
+    running--;
+    if (running == 0) {
+        advance();
+    }
+    pthread_mutex_unlock(&vt_mutex);
+    return ret;
+}
+
+static void sleep_for(uint64_t ns)
+{
+    uint64_t now;
+
+    pthread_mutex_lock(&vt_mutex);
+    now = vt_ns;
+    pthread_mutex_unlock(&vt_mutex);
+
+    sleep_until(now + ns);
+}
+
+// wake_ns is simulated time since the program started
+static void sleep_until(uint64_t wake_ns)
+{
+    struct thread_s *t = &thread_tbl[thread_id];
+
+    pthread_mutex_lock(&vt_mutex);
+
+    if (wake_ns <= vt_ns) {
+        pthread_mutex_unlock(&vt_mutex);
+        return;
+    }
+
+    t->asleep  = true;
+    t->wake_ns = wake_ns;
+    running--;
+
+    // the last thread to sleep advances the time
+    while (t->asleep) {
+        if (running == 0) {
+            advance();
+        } else {
+            pthread_cond_wait(&t->cond, &vt_mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&vt_mutex);
+}
+
+// caller must hold vt_mutex, and no threads are running;
+// advance the time to the earliest wakeup, and wake that thread; when
+// several threads wake at the same time the lowest thread id is woken
+// first, and the others are woken, one at a time, when it sleeps again
+static void advance(void)
+{
+    struct thread_s *t = NULL;
+
+    for (int i = 0; i < max_thread; i++) {
+        if (thread_tbl[i].asleep && (t == NULL || thread_tbl[i].wake_ns < t->wake_ns)) {
+            t = &thread_tbl[i];
+        }
+    }
+    if (t == NULL) {
+        return;
+    }
+
+    if (time_scale > 0) {
+        uint64_t pace_ns = pace_start_ns + (t->wake_ns - pace_start_vt_ns) / time_scale;
+        uint64_t now_ns = real_ns(CLOCK_MONOTONIC);
+        struct timespec ts;
+        if (pace_ns > now_ns) {
+            ns_to_ts(pace_ns - now_ns, &ts);
+            __real_clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+        }
+    }
+
+    vt_ns = t->wake_ns;
+    t->asleep = false;
+    running++;
+    pthread_cond_signal(&t->cond);
+}
+
+// -----------------  SUPPORT  --------------------------------------------
+
+static uint64_t ts_to_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void ns_to_ts(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec  = ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static uint64_t real_ns(clockid_t clk_id)
+{
+    struct timespec ts;
+
+    __real_clock_gettime(clk_id, &ts);
+    return ts_to_ns(&ts);
+}
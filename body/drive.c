@@ -10,42 +10,108 @@
 #define EMER_STOP_THREAD_ENABLED   1
 #define EMER_STOP_OCCURRED         (emer_stop_thread_state == EMER_STOP_THREAD_DISABLED)
 
+#define EMER_STOP_SENSOR_BUTTON    0
+#define EMER_STOP_SENSOR_PROXIMITY 1
+#define EMER_STOP_SENSOR_ENCODER   2
+#define EMER_STOP_SENSOR_ACCEL     3
+
 #define STOP_MOTORS_PRINT_NONE     0
 #define STOP_MOTORS_PRINT_DISTANCE 1
 #define STOP_MOTORS_PRINT_ROTATION 2
 
 #define MC_ACCEL 5
 
+#define ROTATE_MPH                 0.3       // wheel speed when rotating in place
+#define ROTATE_DONE_DEGREES        0.5
+#define MIN_CRAWL_MPH              0.05
+
+#define HEADING_KP                 0.02      // mph per degree of heading error
+#define HEADING_MAX_CORR_MPH       0.1
+
+#define GOTO_DONE_FEET             0.2
+#define GOTO_DONE_DEGREES          1.0
+#define GOTO_STEER_MIN_FEET        0.5
+
+#define CAL_UPDATE_MIN_CRUISE_US   1000000   // min cruise time for online cal update
+
+#define PATH_RATE_HZ               200
+#define PATH_INTVL_NS              (1000000000 / PATH_RATE_HZ)
+#define PATH_ACCEL_FRACTION        0.9       // of the wheel_ctlr accel limit
+
+//
+// typedefs
+//
+
+struct path_seg_s {
+    int    type;
+    double length;       // feet, traveled by the robot center (by the wheels for rotate)
+    double rotation;     // degrees, clockwise positive
+    double radius;       // feet, from the center of rotation to the robot center
+    double dir;          // 1 = fwd, -1 = reverse
+    double left_ratio;   // wheel speed / profile speed
+    double right_ratio;
+    double max_mph;      // profile speed limit
+    double accel;        // profile accel limit, mph/sec
+    double end_mph;      // profile speed at the end of the segment
+};
+
 //
 // variables
 //
 
 static struct msg_drive_proc_s * drive_proc_msg;
+static struct msg_drive_path_s   drive_path_msg;
 static int                       emer_stop_thread_state;
 static char                      emer_stop_reason[200];
+static int                       emer_stop_claimed;
+static volatile bool             emer_stop_log_pending;
+static int                       emer_stop_latency_us;
+static volatile bool             emer_stop_sensor_pending;
+static struct {
+    int    sensor;   // EMER_STOP_SENSOR_xxx
+    int    id;
+    double val;
+} emer_stop_sensor;
+static int                       drive_loop_timing;
+static int                       emer_stop_loop_timing;
 static mc_status_t             * mcs;
 
 //
 // prototypes
 //
 
-static int drive_rotate_to_heading_ex(double desired_heading, double fudge, bool do_sdr_check);
+static void drive_loop_sleep(int us);
 static int stop_motors(int print);
+static double decel_limit_mph(double mph, double remaining_feet);
 
 static int drive_straight(double desired_feet, double mph, bool stop_motors_flag,
                           int *avg_lspeed_arg, int *avg_rspeed_arg);
-static int drive_straight_mtr_speed_comp(bool init, double rotation_target) __attribute__((unused));
 
-static void drive_straight_cal_cvt_mph_to_mtr_speeds(double mph, int *lspeed, int *rspeed);
+static int path_seg_init(struct drive_path_seg_s *in, struct path_seg_s *seg);
+static double path_reach_mph(double end_mph, double accel, double feet);
+
+static void drive_cal_update(double mph, double lspeed, double rspeed);
+static int cal_weights(double mph, int idx[2], double w[2]);
+static void cal_cov_init(double var);
+static void cal_confidence_update(void);
 static int drive_straight_cal_file_read(void);
 static int drive_straight_cal_file_write(void);
+static void drive_straight_cal_file_write_if_updated(void);
 static void drive_straight_cal_tbl_print(void);
 static int drive_straight_cal_proc(double cal_feet);
 static void drive_straight_cal_tbl_init_default(void);
 
 static void *drive_thread(void *cx);
 static void *emer_stop_thread(void *cx);
-static void emer_stop_button_cb(int id, bool pressed, int pressed_duration_us);
+static bool emer_stop_motors(uint64_t detect_us);
+static void emer_stop_event(char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+static void emer_stop_sensor_event(int sensor, int id, double val);
+static void emer_stop_sensor_event_complete(void);
+static void emer_stop_complete(void);
+static void emer_stop_button_cb(int id);
+static void emer_stop_proximity_cb(int id, double sig);
+static void emer_stop_encoder_cb(int id, int errors);
+static void emer_stop_accel_cb(double accel);
 
 // -----------------  API  --------------------------------------------------
 
@@ -56,8 +122,12 @@ int drive_init(void)
     // get pointer to mtr ctlr status
     mcs = mc_get_status();
 
-    // register for left-button press, this will trigger an emergency stop
-    button_register_cb(0, emer_stop_button_cb);
+    // register for left-button press, proximity alerts, encoder errors, and
+    // accel alerts; these trigger an emergency stop
+    button_register_edge_cb(0, emer_stop_button_cb);
+    proximity_register_alert_cb(emer_stop_proximity_cb);
+    encoder_register_error_cb(emer_stop_encoder_cb);
+    imu_register_accel_alert_cb(emer_stop_accel_cb);
 
     // set mtr ctlr accel/decel limits, and disable debug mode
     mc_set_accel(MC_ACCEL, MC_ACCEL);
@@ -70,6 +140,11 @@ int drive_init(void)
     }
     drive_straight_cal_tbl_print();
 
+    // register the drive procs' control loops, and the emer_stop_thread
+    // loop, for loop timing
+    drive_loop_timing = loop_timing_register("drive", PATH_INTVL_NS / 1000);
+    emer_stop_loop_timing = loop_timing_register("emer_stop", 1000);
+
     // create drive_thread and emer_stop_thread
     pthread_create(&tid, NULL, emer_stop_thread, NULL);
     pthread_create(&tid, NULL, drive_thread, NULL);
@@ -93,12 +168,64 @@ void drive_run(struct msg_drive_proc_s *drive_proc_msg_arg)
     drive_proc_msg = &static_drive_proc_msg;
 }
 
+// the path is saved, and then run by the drive_thread as proc DRIVE_PATH
+void drive_run_path(struct msg_drive_path_s *drive_path_msg_arg)
+{
+    struct msg_drive_proc_s dpm;
+
+    if (drive_proc_msg != NULL) {
+        ERROR("drive is busy\n");
+        send_drive_proc_complete_msg(drive_path_msg_arg->unique_id, false, "drive is busy");
+        return;
+    }
+    if (drive_path_msg_arg->max_seg <= 0 || drive_path_msg_arg->max_seg > MAX_DRIVE_PATH_SEG) {
+        ERROR("invalid max_seg %d\n", drive_path_msg_arg->max_seg);
+        send_drive_proc_complete_msg(drive_path_msg_arg->unique_id, false, "invalid path");
+        return;
+    }
+
+    drive_path_msg = *drive_path_msg_arg;
+
+    memset(&dpm, 0, sizeof(dpm));
+    dpm.proc_id = DRIVE_PATH;
+    dpm.unique_id = drive_path_msg_arg->unique_id;
+    drive_run(&dpm);
+}
+
+struct msg_drive_path_s *drive_get_path(void)
+{
+    return &drive_path_msg;
+}
+
 void drive_emer_stop(void)
 {
+    uint64_t start_us = microsec_timer();
+
+    mc_emer_stop_all();
+    wheel_ctlr_disable();
+    mc_emer_stop_complete(microsec_timer() - start_us);
+    if (drive_proc_msg != NULL) {
+        flight_rec_trigger("emergency stop requested");
+    }
     ERROR("emergency stop\n");
     mc_disable_all();
 }
 
+// returns true if an emergency stop event has occurred during the
+// current, or most recent, drive proc
+bool drive_emer_stop_occurred(void)
+{
+    return emer_stop_claimed != 0;
+}
+
+// returns the proc_id of the running drive proc, or 0 if none
+int drive_get_proc_id(void)
+{
+    struct msg_drive_proc_s *dpm = drive_proc_msg;
+
+    return dpm != NULL ? dpm->proc_id : 0;
+}
+
 // -----------------  ROUTINES CALLED FROM DRIVE_PROCS.C  -------------------
 
 int drive_straight_cal(double cal_feet)
@@ -137,61 +264,30 @@ int drive_rev(double feet, double mph)
 
 int drive_rotate(double desired_degrees, double fudge)
 {
-    double left_mtr_start_mph  = (desired_degrees > 0 ? 0.5 : -0.5);
-    double right_mtr_start_mph = -left_mtr_start_mph;
-    double left_mtr_mph        = (desired_degrees > 0 ? 0.3 : -0.3);
-    double right_mtr_mph       = -left_mtr_mph;
-    int    lspeed, rspeed;
-    double start_degrees, rotated_degrees;
+    double start_degrees, rotated_degrees, remaining_degrees, mph;
+    double dir = (desired_degrees > 0 ? 1 : -1);
+    int    ms;
 
     INFO("desired_degrees = %0.1f  fudge = %0.1f\n", desired_degrees, fudge);
 
-    // if caller has not supplied fudge factor then use builtin value
-    if (fudge == 0) {
-        static interp_point_t fudge_points[] = {
-                { 15,   3.2  },
-                { 30,   3.0  },
-                { 90,   2.5  },
-                { 180,  1.5  },
-                { 270,  0.75 },
-                { 360,  0.0  }, };
-        fudge = interpolate(fudge_points, sizeof(fudge_points)/sizeof(interp_point_t), fabs(desired_degrees));
-        INFO("builtin fudge = %0.2f\n", fudge);
-    }
-
     // disable both front and read proximity sensors when rotating
     proximity_disable(0);   // disable front
     proximity_disable(1);   // disable rear
 
-    // get imu rotation value prior to starting motors
-    start_degrees = imu_get_rotation();
-
     // if either motor was left running then stop the motors
-    if (mcs->target_speed[0] != 0 || mcs->target_speed[1] != 0) {
+    if (!wheel_ctlr_is_stopped()) {
         if (stop_motors(STOP_MOTORS_PRINT_NONE) < 0) {
             return -1;
         }
     }
 
-    // start motors using boost speed (0.5 mph), and delay 200 ms
-    lspeed = MTR_MPH_TO_SPEED(left_mtr_start_mph);
-    rspeed = MTR_MPH_TO_SPEED(right_mtr_start_mph);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
-    usleep(200000);  // 200 ms
-
-    // slow down motors to 0.3 mph
-    lspeed = MTR_MPH_TO_SPEED(left_mtr_mph);
-    rspeed = MTR_MPH_TO_SPEED(right_mtr_mph);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
+    // get imu rotation value prior to starting motors
+    start_degrees = imu_get_rotation();
 
-    // wait for rotation to complete
-    int ms = 0;
+    // rotate in place; the wheel speed is reduced as the desired rotation
+    // is approached, so that the robot decelerates to a stop at the
+    // desired rotation; the caller's fudge, if supplied, stops early
+    ms = 0;
     while (true) {
         // check if the emer_stop_thread shut down the motors
         if (EMER_STOP_OCCURRED) {
@@ -204,13 +300,18 @@ int drive_rotate(double desired_degrees, double fudge)
         if ((ms % 1000) == 0) {
             INFO("rotated %0.1f deg\n", rotated_degrees);
         }
-        if (fabs(rotated_degrees) > (fabs(desired_degrees) - fudge)) {
+        remaining_degrees = fabs(desired_degrees) - fudge - fabs(rotated_degrees);
+        if (remaining_degrees < ROTATE_DONE_DEGREES) {
             break;
         }
 
-        // sleep for 1 ms
-        usleep(1000);
-        ms += 1;
+        // set wheel speeds, each wheel travels on a circle of radius WHEEL_BASE_FEET/2
+        mph = decel_limit_mph(ROTATE_MPH, remaining_degrees * (M_PI/180) * (WHEEL_BASE_FEET/2));
+        wheel_ctlr_set_target(dir * mph, -dir * mph);
+
+        // sleep for 5 ms
+        drive_loop_sleep(5000);
+        ms += 5;
     }
 
     // stop motors
@@ -228,115 +329,34 @@ int drive_rotate(double desired_degrees, double fudge)
 }
 
 int drive_rotate_to_heading(double desired_heading, double fudge)
-{
-    return drive_rotate_to_heading_ex(desired_heading, fudge, true);
-}
-
-static int drive_rotate_to_heading_ex(double desired_heading, double fudge, bool do_sdr_check)
 {
     double current_heading, delta;
-    double left_mtr_mph, right_mtr_mph;
-    double left_mtr_start_mph, right_mtr_start_mph;
-    int    ms, lspeed, rspeed;
-    bool   clockwise;
-
-    // if caller has not supplied fudge factor then use builtin value
-    if (fudge == 0) {
-        fudge = 8;
-    }
+    int    pass;
 
     // sanitize the desired_heading into range 0 - 359.99
     desired_heading = sanitize_heading(desired_heading, 0);
 
-    // determine the delta rotation to reach the desired heading
-    current_heading = imu_get_magnetometer();
-    delta = sanitize_heading(desired_heading - current_heading, -180);
-    INFO("desired_heading = %0.1f  current_heading = %0.1f  delta = %0.1f  fudge = %0.1f\n", 
-         desired_heading, current_heading, delta, fudge);
-
-    // return immedeately if current heading is already very close to desired
-    if (fabs(delta) < 2) {
-        INFO("immedeate return due to small delta %0.1f\n", delta);
-        return 0;
-    }
-
-    // disable both front and read proximity sensors when rotating
-    proximity_disable(0);   // disable front
-    proximity_disable(1);   // disable rear
+    // the magnetometer is smoothed and lags the actual heading, so the
+    // rotation is performed using the gyro; a second pass corrects the
+    // residual error once the magnetometer has settled
+    for (pass = 0; pass < 2; pass++) {
+        // determine the delta rotation to reach the desired heading
+        current_heading = imu_get_magnetometer();
+        delta = sanitize_heading(desired_heading - current_heading, -180);
+        INFO("desired_heading = %0.1f  current_heading = %0.1f  delta = %0.1f  fudge = %0.1f\n", 
+             desired_heading, current_heading, delta, fudge);
 
-    // if the delta rotation needed is small then rotate away
-    // from desired_heading to provide a larger delta, to improve accuracy
-    // (do_sdr_check = do small delta rotation check)
-    if (fabs(delta) < 30 && do_sdr_check == true) {
-        double tmp_hdg = sanitize_heading( (delta > 0 ? desired_heading - 30 : desired_heading + 30), 0 );
-        INFO("small delta %0.1f, rotating from current %0.1f to tmp_hdg %0.1f\n",
-             delta, current_heading, tmp_hdg);
-        if (drive_rotate_to_heading_ex(tmp_hdg, 0, false) < 0) {
-            ERROR("small delta rotate failed\n");
-            return -1;
+        // done if current heading is already very close to desired
+        if (fabs(delta) < 2) {
+            break;
         }
-    }
 
-    // determine the left and right mtr mph
-    clockwise = (delta > 0);
-    left_mtr_start_mph  = (clockwise ? 0.5 : -0.5);
-    right_mtr_start_mph = -left_mtr_start_mph;
-    left_mtr_mph        = (clockwise ? 0.3 : -0.3);
-    right_mtr_mph       = -left_mtr_mph;
-
-    // if either motor was left running then stop the motors
-    if (mcs->target_speed[0] != 0 || mcs->target_speed[1] != 0) {
-        if (stop_motors(STOP_MOTORS_PRINT_NONE) < 0) {
+        // rotate, and allow time for the magnetometer to settle
+        if (drive_rotate(delta, fudge) < 0) {
             return -1;
         }
-    }
-
-    // start motors using boost speed (0.5 mph), and delay 200 ms
-    lspeed = MTR_MPH_TO_SPEED(left_mtr_start_mph);
-    rspeed = MTR_MPH_TO_SPEED(right_mtr_start_mph);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
-    usleep(200000);  // 200 ms
-
-    // slow down motors to 0.3 mph
-    lspeed = MTR_MPH_TO_SPEED(left_mtr_mph);
-    rspeed = MTR_MPH_TO_SPEED(right_mtr_mph);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
-
-    // wait for rotation to complete
-    ms = 0;
-    while (true) {
-        // check if the emer_stop_thread shut down the motors
-        if (EMER_STOP_OCCURRED) {
-            ERROR("EMER_STOP_OCCURRED\n");
-            return -1;
-        }
-
-        // check if rotation to heading has completed
-        current_heading = imu_get_magnetometer();
-        delta = sanitize_heading(desired_heading - current_heading, -180);
-        if ((ms % 1000) == 0) {
-            INFO("current %0.1f deg   delta %0.1f\n", current_heading, delta);
-        }
-        if (clockwise) {
-            if (delta < fudge) break;
-        } else {
-            if (delta > -fudge) break;
-        }
-
-        // sleep for 1 ms
-        usleep(1000);
-        ms += 1;
-    }
-
-    // stop motors
-    if (stop_motors(STOP_MOTORS_PRINT_ROTATION) < 0) {
-        return -1;
+        loop_timing_idle(drive_loop_timing);
+        usleep(500000);  // 500 ms
     }
 
     // print result
@@ -351,12 +371,9 @@ static int drive_rotate_to_heading_ex(double desired_heading, double fudge, bool
 
 int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_flag, double fudge)
 {
-    double left_mtr_mph, right_mtr_mph, mtr_a_mph, mtr_b_mph, boost;
-    int    lspeed, rspeed;
-    double start_degrees, rotated_degrees;
-    bool   boost_start_needed;
-
-    #define WHEEL_BASE_FEET (10./12.)
+    double left_mtr_mph, right_mtr_mph, mtr_a_mph, mtr_b_mph, scale;
+    double start_degrees, rotated_degrees, remaining_degrees, left_target, right_target;
+    int    ms;
 
     INFO("desired_degrees = %0.1f  radius_feet =  %0.1f  fudge = %0.1f\n", 
          desired_degrees, radius_feet, fudge);
@@ -373,40 +390,6 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
         return 0;
     }
 
-    // if caller has not supplied fudge factor then use builtin value
-    if (fudge == 0) {
-        if (stop_motors_flag) {
-            static interp_point_t fudge_points_radius_0[] = {  // r = 0 ft
-                    { 45,   5.0  },
-                    { 90,   4.0  },
-                    { 180,  3.0  },
-                    { 360,  0.0  }, };
-            static interp_point_t fudge_points_radius_1_0[] = {  // r = 1.0 ft
-                    { 45,   4.0  },
-                    { 90,   3.5  },
-                    { 180,  3.0  },
-                    { 360,  0.0  }, };
-            static interp_point_t fudge_points_radius_1_5[] = {  // r = 1.5 ft
-                    { 45,   2.5  },
-                    { 90,   2.5  },
-                    { 180,  3.0  },
-                    { 360,  0.0  }, };
-            interp_point_t * fudge_points;
-
-            if (radius_feet == 0) {
-                fudge_points = fudge_points_radius_0;
-            } else if (radius_feet < 1.25) {
-                fudge_points = fudge_points_radius_1_0;
-            } else {
-                fudge_points = fudge_points_radius_1_5;
-            }
-            fudge = interpolate(fudge_points, 4, fabs(desired_degrees));
-            INFO("builtin fudge = %0.2f\n", fudge);
-        } else { // stop_motors_flag == false
-            fudge = -1;
-        }
-    }
-
     // determine speed of motors based on radius, with the following criteria:
     // - ratio of motor speeds chosen to achieve desired turn radius, where the
     //   radius is measured from the inside wheel
@@ -428,14 +411,6 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
         }
     }
 
-    // a motor start boost is required if the slower of the 2 motors (mtr_b_mph) 
-    // is less than 0.5 mph; the startup boost will ensure that both motors start
-    // at >= 0.5 mph
-    boost = 0;
-    if (mtr_b_mph != 0 && mtr_b_mph < 0.5) {
-        boost = 0.5 / mtr_b_mph;
-    }
-
     // assign the left/right mtr mph using the 2 motor speeds determined above, 
     // and the direction of the rotation
     if (desired_degrees > 0) {
@@ -450,51 +425,22 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
     proximity_enable(0);   // enable front
     proximity_disable(1);  // disable rear
 
-    // get imu rotation value prior to starting motors
-    start_degrees = imu_get_rotation();
-
     // if either motor was left running in reverse then
     // return error because the motors should never be left running in reverse
-    if (mcs->target_speed[0] < 0 || mcs->target_speed[1] < 0) {
-        ERROR("motors should never be left running in reverse, %d %d\n",
-            mcs->target_speed[0], mcs->target_speed[1]);
+    wheel_ctlr_get_target(&left_target, &right_target);
+    if (left_target < 0 || right_target < 0) {
+        ERROR("motors should never be left running in reverse, %0.2f %0.2f\n",
+              left_target, right_target);
         return -1;
     }
 
-    // boost_start_needed =
-    //   boost != 0 &&
-    //   ((left_mtr_mph != 0 && left mtr is currently not running) ||
-    //    (right_mtr_mph != 0 && right mtr is currently not running))
-    // 
-    // if boost_start_needed then 
-    //   start motors using boost speed,
-    //   delay 200 ms
-    // endif
-    boost_start_needed = (boost != 0) &&
-                         ((left_mtr_mph != 0 && mcs->target_speed[0] == 0) ||
-                          (right_mtr_mph != 0 && mcs->target_speed[1] == 0));
-    if (boost_start_needed) {
-        INFO("**** BOOST START %0.2f - MPH %0.2f %0.2f\n", boost, boost*left_mtr_mph, boost*right_mtr_mph);
-        lspeed = MTR_MPH_TO_SPEED(boost * left_mtr_mph);
-        rspeed = MTR_MPH_TO_SPEED(boost * right_mtr_mph);
-        if (mc_set_speed_all(lspeed, rspeed) < 0) {
-            ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-            return -1;
-        }
-        usleep(200000);  // 200 ms
-    }
-
-    // set motors to desired speed
-    INFO("**** NORMAL MPH  %0.2f %0.2f\n", left_mtr_mph, right_mtr_mph);
-    lspeed = MTR_MPH_TO_SPEED(left_mtr_mph);
-    rspeed = MTR_MPH_TO_SPEED(right_mtr_mph);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
+    // get imu rotation value prior to starting motors
+    start_degrees = imu_get_rotation();
 
-    // wait for rotation to complete
-    int ms = 0;
+    // drive the turn; when stopping at the end of the turn, the wheel speeds
+    // are scaled down as the desired rotation is approached, so that the outer
+    // wheel decelerates to a stop at the desired rotation
+    ms = 0;
     while (true) {
         // check if the emer_stop_thread shut down the motors
         if (EMER_STOP_OCCURRED) {
@@ -507,13 +453,22 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
         if ((ms % 1000) == 0) {
             INFO("rotated %0.1f deg\n", rotated_degrees);
         }
-        if (fabs(rotated_degrees) > (fabs(desired_degrees) - fudge)) {
+        remaining_degrees = fabs(desired_degrees) - fudge - fabs(rotated_degrees);
+        if (remaining_degrees < (stop_motors_flag ? ROTATE_DONE_DEGREES : 0)) {
             break;
         }
 
-        // sleep for 1 ms
-        usleep(1000);
-        ms += 1;
+        // set wheel speeds
+        scale = 1;
+        if (stop_motors_flag) {
+            double outer_wheel_radius = (radius_feet == 0 ? WHEEL_BASE_FEET : radius_feet + WHEEL_BASE_FEET);
+            scale = decel_limit_mph(mtr_a_mph, remaining_degrees * (M_PI/180) * outer_wheel_radius) / mtr_a_mph;
+        }
+        wheel_ctlr_set_target(scale * left_mtr_mph, scale * right_mtr_mph);
+
+        // sleep for 5 ms
+        drive_loop_sleep(5000);
+        ms += 5;
     }
 
     // stop motors
@@ -527,6 +482,256 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
     rotated_degrees = imu_get_rotation() - start_degrees;
     INFO("done: desired = %0.1f  actual = %0.1f  deviation = %0.1f\n",
          desired_degrees, rotated_degrees, rotated_degrees - desired_degrees);
+    INFO("      deviation per 360 = %0.2f  gyro bias = %0.3f deg/s  temp = %0.1f C\n",
+         (rotated_degrees - desired_degrees) * 360 / fabs(desired_degrees),
+         imu_get_gyro_bias(), imu_get_temperature());
+
+    // success
+    return 0;
+}
+
+// drive to x,y (feet) using the pose estimate: rotate to face x,y, and then
+// drive forward steering toward x,y, so that the heading error of the rotate
+// and drift while driving are corrected; the steering correction is not
+// applied close to x,y, where the bearing is sensitive to small position errors
+int drive_goto(double x, double y, double mph)
+{
+    double distance, bearing, speed, corr;
+    pose_t pose;
+    int    ms;
+
+    INFO("x = %0.2f  y = %0.2f  mph = %0.1f\n", x, y, mph);
+
+    // return immedeately if already at x,y
+    pose_get_bearing(x, y, &distance, &bearing);
+    if (distance < GOTO_DONE_FEET) {
+        INFO("immedeate return due to small distance %0.2f\n", distance);
+        return 0;
+    }
+
+    // rotate to face x,y
+    if (fabs(bearing) > GOTO_DONE_DEGREES) {
+        if (drive_rotate(bearing, 0) < 0) {
+            return -1;
+        }
+    }
+
+    // enable front proximity sensors
+    proximity_enable(0);   // enable front
+    proximity_disable(1);  // disable rear
+
+    // drive toward x,y, until reached or passed
+    ms = 0;
+    while (true) {
+        // check if the emer_stop_thread shut down the motors
+        if (EMER_STOP_OCCURRED) {
+            ERROR("EMER_STOP_OCCURRED\n");
+            return -1;
+        }
+
+        // check if x,y reached or passed
+        pose_get_bearing(x, y, &distance, &bearing);
+        if ((ms % 1000) == 0) {
+            INFO("distance %0.2f ft  bearing %0.1f deg\n", distance, bearing);
+        }
+        if (distance < GOTO_DONE_FEET / 4 || fabs(bearing) > 90) {
+            break;
+        }
+
+        // set wheel speeds, decelerating approaching x,y, and
+        // steering toward x,y
+        speed = decel_limit_mph(mph, distance);
+        corr = (distance > GOTO_STEER_MIN_FEET ? HEADING_KP * bearing : 0);
+        if (corr > HEADING_MAX_CORR_MPH) corr = HEADING_MAX_CORR_MPH;
+        if (corr < -HEADING_MAX_CORR_MPH) corr = -HEADING_MAX_CORR_MPH;
+        wheel_ctlr_set_target(speed + corr, speed - corr);
+
+        // sleep for 5 ms
+        drive_loop_sleep(5000);
+        ms += 5;
+    }
+
+    // stop motors
+    if (stop_motors(STOP_MOTORS_PRINT_DISTANCE) < 0) {
+        return -1;
+    }
+
+    // print result
+    pose_get(&pose);
+    INFO("done: desired = %0.2f,%0.2f  actual = %0.2f,%0.2f  deviation = %0.2f ft\n",
+         x, y, pose.x, pose.y, hypot(pose.x - x, pose.y - y));
+
+    // success
+    return 0;
+}
+
+// return to the origin, and rotate to the origin heading
+int drive_home(double mph)
+{
+    pose_t pose;
+    double delta;
+
+    INFO("mph = %0.1f\n", mph);
+
+    if (drive_goto(0, 0, mph) < 0) {
+        return -1;
+    }
+
+    pose_get(&pose);
+    delta = sanitize_heading(-pose.heading, -180);
+    if (fabs(delta) > GOTO_DONE_DEGREES) {
+        if (drive_rotate(delta, 0) < 0) {
+            return -1;
+        }
+    }
+
+    // success
+    return 0;
+}
+
+// drive a sequence of line, arc and rotate segments, without stopping
+// between segments, see DRIVE PATH SUPPORT below
+int drive_path(struct drive_path_seg_s *in, int max_seg)
+{
+    struct path_seg_s seg[max_seg];
+    struct timespec ts;
+    double dt = 1. / PATH_RATE_HZ;
+    double start_degrees, rot_start, rot_end, rot_now, remaining, target_mph, mph, corr;
+    int    i, ms, initial_left_enc_count, initial_right_enc_count;
+
+    INFO("max_seg = %d\n", max_seg);
+
+    // convert the segments, and determine the max speed at the end of each
+    // segment: the speed is not continuous between a rotate and the adjacent
+    // segments, nor between fwd and reverse segments; and each segment's
+    // end speed must allow the following segments to decelerate in time
+    for (i = 0; i < max_seg; i++) {
+        if (path_seg_init(&in[i], &seg[i]) < 0) {
+            return -1;
+        }
+    }
+    for (i = max_seg-1; i >= 0; i--) {
+        struct path_seg_s *s = &seg[i], *next = (i < max_seg-1 ? &seg[i+1] : NULL);
+        if (next == NULL ||
+            s->type == DRIVE_PATH_ROTATE || next->type == DRIVE_PATH_ROTATE ||
+            s->dir != next->dir)
+        {
+            s->end_mph = 0;
+        } else {
+            s->end_mph = fmin(fmin(s->max_mph, next->max_mph),
+                              path_reach_mph(next->end_mph, next->accel, next->length));
+        }
+    }
+
+    // if either motor was left running then stop the motors
+    if (!wheel_ctlr_is_stopped()) {
+        if (stop_motors(STOP_MOTORS_PRINT_NONE) < 0) {
+            return -1;
+        }
+    }
+
+    // the rotation at the end of each arc and rotate segment, and the heading
+    // held by each line segment, are relative to the rotation at the start of
+    // the path, so that rotation errors do not accumulate
+    start_degrees = imu_get_rotation();
+    rot_start = 0;
+    mph = 0;
+    ms = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (i = 0; i < max_seg; i++) {
+        struct path_seg_s *s = &seg[i];
+
+        INFO("seg %d: %s  length = %0.2f ft  rotation = %0.1f deg  max_mph = %0.2f  end_mph = %0.2f\n",
+             i, DRIVE_PATH_SEG_STR(s->type), s->length, s->rotation, s->max_mph, s->end_mph);
+
+        // enable the proximity sensor in the direction of travel
+        if (s->type == DRIVE_PATH_ROTATE) {
+            proximity_disable(0);
+            proximity_disable(1);
+        } else if (s->dir > 0) {
+            proximity_enable(0);
+            proximity_disable(1);
+        } else {
+            proximity_disable(0);
+            proximity_enable(1);
+        }
+
+        // the speed is not continuous into a rotate, or a change of direction
+        if (i > 0 && seg[i-1].end_mph == 0) {
+            mph = 0;
+        }
+
+        rot_end = rot_start + s->rotation;
+        initial_left_enc_count  = encoder_get_count(0);
+        initial_right_enc_count = encoder_get_count(1);
+
+        while (true) {
+            // check if the emer_stop_thread shut down the motors
+            if (EMER_STOP_OCCURRED) {
+                ERROR("EMER_STOP_OCCURRED\n");
+                return -1;
+            }
+
+            // determine the remaining length of the segment; lines are measured
+            // by the encoders, arcs and rotates by the gyro
+            rot_now = imu_get_rotation() - start_degrees;
+            if (s->type == DRIVE_PATH_LINE) {
+                remaining = s->length -
+                    fabs(ENC_COUNT_TO_FEET(encoder_get_count(0) - initial_left_enc_count) +
+                         ENC_COUNT_TO_FEET(encoder_get_count(1) - initial_right_enc_count)) / 2;
+            } else {
+                remaining = (rot_end - rot_now) * (s->rotation > 0 ? 1 : -1) * (M_PI/180) * s->radius;
+            }
+            if (remaining <= (s->end_mph == 0 && s->type != DRIVE_PATH_LINE ?
+                              ROTATE_DONE_DEGREES * (M_PI/180) * s->radius : 0))
+            {
+                break;
+            }
+            if ((ms % 1000) == 0) {
+                INFO("seg %d: remaining %0.2f ft  mph %0.2f\n", i, remaining, mph);
+            }
+
+            // determine the profile speed: accelerate at the accel limit, and
+            // decelerate so as to reach the segment end speed at the end
+            target_mph = fmin(s->max_mph, path_reach_mph(s->end_mph, s->accel, remaining));
+            target_mph = fmax(target_mph, MIN_CRAWL_MPH);
+            mph = (target_mph > mph ? fmin(target_mph, mph + s->accel * dt) : target_mph);
+
+            // set the wheel speed targets; line segments hold the heading
+            // reached at the end of the preceding segments
+            corr = 0;
+            if (s->type == DRIVE_PATH_LINE) {
+                corr = HEADING_KP * (rot_start - rot_now);
+                if (corr > HEADING_MAX_CORR_MPH) corr = HEADING_MAX_CORR_MPH;
+                if (corr < -HEADING_MAX_CORR_MPH) corr = -HEADING_MAX_CORR_MPH;
+            }
+            wheel_ctlr_set_target(s->left_ratio * mph + corr, s->right_ratio * mph - corr);
+
+            // sleep until the start of the next control interval
+            ts.tv_nsec += PATH_INTVL_NS;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_nsec -= 1000000000;
+                ts.tv_sec++;
+            }
+            loop_timing_end(drive_loop_timing);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            loop_timing_start(drive_loop_timing);
+            ms += 1000 / PATH_RATE_HZ;
+        }
+
+        rot_start = rot_end;
+    }
+
+    // stop motors
+    if (stop_motors(STOP_MOTORS_PRINT_NONE) < 0) {
+        return -1;
+    }
+
+    // print result
+    rot_now = imu_get_rotation() - start_degrees;
+    INFO("done: desired rotation = %0.1f  actual = %0.1f  deviation = %0.1f  duration = %0.1f s\n",
+         rot_start, rot_now, rot_now - rot_start, ms / 1000.);
 
     // success
     return 0;
@@ -534,6 +739,15 @@ int drive_radius(double desired_degrees, double radius_feet, bool stop_motors_fl
 
 // - - - - - - - - - - - - - 
 
+// sleep between the iterations of a drive proc's control loop, and record
+// the loop timing; the loop timing is set idle when the drive proc completes
+static void drive_loop_sleep(int us)
+{
+    loop_timing_end(drive_loop_timing);
+    usleep(us);
+    loop_timing_start(drive_loop_timing);
+}
+
 static int stop_motors(int print)
 {
     uint64_t start_us;
@@ -546,13 +760,11 @@ static int stop_motors(int print)
     right_enc_count = encoder_get_count(1);
     rotation = imu_get_rotation();
 
-    // set all motor speeds to 0
-    if (mc_set_speed_all(0,0) < 0) {
-        ERROR("failed to set mtr speeds to 0 0\n");
-        return -1;
-    }
+    // set the wheel speed targets to 0, the wheel_ctlr ramps the speeds down
+    wheel_ctlr_set_target(0, 0);
 
-    // wait up to 1.5 second for encoder speed to drop to 0
+    // wait up to 1.5 second for the wheel_ctlr ramp to complete, and 
+    // for the encoder speed to drop to 0
     start_us = microsec_timer();
     while (true) {
         if (EMER_STOP_OCCURRED) {
@@ -563,10 +775,10 @@ static int stop_motors(int print)
             ERROR("failed to stop within 1.5 seconds\n");
             return -1;
         }
-        if (encoder_get_speed(0) == 0 && encoder_get_speed(1) == 0) {
+        if (wheel_ctlr_is_stopped() && encoder_get_speed(0) == 0 && encoder_get_speed(1) == 0) {
             break;
         }
-        usleep(1000);  // 1 ms
+        drive_loop_sleep(1000);  // 1 ms
     }
 
     // print the amount of distance or rotation during the stop motors
@@ -587,16 +799,111 @@ static int stop_motors(int print)
     return 0;
 }
 
+// returns the lesser of mph and the speed from which the wheel can
+// decelerate to a stop, at the wheel_ctlr accel limit, within remaining_feet;
+// the returned speed is not less than MIN_CRAWL_MPH so that the robot
+// does not stall short of the goal
+static double decel_limit_mph(double mph, double remaining_feet)
+{
+    double accel_fps2 = wheel_ctlr_get_accel() * FPS_PER_MPH;
+    double stop_mph;
+
+    if (remaining_feet < 0) {
+        remaining_feet = 0;
+    }
+    stop_mph = sqrt(2 * accel_fps2 * remaining_feet) / FPS_PER_MPH;
+
+    if (stop_mph < MIN_CRAWL_MPH) stop_mph = MIN_CRAWL_MPH;
+    return (mph < stop_mph ? mph : stop_mph);
+}
+
+// -----------------  DRIVE PATH SUPPORT  -----------------------------------
+
+// Notes:
+// - Each segment is driven with a profile speed (mph), which is the robot's
+//   center speed for lines and arcs, and the wheel speed for rotates. Each
+//   wheel's speed target is the profile speed multiplied by the wheel's ratio.
+// - The profile accel limit is reduced for arcs by the outer wheel ratio, so
+//   that neither wheel exceeds the wheel_ctlr accel limit; this keeps the
+//   wheel_ctlr ramp from distorting the ratio of the wheel speeds.
+
+static int path_seg_init(struct drive_path_seg_s *in, struct path_seg_s *seg)
+{
+    double mph = (in->mph > 0 ? in->mph : 0.5);
+    double accel = PATH_ACCEL_FRACTION * wheel_ctlr_get_accel();
+    double r_in, r_out, sign;
+
+    memset(seg, 0, sizeof(*seg));
+    seg->type = in->type;
+    seg->dir  = 1;
+
+    switch (in->type) {
+    case DRIVE_PATH_LINE:
+        // arg[0] = feet, negative for reverse
+        seg->dir         = (in->arg[0] >= 0 ? 1 : -1);
+        seg->length      = fabs(in->arg[0]);
+        seg->left_ratio  = seg->dir;
+        seg->right_ratio = seg->dir;
+        seg->max_mph     = mph;
+        seg->accel       = accel;
+        break;
+    case DRIVE_PATH_ARC:
+        // arg[0] = degrees, arg[1] = radius_feet measured from the inside wheel;
+        // mph is the speed of the outside wheel
+        r_in = in->arg[1];
+        if (r_in < 0.8 && r_in != 0) {
+            ERROR("invalid radius %0.1f ft\n", r_in);
+            return -1;
+        }
+        r_out            = r_in + WHEEL_BASE_FEET;
+        sign             = (in->arg[0] >= 0 ? 1 : -1);
+        seg->rotation    = in->arg[0];
+        seg->radius      = r_in + WHEEL_BASE_FEET/2;
+        seg->length      = fabs(seg->rotation) * (M_PI/180) * seg->radius;
+        seg->left_ratio  = (sign > 0 ? r_out : r_in) / seg->radius;
+        seg->right_ratio = (sign > 0 ? r_in : r_out) / seg->radius;
+        seg->max_mph     = mph * seg->radius / r_out;
+        seg->accel       = accel * seg->radius / r_out;
+        break;
+    case DRIVE_PATH_ROTATE:
+        // arg[0] = degrees
+        sign             = (in->arg[0] >= 0 ? 1 : -1);
+        seg->rotation    = in->arg[0];
+        seg->radius      = WHEEL_BASE_FEET/2;
+        seg->length      = fabs(seg->rotation) * (M_PI/180) * seg->radius;
+        seg->left_ratio  = sign;
+        seg->right_ratio = -sign;
+        seg->max_mph     = fmin(mph, ROTATE_MPH);
+        seg->accel       = accel;
+        break;
+    default:
+        ERROR("invalid segment type %d\n", in->type);
+        return -1;
+    }
+
+    return 0;
+}
+
+// returns the speed from which feet is sufficient to decelerate to end_mph
+static double path_reach_mph(double end_mph, double accel, double feet)
+{
+    if (feet < 0) {
+        feet = 0;
+    }
+    return sqrt(end_mph * end_mph + 2 * accel * feet / FPS_PER_MPH);
+}
+
 // -----------------  DRIVE STRAIGHT SUPPORT  -------------------------------
 
 static int drive_straight(double desired_feet, double mph, bool stop_motors_flag,
                           int *avg_lspeed_arg, int *avg_rspeed_arg)
 {
-    int    lspeed, rspeed;
-    double actual_feet, initial_degrees, rot_degrees;
-    int    initial_left_enc_count, initial_right_enc_count;
-    int    avg_lspeed_sum=0, avg_rspeed_sum=0, avg_speed_cnt=0, avg_lspeed, avg_rspeed;
-    bool   boost_start_needed;
+    double   actual_feet, remaining_feet, initial_degrees, rot_degrees;
+    double   left_target, right_target, dir, speed, corr;
+    int      initial_left_enc_count, initial_right_enc_count;
+    int      avg_lspeed=0, avg_rspeed=0, ms;
+    bool     avg_reset=false, avg_done=false;
+    uint64_t cruise_us, avg_start_us=0, avg_end_us=0;
 
     INFO("desired_feet = %0.1f  mph = %0.1f\n", desired_feet, mph);
 
@@ -610,11 +917,6 @@ static int drive_straight(double desired_feet, double mph, bool stop_motors_flag
         return 0;
     }
 
-    // get initial rotation and enc counts
-    initial_degrees         = imu_get_rotation();
-    initial_left_enc_count  = encoder_get_count(0);
-    initial_right_enc_count = encoder_get_count(1);
-
     // if moving fwd then enable front prox sensor, else enable rear
     if (mph > 0) {
         proximity_enable(0);    // enable front
@@ -626,51 +928,34 @@ static int drive_straight(double desired_feet, double mph, bool stop_motors_flag
 
     // if either motor was left running in reverse then
     // return error because the motors should never be left running in reverse
-    if (mcs->target_speed[0] < 0 || mcs->target_speed[1] < 0) {
-        ERROR("motors should never be left running in reverse, %d %d\n",
-            mcs->target_speed[0], mcs->target_speed[1]);
+    wheel_ctlr_get_target(&left_target, &right_target);
+    if (left_target < 0 || right_target < 0) {
+        ERROR("motors should never be left running in reverse, %0.2f %0.2f\n",
+              left_target, right_target);
         return -1;
     }
 
     // if request is to drive reverse and either motor was left running 
     // then stop the motors
-    if ((mph < 0) && (mcs->target_speed[0] != 0 || mcs->target_speed[1] != 0)) {
+    if ((mph < 0) && !wheel_ctlr_is_stopped()) {
         if (stop_motors(STOP_MOTORS_PRINT_NONE) < 0) {
             return -1;
         }
     }
 
-    // boost_start_needed =
-    //  fabs(mph) < 0.5 &&
-    //  (left mtr is currently not running || right mtr is currently not running)
-    // 
-    // if boost_start_needed then 
-    //   start motors using boost speed,
-    //   delay 200 ms
-    // endif
-    boost_start_needed = (fabs(mph) < 0.5) &&
-                         (mcs->target_speed[0] == 0 || mcs->target_speed[1] == 0);
-    if (boost_start_needed) {
-        drive_straight_cal_cvt_mph_to_mtr_speeds(mph > 0 ? 0.5 : -0.5, &lspeed, &rspeed);
-        INFO("boot start - setting mtr speeds = %d %d\n", lspeed, rspeed);
-        if (mc_set_speed_all(lspeed, rspeed) < 0) {
-            ERROR("failed to set boost mtr speeds to %d %d\n", lspeed, rspeed);
-            return -1;
-        }
-        usleep(200000);  // 200 ms
-    }
+    // get initial rotation and enc counts
+    initial_degrees         = imu_get_rotation();
+    initial_left_enc_count  = encoder_get_count(0);
+    initial_right_enc_count = encoder_get_count(1);
 
-    // get left and right mtr speeds from mph, and
-    // set mtr speeds
-    drive_straight_cal_cvt_mph_to_mtr_speeds(mph, &lspeed, &rspeed);
-    INFO("setting mtr speeds = %d %d\n", lspeed, rspeed);
-    if (mc_set_speed_all(lspeed, rspeed) < 0) {
-        ERROR("failed to set boost mtr speeds to %d %d\n", lspeed, rspeed);
-        return -1;
-    }
+    // the avg mtr speeds, used by calibration, are measured from the time
+    // the ramp should have reached the cruise speed until decel begins
+    cruise_us = microsec_timer() + 
+                (fabs(mph) / wheel_ctlr_get_accel() + 0.3) * 1000000;
 
     // wait for distance_travelled to meet requested distance
-    int ms = 0;
+    dir = (mph > 0 ? 1 : -1);
+    ms = 0;
     while (true) {
         // check if the emer_stop_thread shut down the motors
         if (EMER_STOP_OCCURRED) {
@@ -681,30 +966,56 @@ static int drive_straight(double desired_feet, double mph, bool stop_motors_flag
         // check for distance travelled completed
         actual_feet = ( ENC_COUNT_TO_FEET(encoder_get_count(0) - initial_left_enc_count) + 
                         ENC_COUNT_TO_FEET(encoder_get_count(1) - initial_right_enc_count) ) / 2;
-        if (fabs(actual_feet) >= desired_feet) {
+        remaining_feet = desired_feet - fabs(actual_feet);
+        if (remaining_feet <= 0) {
             break;
         }
 
-#if 1   // note: comment this out on bench
-        // perform motor speed compensation, and
-        // maintain sums for calculation of avg mtr speeds
-        if ((ms % 100) == 0) {
-            int adj = drive_straight_mtr_speed_comp(ms==0, initial_degrees);
-            if (adj) {
-                lspeed += adj;
-                //INFO("*** adjusting left_mtr_speed by %d  new=%d\n", adj, lspeed);
-                mc_set_speed(0, lspeed);
-            }
+        // determine speed, if stopping then decelerate approaching the end
+        speed = fabs(mph);
+        if (stop_motors_flag) {
+            speed = decel_limit_mph(speed, remaining_feet);
+        }
 
-            avg_lspeed_sum += lspeed;
-            avg_rspeed_sum += rspeed;
-            avg_speed_cnt++;
+        // maintain the avg mtr speeds while cruising
+        if (!avg_reset && microsec_timer() > cruise_us) {
+            wheel_ctlr_reset_avg_mtr_speeds();
+            avg_start_us = microsec_timer();
+            avg_reset = true;
+        }
+        if (avg_reset && !avg_done && speed < fabs(mph)) {
+            wheel_ctlr_get_avg_mtr_speeds(&avg_lspeed, &avg_rspeed);
+            avg_end_us = microsec_timer();
+            avg_done = true;
         }
-#endif
 
-        // sleep for 1 ms
-        usleep(1000);  // 1 ms
-        ms += 1;
+        // heading hold: the wheel speeds are offset to correct the
+        // deviation from the initial rotation
+        corr = HEADING_KP * (initial_degrees - imu_get_rotation());
+        if (corr > HEADING_MAX_CORR_MPH) corr = HEADING_MAX_CORR_MPH;
+        if (corr < -HEADING_MAX_CORR_MPH) corr = -HEADING_MAX_CORR_MPH;
+
+        // set the wheel speed targets
+        wheel_ctlr_set_target(dir * speed + corr, dir * speed - corr);
+
+        // sleep for 5 ms
+        drive_loop_sleep(5000);
+        ms += 5;
+    }
+
+    // get the avg mtr speeds, if not already obtained when decel began
+    if (avg_reset && !avg_done) {
+        wheel_ctlr_get_avg_mtr_speeds(&avg_lspeed, &avg_rspeed);
+        avg_end_us = microsec_timer();
+    }
+
+    // update the drive straight calibration model, unless this is a
+    // calibration run (the caller is collecting the avg mtr speeds);
+    // short cruises are not used because the avg includes the ramp transient
+    if (avg_lspeed_arg == NULL && avg_reset &&
+        avg_end_us - avg_start_us >= CAL_UPDATE_MIN_CRUISE_US)
+    {
+        drive_cal_update(mph, avg_lspeed, avg_rspeed);
     }
 
     // stop motors
@@ -714,9 +1025,7 @@ static int drive_straight(double desired_feet, double mph, bool stop_motors_flag
         }
     }
 
-    // calculate the avg speeds, and return the values if caller desires
-    avg_lspeed = (avg_speed_cnt ? avg_lspeed_sum / avg_speed_cnt : 0);
-    avg_rspeed = (avg_speed_cnt ? avg_rspeed_sum / avg_speed_cnt : 0);
+    // return the avg speeds if caller desires
     if (avg_lspeed_arg) *avg_lspeed_arg = avg_lspeed;
     if (avg_rspeed_arg) *avg_rspeed_arg = avg_rspeed;
 
@@ -726,107 +1035,232 @@ static int drive_straight(double desired_feet, double mph, bool stop_motors_flag
     rot_degrees = imu_get_rotation() - initial_degrees;
     INFO("done: desired_feet = %0.1f  actual_feet = %0.1f  delta_feet = %0.1f  rot = %0.1f\n",
          desired_feet, actual_feet, desired_feet-actual_feet, rot_degrees);
-    INFO("      average mtr speeds = %d %d\n", avg_lspeed, avg_rspeed);
-    INFO("      actual  mtr speeds = %d %d\n", lspeed, rspeed);
-    INFO("      delta   mtr speeds = %d %d\n", avg_lspeed-lspeed, avg_rspeed-rspeed);
+    INFO("      average mtr speeds = %d %d  duration = %0.1f s\n", 
+         avg_lspeed, avg_rspeed, ms / 1000.);
 
     // success
     return 0;
 }
 
-// returns adjustment value that can be applied either
-// directly to the left mtr, or negated to the right mtr
-static int drive_straight_mtr_speed_comp(bool init, double rotation_target)
-{
-    #define PREDICTION_INTERVAL_SECS  0.5
-    #define TUNE  3.0
+// - - - - - - - - -  DRIVE STRAIGHT SUPPORT - CALIBRATION   - - - - - -
 
-    uint64_t        time_now;
-    double          rotation_now, rotation_rate, rotation_predicted;
-    double          duration_secs;
-    int             compensation;
+// Notes:
+// - The drive_straight_cal_tbl is a piecewise linear model of the mtr
+//   speeds needed to drive straight at a given mph; the lookup interpolates
+//   between the two entries that bracket the mph, with an implied 0 mph entry.
+// - The model is refined by recursive least squares (RLS) from the average
+//   mtr speeds measured while cruising during every drive_straight that is
+//   not a calibration run. Because the lookup is linear in the table speeds,
+//   with at most 2 non-zero weights, each measurement is a linear observation
+//   of the table speeds, and the RLS update adjusts the bracketing entries.
+// - The covariance (speed units squared) starts at CAL_PRIOR_VAR for the
+//   default table, and at CAL_MEAS_VAR after DRIVE_SCAL. A small process
+//   noise is added per update so the model tracks slow drift, such as
+//   battery voltage and tire wear; this is capped at CAL_PRIOR_VAR.
+// - The confidence metric, in the range 0 to 1, is 1 - (std_dev / prior
+//   std_dev), averaged over the table entries.
+// - The variance of each entry is saved in drive_straight.cal as a 4th column;
+//   the covariance between entries is not saved. The file is written to a
+//   temp file which is renamed, so a crash does not leave a partial file.
 
-    static double   rotation_last;
-    static uint64_t time_last;
+#define MAX_DRIVE_STRAIGHT_CAL_TBL   30
+#define DRIVE_STRAIGHT_CAL_FILENAME  "drive_straight.cal"
 
-    time_now = microsec_timer();
+#define CAL_PRIOR_VAR                (100. * 100.)
+#define CAL_MEAS_VAR                 (20. * 20.)
+#define CAL_DRIFT_VAR                (5. * 5.)
 
-    if (init) {
-        time_last = time_now;
-        rotation_last = imu_get_rotation();
-        return 0;
-    }
+static struct drive_straight_cal_s {
+    double mph;
+    double lspeed;
+    double rspeed;
+} drive_straight_cal_tbl[MAX_DRIVE_STRAIGHT_CAL_TBL];
 
-    duration_secs      = (time_now - time_last) / 1000000.;
-    rotation_now       = imu_get_rotation();
-    rotation_rate      = (rotation_now - rotation_last) / duration_secs;
-    rotation_predicted = rotation_now + rotation_rate * PREDICTION_INTERVAL_SECS;
+static double                cal_cov[MAX_DRIVE_STRAIGHT_CAL_TBL][MAX_DRIVE_STRAIGHT_CAL_TBL];
+static int                   cal_max;
+static int                   cal_updates;
+static double                cal_confidence;
+static volatile unsigned int cal_seq;
+static bool                  cal_file_write_needed;
 
-    compensation = nearbyint( (rotation_target - rotation_predicted) * TUNE );
+// returns the mtr speeds for the requested mph, interpolated from the
+// drive_straight_cal_tbl; this is the wheel_ctlr feed forward
+void drive_cal_mph_to_mtr_speeds(double mph, double *lspeed, double *rspeed)
+{
+    int idx[2], n, i;
+    double w[2];
+    unsigned int seq;
+
+    // the tbl is updated by the drive_thread, and read here by the
+    // wheel_ctlr_thread; the cal_seq is odd while the tbl is being updated
+    do {
+        seq = cal_seq;
+        __sync_synchronize();
+
+        // if there are no entries, with the same sign as mph, then
+        // use the nominal conversion
+        n = cal_weights(mph, idx, w);
+        if (n == 0) {
+            *lspeed = *rspeed = MTR_MPH_TO_SPEED(mph);
+        } else {
+            *lspeed = *rspeed = 0;
+            for (i = 0; i < n; i++) {
+                *lspeed += w[i] * drive_straight_cal_tbl[idx[i]].lspeed;
+                *rspeed += w[i] * drive_straight_cal_tbl[idx[i]].rspeed;
+            }
+        }
 
-    //INFO("dur = %0.3f  rot_now = %0.3f  rot_rate = %0.3f rot_pred = %0.3f comp = %d\n",
-    //     duration_secs, rotation_now, rotation_rate, rotation_predicted, compensation);
+        __sync_synchronize();
+    } while ((seq & 1) || seq != cal_seq);
+}
 
-    if (compensation > 10) {
-        compensation = 10;
-    } else if (compensation < -10) {
-        compensation = -10;
+// update the model with the average mtr speeds measured while cruising at mph
+static void drive_cal_update(double mph, double lspeed, double rspeed)
+{
+    int idx[2], n, i, j;
+    double w[2], pw[MAX_DRIVE_STRAIGHT_CAL_TBL], k[MAX_DRIVE_STRAIGHT_CAL_TBL];
+    double s, lerr, rerr, lspeed_model=0, rspeed_model=0;
+
+    n = cal_weights(mph, idx, w);
+    if (n == 0) {
+        return;
     }
 
-    time_last = time_now;
-    rotation_last = rotation_now;
+    // pw = P * w, where w is the interpolation weight vector, and
+    // s = w' * P * w + measurement variance
+    s = CAL_MEAS_VAR;
+    for (j = 0; j < cal_max; j++) {
+        pw[j] = 0;
+        for (i = 0; i < n; i++) {
+            pw[j] += cal_cov[j][idx[i]] * w[i];
+        }
+    }
+    for (i = 0; i < n; i++) {
+        s += w[i] * pw[idx[i]];
+        lspeed_model += w[i] * drive_straight_cal_tbl[idx[i]].lspeed;
+        rspeed_model += w[i] * drive_straight_cal_tbl[idx[i]].rspeed;
+    }
+    lerr = lspeed - lspeed_model;
+    rerr = rspeed - rspeed_model;
 
-    return compensation;
-}
+    // update the table speeds with gain k = pw / s; both wheels have the
+    // same weight vector, so they share the covariance
+    cal_seq++;
+    __sync_synchronize();
+    for (j = 0; j < cal_max; j++) {
+        k[j] = pw[j] / s;
+        drive_straight_cal_tbl[j].lspeed += k[j] * lerr;
+        drive_straight_cal_tbl[j].rspeed += k[j] * rerr;
+    }
+    __sync_synchronize();
+    cal_seq++;
 
-// - - - - - - - - -  DRIVE STRAIGHT SUPPORT - CALIBRATION   - - - - - -
+    // update the covariance, P = P - k * pw', and add the process noise
+    for (i = 0; i < cal_max; i++) {
+        for (j = 0; j < cal_max; j++) {
+            cal_cov[i][j] -= k[i] * pw[j];
+        }
+        if (cal_cov[i][i] + CAL_DRIFT_VAR <= CAL_PRIOR_VAR) {
+            cal_cov[i][i] += CAL_DRIFT_VAR;
+        }
+    }
 
-#define MAX_DRIVE_STRAIGHT_CAL_TBL   30
-#define DRIVE_STRAIGHT_CAL_FILENAME  "drive_straight.cal"
+    cal_updates++;
+    cal_confidence_update();
+    cal_file_write_needed = true;
 
-static struct drive_straight_cal_s {
-    double mph;
-    int    lspeed;
-    int    rspeed;
-} drive_straight_cal_tbl[MAX_DRIVE_STRAIGHT_CAL_TBL];
+    INFO("mph %0.2f  measured %0.0f %0.0f  model %0.0f %0.0f  confidence %0.2f\n",
+         mph, lspeed, rspeed, lspeed_model, rspeed_model, cal_confidence);
+}
 
-static void drive_straight_cal_cvt_mph_to_mtr_speeds(double mph, int *lspeed, int *rspeed)
+void drive_cal_get_confidence(double *confidence, int *updates)
 {
-    int idx, min_idx=-1;
-    double min_delta = 1000000;
-    double delta;
+    *confidence = cal_confidence;
+    *updates    = cal_updates;
+}
 
-    // loop over the drive_straight_cal_tbl and find the entry with mph nearest
-    // what caller is requesting
-    for (idx = 0; idx < MAX_DRIVE_STRAIGHT_CAL_TBL; idx++) {
-        struct drive_straight_cal_s *x = &drive_straight_cal_tbl[idx];
-        if (x->mph == 0) {
-            break;
+// returns the number of table entries used to interpolate mph, and their
+// indexes and weights; the implied 0 mph entry is not returned
+static int cal_weights(double mph, int idx[2], double w[2])
+{
+    int i, lo = -1, hi = -1;
+    double lo_mph = 0, f;
+
+    if (mph == 0) {
+        return 0;
+    }
+
+    // find the entries, with the same sign as mph, that bracket mph;
+    // lo is the nearest entry with smaller magnitude, and hi is the
+    // nearest entry with larger magnitude
+    for (i = 0; i < cal_max; i++) {
+        struct drive_straight_cal_s *x = &drive_straight_cal_tbl[i];
+        if ((x->mph > 0) != (mph > 0)) {
+            continue;
         }
-        delta = fabs(mph - x->mph);
-        if (delta < min_delta) {
-            min_delta = delta;
-            min_idx = idx;
+        if (fabs(x->mph) <= fabs(mph)) {
+            if (lo == -1 || fabs(x->mph) > fabs(drive_straight_cal_tbl[lo].mph)) lo = i;
+        } else {
+            if (hi == -1 || fabs(x->mph) < fabs(drive_straight_cal_tbl[hi].mph)) hi = i;
         }
     }
 
-    // return the lspeed and rspeed
-    if (idx == -1) {
-        FATAL("bug\n");
+    // if mph exceeds the table then scale the largest entry
+    if (hi == -1) {
+        if (lo == -1) {
+            return 0;
+        }
+        idx[0] = lo;
+        w[0] = mph / drive_straight_cal_tbl[lo].mph;
+        return 1;
     }
-    *lspeed = drive_straight_cal_tbl[min_idx].lspeed;
-    *rspeed = drive_straight_cal_tbl[min_idx].rspeed;
 
-    // debug print result
-    INFO("requested mph = %0.1f  nearest_mph = %0.1f  l/rspeed = %d %d\n",
-         mph, drive_straight_cal_tbl[min_idx].mph, *lspeed, *rspeed);
+    // interpolate between lo and hi; if mph is below the table then
+    // lo is the implied 0 mph entry
+    if (lo != -1) {
+        lo_mph = drive_straight_cal_tbl[lo].mph;
+    }
+    f = (mph - lo_mph) / (drive_straight_cal_tbl[hi].mph - lo_mph);
+    if (lo == -1) {
+        idx[0] = hi;
+        w[0] = f;
+        return 1;
+    }
+    idx[0] = lo;
+    w[0] = 1 - f;
+    idx[1] = hi;
+    w[1] = f;
+    return 2;
+}
+
+static void cal_cov_init(double var)
+{
+    int i;
+
+    memset(cal_cov, 0, sizeof(cal_cov));
+    for (i = 0; i < cal_max; i++) {
+        cal_cov[i][i] = var;
+    }
+    cal_confidence_update();
+}
+
+static void cal_confidence_update(void)
+{
+    int i;
+    double sum = 0;
+
+    for (i = 0; i < cal_max; i++) {
+        sum += 1 - sqrt(fmax(cal_cov[i][i], 0) / CAL_PRIOR_VAR);
+    }
+    cal_confidence = (cal_max ? sum / cal_max : 0);
 }
 
 static int drive_straight_cal_file_read(void)
 {
     FILE *fp;
-    int idx=0;
+    int idx=0, n;
     char s[100];
+    double var[MAX_DRIVE_STRAIGHT_CAL_TBL];
 
     fp = fopen(DRIVE_STRAIGHT_CAL_FILENAME, "r");
     if (fp == NULL) {
@@ -838,18 +1272,33 @@ static int drive_straight_cal_file_read(void)
     while (fgets(s, sizeof(s), fp)) {
         if (idx == MAX_DRIVE_STRAIGHT_CAL_TBL) {
             ERROR("too man entries in %s\n", DRIVE_STRAIGHT_CAL_FILENAME);
+            fclose(fp);
             return -1;
         }
 
+        // the variance column is optional, files without it were
+        // written by DRIVE_SCAL
         struct drive_straight_cal_s *x = &drive_straight_cal_tbl[idx];
-        if (sscanf(s, "%lf %d %d", &x->mph, &x->lspeed, &x->rspeed)!= 3) {
+        n = sscanf(s, "%lf %lf %lf %lf", &x->mph, &x->lspeed, &x->rspeed, &var[idx]);
+        if (n != 3 && n != 4) {
             ERROR("invalid line: %s\n", s);
+            fclose(fp);
             return -1;
         }
+        if (n == 3) {
+            var[idx] = CAL_MEAS_VAR;
+        }
         idx++;
     }
     fclose(fp);
 
+    cal_max = idx;
+    cal_cov_init(0);
+    for (idx = 0; idx < cal_max; idx++) {
+        cal_cov[idx][idx] = var[idx];
+    }
+    cal_confidence_update();
+
     return 0;
 }
 
@@ -857,38 +1306,56 @@ static int drive_straight_cal_file_write(void)
 {
     FILE *fp;
     int idx;
+    char tmp_filename[100];
 
-    fp = fopen(DRIVE_STRAIGHT_CAL_FILENAME, "w");
+    // write to a temp file, and rename it to the cal file
+    sprintf(tmp_filename, "%s.tmp", DRIVE_STRAIGHT_CAL_FILENAME);
+    fp = fopen(tmp_filename, "w");
     if (fp == NULL) {
         ERROR("failed to open %s for writing, %s\n", 
-              DRIVE_STRAIGHT_CAL_FILENAME, strerror(errno));
+              tmp_filename, strerror(errno));
         return -1;
     }
-    for (idx = 0; idx < MAX_DRIVE_STRAIGHT_CAL_TBL; idx++) {
+    for (idx = 0; idx < cal_max; idx++) {
         struct drive_straight_cal_s *x = &drive_straight_cal_tbl[idx];
-        if (x->mph == 0) {
-            break;
-        }
-        fprintf(fp, "%4.1f %5d %5d\n", x->mph, x->lspeed, x->rspeed);
+        fprintf(fp, "%4.1f %7.1f %7.1f %7.1f\n", x->mph, x->lspeed, x->rspeed, cal_cov[idx][idx]);
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        ERROR("failed to write %s, %s\n", tmp_filename, strerror(errno));
+        fclose(fp);
+        return -1;
     }
     fclose(fp);
 
+    if (rename(tmp_filename, DRIVE_STRAIGHT_CAL_FILENAME) < 0) {
+        ERROR("failed to rename %s, %s\n", tmp_filename, strerror(errno));
+        return -1;
+    }
+
     return 0;
 }
 
+// the file is written by the drive_thread when the drive proc has completed,
+// rather than when the model is updated, which may be while driving
+static void drive_straight_cal_file_write_if_updated(void)
+{
+    if (cal_file_write_needed) {
+        drive_straight_cal_file_write();
+        cal_file_write_needed = false;
+    }
+}
+
 static void drive_straight_cal_tbl_print(void)
 {
     int idx;
 
-    INFO(" MPH LSPEED RSPEED\n");
-    INFO(" --- ------ ------\n");
-    for (idx = 0; idx < MAX_DRIVE_STRAIGHT_CAL_TBL; idx++) {
+    INFO(" MPH LSPEED RSPEED  STDDEV\n");
+    INFO(" --- ------ ------  ------\n");
+    for (idx = 0; idx < cal_max; idx++) {
         struct drive_straight_cal_s *x = &drive_straight_cal_tbl[idx];
-        if (x->mph == 0) {
-            break;
-        }
-        INFO("%4.1f %6d %6d\n", x->mph, x->lspeed, x->rspeed);
+        INFO("%4.1f %6.0f %6.0f  %6.1f\n", x->mph, x->lspeed, x->rspeed, sqrt(cal_cov[idx][idx]));
     }
+    INFO("confidence = %0.2f\n", cal_confidence);
 }
 
 static int drive_straight_cal_proc(double cal_feet)
@@ -901,11 +1368,8 @@ static int drive_straight_cal_proc(double cal_feet)
 
     // loop over the new_drive_straight_cal_tbl, 
     // and update the lspeed and rspeed values
-    for (idx = 0; idx < MAX_DRIVE_STRAIGHT_CAL_TBL; idx++) {
+    for (idx = 0; idx < cal_max; idx++) {
         struct drive_straight_cal_s *new = &new_drive_straight_cal_tbl[idx];
-        if (new->mph == 0) {
-            break;
-        }
 
         INFO("calibrate mph %0.1f\n", new->mph);
         if (drive_straight(cal_feet, new->mph, true, &lspeed, &rspeed) < 0) {
@@ -920,13 +1384,10 @@ static int drive_straight_cal_proc(double cal_feet)
     INFO("          CURRENT           NEW            DELTA\n");
     INFO(" MPH   LSPEED RSPEED   LSPEED RSPEED   LSPEED RSPEED\n");
     INFO(" ---   ------ ------   ------ ------   ------ ------\n");
-    for (idx = 0; idx < MAX_DRIVE_STRAIGHT_CAL_TBL; idx++) {
+    for (idx = 0; idx < cal_max; idx++) {
         struct drive_straight_cal_s *cur = &drive_straight_cal_tbl[idx];
         struct drive_straight_cal_s *new = &new_drive_straight_cal_tbl[idx];
-        if (new->mph == 0) {
-            break;
-        }
-        INFO("%4.1f   %6d %6d   %6d %6d   %6d %6d\n", 
+        INFO("%4.1f   %6.0f %6.0f   %6.0f %6.0f   %6.0f %6.0f\n", 
              cur->mph, 
              cur->lspeed, cur->rspeed,
              new->lspeed, new->rspeed,
@@ -934,8 +1395,14 @@ static int drive_straight_cal_proc(double cal_feet)
     }
 
     // publish the new_drive_straight_cal_tbl to drive_straight_cal_tbl,
-    // write drive_straight_cal_tbl to file
+    // reset the model covariance to that of a single measurement of each
+    // entry, and write drive_straight_cal_tbl to file
+    cal_seq++;
+    __sync_synchronize();
     memcpy(drive_straight_cal_tbl, new_drive_straight_cal_tbl, sizeof(drive_straight_cal_tbl));
+    __sync_synchronize();
+    cal_seq++;
+    cal_cov_init(CAL_MEAS_VAR);
     drive_straight_cal_file_write();
     return 0;
 }
@@ -961,6 +1428,10 @@ static void drive_straight_cal_tbl_init_default(void)
         x->lspeed = x->rspeed = MTR_MPH_TO_SPEED(x->mph);
         idx++;
     }
+    cal_max = idx;
+
+    // the default table is uncalibrated
+    cal_cov_init(CAL_PRIOR_VAR);
 }
 
 // -----------------  THREADS  ----------------------------------------------
@@ -1008,15 +1479,34 @@ static void *drive_thread(void *cx)
         proximity_disable(0);
         proximity_disable(1);
         imu_set_accel_rot_ctrl(true);
+        emer_stop_claimed = 0;
+        __sync_synchronize();
         emer_stop_thread_state = EMER_STOP_THREAD_ENABLED;
+        wheel_ctlr_enable();
+
+        // the encoder error callback is only called for new errors, so
+        // check for errors that occurred prior to this drive proc
+        for (int id = 0; id < 2; id++) {
+            int encoder_errs = encoder_get_errors(id);
+            if (encoder_errs) {
+                emer_stop_event("%s wheel encoder has %d errors",
+                                id == 0 ? "left" : "right", encoder_errs);
+            }
+        }
         usleep(15000);  // 15 ms
 
         // call the drive proc
         rc = drive_proc(drive_proc_msg);
+        loop_timing_idle(drive_loop_timing);
 
-        // disable emer_stop_thread, and
+        // disable emer_stop_thread, and wait for it to complete a sensor
+        // emer stop event, which sets emer_stop_reason; and
         // disable motor-ctlr and sensors
         emer_stop_thread_state = EMER_STOP_THREAD_DISABLED;
+        while (emer_stop_sensor_pending) {
+            usleep(1000);  // 1 ms
+        }
+        wheel_ctlr_disable();
         mc_disable_all();
         encoder_disable(0);
         encoder_disable(1);
@@ -1024,6 +1514,9 @@ static void *drive_thread(void *cx)
         proximity_disable(1);
         imu_set_accel_rot_ctrl(false);
 
+        // save the drive straight calibration, if it was updated by the drive proc
+        drive_straight_cal_file_write_if_updated();
+
         // clear drive_proc_msg
 done:   drive_proc_msg = NULL;
 
@@ -1039,22 +1532,30 @@ done:   drive_proc_msg = NULL;
 
 // - - - - - - - - -  EMER_STOP_THREAD - - - - - - - - - - - - - - - - 
 
+// Notes:
+// - The sensor events (stop button, proximity alert, encoder error, and accel
+//   alert) call emer_stop_sensor_event from the sensor's thread, most of which
+//   are the realtime gpio_sampler decoders, and must not block. It stops the
+//   motors with mc_emer_stop_all, which writes a pre-encoded stop cmd directly
+//   to the mtr ctlrs without blocking, and disables the wheel ctlr. The
+//   reason is formatted, the flight recorder triggered, and the mc status
+//   updated by the emer_stop_thread, which polls emer_stop_sensor_pending.
+// - The conditions that must be polled (mtr ctlr disabled, and encoder speed
+//   not matching the motor speed) are checked by the emer_stop_thread, which
+//   calls emer_stop_event to do all of the above inline.
+// - EMER_STOP_OCCURRED is set after the reason, so the drive procs that
+//   return because of it always have a reason.
+
 static uint64_t enc_low_speed_start_time[2];
-static bool     stop_button_pressed;
 
 static void *emer_stop_thread(void *cx)
 {
-    int encoder_errs;
-    double accel;
     struct sched_param param;
     int rc;
 
     #define DO_EMER_STOP(fmt, args...) \
         do { \
-            sprintf(emer_stop_reason, fmt, ## args); \
-            ERROR("%s\n", emer_stop_reason); \
-            mc_disable_all(); \
-            emer_stop_thread_state = EMER_STOP_THREAD_DISABLED; \
+            emer_stop_event(fmt, ## args); \
             goto emer_stopped; \
         } while (0)
 
@@ -1069,41 +1570,36 @@ static void *emer_stop_thread(void *cx)
     while (true) {
 emer_stopped:
         while (emer_stop_thread_state != EMER_STOP_THREAD_ENABLED) {
+            loop_timing_idle(emer_stop_loop_timing);
+            if (emer_stop_sensor_pending) {
+                // the sensor event raced with the drive_thread disabling
+                // this thread, and the drive_thread is waiting for it
+                emer_stop_sensor_event_complete();
+            }
+            if (emer_stop_log_pending) {
+                emer_stop_log_pending = false;
+                ERROR("%s - latency %d us\n", emer_stop_reason, mcs->emer_stop_latency_us);
+            }
             enc_low_speed_start_time[0] = 0;
             enc_low_speed_start_time[1] = 0;
-            stop_button_pressed = false;
             usleep(10000);  // 10 ms
         }
+        loop_timing_start(emer_stop_loop_timing);
 
-        if (mcs->state == MC_STATE_DISABLED) {
-            DO_EMER_STOP("motors have been disabled");
-        }
-
-        if (stop_button_pressed) {
-            DO_EMER_STOP("stop button");
-        }
-
-        if ((encoder_errs = encoder_get_errors(0))) {
-            DO_EMER_STOP("left wheel encoder has %d errors", encoder_errs);
-        }
-        if ((encoder_errs = encoder_get_errors(1))) {
-            DO_EMER_STOP("right wheel encoder has %d errors", encoder_errs);
+        if (emer_stop_sensor_pending) {
+            emer_stop_sensor_event_complete();
+            goto emer_stopped;
         }
 
-        if (proximity_check(0,NULL)) {
-            DO_EMER_STOP("front proximity alert");
-        }
-        if (proximity_check(1,NULL)) {
-            DO_EMER_STOP("rear proximity alert");
-        }
-
-        if (imu_check_accel_alert(&accel)) {
-            DO_EMER_STOP("acceleration %0.1f gravity", accel);
+        if (mcs->state == MC_STATE_DISABLED) {
+            DO_EMER_STOP("motors have been disabled");
         }
 
         for (int id = 0; id < 2; id++) {
             double enc_mph = ENC_SPEED_TO_MPH(encoder_get_speed(id));
-            double mtr_mph = MTR_SPEED_TO_MPH(mcs->target_speed[id]);  // xxx or use drive cal
+            double mtr_mph, measured_mph;
+            int    mtr_speed;
+            wheel_ctlr_get_state(id, &mtr_mph, &measured_mph, &mtr_speed);
             if ((mtr_mph >= 0 && enc_mph < mtr_mph / 2) ||
                 (mtr_mph <  0 && enc_mph > mtr_mph / 2))
             {
@@ -1121,15 +1617,121 @@ emer_stopped:
             }
         }
 
+        loop_timing_end(emer_stop_loop_timing);
         usleep(1000);  // 1 ms
     }
 
     return NULL;
 }
 
-static void emer_stop_button_cb(int id, bool pressed, int pressed_duration_us)
+// stop the motors, if a drive proc is running; only the first event stops
+// the motors, and returns true; this does not block
+static bool emer_stop_motors(uint64_t detect_us)
+{
+    if (emer_stop_thread_state != EMER_STOP_THREAD_ENABLED ||
+        !__sync_bool_compare_and_swap(&emer_stop_claimed, 0, 1))
+    {
+        return false;
+    }
+
+    mc_emer_stop_all();
+    wheel_ctlr_disable();
+    emer_stop_latency_us = microsec_timer() - detect_us;
+    return true;
+}
+
+// called from the emer_stop_thread and the drive_thread, which may block
+static void emer_stop_event(char *fmt, ...)
+{
+    va_list ap;
+
+    if (!emer_stop_motors(microsec_timer())) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(emer_stop_reason, sizeof(emer_stop_reason), fmt, ap);
+    va_end(ap);
+
+    emer_stop_complete();
+}
+
+// called from the sensor threads, which must not block; the emer_stop_thread
+// completes the event by calling emer_stop_sensor_event_complete
+static void emer_stop_sensor_event(int sensor, int id, double val)
+{
+    if (!emer_stop_motors(microsec_timer())) {
+        return;
+    }
+
+    emer_stop_sensor.sensor = sensor;
+    emer_stop_sensor.id     = id;
+    emer_stop_sensor.val    = val;
+    __sync_synchronize();
+    emer_stop_sensor_pending = true;
+}
+
+static void emer_stop_sensor_event_complete(void)
 {
-    if (pressed) {
-        stop_button_pressed = true;
+    int id = emer_stop_sensor.id;
+    double val = emer_stop_sensor.val;
+
+    switch (emer_stop_sensor.sensor) {
+    case EMER_STOP_SENSOR_BUTTON:
+        sprintf(emer_stop_reason, "stop button");
+        break;
+    case EMER_STOP_SENSOR_PROXIMITY:
+        sprintf(emer_stop_reason, "%s proximity alert", id == 0 ? "front" : "rear");
+        break;
+    case EMER_STOP_SENSOR_ENCODER:
+        sprintf(emer_stop_reason, "%s wheel encoder has %d errors",
+                id == 0 ? "left" : "right", (int)val);
+        break;
+    case EMER_STOP_SENSOR_ACCEL:
+        sprintf(emer_stop_reason, "acceleration %0.1f gravity", val);
+        break;
+    default:
+        sprintf(emer_stop_reason, "invalid sensor %d", emer_stop_sensor.sensor);
+        break;
     }
+
+    emer_stop_complete();
+
+    __sync_synchronize();
+    emer_stop_sensor_pending = false;
+}
+
+// called after the motors have been stopped, and the emer_stop_reason set
+static void emer_stop_complete(void)
+{
+    // freeze the flight recorder window around the emergency stop, and
+    // set the mc state and emer stop status
+    flight_rec_trigger(emer_stop_reason);
+    mc_emer_stop_complete(emer_stop_latency_us);
+
+    // the drive procs check for EMER_STOP_OCCURRED
+    __sync_synchronize();
+    emer_stop_thread_state = EMER_STOP_THREAD_DISABLED;
+    emer_stop_log_pending = true;
+}
+
+// called on the first edge of the button press, before it is debounced
+static void emer_stop_button_cb(int id)
+{
+    emer_stop_sensor_event(EMER_STOP_SENSOR_BUTTON, id, 0);
+}
+
+static void emer_stop_proximity_cb(int id, double sig)
+{
+    emer_stop_sensor_event(EMER_STOP_SENSOR_PROXIMITY, id, sig);
+}
+
+static void emer_stop_encoder_cb(int id, int errors)
+{
+    emer_stop_sensor_event(EMER_STOP_SENSOR_ENCODER, id, errors);
+}
+
+static void emer_stop_accel_cb(double accel)
+{
+    emer_stop_sensor_event(EMER_STOP_SENSOR_ACCEL, 0, accel);
 }
@@ -6,6 +6,22 @@
 #define GET_ARG(n,default)  (dpm->arg[n] == 0 ? (default) : dpm->arg[n])
 #define STEP(drvfunc) if ((drvfunc) < 0) return -1;
 
+#define PATH_LINE(s,_feet) \
+    do { \
+        memset((s), 0, sizeof(*(s))); \
+        (s)->type = DRIVE_PATH_LINE; \
+        (s)->arg[0] = (_feet); \
+    } while (0)
+#define PATH_ARC(s,_degrees,_radius_feet) \
+    do { \
+        memset((s), 0, sizeof(*(s))); \
+        (s)->type = DRIVE_PATH_ARC; \
+        (s)->arg[0] = (_degrees); \
+        (s)->arg[1] = (_radius_feet); \
+    } while (0)
+
+static int get_cycles(struct msg_drive_proc_s *dpm, int seg_per_cycle);
+
 int drive_proc(struct msg_drive_proc_s *dpm)
 {
     switch (dpm->proc_id) {
@@ -51,6 +67,22 @@ int drive_proc(struct msg_drive_proc_s *dpm)
         double fudge       = GET_ARG(2, 0);
         STEP(drive_radius(degrees, radius_feet, STOP_MOTORS, fudge));
         break; }
+    case DRIVE_GOTO: {
+        // goto <x_feet> <y_feet> [mph] - drive to location, relative to the origin
+        double x   = dpm->arg[0];
+        double y   = dpm->arg[1];
+        double mph = GET_ARG(2, 0.5);   // default mph  = 0.5
+        STEP(drive_goto(x, y, mph));
+        break; }
+    case DRIVE_HOME: {
+        // home [mph] - return to the origin
+        double mph = GET_ARG(0, 0.5);   // default mph  = 0.5
+        STEP(drive_home(mph));
+        break; }
+    case DRIVE_ORIG: {
+        // orig - set the origin to the current location and heading
+        pose_reset(0, 0, 0);
+        break; }
 
     case DRIVE_TST1: {
         // tst1 - repeat drive fwd/rev for range of mph, range 0.3 to 0.8 
@@ -78,61 +110,60 @@ int drive_proc(struct msg_drive_proc_s *dpm)
         STEP(drive_rotate_to_heading(curr_heading, fudge));
         break; }
     case DRIVE_TST4: {
-        // tst4 [cycles] [fudge] - repeating figure eight
-        double cycles = GET_ARG(0, 1);   // default cycles = 1
-        double fudge  = GET_ARG(1, 0);
+        // tst4 [cycles] - repeating figure eight
+        int cycles = get_cycles(dpm, 2);   // default cycles = 1
+        struct drive_path_seg_s seg[MAX_DRIVE_PATH_SEG];
+        if (cycles < 0) return -1;
         for (int i = 0; i < cycles; i++) {
-            STEP(drive_radius(360, 1, DONT_STOP_MOTORS, fudge));
-            STEP(drive_radius(-360, 1, DONT_STOP_MOTORS, fudge));
+            PATH_ARC(&seg[2*i+0], 360, 1);
+            PATH_ARC(&seg[2*i+1], -360, 1);
         }
+        STEP(drive_path(seg, 2*cycles));
         break; }
     case DRIVE_TST5: {
-        // tst5 [cycles] [fudge] - repeating oval
-        double cycles = GET_ARG(0, 1);   // default cycles = 1
-        double fudge  = GET_ARG(1, 0);
+        // tst5 [cycles] - repeating oval
+        int cycles = get_cycles(dpm, 4);   // default cycles = 1
+        struct drive_path_seg_s seg[MAX_DRIVE_PATH_SEG];
+        if (cycles < 0) return -1;
         for (int i = 0; i < cycles; i++) {
-            bool last = (i == cycles-1);
-            STEP(drive_fwd(3, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(180, 1, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(3, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(180, 1, last ? STOP_MOTORS : DONT_STOP_MOTORS, fudge));
+            PATH_LINE(&seg[4*i+0], 3);
+            PATH_ARC(&seg[4*i+1], 180, 1);
+            PATH_LINE(&seg[4*i+2], 3);
+            PATH_ARC(&seg[4*i+3], 180, 1);
         }
+        STEP(drive_path(seg, 4*cycles));
         break; }
     case DRIVE_TST6: {
-        // tst6 [cycles] [fudge] - repeating square, corner turn radius = 1
-        double cycles = GET_ARG(0, 1);   // default cycles = 1
-        double fudge  = GET_ARG(1, 0);
+        // tst6 [cycles] - repeating square, corner turn radius = 1
+        int cycles = get_cycles(dpm, 8);   // default cycles = 1
         double corner_radius = 1;
         double feet = 1.5;
-        for (int i = 0; i < cycles; i++) {
-            bool last = (i == cycles-1);
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, last ? STOP_MOTORS : DONT_STOP_MOTORS, fudge));
+        struct drive_path_seg_s seg[MAX_DRIVE_PATH_SEG];
+        if (cycles < 0) return -1;
+        for (int i = 0; i < 4*cycles; i++) {
+            PATH_LINE(&seg[2*i+0], feet);
+            PATH_ARC(&seg[2*i+1], 90, corner_radius);
         }
+        STEP(drive_path(seg, 8*cycles));
         break; }
     case DRIVE_TST7: {
-        // tst7 [cycles] [fudge] - repeating square, corner turn radius = 0
-        double cycles = GET_ARG(0, 1);   // default cycles = 1
-        double fudge  = GET_ARG(1, 0);
+        // tst7 [cycles] - repeating square, corner turn radius = 0
+        int cycles = get_cycles(dpm, 8);   // default cycles = 1
         double corner_radius = 0;
         double feet = 2;
-        for (int i = 0; i < cycles; i++) {
-            bool last = (i == cycles-1);
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, DONT_STOP_MOTORS, fudge));
-            STEP(drive_fwd(feet, 0.5, DONT_STOP_MOTORS));
-            STEP(drive_radius(90, corner_radius, last ? STOP_MOTORS : DONT_STOP_MOTORS, fudge));
+        struct drive_path_seg_s seg[MAX_DRIVE_PATH_SEG];
+        if (cycles < 0) return -1;
+        for (int i = 0; i < 4*cycles; i++) {
+            PATH_LINE(&seg[2*i+0], feet);
+            PATH_ARC(&seg[2*i+1], 90, corner_radius);
         }
+        STEP(drive_path(seg, 8*cycles));
+        break; }
+
+    case DRIVE_PATH: {
+        // path - run the path from the last MSG_ID_DRIVE_PATH
+        struct msg_drive_path_s *path = drive_get_path();
+        STEP(drive_path(path->seg, path->max_seg));
         break; }
 
     default:
@@ -142,3 +173,21 @@ int drive_proc(struct msg_drive_proc_s *dpm)
 
     return 0;
 }
+
+// returns the cycles arg of the repeating path tests, or -1 if it is invalid;
+// the cycles are limited so that the path has at most MAX_DRIVE_PATH_SEG segments
+static int get_cycles(struct msg_drive_proc_s *dpm, int seg_per_cycle)
+{
+    double cycles = GET_ARG(0, 1);
+    int max_cycles = MAX_DRIVE_PATH_SEG / seg_per_cycle;
+
+    if (!(cycles >= 1)) {
+        ERROR("invalid cycles %g\n", cycles);
+        return -1;
+    }
+    if (cycles > max_cycles) {
+        WARN("cycles %g limited to %d\n", cycles, max_cycles);
+        cycles = max_cycles;
+    }
+    return cycles;
+}
@@ -0,0 +1,334 @@
+#include "common.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// Notes:
+// - The flight_rec_thread records the drive state at 1 kHz to a ring of
+//   flight_rec_t records, see flight_rec.h. The ring is an mmap'ed file, so
+//   the most recent records survive a crash of this program; at startup the
+//   ring file left by the previous run is renamed to FLIGHT_REC_PREV_FILENAME.
+// - The ring is written only by the flight_rec_thread, and is not locked.
+//   The recording cost is a few reads of values that are published by the
+//   device and control threads; the control threads are not involved.
+// - flight_rec_trigger freezes the window from PRE_TRIGGER_REC records before
+//   the trigger to POST_TRIGGER_REC records after. It does not block, and is
+//   called by drive.c when an emergency stop occurs.
+// - The window is written by the flight_rec_dump_thread, which is not
+//   realtime, to flight_rec.<n>.frd, where n cycles from 0 to MAX_DUMP_FILE-1.
+//   The ring holds about 16 secs, so the window is copied well before it
+//   is overwritten.
+// - Use devel/flight_rec/flight_rec_csv to convert the files to csv.
+
+//
+// defines
+//
+
+#define FLIGHT_REC_RATE_HZ        1000
+#define FLIGHT_REC_INTVL_NS       (1000000000 / FLIGHT_REC_RATE_HZ)
+
+#define MAX_RING_REC              16384
+#define PRE_TRIGGER_REC           4000
+#define POST_TRIGGER_REC          1000
+#define MAX_DUMP_FILE             10
+
+#define FLIGHT_REC_RING_FILENAME  "flight_rec.ring"
+#define FLIGHT_REC_PREV_FILENAME  "flight_rec.prev.frd"
+
+#define RING_FILE_SIZE            (FLIGHT_REC_DATA_OFFSET + MAX_RING_REC * sizeof(flight_rec_t))
+
+#define TRIGGER_IDLE              0
+#define TRIGGER_CLAIMED           1
+#define TRIGGER_POST              2
+#define TRIGGER_DUMP              3
+
+//
+// variables
+//
+
+static flight_rec_hdr_t * hdr;
+static flight_rec_t     * ring;
+static mc_status_t      * mcs;
+
+static int                trigger_state;
+static uint64_t           trigger_head;
+static uint64_t           trigger_time_us;
+static char               trigger_reason[FLIGHT_REC_MAX_REASON];
+static volatile int       trigger_dropped;
+
+static volatile int       record_cost_max_us;
+static volatile uint64_t  record_cost_sum_us;
+
+//
+// prototypes
+//
+
+static void *flight_rec_thread(void *cx);
+static void flight_rec_sample(flight_rec_t *r, uint64_t time_us);
+static void *flight_rec_dump_thread(void *cx);
+static int flight_rec_dump_file_write(char *filename, flight_rec_t *recs, int max_rec);
+
+// -----------------  API  --------------------------------------------------
+
+int flight_rec_init(void)
+{
+    pthread_t tid;
+    int fd;
+    void *addr;
+
+    // get pointer to mtr ctlr status
+    mcs = mc_get_status();
+
+    // save the ring file from the previous run
+    if (rename(FLIGHT_REC_RING_FILENAME, FLIGHT_REC_PREV_FILENAME) == 0) {
+        INFO("saved %s to %s\n", FLIGHT_REC_RING_FILENAME, FLIGHT_REC_PREV_FILENAME);
+    }
+
+    // create and map the ring file
+    fd = open(FLIGHT_REC_RING_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        ERROR("failed to open %s, %s\n", FLIGHT_REC_RING_FILENAME, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, RING_FILE_SIZE) < 0) {
+        ERROR("failed to truncate %s, %s\n", FLIGHT_REC_RING_FILENAME, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    addr = mmap(NULL, RING_FILE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ERROR("failed to mmap %s, %s\n", FLIGHT_REC_RING_FILENAME, strerror(errno));
+        return -1;
+    }
+
+    // init the header; the pages are touched now so that the
+    // flight_rec_thread does not take page faults
+    memset(addr, 0, RING_FILE_SIZE);
+    hdr  = addr;
+    ring = (flight_rec_t*)((char*)addr + FLIGHT_REC_DATA_OFFSET);
+    hdr->magic    = FLIGHT_REC_MAGIC;
+    hdr->version  = FLIGHT_REC_VERSION;
+    hdr->rec_size = sizeof(flight_rec_t);
+    hdr->max_rec  = MAX_RING_REC;
+
+    // create the flight_rec_thread and flight_rec_dump_thread
+    pthread_create(&tid, NULL, flight_rec_thread, NULL);
+    pthread_create(&tid, NULL, flight_rec_dump_thread, NULL);
+
+    return 0;
+}
+
+// freeze the records around this time, and write them to a dump file;
+// a trigger while the previous trigger's dump is in progress is dropped
+void flight_rec_trigger(char *reason)
+{
+    if (hdr == NULL ||
+        !__sync_bool_compare_and_swap(&trigger_state, TRIGGER_IDLE, TRIGGER_CLAIMED))
+    {
+        __sync_fetch_and_add(&trigger_dropped, 1);
+        return;
+    }
+
+    trigger_head    = hdr->head;
+    trigger_time_us = microsec_timer();
+    strncpy(trigger_reason, reason, sizeof(trigger_reason)-1);
+    trigger_reason[sizeof(trigger_reason)-1] = '\0';
+
+    __sync_synchronize();
+    trigger_state = TRIGGER_POST;
+}
+
+// -----------------  FLIGHT REC THREAD  ------------------------------------
+
+static void *flight_rec_thread(void *cx)
+{
+    struct sched_param param;
+    struct timespec    ts;
+    uint64_t           head, start_us, cost_us;
+    int                rc, loop_timing;
+
+    loop_timing = loop_timing_register("flight_rec", FLIGHT_REC_INTVL_NS / 1000);
+
+    // set realtime priority, just below the drive_thread
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = 79;
+    rc = sched_setscheduler(0, SCHED_FIFO, &param);
+    if (rc < 0) {
+        FATAL("sched_setscheduler, %s\n", strerror(errno));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while (true) {
+        // sleep until the start of the next interval
+        ts.tv_nsec += FLIGHT_REC_INTVL_NS;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        loop_timing_start(loop_timing);
+
+        // fill in the next record, and then publish it by advancing head
+        start_us = microsec_timer();
+        head = hdr->head;
+        flight_rec_sample(&ring[head % MAX_RING_REC], start_us);
+        __sync_synchronize();
+        hdr->head = head + 1;
+
+        // when the post trigger records have been recorded, hand off
+        // to the flight_rec_dump_thread
+        if (trigger_state == TRIGGER_POST && head + 1 >= trigger_head + POST_TRIGGER_REC) {
+            trigger_state = TRIGGER_DUMP;
+        }
+
+        cost_us = microsec_timer() - start_us;
+        record_cost_sum_us += cost_us;
+        if (cost_us > record_cost_max_us) {
+            record_cost_max_us = cost_us;
+        }
+
+        loop_timing_end(loop_timing);
+    }
+
+    return NULL;
+}
+
+static void flight_rec_sample(flight_rec_t *r, uint64_t time_us)
+{
+    double target_mph[2], sig;
+    pose_t pose;
+    int    id, flags = 0;
+
+    r->time_us = time_us;
+    for (id = 0; id < 2; id++) {
+        r->enc_count[id]       = encoder_get_total_count(id);
+        r->enc_speed[id]       = encoder_get_speed(id);
+        r->mc_target_speed[id] = mcs->target_speed[id];
+        if (proximity_check(id, &sig)) {
+            flags |= (id == 0 ? FLIGHT_REC_FLAG_PROX_ALERT_FRONT : FLIGHT_REC_FLAG_PROX_ALERT_REAR);
+        }
+        r->prox_sig[id] = sig;
+    }
+
+    wheel_ctlr_get_target(&target_mph[0], &target_mph[1]);
+    r->wheel_target_mph[0] = target_mph[0];
+    r->wheel_target_mph[1] = target_mph[1];
+
+    pose_get(&pose);
+    r->rotation            = imu_get_rotation();
+    r->heading             = pose.heading;
+    r->motors_current      = mcs->motors_current;
+    r->electronics_current = current_get(0);
+    r->drive_proc_id       = drive_get_proc_id();
+    r->mc_state            = mcs->state;
+
+    if (wheel_ctlr_is_enabled()) {
+        flags |= FLIGHT_REC_FLAG_WHEEL_CTLR_ENABLED;
+    }
+    if (drive_emer_stop_occurred()) {
+        flags |= FLIGHT_REC_FLAG_EMER_STOP;
+    }
+    r->flags = flags;
+}
+
+// -----------------  FLIGHT REC DUMP THREAD  -------------------------------
+
+static void *flight_rec_dump_thread(void *cx)
+{
+    static flight_rec_t recs[PRE_TRIGGER_REC + POST_TRIGGER_REC];
+    uint64_t first, head, n;
+    int      max_rec;
+    char     filename[100];
+
+    while (true) {
+        // wait for the flight_rec_thread to have recorded the post trigger records
+        while (trigger_state != TRIGGER_DUMP) {
+            usleep(10000);  // 10 ms
+        }
+
+        // copy the window from the ring; the window starts at the oldest
+        // record that is still in the ring, if that is after the desired start;
+        // the slot of record head - MAX_RING_REC may be being overwritten by
+        // record head, because head is advanced after the record is filled
+        head = hdr->head;
+        first = (trigger_head > PRE_TRIGGER_REC ? trigger_head - PRE_TRIGGER_REC : 0);
+        if (head >= MAX_RING_REC && first <= head - MAX_RING_REC) {
+            first = head - MAX_RING_REC + 1;
+        }
+        max_rec = 0;
+        for (n = first; n < trigger_head + POST_TRIGGER_REC; n++) {
+            recs[max_rec++] = ring[n % MAX_RING_REC];
+        }
+
+        // the records are still valid if the flight_rec_thread has not wrapped
+        // around to them while they were being copied; when head equals
+        // first + MAX_RING_REC the first record's slot may be being written
+        __sync_synchronize();
+        if (hdr->head >= first + MAX_RING_REC) {
+            ERROR("flight_rec records overwritten while copying\n");
+            trigger_state = TRIGGER_IDLE;
+            continue;
+        }
+
+        // write the dump file
+        sprintf(filename, "flight_rec.%d.frd", hdr->dump_count % MAX_DUMP_FILE);
+        if (flight_rec_dump_file_write(filename, recs, max_rec) == 0) {
+            INFO("flight_rec wrote %s, %d records, reason '%s', record_cost avg=%0.1f max=%d us, dropped=%d\n",
+                 filename, max_rec, trigger_reason,
+                 (double)record_cost_sum_us / hdr->head, record_cost_max_us, trigger_dropped);
+            hdr->dump_count++;
+        }
+
+        // allow the next trigger
+        __sync_synchronize();
+        trigger_state = TRIGGER_IDLE;
+    }
+
+    return NULL;
+}
+
+static int flight_rec_dump_file_write(char *filename, flight_rec_t *recs, int max_rec)
+{
+    FILE *fp;
+    flight_rec_hdr_t h;
+    char tmp_filename[100];
+
+    memset(&h, 0, sizeof(h));
+    h.magic           = FLIGHT_REC_MAGIC;
+    h.version         = FLIGHT_REC_VERSION;
+    h.rec_size        = sizeof(flight_rec_t);
+    h.max_rec         = max_rec;
+    h.head            = max_rec;
+    h.trigger_time_us = trigger_time_us;
+    memcpy(h.reason, trigger_reason, sizeof(h.reason));
+
+    // write to a temp file, and rename it to the dump file
+    if (snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename) >= sizeof(tmp_filename)) {
+        ERROR("filename %s is too long\n", filename);
+        return -1;
+    }
+    fp = fopen(tmp_filename, "w");
+    if (fp == NULL) {
+        ERROR("failed to open %s for writing, %s\n", tmp_filename, strerror(errno));
+        return -1;
+    }
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+        fseek(fp, FLIGHT_REC_DATA_OFFSET, SEEK_SET) != 0 ||
+        fwrite(recs, sizeof(flight_rec_t), max_rec, fp) != max_rec ||
+        fflush(fp) != 0 ||
+        fsync(fileno(fp)) != 0)
+    {
+        ERROR("failed to write %s, %s\n", tmp_filename, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    if (rename(tmp_filename, filename) < 0) {
+        ERROR("failed to rename %s, %s\n", tmp_filename, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -27,6 +27,8 @@ extern "C" {
 #define ENC_SPEED_TO_MPH(encspd)   ((encspd) * ((1/2248.86) * FEET_PER_REV * 0.681818))
 #define MTR_SPEED_TO_MPH(mtrspd)   ((mtrspd) * ((1./3200) * MOTOR_RPM_AT_12V * FEET_PER_REV / 60 * 0.681818))
 #define MTR_MPH_TO_SPEED(mph)      ((mph)   / ((1./3200) * MOTOR_RPM_AT_12V * FEET_PER_REV / 60 * 0.681818))
+#define WHEEL_BASE_FEET            (10./12.)
+#define FPS_PER_MPH                1.46667   // feet/sec per mph
 
 // motor ctlrs
 #define LEFT_MOTOR                   "/dev/ttyACM1"       // USB serial device
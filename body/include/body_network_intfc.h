@@ -11,17 +11,23 @@ extern "C" {
 #define MAX_OLED_STR          5
 #define MAX_OLED_STR_SIZE     10
 #define MAX_DRIVE_PROC_COMPLETE_REASON_STR_SIZE 100
+#define MAX_DRIVE_PATH_SEG    16
+#define MAX_MSG_LOOP_TIMING   20
+#define MAX_MSG_LOOP_TIMING_NAME 16
 
 // msgs sent from client to body
 #define MSG_ID_DRIVE_EMER_STOP      0x1001
 #define MSG_ID_DRIVE_PROC           0x1002
 #define MSG_ID_MC_DEBUG_CTL         0x1003
 #define MSG_ID_LOG_MARK             0x1004
+#define MSG_ID_DRIVE_PATH           0x1005
+#define MSG_ID_FLIGHT_REC_DUMP      0x1006
 
 // msgs sent from body to client
 #define MSG_ID_STATUS               0x2001
 #define MSG_ID_LOGMSG               0x2002
 #define MSG_ID_DRIVE_PROC_COMPLETE  0x2003
+#define MSG_ID_LOOP_TIMING          0x2004
 
 // msg drive_proc, proc_id values
 #define DRIVE_SCAL     1   // scal [feet] - drive straight calibration
@@ -31,13 +37,34 @@ extern "C" {
 #define DRIVE_ROT     13   // rot [degress] [fudge] - rotate 
 #define DRIVE_HDG     14   // hdg [heading] [fudge] - rotate to magnetic heading
 #define DRIVE_RAD     15   // rad [degrees] [radius_feet] [fudge] - drive forward with turn radius
+#define DRIVE_GOTO    16   // goto <x_feet> <y_feet> [mph] - drive to location, relative to the origin
+#define DRIVE_HOME    17   // home [mph] - return to the origin
+#define DRIVE_ORIG    18   // orig - set the origin to the current location and heading
+#define DRIVE_PATH    20   // runs the path from the last MSG_ID_DRIVE_PATH, not sent by the client
 #define DRIVE_TST1   101   // tst1 - repeat drive fwd/rev for range of mph, range 0.3 to 0.8  
 #define DRIVE_TST2   102   // tst2 [fudge] - drive fwd, turn around and return to start point, using gyro
 #define DRIVE_TST3   103   // tst3 [fudge] - drive fwd, turn around and return to start point, using magnetometer
-#define DRIVE_TST4   104   // tst4 [cycles] [fudge] - repeating figure eight
-#define DRIVE_TST5   105   // tst5 [cycles] [fudge] - repeating oval
-#define DRIVE_TST6   106   // tst6 [cycles] [fudge] - repeating square, corner turn radius = 1
-#define DRIVE_TST7   107   // tst7 [cycles] [fudge] - repeating square, corner turn radius = 0
+#define DRIVE_TST4   104   // tst4 [cycles] - repeating figure eight
+#define DRIVE_TST5   105   // tst5 [cycles] - repeating oval
+#define DRIVE_TST6   106   // tst6 [cycles] - repeating square, corner turn radius = 1
+#define DRIVE_TST7   107   // tst7 [cycles] - repeating square, corner turn radius = 0
+
+// msg drive_path, segment types
+#define DRIVE_PATH_LINE    1   // arg[0]=feet (negative for reverse)
+#define DRIVE_PATH_ARC     2   // arg[0]=degrees (negative for ccw), arg[1]=radius_feet (from inside wheel)
+#define DRIVE_PATH_ROTATE  3   // arg[0]=degrees (negative for ccw)
+
+#define DRIVE_PATH_SEG_STR(t) \
+    ((t) == DRIVE_PATH_LINE   ? "LINE"   : \
+     (t) == DRIVE_PATH_ARC    ? "ARC"    : \
+     (t) == DRIVE_PATH_ROTATE ? "ROTATE" : \
+                                "????")
+
+struct drive_path_seg_s {
+    int type;
+    double arg[2];
+    double mph;   // 0 for default
+};
 
 typedef struct {
     int id;
@@ -47,6 +74,11 @@ typedef struct {
             int unique_id;
 	    double arg[8];
         } drive_proc;
+        struct msg_drive_path_s {
+            int unique_id;
+            int max_seg;
+            struct drive_path_seg_s seg[MAX_DRIVE_PATH_SEG];
+        } drive_path;
         struct drive_proc_complete_s {
             int unique_id;
             bool succ;
@@ -66,6 +98,11 @@ typedef struct {
             char mc_state_str[16];
             int mc_debug_mode_enabled;
             int mc_target_speed[2];
+            int mc_speed_cmd_latency_us;
+            int mc_speed_cmd_latency_max_us;
+            int mc_emer_stop_latency_us;
+            int mc_emer_stop_latency_max_us;
+            int mc_emer_stop_count;
             int enc_poll_intvl_us;
             struct {
                 int enabled;
@@ -90,6 +127,17 @@ typedef struct {
                 int alert;
                 double sig;
             } prox[2];
+            // pose, relative to the origin
+            struct {
+                double x;
+                double y;
+                double heading;
+                double speed;
+                double rotation_rate;
+            } pose;
+            // drive straight calibration model
+            double drive_cal_confidence;
+            int drive_cal_updates;
             // imu
             double mag_heading;
             double rotation;
@@ -112,6 +160,24 @@ typedef struct {
         struct msg_logmsg_s {
             char str[MAX_LOGMSG_STR_SIZE];
         } logmsg;
+        struct msg_loop_timing_s {
+            // the stats are for the most recent window of each loop
+            int max_loop;
+            struct {
+                char name[MAX_MSG_LOOP_TIMING_NAME];
+                int expected_period_us;
+                int window_us;
+                int period_count;
+                int late_count;
+                int period_max_us;
+                int period_p50_us;
+                int period_p99_us;
+                int period_p999_us;
+                int work_max_us;
+                int work_p99_us;
+                int work_p999_us;
+            } loop[MAX_MSG_LOOP_TIMING];
+        } loop_timing;
     };
 } msg_t;
 
@@ -0,0 +1,58 @@
+#ifndef __FLIGHT_REC_H__
+#define __FLIGHT_REC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// flight recorder file format
+//
+// The ring file and the dump files have the same format: the header,
+// followed by the records starting at FLIGHT_REC_DATA_OFFSET. Record n
+// (counting from 0) is at index n % max_rec, and the valid records are
+// n = max(0, head-max_rec) to head-1. A dump file has head == max_rec.
+
+#define FLIGHT_REC_MAGIC        0x43455246   // "FREC"
+#define FLIGHT_REC_VERSION      1
+#define FLIGHT_REC_DATA_OFFSET  4096
+#define FLIGHT_REC_MAX_REASON   200
+
+// flight_rec_t flags
+#define FLIGHT_REC_FLAG_WHEEL_CTLR_ENABLED  0x01
+#define FLIGHT_REC_FLAG_EMER_STOP           0x02
+#define FLIGHT_REC_FLAG_PROX_ALERT_FRONT    0x04
+#define FLIGHT_REC_FLAG_PROX_ALERT_REAR     0x08
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t max_rec;
+    uint64_t head;              // number of records written
+    uint64_t trigger_time_us;   // 0 when not triggered
+    uint32_t dump_count;        // ring file only, number of dumps written
+    uint32_t spare;
+    char     reason[FLIGHT_REC_MAX_REASON];  // the trigger reason
+} flight_rec_hdr_t;
+
+typedef struct {
+    uint64_t time_us;
+    int32_t  enc_count[2];        // encoder total count
+    int32_t  enc_speed[2];        // encoder counts/sec
+    int16_t  mc_target_speed[2];  // mtr ctlr speed units
+    float    wheel_target_mph[2];
+    float    rotation;            // imu rotation, degrees
+    float    heading;             // pose heading, degrees
+    float    prox_sig[2];
+    float    motors_current;      // amps
+    int16_t  drive_proc_id;       // 0 when a drive proc is not running
+    uint8_t  mc_state;
+    uint8_t  flags;
+    float    electronics_current; // amps
+} flight_rec_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
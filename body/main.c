@@ -42,6 +42,7 @@ static void process_received_msg(msg_t *msg);
 
 static void *send_status_msg_thread(void *cx);
 static void generate_status_msg(msg_t *msg);
+static void generate_loop_timing_msg(msg_t *msg);
 
 // -----------------  MAIN AND INIT ROUTINES  ------------------------------
 
@@ -87,8 +88,11 @@ static void initialize(void)
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTERM, &act, NULL);
 
-    // register logmsg callback
+    // register logmsg callback, and defer logmsg formatting and output
+    // to the logmsg thread, so that the realtime threads do not block on
+    // stderr or the logmsg callback's send
     logmsg_register_cb(logmsg_cb);
+    logmsg_init();
 
     // init devices
     CALL(gpio_init, ());
@@ -106,7 +110,10 @@ static void initialize(void)
 
     // init body program functions
     CALL(oled_ctlr_init, ());
+    CALL(wheel_ctlr_init, ());
+    CALL(pose_init, ());
     CALL(drive_init, ());
+    CALL(flight_rec_init, ());
 
     // create send_status_msg_thread
     pthread_create(&tid, NULL, send_status_msg_thread, NULL);
@@ -236,8 +243,10 @@ static int recv_msg(int sfd, msg_t *msg)
     // validate the msg->id
     if (msg->id != MSG_ID_DRIVE_EMER_STOP &&
         msg->id != MSG_ID_DRIVE_PROC &&
+        msg->id != MSG_ID_DRIVE_PATH &&
         msg->id != MSG_ID_MC_DEBUG_CTL &&
-        msg->id != MSG_ID_LOG_MARK)
+        msg->id != MSG_ID_LOG_MARK &&
+        msg->id != MSG_ID_FLIGHT_REC_DUMP)
     {
         ERROR("invalid msg id 0x%x\n", msg->id);
         return -1;
@@ -256,12 +265,18 @@ static void process_received_msg(msg_t *msg)
     case MSG_ID_DRIVE_PROC:
         drive_run(&msg->drive_proc);
         break;
+    case MSG_ID_DRIVE_PATH:
+        drive_run_path(&msg->drive_path);
+        break;
     case MSG_ID_MC_DEBUG_CTL:
         mc_debug_mode(msg->mc_debug_ctl.enable);
         break;
     case MSG_ID_LOG_MARK:
         INFO("------------------------------------------------\n");
         break;
+    case MSG_ID_FLIGHT_REC_DUMP:
+        flight_rec_trigger("requested by client");
+        break;
     default:
         FATAL("received invalid msg id %d\n", msg->id);
         break;
@@ -273,11 +288,18 @@ static void process_received_msg(msg_t *msg)
 static void *send_status_msg_thread(void *cx)
 {
     msg_t msg;
+    int   count = 0;
 
     while (true) {
         if (sockfd[0] != -1 || sockfd[1] != -1) {
             generate_status_msg(&msg);
             SEND_MSG(&msg);
+
+            // the loop timing msg is sent once per second
+            if ((count++ % 2) == 0) {
+                generate_loop_timing_msg(&msg);
+                SEND_MSG(&msg);
+            }
         }
 
         usleep(500000);
@@ -291,6 +313,7 @@ static void generate_status_msg(msg_t *msg)
     mc_status_t *mcs = mc_get_status();
     int id;
     double val;
+    pose_t pose;
     struct msg_status_s *x = &msg->status;
 
     static int accel_alert_count;
@@ -312,6 +335,11 @@ static void generate_status_msg(msg_t *msg)
     x->mc_debug_mode_enabled = mcs->debug_mode_enabled;
     x->mc_target_speed[0]    = mcs->target_speed[0];
     x->mc_target_speed[1]    = mcs->target_speed[1];
+    x->mc_speed_cmd_latency_us     = mcs->speed_cmd_latency_us;
+    x->mc_speed_cmd_latency_max_us = mcs->speed_cmd_latency_max_us;
+    x->mc_emer_stop_latency_us     = mcs->emer_stop_latency_us;
+    x->mc_emer_stop_latency_max_us = mcs->emer_stop_latency_max_us;
+    x->mc_emer_stop_count          = mcs->emer_stop_count;
     x->enc_poll_intvl_us     = encoder_get_poll_intvl_us();
     for (id = 0; id < 2; id++) {
         x->enc[id].enabled  = encoder_get_enabled(id);
@@ -341,6 +369,17 @@ static void generate_status_msg(msg_t *msg)
         x->prox[id].alert   = proximity_check(id, &x->prox[id].sig);
     }
 
+    // pose
+    pose_get(&pose);
+    x->pose.x             = pose.x;
+    x->pose.y             = pose.y;
+    x->pose.heading       = pose.heading;
+    x->pose.speed         = pose.speed;
+    x->pose.rotation_rate = pose.rotation_rate;
+
+    // drive straight calibration model
+    drive_cal_get_confidence(&x->drive_cal_confidence, &x->drive_cal_updates);
+
     // imu
     if (imu_check_accel_alert(&val)) {
         accel_alert_count++;
@@ -372,6 +411,42 @@ static void generate_status_msg(msg_t *msg)
     memcpy(x->oled_strs, oled_get_strs(), sizeof(oled_strs_t));
 }
 
+// the loop timing msg is defined in body_network_intfc.h, which is shared with
+// the brain, and so does not use the misc.h loop timing defines
+_Static_assert(MAX_MSG_LOOP_TIMING == MAX_LOOP_TIMING, "MAX_MSG_LOOP_TIMING");
+_Static_assert(MAX_MSG_LOOP_TIMING_NAME == MAX_LOOP_TIMING_NAME, "MAX_MSG_LOOP_TIMING_NAME");
+
+static void generate_loop_timing_msg(msg_t *msg)
+{
+    struct msg_loop_timing_s *x = &msg->loop_timing;
+    loop_timing_stats_t stats;
+    int handle, n = 0;
+
+    // set msg id
+    memset(msg, 0, sizeof(msg_t));
+    msg->id = MSG_ID_LOOP_TIMING;
+
+    for (handle = 0; handle < loop_timing_get_max() && n < MAX_MSG_LOOP_TIMING; handle++) {
+        if (loop_timing_get_stats(handle, &stats) < 0) {
+            continue;
+        }
+        memcpy(x->loop[n].name, stats.name, sizeof(x->loop[n].name));
+        x->loop[n].expected_period_us = stats.expected_period_us;
+        x->loop[n].window_us          = stats.window_us;
+        x->loop[n].period_count       = stats.period_count;
+        x->loop[n].late_count         = stats.late_count;
+        x->loop[n].period_max_us      = stats.period_max_us;
+        x->loop[n].period_p50_us      = stats.period_p50_us;
+        x->loop[n].period_p99_us      = stats.period_p99_us;
+        x->loop[n].period_p999_us     = stats.period_p999_us;
+        x->loop[n].work_max_us        = stats.work_max_us;
+        x->loop[n].work_p99_us        = stats.work_p99_us;
+        x->loop[n].work_p999_us       = stats.work_p999_us;
+        n++;
+    }
+    x->max_loop = n;
+}
+
 // -----------------  SEND MSG PROCS  --------------------------------------
 
 void send_drive_proc_complete_msg(int unique_id, bool succ, char *failure_reason)
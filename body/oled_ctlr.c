@@ -55,9 +55,12 @@ oled_strs_t *oled_get_strs(void)
 
 static void *oled_ctlr_thread(void *cx)
 {
-    int   count=0, count_last_oled_advance=0;
+    int   count=0, count_last_oled_advance=0, i;
     char *str_to_display;
     char  str_currently_displayed[MAX_OLED_STR_SIZE] = "";
+    char  strs_currently_displayed[MAX_OLED_STR][MAX_OLED_STR_SIZE] = { "" };
+    char *strs_to_display[MAX_OLED_STR];
+    bool  multi_str_displayed = false;
 
     while (true) {
         // update oled_str array once per second
@@ -81,23 +84,45 @@ static void *oled_ctlr_thread(void *cx)
                      "P=%-5.2f", env_get_pressure_inhg());
         }
 
-        // check if should display the next str
+        // check if should display the next str; after the individual strs,
+        // oled_stridx==MAX_OLED_STR displays all the strs at once
         if ((oled_advance_intvl_ms != 0 && (count-count_last_oled_advance)*100 > oled_advance_intvl_ms) ||
             (oled_button_advance_req))
         {
-            oled_stridx = (oled_stridx + 1) % MAX_OLED_STR;
+            oled_stridx = (oled_stridx + 1) % (MAX_OLED_STR + 1);
             count_last_oled_advance = count;
             oled_button_advance_req = false;
         }
 
-        // if oled string that is to be displayed differs from last displayed
-        // then display the new string
-        str_to_display = oled_strs[oled_stridx];
-        if (strcmp(str_to_display, str_currently_displayed) != 0) {
-            pthread_mutex_lock(&oled_mutex);
-            oled_draw_str(0, str_to_display);
-            pthread_mutex_unlock(&oled_mutex);
-            strcpy(str_currently_displayed, str_to_display);
+        // if oled string(s) that are to be displayed differ from last displayed
+        // then display the new string(s)
+        if (oled_stridx == MAX_OLED_STR) {
+            bool changed = !multi_str_displayed;
+            for (i = 0; i < MAX_OLED_STR; i++) {
+                strs_to_display[i] = oled_strs[i];
+                if (strcmp(oled_strs[i], strs_currently_displayed[i]) != 0) {
+                    changed = true;
+                }
+            }
+            if (changed) {
+                pthread_mutex_lock(&oled_mutex);
+                oled_draw_multi_str(0, MAX_OLED_STR, strs_to_display);
+                pthread_mutex_unlock(&oled_mutex);
+                for (i = 0; i < MAX_OLED_STR; i++) {
+                    strcpy(strs_currently_displayed[i], oled_strs[i]);
+                }
+                multi_str_displayed = true;
+                str_currently_displayed[0] = '\0';
+            }
+        } else {
+            str_to_display = oled_strs[oled_stridx];
+            if (strcmp(str_to_display, str_currently_displayed) != 0) {
+                pthread_mutex_lock(&oled_mutex);
+                oled_draw_str(0, str_to_display);
+                pthread_mutex_unlock(&oled_mutex);
+                strcpy(str_currently_displayed, str_to_display);
+                multi_str_displayed = false;
+            }
         }
 
         // sleep 100 ms
@@ -0,0 +1,205 @@
+#include "common.h"
+
+// Notes:
+// - The pose_thread dead reckons the robot's pose, continuously, from the
+//   wheel encoders, the gyro and the magnetometer. The pose is not reset
+//   by the drive procs; it is relative to the origin set by pose_reset, or
+//   to the position and heading at program start.
+// - The pose is in feet, and the heading is in degrees clockwise from the
+//   +y axis, which is the same sense as the imu rotation.
+// - Heading fusion (complementary filter):
+//   . the change in heading is mostly from the gyro, when the gyro is
+//     enabled, with a small part from the encoder wheel difference, which
+//     is affected by wheel slip
+//   . the magnetometer slowly corrects the heading drift, with time
+//     constant MAG_TC_SECS; the magnetometer is referenced to the heading
+//     at the last pose_reset
+// - The snapshot uses a sequence count, as in gpio_sampler.c; the count is
+//   odd while the snapshot is being updated.
+
+//
+// defines
+//
+
+#define POSE_RATE_HZ         500
+#define POSE_INTVL_NS        (1000000000 / POSE_RATE_HZ)
+
+#define GYRO_WEIGHT          0.95
+#define MAG_TC_SECS          20.
+#define VELOCITY_ALPHA       0.05    // velocity smoothing, per interval
+
+//
+// variables
+//
+
+static struct {
+    volatile unsigned int seq;
+    pose_t                pose;
+} snapshot;
+
+static volatile bool   reset_req;
+static double          reset_x, reset_y, reset_heading;
+
+//
+// prototypes
+//
+
+static void *pose_thread(void *cx);
+
+// -----------------  API  --------------------------------------------------
+
+int pose_init(void)
+{
+    pthread_t tid;
+
+    pthread_create(&tid, NULL, pose_thread, NULL);
+    return 0;
+}
+
+void pose_get(pose_t *pose)
+{
+    unsigned int seq;
+
+    do {
+        seq = snapshot.seq;
+        __sync_synchronize();
+        *pose = snapshot.pose;
+        __sync_synchronize();
+    } while ((seq & 1) || seq != snapshot.seq);
+}
+
+// set the pose; the pose_thread applies the new pose on its next
+// interval, and this routine waits for that
+void pose_reset(double x, double y, double heading)
+{
+    reset_x = x;
+    reset_y = y;
+    reset_heading = heading;
+    __sync_synchronize();
+    reset_req = true;
+
+    while (reset_req) {
+        usleep(1000);
+    }
+}
+
+// returns the distance (feet) and bearing (degrees, in range -180 to 180,
+// relative to the current heading) from the current pose to x,y
+void pose_get_bearing(double x, double y, double *distance, double *bearing)
+{
+    pose_t p;
+    double dx, dy;
+
+    pose_get(&p);
+    dx = x - p.x;
+    dy = y - p.y;
+    *distance = hypot(dx, dy);
+    *bearing = sanitize_heading(atan2(dx, dy) * (180/M_PI) - p.heading, -180);
+}
+
+// -----------------  POSE THREAD  ------------------------------------------
+
+static void *pose_thread(void *cx)
+{
+    struct sched_param param;
+    struct timespec    ts;
+    double             dt = 1. / POSE_RATE_HZ;
+    double             x=0, y=0, heading=0, speed=0, rotation_rate=0, mag_ref;
+    double             dl, dr, ds, dh, dh_gyro, dh_enc, mag_err, h_mid, gyro, last_gyro;
+    int                lcount, rcount, last_lcount, last_rcount, rc;
+    int                loop_timing;
+
+    loop_timing = loop_timing_register("pose", POSE_INTVL_NS / 1000);
+
+    // set realtime priority, between the wheel_ctlr_thread and the drive_thread
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = 81;
+    rc = sched_setscheduler(0, SCHED_FIFO, &param);
+    if (rc < 0) {
+        FATAL("sched_setscheduler, %s\n", strerror(errno));
+    }
+
+    // allow time for the smoothed magnetometer value to settle
+    usleep(1000000);
+
+    last_lcount = encoder_get_total_count(0);
+    last_rcount = encoder_get_total_count(1);
+    last_gyro   = imu_get_total_rotation();
+    mag_ref     = imu_get_magnetometer();
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while (true) {
+        // sleep until the start of the next interval
+        ts.tv_nsec += POSE_INTVL_NS;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        loop_timing_start(loop_timing);
+
+        // apply a pose reset request; the magnetometer reference is set
+        // so that the current magnetometer reading equals the new heading
+        if (reset_req) {
+            x = reset_x;
+            y = reset_y;
+            heading = reset_heading;
+            speed = rotation_rate = 0;
+            mag_ref = imu_get_magnetometer() - heading;
+            __sync_synchronize();
+            reset_req = false;
+        }
+
+        // get the change in wheel travel, and gyro rotation
+        lcount = encoder_get_total_count(0);
+        rcount = encoder_get_total_count(1);
+        gyro   = imu_get_total_rotation();
+        dl = ENC_COUNT_TO_FEET(lcount - last_lcount);
+        dr = ENC_COUNT_TO_FEET(rcount - last_rcount);
+        dh_gyro = gyro - last_gyro;
+        last_lcount = lcount;
+        last_rcount = rcount;
+        last_gyro   = gyro;
+
+        // determine the change in heading; the gyro is only integrated
+        // when accel/rot is enabled, which is while a drive proc is running
+        dh_enc = (dl - dr) / WHEEL_BASE_FEET * (180/M_PI);
+        if (imu_get_accel_rot_ctrl()) {
+            dh = GYRO_WEIGHT * dh_gyro + (1 - GYRO_WEIGHT) * dh_enc;
+        } else {
+            dh = dh_enc;
+        }
+
+        // advance the position along the mid-interval heading
+        ds = (dl + dr) / 2;
+        h_mid = (heading + dh / 2) * (M_PI/180);
+        x += ds * sin(h_mid);
+        y += ds * cos(h_mid);
+        heading += dh;
+
+        // correct heading drift using the magnetometer
+        mag_err = sanitize_heading((imu_get_magnetometer() - mag_ref) - heading, -180);
+        heading += mag_err * (dt / MAG_TC_SECS);
+        heading = sanitize_heading(heading, 0);
+
+        // smoothed velocities
+        speed         += VELOCITY_ALPHA * (ds / dt - speed);
+        rotation_rate += VELOCITY_ALPHA * (dh / dt - rotation_rate);
+
+        // publish the snapshot
+        snapshot.seq++;
+        __sync_synchronize();
+        snapshot.pose.x             = x;
+        snapshot.pose.y             = y;
+        snapshot.pose.heading       = heading;
+        snapshot.pose.speed         = speed;
+        snapshot.pose.rotation_rate = rotation_rate;
+        snapshot.pose.time_us       = microsec_timer();
+        __sync_synchronize();
+        snapshot.seq++;
+
+        loop_timing_end(loop_timing);
+    }
+
+    return NULL;
+}
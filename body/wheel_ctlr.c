@@ -0,0 +1,249 @@
+#include "common.h"
+
+// Notes:
+// - The wheel_ctlr_thread runs at a fixed rate, and closes a velocity loop
+//   for each wheel using the encoder speed. The motor speed sent to the
+//   mtr ctlr is:
+//     feed_forward(target) + Kp * error + Ki * integral(error)
+//   where feed_forward is obtained from the drive straight calibration.
+// - The drive routines set the wheel velocity targets (mph). The targets
+//   are ramped at the accel limit, so the drive routines do not need to
+//   boost or ramp the motors themselves.
+// - When disabled, or when the mtr ctlr is not enabled, no speed cmds are
+//   issued and the controller state is reset.
+
+//
+// defines
+//
+
+#define WHEEL_CTLR_RATE_HZ        200
+#define WHEEL_CTLR_INTVL_NS       (1000000000 / WHEEL_CTLR_RATE_HZ)
+
+#define DEFAULT_ACCEL_MPH_PER_SEC 1.0
+
+// gains, in mtr ctlr speed units per mph of error
+#define KP                        (0.5 * MTR_MPH_TO_SPEED(1))
+#define KI                        (3.0 * MTR_MPH_TO_SPEED(1))
+#define MAX_INTEGRAL_MPH_SECS     0.2
+
+#define MAX_MTR_SPEED             3200
+
+//
+// variables
+//
+
+static volatile bool   enabled;
+static volatile double target_mph[2];
+static volatile double accel_mph_per_sec = DEFAULT_ACCEL_MPH_PER_SEC;
+static volatile bool   avg_reset_req;
+
+static struct wheel_s {
+    double ramped_mph;
+    double measured_mph;
+    double integral;
+    int    mtr_speed;
+    double mtr_speed_sum;
+    int    mtr_speed_cnt;
+} wheel[2];
+
+static mc_status_t *mcs;
+
+//
+// prototypes
+//
+
+static void *wheel_ctlr_thread(void *cx);
+static void wheel_ctlr_reset(void);
+
+// -----------------  API  --------------------------------------------------
+
+int wheel_ctlr_init(void)
+{
+    pthread_t tid;
+
+    mcs = mc_get_status();
+    pthread_create(&tid, NULL, wheel_ctlr_thread, NULL);
+    return 0;
+}
+
+void wheel_ctlr_enable(void)
+{
+    target_mph[0] = target_mph[1] = 0;
+    __sync_synchronize();
+    enabled = true;
+}
+
+void wheel_ctlr_disable(void)
+{
+    enabled = false;
+    target_mph[0] = target_mph[1] = 0;
+}
+
+bool wheel_ctlr_is_enabled(void)
+{
+    return enabled;
+}
+
+void wheel_ctlr_set_target(double left_mph, double right_mph)
+{
+    target_mph[0] = left_mph;
+    target_mph[1] = right_mph;
+}
+
+void wheel_ctlr_get_target(double *left_mph, double *right_mph)
+{
+    *left_mph  = target_mph[0];
+    *right_mph = target_mph[1];
+}
+
+void wheel_ctlr_set_accel(double mph_per_sec)
+{
+    accel_mph_per_sec = (mph_per_sec > 0 ? mph_per_sec : DEFAULT_ACCEL_MPH_PER_SEC);
+}
+
+double wheel_ctlr_get_accel(void)
+{
+    return accel_mph_per_sec;
+}
+
+// returns true when the targets are 0 and the ramp has reached 0
+bool wheel_ctlr_is_stopped(void)
+{
+    return target_mph[0] == 0 && target_mph[1] == 0 &&
+           wheel[0].ramped_mph == 0 && wheel[1].ramped_mph == 0;
+}
+
+// the average mtr speeds output by the controller, since the last reset,
+// are used by the drive straight calibration
+void wheel_ctlr_reset_avg_mtr_speeds(void)
+{
+    avg_reset_req = true;
+}
+
+void wheel_ctlr_get_avg_mtr_speeds(int *lspeed, int *rspeed)
+{
+    struct wheel_s *l = &wheel[0], *r = &wheel[1];
+
+    *lspeed = (l->mtr_speed_cnt ? nearbyint(l->mtr_speed_sum / l->mtr_speed_cnt) : 0);
+    *rspeed = (r->mtr_speed_cnt ? nearbyint(r->mtr_speed_sum / r->mtr_speed_cnt) : 0);
+}
+
+void wheel_ctlr_get_state(int id, double *ramped_mph, double *measured_mph, int *mtr_speed)
+{
+    *ramped_mph   = wheel[id].ramped_mph;
+    *measured_mph = wheel[id].measured_mph;
+    *mtr_speed    = wheel[id].mtr_speed;
+}
+
+// -----------------  WHEEL CTLR THREAD  ------------------------------------
+
+static void *wheel_ctlr_thread(void *cx)
+{
+    struct sched_param param;
+    struct timespec    ts;
+    double             dt = 1. / WHEEL_CTLR_RATE_HZ;
+    int                id, rc, mtr_speed[2], last_mtr_speed[2] = {0,0};
+    int                loop_timing;
+
+    loop_timing = loop_timing_register("wheel_ctlr", WHEEL_CTLR_INTVL_NS / 1000);
+
+    // set realtime priority, higher than the drive_thread
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = 82;
+    rc = sched_setscheduler(0, SCHED_FIFO, &param);
+    if (rc < 0) {
+        FATAL("sched_setscheduler, %s\n", strerror(errno));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while (true) {
+        // sleep until the start of the next interval
+        ts.tv_nsec += WHEEL_CTLR_INTVL_NS;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        // if not enabled then reset the controller state and continue
+        if (!enabled || mcs->state != MC_STATE_ENABLED) {
+            loop_timing_idle(loop_timing);
+            wheel_ctlr_reset();
+            last_mtr_speed[0] = last_mtr_speed[1] = 0;
+            continue;
+        }
+        loop_timing_start(loop_timing);
+
+        // reset the average mtr speeds, if requested
+        if (avg_reset_req) {
+            for (id = 0; id < 2; id++) {
+                wheel[id].mtr_speed_sum = 0;
+                wheel[id].mtr_speed_cnt = 0;
+            }
+            avg_reset_req = false;
+        }
+
+        for (id = 0; id < 2; id++) {
+            struct wheel_s *w = &wheel[id];
+            double target = target_mph[id];
+            double max_delta = accel_mph_per_sec * dt;
+            double err, ff_lspeed, ff_rspeed, out;
+
+            // ramp toward the target, at the accel limit
+            if (target > w->ramped_mph + max_delta) {
+                w->ramped_mph += max_delta;
+            } else if (target < w->ramped_mph - max_delta) {
+                w->ramped_mph -= max_delta;
+            } else {
+                w->ramped_mph = target;
+            }
+
+            // when stopped, output 0 and don't accumulate integral
+            w->measured_mph = ENC_SPEED_TO_MPH(encoder_get_speed(id));
+            if (w->ramped_mph == 0) {
+                w->integral = 0;
+                w->mtr_speed = 0;
+                mtr_speed[id] = 0;
+                continue;
+            }
+
+            // pi with feed forward; the integral is clamped to limit windup
+            err = w->ramped_mph - w->measured_mph;
+            w->integral += err * dt;
+            if (w->integral > MAX_INTEGRAL_MPH_SECS) w->integral = MAX_INTEGRAL_MPH_SECS;
+            if (w->integral < -MAX_INTEGRAL_MPH_SECS) w->integral = -MAX_INTEGRAL_MPH_SECS;
+
+            drive_cal_mph_to_mtr_speeds(w->ramped_mph, &ff_lspeed, &ff_rspeed);
+            out = (id == 0 ? ff_lspeed : ff_rspeed) + KP * err + KI * w->integral;
+            if (out > MAX_MTR_SPEED) out = MAX_MTR_SPEED;
+            if (out < -MAX_MTR_SPEED) out = -MAX_MTR_SPEED;
+
+            w->mtr_speed = nearbyint(out);
+            w->mtr_speed_sum += w->mtr_speed;
+            w->mtr_speed_cnt++;
+            mtr_speed[id] = w->mtr_speed;
+        }
+
+        // send the mtr speeds, if changed
+        if (mtr_speed[0] != last_mtr_speed[0] || mtr_speed[1] != last_mtr_speed[1]) {
+            if (mc_set_speed_all(mtr_speed[0], mtr_speed[1]) == 0) {
+                last_mtr_speed[0] = mtr_speed[0];
+                last_mtr_speed[1] = mtr_speed[1];
+            }
+        }
+
+        loop_timing_end(loop_timing);
+    }
+
+    return NULL;
+}
+
+static void wheel_ctlr_reset(void)
+{
+    for (int id = 0; id < 2; id++) {
+        struct wheel_s *w = &wheel[id];
+        w->ramped_mph = 0;
+        w->integral = 0;
+        w->mtr_speed = 0;
+    }
+}
@@ -1,3 +1,16 @@
+// Notes:
+// - usage: bt [-r record_file | -p replay_file]
+//   -r: record all msgs received from the body to record_file
+//   -p: replay a recorded file, the body is not used
+// - The record file contains a rec_file_hdr_s followed by a rec_hdr_s and
+//   the msg payload for each received msg. Only the used portion of the
+//   msg_t union is written.
+// - In replay mode the recorded msgs are processed by the same
+//   process_msg routine as received msgs; the replay cmds are:
+//     speed <1|10|max>, seek <secs>, pause
+// - The 'plot' cmd displays a scrolling time-series of the encoder speeds,
+//   current and heading, from the status msgs.
+
 // linux hdrs
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,6 +22,8 @@
 #include <pthread.h>
 #include <curses.h>
 #include <signal.h>
+#include <time.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -25,6 +40,17 @@
 
 #define MAX_LOGMSG_STRS 50
 
+#define SCREEN_STATUS       0
+#define SCREEN_LOOP_TIMING  1
+#define SCREEN_PLOT         2
+
+#define REC_FILE_MAGIC    0x43455242   // "BREC"
+#define REC_FILE_VERSION  1
+
+#define REPLAY_SPEED_MAX  0
+
+#define MAX_HIST          2000   // 2 status msgs per sec
+
 // dest must be a char array, and not a char *
 #define safe_strcpy(dest, src) \
     do { \
@@ -32,22 +58,64 @@
         (dest)[sizeof(dest)-1] = '\0'; \
     } while (0)
 
+//
+// typedefs
+//
+
+struct rec_file_hdr_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_time;   // unix time, secs
+};
+
+struct rec_hdr_s {
+    uint64_t time_us;      // relative to the start of the recording
+    uint32_t id;
+    uint32_t len;          // length of the msg payload that follows
+};
+
+typedef struct {
+    int    enc_speed[2];
+    double current;
+    double heading;
+} hist_t;
+
 //
 // variables
 //
 
 static int                 sfd;
 static struct msg_status_s body_status;
+static struct msg_loop_timing_s body_loop_timing;
+static int                 screen = SCREEN_STATUS;
 static char                fatal_err_str[100];
 static bool                sigint;
 static char                logmsg_strs[MAX_LOGMSG_STRS][MAX_LOGMSG_STR_SIZE];
 static int                 logmsg_strs_count;
 
+static hist_t              hist[MAX_HIST];
+static int                 hist_count;
+
+static FILE               *record_fp;
+static uint64_t            record_start_us;
+
+static char               *replay_filename;
+static FILE               *replay_fp;
+static int                 replay_max_rec;
+static long               *replay_rec_offset;
+static uint64_t           *replay_rec_time_us;
+static int                 replay_idx;
+static int                 replay_speed = 1;
+static bool                replay_paused;
+static bool                replay_rebase;
+static double              replay_seek_secs = -1;
+
 //
 // prototypes
 //
 
-static void initialize(void);
+static void initialize(char *record_filename);
+static uint64_t microsec_timer(void);
 static void sig_hndlr(int sig);
 static void blank_line(void);
 static void info(char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
@@ -57,11 +125,25 @@ static int getsockaddr(char * node, int port, struct sockaddr_in * ret_addr);
 static char *sock_addr_to_str(char * s, int slen, struct sockaddr * addr);
 
 static void *msg_receive_thread(void *cx);
+static void process_msg(msg_t *msg);
 static void send_msg(msg_t *msg);
 
+static int msg_payload_len(int id);
+static void record_open(char *filename);
+static void record_msg(msg_t *msg);
+static void replay_open(char *filename);
+static void *replay_thread(void *cx);
+static int replay_read_msg(int idx, msg_t *msg);
+static int replay_find(double secs);
+
 static void update_display(int maxy, int maxx);
+static void update_display_loop_timing(void);
+static void update_display_plot(int maxx);
+static void plot_strip(int row, char *title, double *v0, char ch0, double *v1, char ch1, int n,
+                       bool fixed_range, double min, double max);
 static int input_handler(int input_char);
 static int  process_cmdline(void);
+static int  parse_path(char *str, struct msg_drive_path_s *path);
 static void other_handler(void);
 
 //
@@ -85,8 +167,33 @@ static void curses_runtime(void (*update_display)(int maxy, int maxx), int (*inp
 
 int main(int argc, char **argv)
 {
+    char *record_filename = NULL;
+
+    // parse options
+    while (true) {
+        int ch = getopt(argc, argv, "r:p:");
+        if (ch == -1) {
+            break;
+        }
+        switch (ch) {
+        case 'r':
+            record_filename = optarg;
+            break;
+        case 'p':
+            replay_filename = optarg;
+            break;
+        default:
+            printf("usage: bt [-r record_file | -p replay_file]\n");
+            return 1;
+        }
+    }
+    if (record_filename && replay_filename) {
+        printf("usage: bt [-r record_file | -p replay_file]\n");
+        return 1;
+    }
+
     // initialize
-    initialize();
+    initialize(record_filename);
 
     // invoke the curses user interface
     curses_init();
@@ -103,7 +210,7 @@ int main(int argc, char **argv)
     return 0;
 }
 
-static void initialize(void)
+static void initialize(char *record_filename)
 {
     static struct sockaddr_in  sockaddr;
     char s[110];
@@ -119,6 +226,18 @@ static void initialize(void)
     act.sa_handler = sig_hndlr;
     sigaction(SIGINT, &act, NULL);
 
+    // in replay mode, the msgs are read from the replay file instead of the body
+    if (replay_filename) {
+        replay_open(replay_filename);
+        pthread_create(&tid, NULL, replay_thread, NULL);
+        return;
+    }
+
+    // open the record file
+    if (record_filename) {
+        record_open(record_filename);
+    }
+
     // get sockaddr for body pgm
     if (getsockaddr(NODE, PORT, &sockaddr) < 0) {
         fatal("failed to get address of %s", NODE);
@@ -142,6 +261,14 @@ static void initialize(void)
     pthread_create(&tid, NULL, msg_receive_thread, NULL);
 }
 
+static uint64_t microsec_timer(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 static void sig_hndlr(int sig)
 {
     if (sig == SIGINT) {
@@ -303,32 +430,62 @@ static void *msg_receive_thread(void *cx)
             }
         }
 
-        // process the msg
-        switch (msg.id) {
-        case MSG_ID_STATUS:
-            body_status = msg.status;
-            break;
-        case MSG_ID_LOGMSG:
-            safe_strcpy(logmsg_strs[logmsg_strs_count%MAX_LOGMSG_STRS], msg.logmsg.str);
-            __sync_fetch_and_add(&logmsg_strs_count, 1);
-            break;
-        case MSG_ID_DRIVE_PROC_COMPLETE:
-            break;
-        default:
-            fatal("unsupported msg id %d", msg.id);
-            break;
+        // if recording then write the msg to the record file
+        if (record_fp) {
+            record_msg(&msg);
         }
+
+        // process the msg
+        process_msg(&msg);
     }
 
     return NULL;
 }
 
+// called for both received and replayed msgs
+static void process_msg(msg_t *msg)
+{
+    hist_t *h;
+
+    switch (msg->id) {
+    case MSG_ID_STATUS:
+        body_status = msg->status;
+
+        // save the values displayed by the plot screen
+        h = &hist[hist_count%MAX_HIST];
+        h->enc_speed[0] = msg->status.enc[0].speed;
+        h->enc_speed[1] = msg->status.enc[1].speed;
+        h->current      = msg->status.total_current;
+        h->heading      = msg->status.pose.heading;
+        __sync_fetch_and_add(&hist_count, 1);
+        break;
+    case MSG_ID_LOGMSG:
+        safe_strcpy(logmsg_strs[logmsg_strs_count%MAX_LOGMSG_STRS], msg->logmsg.str);
+        __sync_fetch_and_add(&logmsg_strs_count, 1);
+        break;
+    case MSG_ID_DRIVE_PROC_COMPLETE:
+        break;
+    case MSG_ID_LOOP_TIMING:
+        body_loop_timing = msg->loop_timing;
+        break;
+    default:
+        fatal("unsupported msg id %d", msg->id);
+        break;
+    }
+}
+
 // -----------------  SEND MSG ---------------------------------------------------
 
 static void send_msg(msg_t *msg)
 {
     int rc;
 
+    // in replay mode there is no connection to the body
+    if (replay_filename) {
+        error("not connected to body in replay mode");
+        return;
+    }
+
     // send the msg
     rc = send(sfd, msg, sizeof(msg_t), MSG_NOSIGNAL);   
     if (rc != sizeof(msg_t)) {
@@ -340,6 +497,226 @@ static void send_msg(msg_t *msg)
     }
 }
 
+// -----------------  RECORD & REPLAY  -------------------------------------------
+
+// all msg_t union members start at the same offset
+#define MSG_PAYLOAD_OFFSET  offsetof(msg_t, status)
+#define MSG_PAYLOAD_MAX_LEN (sizeof(msg_t) - MSG_PAYLOAD_OFFSET)
+
+static int msg_payload_len(int id)
+{
+    msg_t *m = NULL;
+
+    switch (id) {
+    case MSG_ID_STATUS:              return sizeof(m->status);
+    case MSG_ID_LOGMSG:              return sizeof(m->logmsg);
+    case MSG_ID_DRIVE_PROC_COMPLETE: return sizeof(m->drive_proc_complete);
+    case MSG_ID_LOOP_TIMING:         return sizeof(m->loop_timing);
+    default:                         return MSG_PAYLOAD_MAX_LEN;
+    }
+}
+
+static void record_open(char *filename)
+{
+    struct rec_file_hdr_s hdr;
+
+    record_fp = fopen(filename, "w");
+    if (record_fp == NULL) {
+        fatal("failed to create %s, %s", filename, strerror(errno));
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = REC_FILE_MAGIC;
+    hdr.version = REC_FILE_VERSION;
+    hdr.start_time = time(NULL);
+    if (fwrite(&hdr, sizeof(hdr), 1, record_fp) != 1) {
+        fatal("failed to write %s, %s", filename, strerror(errno));
+    }
+
+    record_start_us = microsec_timer();
+}
+
+static void record_msg(msg_t *msg)
+{
+    struct rec_hdr_s hdr;
+
+    hdr.time_us = microsec_timer() - record_start_us;
+    hdr.id = msg->id;
+    hdr.len = msg_payload_len(msg->id);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, record_fp) != 1 ||
+        fwrite((char*)msg + MSG_PAYLOAD_OFFSET, hdr.len, 1, record_fp) != 1)
+    {
+        error("failed to write record file, %s", strerror(errno));
+        fclose(record_fp);
+        record_fp = NULL;
+        return;
+    }
+
+    // the status msg is received twice a second; flushing when it is
+    // received limits the msgs lost if bt is killed
+    if (msg->id == MSG_ID_STATUS) {
+        fflush(record_fp);
+    }
+}
+
+// read the replay file, and build an index of the records
+static void replay_open(char *filename)
+{
+    struct rec_file_hdr_s fhdr;
+    struct rec_hdr_s hdr;
+    long offset;
+    int max_alloc = 0;
+
+    replay_fp = fopen(filename, "r");
+    if (replay_fp == NULL) {
+        fatal("failed to open %s, %s", filename, strerror(errno));
+    }
+
+    if (fread(&fhdr, sizeof(fhdr), 1, replay_fp) != 1 ||
+        fhdr.magic != REC_FILE_MAGIC || fhdr.version != REC_FILE_VERSION)
+    {
+        fatal("%s is not a bt record file", filename);
+    }
+
+    // a partial record at the end of the file, from a recording that was
+    // not terminated normally, is ignored
+    while (true) {
+        offset = ftell(replay_fp);
+        if (fread(&hdr, sizeof(hdr), 1, replay_fp) != 1 ||
+            hdr.len > MSG_PAYLOAD_MAX_LEN ||
+            fseek(replay_fp, hdr.len, SEEK_CUR) != 0)
+        {
+            break;
+        }
+
+        if (replay_max_rec == max_alloc) {
+            max_alloc = (max_alloc == 0 ? 10000 : 2 * max_alloc);
+            replay_rec_offset = realloc(replay_rec_offset, max_alloc * sizeof(long));
+            replay_rec_time_us = realloc(replay_rec_time_us, max_alloc * sizeof(uint64_t));
+            if (replay_rec_offset == NULL || replay_rec_time_us == NULL) {
+                fatal("failed to allocate replay index");
+            }
+        }
+        replay_rec_offset[replay_max_rec] = offset;
+        replay_rec_time_us[replay_max_rec] = hdr.time_us;
+        replay_max_rec++;
+    }
+
+    // the last record is checked by reading it, because fseek past eof succeeds
+    if (replay_max_rec > 0) {
+        msg_t msg;
+        if (replay_read_msg(replay_max_rec-1, &msg) < 0) {
+            replay_max_rec--;
+        }
+    }
+
+    if (replay_max_rec == 0) {
+        fatal("%s has no records", filename);
+    }
+
+    info("replaying %s, %d msgs, %0.1f secs",
+         filename, replay_max_rec, replay_rec_time_us[replay_max_rec-1] / 1000000.);
+}
+
+static int replay_read_msg(int idx, msg_t *msg)
+{
+    struct rec_hdr_s hdr;
+
+    memset(msg, 0, sizeof(msg_t));
+    if (fseek(replay_fp, replay_rec_offset[idx], SEEK_SET) != 0 ||
+        fread(&hdr, sizeof(hdr), 1, replay_fp) != 1 ||
+        fread((char*)msg + MSG_PAYLOAD_OFFSET, hdr.len, 1, replay_fp) != 1)
+    {
+        return -1;
+    }
+    msg->id = hdr.id;
+    return 0;
+}
+
+// returns the index of the first record at or after secs
+static int replay_find(double secs)
+{
+    uint64_t time_us = secs * 1000000;
+    int lo = 0, hi = replay_max_rec, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (replay_rec_time_us[mid] < time_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// feeds the recorded msgs to process_msg, paced by their recorded time
+// divided by replay_speed; with REPLAY_SPEED_MAX the msgs are not paced,
+// and the msgs/sec is a throughput test of the display path
+static void *replay_thread(void *cx)
+{
+    msg_t    msg;
+    uint64_t base_real_us = 0, base_rec_us = 0, due_us, time_now;
+    int      base_idx = 0;
+    bool     complete = false;
+
+    replay_rebase = true;
+
+    while (true) {
+        // seek, the plot history is cleared because it would
+        // no longer be contiguous
+        if (replay_seek_secs >= 0) {
+            replay_idx = replay_find(replay_seek_secs);
+            replay_seek_secs = -1;
+            hist_count = 0;
+            replay_rebase = true;
+            complete = false;
+        }
+
+        // when paused or at the end of the replay file, wait for a cmd
+        if (replay_idx >= replay_max_rec && !complete) {
+            double secs = (microsec_timer() - base_real_us) / 1000000.;
+            info("replay complete, %d msgs in %0.3f secs, %0.0f msgs/sec",
+                 replay_idx - base_idx, secs, (replay_idx - base_idx) / secs);
+            complete = true;
+        }
+        if (replay_paused || replay_idx >= replay_max_rec) {
+            replay_rebase = true;
+            usleep(100000);
+            continue;
+        }
+
+        // the pacing is restarted after a seek, pause, or speed change
+        if (replay_rebase) {
+            replay_rebase = false;
+            base_real_us = microsec_timer();
+            base_rec_us = replay_rec_time_us[replay_idx];
+            base_idx = replay_idx;
+        }
+
+        // wait until the msg is due, in increments of no more than 100 ms so
+        // that cmds are acted on promptly
+        if (replay_speed != REPLAY_SPEED_MAX) {
+            due_us = base_real_us + (replay_rec_time_us[replay_idx] - base_rec_us) / replay_speed;
+            time_now = microsec_timer();
+            if (due_us > time_now) {
+                usleep(due_us - time_now < 100000 ? due_us - time_now : 100000);
+                continue;
+            }
+        }
+
+        // process the msg
+        if (replay_read_msg(replay_idx, &msg) < 0) {
+            fatal("failed to read replay msg %d", replay_idx);
+        }
+        process_msg(&msg);
+        replay_idx++;
+    }
+
+    return NULL;
+}
+
 // -----------------  CURSES WRAPPER CALLBACKS  ----------------------------
 
 static char cmdline[100];
@@ -351,6 +728,16 @@ static void update_display(int maxy, int maxx)
 
     static int last_accel_alert_count = -1;
 
+    // the loop timing and plot screens replace rows 0-17
+    if (screen == SCREEN_LOOP_TIMING) {
+        update_display_loop_timing();
+        goto display_logmsgs;
+    }
+    if (screen == SCREEN_PLOT) {
+        update_display_plot(maxx);
+        goto display_logmsgs;
+    }
+
     // display voltage and current
     // row 0
     mvprintw(0, 0,
@@ -363,8 +750,10 @@ static void update_display(int maxy, int maxx)
     // display motor ctlr values
     // rows 2-5
     mvprintw(2, 0,
-             "MOTORS: %s   EncPollIntvlUs=%d",
-            x->mc_state_str, x->enc_poll_intvl_us);
+             "MOTORS: %s   EncPollIntvlUs=%d  SpeedCmdLatUs=%d max=%d  EStopLatUs=%d max=%d cnt=%d",
+            x->mc_state_str, x->enc_poll_intvl_us,
+            x->mc_speed_cmd_latency_us, x->mc_speed_cmd_latency_max_us,
+            x->mc_emer_stop_latency_us, x->mc_emer_stop_latency_max_us, x->mc_emer_stop_count);
     if (x->mc_debug_mode_enabled) {
         mvprintw(3,0, 
              "      Target   Ena Position Speed Errors   ErrStat Target Current Accel Voltage Current");
@@ -434,6 +823,18 @@ static void update_display(int maxy, int maxx)
     }
     last_accel_alert_count = x->accel_alert_count;
 
+    // display pose values
+    // row 12
+    mvprintw(12, 0,
+        "POSE: X=%0.2f  Y=%0.2f  Heading=%3.0f  Speed=%0.2f  RotRate=%0.0f  CalConf=%0.2f (%d)",
+        x->pose.x,
+        x->pose.y,
+        x->pose.heading,
+        x->pose.speed,
+        x->pose.rotation_rate,
+        x->drive_cal_confidence,
+        x->drive_cal_updates);
+
     // display ENV values
     // row 13
     mvprintw(13, 0, 
@@ -457,6 +858,7 @@ static void update_display(int maxy, int maxx)
 
     // display the logfile msgs
     // rows 19..maxy-5
+display_logmsgs:
     int num_rows = (maxy-5) - 19 + 1;
     int rcvd_count = logmsg_strs_count;
     for (int i = 0; i < num_rows; i++) {
@@ -479,10 +881,132 @@ static void update_display(int maxy, int maxx)
         }
     }
 
+    // display replay position, or the record file
+    if (replay_filename) {
+        int idx = (replay_idx < replay_max_rec ? replay_idx : replay_max_rec-1);
+        mvprintw(maxy-3, 0, "REPLAY: %s  %0.1f / %0.1f secs  speed=%s%s",
+                 replay_filename,
+                 replay_rec_time_us[idx] / 1000000.,
+                 replay_rec_time_us[replay_max_rec-1] / 1000000.,
+                 (replay_speed == REPLAY_SPEED_MAX ? "max" : replay_speed == 1 ? "1x" : "10x"),
+                 (replay_paused ? "  PAUSED" : ""));
+    } else if (record_fp) {
+        mvprintw(maxy-3, 0, "RECORDING: %0.1f secs",
+                 (microsec_timer() - record_start_us) / 1000000.);
+    }
+
     // display cmdline
     mvprintw(maxy-1, 0, "> %s", cmdline);
 }
 
+#define PLOT_ROWS  5
+#define PLOT_COL   10
+
+static void update_display_plot(int maxx)
+{
+    static double v0[MAX_HIST], v1[MAX_HIST];
+    char title[100];
+    int count, n, i;
+    hist_t *h;
+
+    // the newest sample is in the rightmost column
+    count = hist_count;
+    n = (count < MAX_HIST ? count : MAX_HIST);
+    if (n > maxx - PLOT_COL) {
+        n = maxx - PLOT_COL;
+    }
+    if (n <= 0) {
+        mvprintw(0, 0, "PLOT: no status msgs");
+        return;
+    }
+    h = &hist[(count-1)%MAX_HIST];
+
+    // rows 0-5
+    for (i = 0; i < n; i++) {
+        v0[i] = hist[(count-n+i)%MAX_HIST].enc_speed[0];
+        v1[i] = hist[(count-n+i)%MAX_HIST].enc_speed[1];
+    }
+    sprintf(title, "ENCODER SPEED (counts/sec):  L=%d  R=%d", h->enc_speed[0], h->enc_speed[1]);
+    plot_strip(0, title, v0, 'L', v1, 'R', n, false, 0, 0);
+
+    // rows 6-11
+    for (i = 0; i < n; i++) {
+        v0[i] = hist[(count-n+i)%MAX_HIST].current;
+    }
+    sprintf(title, "CURRENT (amps):  %0.2f", h->current);
+    plot_strip(6, title, v0, '*', NULL, 0, n, false, 0, 0);
+
+    // rows 12-17
+    for (i = 0; i < n; i++) {
+        v0[i] = hist[(count-n+i)%MAX_HIST].heading;
+    }
+    sprintf(title, "HEADING (degrees):  %0.0f", h->heading);
+    plot_strip(12, title, v0, '*', NULL, 0, n, true, 0, 360);
+}
+
+// plots one or two series in the PLOT_ROWS rows following the title row;
+// the range is the min and max of the series, unless fixed_range is set
+static void plot_strip(int row, char *title, double *v0, char ch0, double *v1, char ch1, int n,
+                       bool fixed_range, double min, double max)
+{
+    int i, r;
+
+    if (!fixed_range) {
+        min = max = v0[0];
+        for (i = 0; i < n; i++) {
+            if (v0[i] < min) min = v0[i];
+            if (v0[i] > max) max = v0[i];
+            if (v1 && v1[i] < min) min = v1[i];
+            if (v1 && v1[i] > max) max = v1[i];
+        }
+        if (max - min < 1e-3) {
+            min -= 1;
+            max += 1;
+        }
+    }
+
+    mvprintw(row, 0, "%s", title);
+    mvprintw(row+1, 0, "%8.2f", max);
+    mvprintw(row+PLOT_ROWS, 0, "%8.2f", min);
+
+    #define PLOT_ROW(v) \
+        (r = row + PLOT_ROWS - (int)(((v) - min) / (max - min) * (PLOT_ROWS-1) + 0.5), \
+         (r < row+1 ? row+1 : r > row+PLOT_ROWS ? row+PLOT_ROWS : r))
+
+    for (i = 0; i < n; i++) {
+        mvaddch(PLOT_ROW(v0[i]), PLOT_COL+i, ch0);
+        if (v1) {
+            mvaddch(PLOT_ROW(v1[i]), PLOT_COL+i, ch1);
+        }
+    }
+}
+
+static void update_display_loop_timing(void)
+{
+    struct msg_loop_timing_s *x = &body_loop_timing;
+    int i;
+
+    // row 0
+    mvprintw(0, 0,
+             "LOOP TIMING (us)     Expect Count  Late   Period: p50    p99  p99.9    max   Work: p99  p99.9    max");
+
+    // rows 1-17; the loops with late periods are displayed in red
+    for (i = 0; i < x->max_loop && i < 17; i++) {
+        typeof(x->loop[0]) *l = &x->loop[i];
+        if (l->late_count) {
+            attron(COLOR_PAIR(COLOR_PAIR_RED));
+        }
+        mvprintw(1+i, 0,
+                 "  %-16s %8d %5d %5d  %13d %6d %6d %6d  %11d %6d %6d",
+                 l->name, l->expected_period_us, l->period_count, l->late_count,
+                 l->period_p50_us, l->period_p99_us, l->period_p999_us, l->period_max_us,
+                 l->work_p99_us, l->work_p999_us, l->work_max_us);
+        if (l->late_count) {
+            attroff(COLOR_PAIR(COLOR_PAIR_RED));
+        }
+    }
+}
+
 static int input_handler(int input_char)
 {
     // process input_char
@@ -538,9 +1062,36 @@ static int process_cmdline(void)
         msg.id = MSG_ID_MC_DEBUG_CTL;
         msg.mc_debug_ctl.enable = arg[0];
         send_msg(&msg);
+    } else if (strcmp(cmd, "timing") == 0) {
+        // toggle between the status and loop timing screens
+        screen = (screen != SCREEN_LOOP_TIMING ? SCREEN_LOOP_TIMING : SCREEN_STATUS);
+    } else if (strcmp(cmd, "plot") == 0) {
+        // toggle between the status and plot screens
+        screen = (screen != SCREEN_PLOT ? SCREEN_PLOT : SCREEN_STATUS);
+    } else if (strcmp(cmd, "speed") == 0 && replay_filename) {
+        // speed <1|10|max> - max, or any other arg, replays without pacing
+        replay_speed = (arg[0] == 1 || arg[0] == 10 ? arg[0] : REPLAY_SPEED_MAX);
+        replay_rebase = true;
+    } else if (strcmp(cmd, "seek") == 0 && replay_filename) {
+        // seek <secs> - relative to the start of the recording
+        replay_seek_secs = (arg[0] > 0 ? arg[0] : 0);
+    } else if (strcmp(cmd, "pause") == 0 && replay_filename) {
+        replay_paused = !replay_paused;
     } else if (strcmp(cmd, "log_mark") == 0) {
         msg.id = MSG_ID_LOG_MARK;
         send_msg(&msg);
+    } else if (strcmp(cmd, "flight_rec") == 0) {
+        msg.id = MSG_ID_FLIGHT_REC_DUMP;
+        send_msg(&msg);
+    } else if (strcmp(cmd, "path") == 0) {
+        // path <seg> ... - where seg is l:feet[:mph], a:degrees:radius_feet[:mph], or r:degrees[:mph]
+        msg.id = MSG_ID_DRIVE_PATH;
+        msg.drive_path.unique_id = ++unique_id;
+        if (parse_path(cmdline+strlen(cmd), &msg.drive_path) < 0) {
+            error("invalid path: %s", cmdline);
+        } else {
+            send_msg(&msg);
+        }
     } else if ( (strcmp(cmd, "scal") == 0 && (proc_id = DRIVE_SCAL))  ||
                 (strcmp(cmd, "mcal") == 0 && (proc_id = DRIVE_MCAL))  ||
                 (strcmp(cmd, "fwd")  == 0 && (proc_id = DRIVE_FWD))  ||
@@ -548,6 +1099,9 @@ static int process_cmdline(void)
                 (strcmp(cmd, "rot")  == 0 && (proc_id = DRIVE_ROT))  ||
                 (strcmp(cmd, "hdg")  == 0 && (proc_id = DRIVE_HDG))  ||
                 (strcmp(cmd, "rad")  == 0 && (proc_id = DRIVE_RAD))  ||
+                (strcmp(cmd, "goto") == 0 && (proc_id = DRIVE_GOTO)) ||
+                (strcmp(cmd, "home") == 0 && (proc_id = DRIVE_HOME)) ||
+                (strcmp(cmd, "orig") == 0 && (proc_id = DRIVE_ORIG)) ||
                 (strcmp(cmd, "tst1") == 0 && (proc_id = DRIVE_TST1)) ||
                 (strcmp(cmd, "tst2") == 0 && (proc_id = DRIVE_TST2)) ||
                 (strcmp(cmd, "tst3") == 0 && (proc_id = DRIVE_TST3)) ||
@@ -574,6 +1128,47 @@ static int process_cmdline(void)
     return 0;
 }
 
+static int parse_path(char *str, struct msg_drive_path_s *path)
+{
+    char   s[200], *tok, *saveptr, type;
+    double v[3];
+    int    n;
+
+    safe_strcpy(s, str);
+    path->max_seg = 0;
+
+    for (tok = strtok_r(s, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr)) {
+        struct drive_path_seg_s *seg = &path->seg[path->max_seg];
+
+        if (path->max_seg == MAX_DRIVE_PATH_SEG) {
+            return -1;
+        }
+        memset(v, 0, sizeof(v));
+        n = sscanf(tok, "%c:%lf:%lf:%lf", &type, &v[0], &v[1], &v[2]);
+
+        memset(seg, 0, sizeof(*seg));
+        if (type == 'l' && (n == 2 || n == 3)) {
+            seg->type = DRIVE_PATH_LINE;
+            seg->arg[0] = v[0];
+            seg->mph = v[1];
+        } else if (type == 'a' && (n == 3 || n == 4)) {
+            seg->type = DRIVE_PATH_ARC;
+            seg->arg[0] = v[0];
+            seg->arg[1] = v[1];
+            seg->mph = v[2];
+        } else if (type == 'r' && (n == 2 || n == 3)) {
+            seg->type = DRIVE_PATH_ROTATE;
+            seg->arg[0] = v[0];
+            seg->mph = v[1];
+        } else {
+            return -1;
+        }
+        path->max_seg++;
+    }
+
+    return path->max_seg > 0 ? 0 : -1;
+}
+
 static void other_handler(void)
 {
     static msg_t msg = {MSG_ID_DRIVE_EMER_STOP};
@@ -29,10 +29,32 @@
         } \
     } while (0)
 
+#define MAX_DRIVE_REQ          16
+#define DRIVE_REQ_ACK_TIMEOUT  (1*SECONDS)
+
+#define REQ_QUEUED    1
+#define REQ_SENT      2
+#define REQ_COMPLETE  3
+
 #define GPIO_BODY_POWER  12
 #define BODY_ON  1
 #define BODY_OFF 0
 
+//
+// typedefs
+//
+
+struct drive_req_s {
+    int      handle;        // 0 when the entry is free
+    int      state;
+    msg_t    msg;
+    uint64_t deadline_us;   // 0 for no timeout
+    bool     stopping;      // emergency stop sent, waiting for acknowledgement
+    bool     succ;
+    char     stop_reason[MAX_DRIVE_PROC_COMPLETE_REASON_STR_SIZE];
+    char     failure_reason[MAX_DRIVE_PROC_COMPLETE_REASON_STR_SIZE];
+};
+
 //
 // variables
 //
@@ -41,13 +63,14 @@ static pthread_mutex_t              mutex;
 
 static int                          conn_sfd = -1;
 static struct msg_status_s          status;
-static struct drive_proc_complete_s drive_proc_complete;
-static bool                         body_emer_stop_called;
+static pthread_cond_t               req_cond;
+static struct drive_req_s           drive_req_tbl[MAX_DRIVE_REQ];
 
 static uint64_t                     power_on_time;
 static uint64_t                     conn_time;
 static uint64_t                     status_msg_time;
 static uint64_t                     drive_cmd_time;
+static int                          drive_unique_id;
 
 //
 // prototypes
@@ -55,6 +78,18 @@ static uint64_t                     drive_cmd_time;
 
 static void exit_handler(void);
 
+static int drive_req_wait_and_report(int handle);
+static int drive_req_submit(msg_t *msg, int timeout_secs);
+static struct drive_req_s *drive_req_find(int handle);
+static void drive_req_dispatch(void);
+static void drive_req_complete(struct drive_req_s *r, bool succ, char *failure_reason);
+static void drive_req_stop(struct drive_req_s *r, char *reason);
+static void drive_req_send_emer_stop(void);
+static uint64_t drive_req_next_deadline(void);
+static void drive_req_check_timeouts(void);
+static void drive_req_proc_complete(struct drive_proc_complete_s *dpc);
+static void drive_req_disconnected(void);
+
 static void *connect_and_recv_thread(void *cx);
 static int connect_to_body(void);
 static void disconnect_from_body(void);
@@ -69,12 +104,20 @@ void body_init(void)
 {
     pthread_t tid;
     pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
 
     pthread_mutexattr_init(&mutex_attr);
     pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(&mutex, &mutex_attr);
     pthread_mutexattr_destroy(&mutex_attr);
 
+    // the drive request deadlines are microsec_timer times, which use
+    // CLOCK_MONOTONIC, so req_cond's timed waits must use that clock too
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&req_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
     pthread_create(&tid, NULL, connect_and_recv_thread, NULL);
     pthread_create(&tid, NULL, monitor_thread, NULL);
 
@@ -88,116 +131,439 @@ static void exit_handler(void)
 
 // -----------------  API  ---------------------------------------
 
+// - - - - - - - - -  SYNCHRONOUS DRIVE CMDS  - - - - - - - - - - - -
+
 int body_drive_cmd(int proc_id, int arg0, int arg1, int arg2, int arg3)
 {
-    static int unique_id;
-    msg_t msg;
-    bool succ;
+    int handle;
 
-    // acquire mutex
-    MUTEX_LOCK;
+    handle = body_drive_cmd_submit(proc_id, arg0, arg1, arg2, arg3, 0);
+    return drive_req_wait_and_report(handle);
+}
 
-    // if not connected to body return error
-    if (conn_sfd == -1) {
-        MUTEX_UNLOCK;
-        t2s_play("brain is not connected to body");
+// upload a path of line, arc and rotate segments, which the body
+// drives without stopping between segments
+int body_drive_path(int max_seg, struct drive_path_seg_s *seg)
+{
+    int handle;
+
+    if (max_seg <= 0 || max_seg > MAX_DRIVE_PATH_SEG) {
+        t2s_play("invalid path");
         return -1;
     }
 
-    // clear body_emer_stop_called flag; this flag will be
-    // set if body_emer_stop is called while processing this drive command
-    body_emer_stop_called = false;
+    handle = body_drive_path_submit(max_seg, seg, 0);
+    return drive_req_wait_and_report(handle);
+}
+
+// wait for the request to complete, and play the failure reason
+static int drive_req_wait_and_report(int handle)
+{
+    char failure_reason[MAX_DRIVE_PROC_COMPLETE_REASON_STR_SIZE];
+
+    if (handle < 0) {
+        t2s_play("too many drive requests");
+        return -1;
+    }
+
+    if (body_req_wait(handle, failure_reason, sizeof(failure_reason)) < 0) {
+        t2s_play("%s", failure_reason);
+        return -1;
+    }
 
-    // send the body drive request
+    return 0;
+}
+
+// - - - - - - - - -  ASYNCHRONOUS DRIVE REQUESTS  - - - - - - - - - -
+
+// Notes:
+// - The body runs one drive proc at a time, so the requests are queued
+//   and sent to the body in the order submitted. The next request is sent
+//   by the connect_and_recv_thread when the previous request's
+//   drive_proc_complete msg is received, so chained requests run without
+//   a gap.
+// - The submit routines return a handle, or -1 if the drive_req_tbl is
+//   full. Any failure, including not being connected, is reported by
+//   body_req_wait. A completed entry is freed by body_req_wait, or reused
+//   by a later submit when the table is full.
+// - The drive_req_tbl is protected by mutex, and completions are signalled
+//   with req_cond. The mutex is recursive, so body_req_wait must not be
+//   called with the mutex locked.
+// - A timeout, cancel or body_emer_stop of the running request sends an
+//   emergency stop to the body; the request then completes when the body
+//   acknowledges with the drive_proc_complete msg, or after
+//   DRIVE_REQ_ACK_TIMEOUT.
+
+int body_drive_cmd_submit(int proc_id, int arg0, int arg1, int arg2, int arg3, int timeout_secs)
+{
+    msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
     msg.id = MSG_ID_DRIVE_PROC;
-    msg.drive_proc.proc_id = proc_id;;
-    msg.drive_proc.unique_id = ++unique_id;
+    msg.drive_proc.proc_id = proc_id;
     msg.drive_proc.arg[0] = arg0;
     msg.drive_proc.arg[1] = arg1;
     msg.drive_proc.arg[2] = arg2;
     msg.drive_proc.arg[3] = arg3;
 
-    SEND_MSG(&msg, succ);
-    if (!succ) {
+    return drive_req_submit(&msg, timeout_secs);
+}
+
+int body_drive_path_submit(int max_seg, struct drive_path_seg_s *seg, int timeout_secs)
+{
+    msg_t msg;
+
+    if (max_seg <= 0 || max_seg > MAX_DRIVE_PATH_SEG) {
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.id = MSG_ID_DRIVE_PATH;
+    msg.drive_path.max_seg = max_seg;
+    memcpy(msg.drive_path.seg, seg, max_seg * sizeof(struct drive_path_seg_s));
+
+    return drive_req_submit(&msg, timeout_secs);
+}
+
+// returns 0 if the request succeeded, else -1 and the failure_reason;
+// the request's entry is freed
+int body_req_wait(int handle, char *failure_reason, int failure_reason_len)
+{
+    struct drive_req_s *r;
+    struct timespec ts;
+    uint64_t deadline_us;
+    int rc;
+
+    MUTEX_LOCK;
+
+    r = drive_req_find(handle);
+    if (r == NULL) {
         MUTEX_UNLOCK;
-        t2s_play("failed to send message to body");
+        snprintf(failure_reason, failure_reason_len, "invalid drive request");
         return -1;
     }
 
-    // keep track of the last body drive time; so that body can be powered off
-    // if the body has not been driven in some time
-    drive_cmd_time = microsec_timer();
+    while (r->state != REQ_COMPLETE) {
+        // the timeouts are also checked by the monitor_thread, but
+        // the waiter checks them at the deadline for better resolution
+        deadline_us = drive_req_next_deadline();
+        if (deadline_us == 0) {
+            pthread_cond_wait(&req_cond, &mutex);
+        } else {
+            ts.tv_sec  = deadline_us / SECONDS;
+            ts.tv_nsec = (deadline_us % SECONDS) * 1000;
+            pthread_cond_timedwait(&req_cond, &mutex, &ts);
+            drive_req_check_timeouts();
+        }
+    }
+
+    rc = r->succ ? 0 : -1;
+    if (!r->succ) {
+        snprintf(failure_reason, failure_reason_len, "%s", r->failure_reason);
+    }
+    r->handle = 0;
 
-    // release mutex
     MUTEX_UNLOCK;
 
-    // wait for response to be received or abnormal completion
-    while (drive_proc_complete.unique_id != unique_id && 
-           conn_sfd != -1 &&
-           body_emer_stop_called == false)
-    {
-        usleep(10*MS);
+    return rc;
+}
+
+bool body_req_is_complete(int handle)
+{
+    struct drive_req_s *r;
+    bool complete;
+
+    MUTEX_LOCK;
+    r = drive_req_find(handle);
+    complete = (r == NULL || r->state == REQ_COMPLETE);
+    MUTEX_UNLOCK;
+
+    return complete;
+}
+
+// a queued request is completed immediately; a running request
+// is stopped, and completes when the body acknowledges the stop
+void body_req_cancel(int handle)
+{
+    struct drive_req_s *r;
+
+    MUTEX_LOCK;
+    r = drive_req_find(handle);
+    if (r != NULL) {
+        if (r->state == REQ_QUEUED) {
+            drive_req_complete(r, false, "drive request was canceled");
+        } else if (r->state == REQ_SENT) {
+            drive_req_stop(r, "drive request was canceled");
+        }
     }
+    MUTEX_UNLOCK;
+}
 
-    // reached here because one of these:
-    // - received a response from body
-    // - lost connection to body
-    // - body_emer_stop has been called
+void body_emer_stop(void)
+{
+    struct drive_req_s *r;
+    bool stop_sent = false;
 
-    // handle the completion possibilities
-    if (drive_proc_complete.unique_id == unique_id) {
-        if (drive_proc_complete.succ) {
-            return 0;
-        } else {
-            t2s_play("%s", drive_proc_complete.failure_reason);
+    // complete the queued requests, so that they are not sent after the
+    // emergency stop, and stop the running request; stopping the running
+    // request sends the emergency stop
+    MUTEX_LOCK;
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle == 0) {
+            continue;
+        }
+        if (r->state == REQ_QUEUED) {
+            drive_req_complete(r, false, "emergency stop");
+        } else if (r->state == REQ_SENT) {
+            drive_req_stop(r, NULL);
+            stop_sent = true;
+        }
+    }
+
+    // send the emergency stop, even if no request is running
+    if (!stop_sent) {
+        drive_req_send_emer_stop();
+    }
+    MUTEX_UNLOCK;
+}
+
+static int drive_req_submit(msg_t *msg, int timeout_secs)
+{
+    struct drive_req_s *r, *oldest = NULL;
+    int handle;
+
+    MUTEX_LOCK;
+
+    // find a free entry, or else reuse the oldest completed entry
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle == 0) {
+            break;
+        }
+        if (r->state == REQ_COMPLETE && (oldest == NULL || r->handle < oldest->handle)) {
+            oldest = r;
+        }
+    }
+    if (r == drive_req_tbl + MAX_DRIVE_REQ) {
+        if (oldest == NULL) {
+            MUTEX_UNLOCK;
+            ERROR("drive_req_tbl is full\n");
             return -1;
         }
-    } else if (conn_sfd == -1) {
-        t2s_play("lost connection to body");
-        return -1;
+        r = oldest;
+    }
+
+    // the handle is the unique_id of the drive msg
+    handle = __sync_add_and_fetch(&drive_unique_id, 1);
+    if (msg->id == MSG_ID_DRIVE_PROC) {
+        msg->drive_proc.unique_id = handle;
     } else {
-        // must be body_emer_stop was called ...
-        //
-        // there should be a drive_proc_complete received as a result of the emer stop;
-        // give one second to receive it
-        int cnt = 0;
-        while (drive_proc_complete.unique_id != unique_id && cnt++ < 100) {
-            usleep(10*MS);
+        msg->drive_path.unique_id = handle;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->handle = handle;
+    r->state = REQ_QUEUED;
+    r->msg = *msg;
+    r->deadline_us = (timeout_secs > 0 ? microsec_timer() + timeout_secs * (uint64_t)SECONDS : 0);
+
+    // send the request, if no other request is running
+    drive_req_dispatch();
+
+    MUTEX_UNLOCK;
+
+    return handle;
+}
+
+// the following drive_req routines are called with mutex locked
+
+static struct drive_req_s *drive_req_find(int handle)
+{
+    struct drive_req_s *r;
+
+    if (handle <= 0) {
+        return NULL;
+    }
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle == handle) {
+            return r;
         }
+    }
+    return NULL;
+}
+
+// send the oldest queued request, if no request is running
+static void drive_req_dispatch(void)
+{
+    struct drive_req_s *r, *next;
+    bool succ;
 
-        // if the drive_proc_complete was received then return completion status
-        // from it, otherwise return error that the emergency stop acknowledgement was
-        // not received
-        if (drive_proc_complete.unique_id == unique_id) {
-            if (drive_proc_complete.succ) {
-                return 0;
-            } else {
-                t2s_play(drive_proc_complete.failure_reason);
-                return -1;
+    while (true) {
+        next = NULL;
+        for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+            if (r->handle == 0) {
+                continue;
+            }
+            if (r->state == REQ_SENT) {
+                return;
+            }
+            if (r->state == REQ_QUEUED && (next == NULL || r->handle < next->handle)) {
+                next = r;
             }
-        } else {
-            t2s_play("did not receive emergency stop acknowledgement from body");
-            return -1;
         }
+        if (next == NULL) {
+            return;
+        }
+
+        MUTEX_LOCK;
+        if (conn_sfd == -1) {
+            MUTEX_UNLOCK;
+            drive_req_complete(next, false, "brain is not connected to body");
+            continue;
+        }
+        SEND_MSG(&next->msg, succ);
+        if (succ) {
+            // keep track of the last body drive time; so that body can be powered off
+            // if the body has not been driven in some time
+            drive_cmd_time = microsec_timer();
+        }
+        MUTEX_UNLOCK;
+
+        if (!succ) {
+            drive_req_complete(next, false, "failed to send message to body");
+            continue;
+        }
+        next->state = REQ_SENT;
+        return;
     }
+}
 
-    // should not get here
-    assert(0);
+static void drive_req_complete(struct drive_req_s *r, bool succ, char *failure_reason)
+{
+    r->state = REQ_COMPLETE;
+    r->succ = succ;
+    snprintf(r->failure_reason, sizeof(r->failure_reason), "%s", succ ? "" : failure_reason);
+    pthread_cond_broadcast(&req_cond);
 }
 
-void body_emer_stop(void)
+// stop the running request; the failure reason is the reason from the body's
+// acknowledgement if the reason arg is NULL
+static void drive_req_stop(struct drive_req_s *r, char *reason)
+{
+    if (r->stopping) {
+        return;
+    }
+
+    r->stopping = true;
+    if (reason != NULL) {
+        snprintf(r->stop_reason, sizeof(r->stop_reason), "%s", reason);
+    }
+    r->deadline_us = microsec_timer() + DRIVE_REQ_ACK_TIMEOUT;
+    pthread_cond_broadcast(&req_cond);
+
+    drive_req_send_emer_stop();
+}
+
+static void drive_req_send_emer_stop(void)
 {
     msg_t msg;
     bool succ __attribute__((unused));
 
+    memset(&msg, 0, sizeof(msg));
+    msg.id = MSG_ID_DRIVE_EMER_STOP;
+
     MUTEX_LOCK;
+    SEND_MSG(&msg, succ);
+    MUTEX_UNLOCK;
+}
 
-    body_emer_stop_called = true;
+// returns the earliest deadline of the requests that are not complete, or 0
+static uint64_t drive_req_next_deadline(void)
+{
+    struct drive_req_s *r;
+    uint64_t deadline_us = 0;
+
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle != 0 && r->state != REQ_COMPLETE && r->deadline_us != 0 &&
+            (deadline_us == 0 || r->deadline_us < deadline_us))
+        {
+            deadline_us = r->deadline_us;
+        }
+    }
+    return deadline_us;
+}
 
-    msg.id = MSG_ID_DRIVE_EMER_STOP;
+static void drive_req_check_timeouts(void)
+{
+    struct drive_req_s *r;
+    uint64_t time_now = microsec_timer();
+
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle == 0 || r->state == REQ_COMPLETE ||
+            r->deadline_us == 0 || time_now < r->deadline_us)
+        {
+            continue;
+        }
+
+        if (r->state == REQ_QUEUED) {
+            drive_req_complete(r, false, "drive request timed out");
+        } else if (!r->stopping) {
+            drive_req_stop(r, "drive request timed out");
+        } else {
+            drive_req_complete(r, false, "did not receive emergency stop acknowledgement from body");
+        }
+    }
+
+    drive_req_dispatch();
+}
+
+// called by the connect_and_recv_thread when the drive_proc_complete msg is received
+static void drive_req_proc_complete(struct drive_proc_complete_s *dpc)
+{
+    struct drive_req_s *r;
+
+    MUTEX_LOCK;
+
+    r = drive_req_find(dpc->unique_id);
+    if (r != NULL && r->state == REQ_SENT) {
+        drive_req_complete(r, dpc->succ,
+                           r->stop_reason[0] != '\0' ? r->stop_reason : dpc->failure_reason);
+    }
+    drive_req_dispatch();
+
+    MUTEX_UNLOCK;
+}
+
+// called when the connection to the body is lost
+static void drive_req_disconnected(void)
+{
+    struct drive_req_s *r;
+
+    MUTEX_LOCK;
+    for (r = drive_req_tbl; r < drive_req_tbl + MAX_DRIVE_REQ; r++) {
+        if (r->handle != 0 && r->state != REQ_COMPLETE) {
+            drive_req_complete(r, false, "lost connection to body");
+        }
+    }
+    MUTEX_UNLOCK;
+}
+
+// - - - - - - - - -  OTHER API ROUTINES  - - - - - - - - - - - - - -
+
+// the body writes the flight recorder window around this time to a dump file
+int body_flight_rec_dump(void)
+{
+    msg_t msg;
+    bool succ;
+
+    MUTEX_LOCK;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.id = MSG_ID_FLIGHT_REC_DUMP;
     SEND_MSG(&msg, succ);
 
     MUTEX_UNLOCK;
+
+    return succ ? 0 : -1;
 }
 
 void body_power_on(void)
@@ -232,41 +598,57 @@ void body_power_off(void)
     t2s_play("body power is off");
 }
 
+// returns -1 if a recent status msg has not been received from the body
+int body_get_status(struct msg_status_s *s)
+{
+    int rc = -1;
+
+    MUTEX_LOCK;
+    if (conn_sfd != -1 && status_msg_time != 0 && microsec_timer() - status_msg_time <= 5*SECONDS) {
+        *s = status;
+        rc = 0;
+    }
+    MUTEX_UNLOCK;
+
+    return rc;
+}
+
 void body_status_report(char *request)
 {
+    struct msg_status_s s;
+
     if (power_on_time == 0) {
         t2s_play("Bbody is off.");
     } else if (conn_sfd == -1) {
         t2s_play("Brain is not connected to body.");
-    } else if (status_msg_time == 0 || microsec_timer() - status_msg_time > 5*SECONDS) {
+    } else if (body_get_status(&s) < 0) {
         t2s_play("Status message has not been received from the body.");
     } else {
-        double voltage = status.voltage;
-        double total_current = status.total_current;
-        double mag_heading = status.mag_heading;
         if (strmatch(request, "status", "voltage", NULL)) {
-            t2s_play_nocache("Voltage is %0.2f volts", voltage);
+            t2s_play_nocache("Voltage is %0.2f volts", s.voltage);
         }
         if (strmatch(request, "status", "current", NULL)) {
-            t2s_play_nocache("Current is %0.0f milliamps", 1000*total_current);
+            t2s_play_nocache("Current is %0.0f milliamps", 1000*s.total_current);
         }
         if (strmatch(request, "status", "compass heading", NULL)) {
-            t2s_play_nocache("Compass heading is %0.0f degrees", mag_heading);
+            t2s_play_nocache("Compass heading is %0.0f degrees", s.mag_heading);
         }
     }
 }
 
 void body_weather_report(void)
 {
+    struct msg_status_s s;
+
     if (power_on_time == 0) {
         t2s_play("Body is off.");
     } else if (conn_sfd == -1) {
         t2s_play("Brain is not connected to body.");
-    } else if (status_msg_time == 0 || microsec_timer() - status_msg_time > 5*SECONDS) {
+    } else if (body_get_status(&s) < 0) {
         t2s_play("Status message has not been received from the body.");
     } else {
-        t2s_play("Temperature is %0.0f degrees", status.temperature_degf);
-        t2s_play("Pressure is %0.1f inches of mercury", status.pressure_inhg);
+        t2s_play("Temperature is %0.0f degrees", s.temperature_degf);
+        t2s_play("Pressure is %0.1f inches of mercury", s.pressure_inhg);
     }
 }
 
@@ -372,6 +754,9 @@ static void disconnect_from_body(void)
     status_msg_time = 0;
     drive_cmd_time = 0;
 
+    // complete the pending drive requests
+    drive_req_disconnected();
+
     // unlock mutex
     MUTEX_UNLOCK;
 
@@ -406,7 +791,8 @@ try_again:
     // validate the msg->id
     if (msg->id != MSG_ID_STATUS &&
         msg->id != MSG_ID_LOGMSG &&
-        msg->id != MSG_ID_DRIVE_PROC_COMPLETE)
+        msg->id != MSG_ID_DRIVE_PROC_COMPLETE &&
+        msg->id != MSG_ID_LOOP_TIMING)
     {
         ERROR("invalid msg id 0x%x\n", msg->id);
         return -1;
@@ -420,17 +806,22 @@ static void process_recvd_msg(msg_t *msg)
 {
     switch (msg->id) {
     case MSG_ID_STATUS:
+        MUTEX_LOCK;
         status = msg->status;
         if (status_msg_time == 0) {
             t2s_play_nocache("Voltage is %0.2f volts", status.voltage);
         }
         status_msg_time = microsec_timer();
+        MUTEX_UNLOCK;
         break;
     case MSG_ID_LOGMSG:
         INFO("BODY: %s\n", msg->logmsg.str);
         break;
     case MSG_ID_DRIVE_PROC_COMPLETE:
-        drive_proc_complete = msg->drive_proc_complete;
+        drive_req_proc_complete(&msg->drive_proc_complete);
+        break;
+    case MSG_ID_LOOP_TIMING:
+        // the loop timing is displayed by the body_test program
         break;
     default:
         assert(0);
@@ -512,6 +903,9 @@ static void *monitor_thread(void *cx)
             }
         } while (0);
 
+        // check for drive requests that have timed out
+        drive_req_check_timeouts();
+
         MUTEX_UNLOCK;
 
         sleep(1);
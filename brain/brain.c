@@ -1,32 +1,12 @@
 #include <common.h>
 
-//
-// defines
-//
-
-#define MAX_RECORDING (60*16000)
-
-#define LEDS_IDLE              1
-#define LEDS_RECV_AND_PROC_CMD 2
-#define LEDS_ERROR             3
-
-//
-// variables
-//
-
-static bool  end_program;
-static short recording[4][MAX_RECORDING];
-static int   recording_idx;
-
 //
 // prototypes
 //
 
 static void initialize(void);
 static void sig_hndlr(int sig);
-static int proc_mic_data(short *frame);
-static void set_leds(int cmd, int doa);
-static void *leds_thread(void *cx);
+static void leds_start(void);
 
 // -----------------  MAIN  ------------------------------------------------------
 
@@ -34,6 +14,7 @@ int main(int argc, char **argv)
 {
     // initialize
     log_init(NULL, false, false);
+    log_deferred_init();
     INFO("INITIALIZING\n")
     initialize();
 
@@ -41,11 +22,10 @@ int main(int argc, char **argv)
     INFO("PROGRAM RUNNING\n");
     t2s_play("program running");
 
-    // wait for end_pgm
-    while (!end_program) {
-        usleep(10*MS);
-    }
-    
+    // run the reactor, which calls the event driven and timer procs,
+    // until brain_end_program is called
+    reactor_run();
+
     // program is terminating
     INFO("PROGRAM TERMINATING\n")
     audio_out_cancel();
@@ -58,7 +38,6 @@ int main(int argc, char **argv)
 static void initialize(void)
 {
     uint64_t secs_since_boot;
-    pthread_t tid;
 
     // register for SIGINT and SIGTERM
     static struct sigaction act;
@@ -89,20 +68,30 @@ static void initialize(void)
     settings.color_organ = db_get_num(KEYID_PROG_SETTINGS, "color_organ", 2);
     settings.led_scale_factor = db_get_num(KEYID_PROG_SETTINGS, "led_scale_factor", 3.0);
 
-    // init other functions
+    // init cmd latency tracing, the latency histograms are saved in the db
+    trace_init(KEYID_LATENCY);
+
+    // init the store for the captured utterances, see proc_mic_data.c
+    capture_init("capture", 500*MB);
+
+    // init other functions; the reactor is first because the
+    // other functions may start timers
+    reactor_init();
     misc_init();
     wwd_init();
     t2s_init();
     s2t_init();
     doa_init();
+    beam_init();
+    aec_init();
     leds_init(settings.led_scale_factor);
     sf_init();
     proc_cmd_init();
     audio_init(proc_mic_data, settings.volume);
     body_init();
 
-    // create thread to display leds
-    pthread_create(&tid, NULL, leds_thread, NULL);
+    // display the idle leds
+    leds_start();
 }
 
 static void sig_hndlr(int sig)
@@ -112,9 +101,10 @@ static void sig_hndlr(int sig)
 
 // -----------------  PUBLIC ROUTINES  -------------------------------------------
 
+// may be called from the signal handler
 void brain_end_program(void)
 {
-    end_program = true;
+    reactor_stop();
 }
 
 void brain_restart_program(void)
@@ -122,179 +112,62 @@ void brain_restart_program(void)
     system("sudo systemctl restart robot-brain &");
 }
 
-void brain_get_recording(short *mic[4], int max)
-{
-    int ri = recording_idx;
+// -----------------  LEDS  ------------------------------------------------------
 
-    assert(max < MAX_RECORDING - 1*16000);
+// The leds are composed from layers by leds.c, and are rendered by a
+// periodic timer proc that runs on the reactor thread. The idle layer is
+// always enabled, with a rotating animation; the doa and error layers are
+// enabled above it while a cmd is being received and processed, and for
+// LEDS_ERROR_DURATION after a cmd fails.
 
-    for (int i = 0; i < 4; i++) {
-        if (ri-max >= 0) {
-            memcpy(mic[i], recording[i]+(ri-max), max*sizeof(short));
-        } else {
-            int tmp = -(ri-max);
-            memcpy(mic[i], recording[i]+(MAX_RECORDING-tmp), tmp*sizeof(short));
-            memcpy(mic[i]+tmp, recording[i], (max-tmp)*sizeof(short));
-        }
-    }
-}
+#define LEDS_RENDER_INTVL   (10*MS)
+#define LEDS_ROTATE_INTVL   (200*MS)
+#define LEDS_ERROR_DURATION (300*MS)
 
-// -----------------  PROCESS MIC DATA FRAME  ------------------------------------
+static void leds_render_proc(void *cx);
+static void convert_angle_to_led_num(double angle, int *led_a, int *led_b);
 
-// called at sample rate 48000
-static int proc_mic_data(short *frame)
+static void leds_start(void)
 {
-    #define STATE_WAITING_FOR_WAKE_WORD  0
-    #define STATE_RECEIVING_CMD          1
-    #define STATE_PROCESSING_CMD         2
-    #define STATE_COMPLETED_CMD_OKAY     3
-    #define STATE_COMPLETED_CMD_ERROR    4
-
-    static int    state = STATE_WAITING_FOR_WAKE_WORD;
-    static double doa;
-    static double filter_cx[4];
-
-    short filtered_frame[4];
-    short sound_val;
-
-    // supply the frame for doa analysis, frame is 4 shorts
-    doa_feed(frame);
-
-    // discard 2 out of 3 frames, so the sample rate for the code following is 16000
-    static int discard_cnt;
-    if (++discard_cnt < 3) {
-        return 0;
+    for (int i = 0; i < MAX_LED; i++) {
+        leds_layer_set_led(LEDS_LAYER_IDLE, i, LED_BLUE, 50 * (i + 4) / MAX_LED);
     }
-    discard_cnt = 0;
+    leds_layer_rotate(LEDS_LAYER_IDLE, LEDS_ROTATE_INTVL, 1);
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
 
-    // filter the 4 microphone channels to remove some of the high pitch background noise
-    for (int mic = 0; mic < 4; mic++) {
-        int tmp = 4 * low_pass_filter(frame[mic], &filter_cx[mic], 0.90);
-        filtered_frame[mic] = clip_int(tmp, -32767, 32767);
-    }
-
-    // save sound recording so it can be played to test audio quality
-    for (int mic = 0; mic < 4; mic++) {
-        recording[mic][recording_idx] = filtered_frame[mic];
-    }
-    recording_idx = (recording_idx == MAX_RECORDING-1 ? 0 : recording_idx+1);
-
-    // all channels sound about the same; so the code following will always use
-    // the sound from microphone channel 0
-    sound_val = filtered_frame[0];
-
-    // process mic data state machine
-    switch (state) {
-    case STATE_WAITING_FOR_WAKE_WORD: {
-        if (wwd_feed(sound_val) & WW_KEYWORD_MASK) {
-            state = STATE_RECEIVING_CMD;
-            doa = doa_get();
-            set_leds(LEDS_RECV_AND_PROC_CMD, doa);
-        }
-        break; }
-    case STATE_RECEIVING_CMD: {
-        char *transcript = s2t_feed(sound_val);
-        if (transcript) {
-            if (strcmp(transcript, "TIMEDOUT") == 0) {
-                free(transcript);
-                set_leds(LEDS_IDLE, -1);
-                state = STATE_WAITING_FOR_WAKE_WORD;
-                break;
-            }
-            proc_cmd_execute(transcript, doa);
-            state = STATE_PROCESSING_CMD;
-        }
-        break; }
-    case STATE_PROCESSING_CMD: {
-        bool succ;
-        if (proc_cmd_in_progress(&succ) == false) {
-            state = (succ ? STATE_COMPLETED_CMD_OKAY : STATE_COMPLETED_CMD_ERROR);
-            break;
-        }
-        if (wwd_feed(sound_val) & WW_TERMINATE_MASK) {
-            proc_cmd_cancel();
-        }
-        break; }
-    case STATE_COMPLETED_CMD_OKAY: {
-        set_leds(LEDS_IDLE, -1);
-        state = STATE_WAITING_FOR_WAKE_WORD;
-        break; }
-    case STATE_COMPLETED_CMD_ERROR: {
-        set_leds(LEDS_ERROR, -1);
-        state = STATE_WAITING_FOR_WAKE_WORD;
-        break; }
-    }
-        
-    // return 0 to continue
-    return 0;
-}
-
-// -----------------  LEDS THREAD  -----------------------------------------------
+    leds_layer_set_all(LEDS_LAYER_ERROR, LED_RED, 50);
 
-static int leds_cmd;
-static int leds_doa;
-static void convert_angle_to_led_num(double angle, int *led_a, int *led_b);
-
-static void set_leds(int cmd, int doa)
-{
-    leds_doa = doa; 
-    __sync_synchronize();
-    leds_cmd = cmd;
+    reactor_timer_start(LEDS_RENDER_INTVL, LEDS_RENDER_INTVL, leds_render_proc, NULL);
 }
 
-static void *leds_thread(void *cx)
+void brain_set_leds(int cmd, int doa)
 {
-    static bool     rotating = false;
-    static int      rotating_cnt = 0;
-    static uint64_t set_leds_idle_time = 0;
-
-    set_leds(LEDS_IDLE, -1);
-
-    while (true) {
-        switch (leds_cmd) {
-        case LEDS_IDLE:
-            for (int i = 0; i < MAX_LED; i++) {
-                leds_stage_led(i, LED_BLUE, 50 * (i + 4) / MAX_LED);
-            }
-            leds_commit(settings.brightness);
-            rotating = true;
-            set_leds_idle_time = 0;
-            break;
-        case LEDS_RECV_AND_PROC_CMD:
-            leds_stage_all(LED_WHITE, 50);
-            if (leds_doa != -1) {
-                int led_a, led_b;
-                convert_angle_to_led_num(leds_doa, &led_a, &led_b);
-                if (led_a != -1) leds_stage_led(led_a, LED_LIGHT_BLUE, 80);
-                if (led_b != -1) leds_stage_led(led_b, LED_LIGHT_BLUE, 80);
-            }
-            leds_commit(settings.brightness);
-            rotating = false;
-            set_leds_idle_time = 0;
-            break;
-        case LEDS_ERROR:
-            leds_stage_all(LED_RED, 50);
-            leds_commit(settings.brightness);
-            rotating = false;
-            set_leds_idle_time = microsec_timer() + 300000;
-            break;
-        default:
-            break;
+    switch (cmd) {
+    case LEDS_IDLE:
+        leds_layer_disable(LEDS_LAYER_DOA);
+        break;
+    case LEDS_RECV_AND_PROC_CMD:
+        leds_layer_set_all(LEDS_LAYER_DOA, LED_WHITE, 50);
+        if (doa != -1) {
+            int led_a, led_b;
+            convert_angle_to_led_num(doa, &led_a, &led_b);
+            if (led_a != -1) leds_layer_set_led(LEDS_LAYER_DOA, led_a, LED_LIGHT_BLUE, 80);
+            if (led_b != -1) leds_layer_set_led(LEDS_LAYER_DOA, led_b, LED_LIGHT_BLUE, 80);
         }
-        leds_cmd = 0;
-
-        if (set_leds_idle_time != 0 && microsec_timer() > set_leds_idle_time) {
-            set_leds(LEDS_IDLE, -1);
-        } else if (rotating && rotating_cnt++ >= 20) {
-            leds_stage_rotate(1);
-            leds_commit(settings.brightness);
-            rotating_cnt = 0;
-        }
-
-        usleep(10*MS);
+        leds_layer_enable(LEDS_LAYER_DOA, LEDS_BLEND_REPLACE, 0);
+        break;
+    case LEDS_ERROR:
+        leds_layer_disable(LEDS_LAYER_DOA);
+        leds_layer_enable(LEDS_LAYER_ERROR, LEDS_BLEND_REPLACE, LEDS_ERROR_DURATION);
+        break;
+    default:
+        break;
     }
+}
 
-    return NULL;
+static void leds_render_proc(void *cx)
+{
+    leds_render(settings.brightness);
 }
 
 static void convert_angle_to_led_num(double angle, int *led_a, int *led_b)
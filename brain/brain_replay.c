@@ -0,0 +1,472 @@
+#include <common.h>
+
+#include <sys/resource.h>
+
+#include "brain_replay.h"
+
+// Notes:
+// - Replays 4 channel 48000 sample rate wav files through the brain's
+//   proc_mic_data state machine, faster than real time, and reports the
+//   per-stage latency and cpu usage. Used to regression test changes to
+//   the audio path without the robot.
+// - usage: brain_replay [-l log_file] <wav_file> ...
+//   -l: write the log msgs to log_file instead of stdout
+//   run from the brain directory, the grammar file is read from there
+// - The wake word detector, speech to text, text to speech, audio output,
+//   leds, music, search and body are replaced by the stubs in
+//   brain_replay_stubs.c. The real proc_mic_data, doa, beamformer, echo
+//   canceller, grammar and cmd handlers are used. See Makefile.brain_replay
+//   for using the porcupine wake word detector, or the real search, instead
+//   of the stubs.
+// - The stubs are driven by an optional script file for each wav file,
+//   with the wav filename's extension replaced by '.txt'. Each line is:
+//     <secs> wake                - wake word ends at secs
+//     <secs> cmd <transcript>    - speech to text result is available at secs
+//     <secs> terminate           - terminate word ends at secs
+//   where secs is relative to the start of that wav file.
+// - The echo canceller reference for each wav file is read from an optional
+//   mono wav file, of any sample rate, with the wav filename's extension
+//   replaced by '.ref.wav'. This is the audio output that was playing,
+//   starting at the start of the wav file. Without it the reference is
+//   silent. The echo canceller's results are included in the report.
+// - The audio is paused while a cmd handler runs, so the results do not
+//   depend on the speed of the build machine.
+// - The stage timings are collected by wrapping the stage routines, using
+//   the linker's --wrap option.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE    48000
+#define MAX_CHAN       4
+#define MAX_EVENT      1000
+#define MAX_HIST_BKT   64
+
+#define STAGE_PROC_MIC_DATA  0
+#define STAGE_DOA_FEED       1
+#define STAGE_BEAM_FEED      2
+#define STAGE_AEC_FEED       3
+#define STAGE_WWD_FEED       4
+#define STAGE_S2T_FEED       5
+#define STAGE_GRAMMAR_MATCH  6
+#define STAGE_CMD            7
+#define MAX_STAGE            8
+
+//
+// typedefs
+//
+
+typedef struct {
+    char    *name;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[MAX_HIST_BKT];   // bucket n counts durations < 2^n ns
+} stage_t;
+
+//
+// variables
+//
+
+replay_event_t    replay_event[MAX_EVENT];
+int               replay_max_event;
+uint64_t          replay_frame_idx;   // 48000 sample rate, from the start of the replay
+
+static stage_t stage[MAX_STAGE] = {
+    [STAGE_PROC_MIC_DATA] = { "proc_mic_data" },
+    [STAGE_DOA_FEED]      = { "doa_feed" },
+    [STAGE_BEAM_FEED]     = { "beam_feed" },
+    [STAGE_AEC_FEED]      = { "aec_feed" },
+    [STAGE_WWD_FEED]      = { "wwd_feed" },
+    [STAGE_S2T_FEED]      = { "s2t_feed" },
+    [STAGE_GRAMMAR_MATCH] = { "grammar_match" },
+    [STAGE_CMD]           = { "cmd" },
+};
+
+static bool     cmd_active;
+static uint64_t cmd_start_ns;
+
+//
+// prototypes
+//
+
+static void read_script(char *wav_filename, uint64_t frame_idx_start);
+static void replay_wav(char *wav_filename);
+static short *read_ref(char *wav_filename, int *max_ref, int *ref_sample_rate);
+static void report(double audio_secs, double wall_secs, struct rusage *ru);
+static uint64_t nanosec_timer(void);
+static void stage_add(int idx, uint64_t ns);
+static uint64_t stage_percentile(stage_t *s, double pct);
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    char *log_file = NULL;
+    uint64_t start_ns;
+    double wall_secs;
+    struct rusage ru;
+    int i;
+
+    // parse options
+    while (true) {
+        int ch = getopt(argc, argv, "l:");
+        if (ch == -1) {
+            break;
+        }
+        switch (ch) {
+        case 'l':
+            log_file = optarg;
+            break;
+        default:
+            printf("usage: brain_replay [-l log_file] <wav_file> ...\n");
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        printf("usage: brain_replay [-l log_file] <wav_file> ...\n");
+        return 1;
+    }
+
+    // initialize logging, deferred as in the brain program
+    log_init(log_file, false, false);
+    log_deferred_init();
+
+    // init the program settings, and the functions used by the cmd handlers;
+    // the database is private to brain_replay
+    db_init("brain_replay.dat", true, 100*MB);
+    settings.volume = 20;
+    settings.brightness = 60;
+    settings.color_organ = 2;
+    settings.led_scale_factor = 3.0;
+
+    misc_init();
+    wwd_init();
+    t2s_init();
+    s2t_init();
+    doa_init();
+    beam_init();
+    aec_init();
+    sf_init();
+    proc_cmd_init();
+
+    // replay the wav files
+    start_ns = nanosec_timer();
+    for (i = optind; i < argc; i++) {
+        read_script(argv[i], replay_frame_idx);
+        replay_wav(argv[i]);
+    }
+    wall_secs = (nanosec_timer() - start_ns) / 1e9;
+    getrusage(RUSAGE_SELF, &ru);
+
+    // print the results and the timing report
+    report((double)replay_frame_idx / SAMPLE_RATE, wall_secs, &ru);
+    return 0;
+}
+
+static void read_script(char *wav_filename, uint64_t frame_idx_start)
+{
+    char filename[1000], s[1000], *p;
+    double secs;
+    replay_event_t *ev;
+    FILE *fp;
+    int n, line = 0;
+
+    // the script filename is the wav filename with the extension replaced by .txt
+    snprintf(filename, sizeof(filename), "%s", wav_filename);
+    p = strrchr(filename, '.');
+    if (p) *p = '\0';
+    strcat(filename, ".txt");
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("%s: no script\n", wav_filename);
+        return;
+    }
+
+    while (fgets(s, sizeof(s), fp) != NULL) {
+        line++;
+        s[strcspn(s, "\n")] = '\0';
+        if (s[0] == '#' || s[strspn(s, " ")] == '\0') {
+            continue;
+        }
+        if (replay_max_event == MAX_EVENT) {
+            FATAL("%s: too many events\n", filename);
+        }
+
+        ev = &replay_event[replay_max_event];
+        memset(ev, 0, sizeof(*ev));
+        if (sscanf(s, "%lf %n", &secs, &n) != 1 || secs < 0) {
+            FATAL("%s line %d: invalid '%s'\n", filename, line, s);
+        }
+        ev->frame_idx = frame_idx_start + secs * SAMPLE_RATE;
+        if (replay_max_event > 0 && ev->frame_idx < replay_event[replay_max_event-1].frame_idx) {
+            FATAL("%s line %d: events must be in time order\n", filename, line);
+        }
+
+        p = s + n;
+        if (strcmp(p, "wake") == 0) {
+            ev->type = REPLAY_EVENT_WAKE;
+        } else if (strcmp(p, "terminate") == 0) {
+            ev->type = REPLAY_EVENT_TERMINATE;
+        } else if (strncmp(p, "cmd ", 4) == 0) {
+            ev->type = REPLAY_EVENT_CMD;
+            snprintf(ev->transcript, sizeof(ev->transcript), "%s", p+4);
+        } else {
+            FATAL("%s line %d: invalid '%s'\n", filename, line, s);
+        }
+        replay_max_event++;
+    }
+
+    fclose(fp);
+}
+
+// -----------------  REPLAY  ----------------------------------------------------
+
+static void replay_wav(char *wav_filename)
+{
+    short *data, *ref_data, ref;
+    int max_chan, max_data, sample_rate, max_ref, ref_sample_rate, i, ref_idx;
+    uint64_t start_ns, end_ns;
+    double ref_pos;
+    bool succ;
+
+    if (sf_read_wav_file(wav_filename, &data, &max_chan, &max_data, &sample_rate) < 0) {
+        FATAL("failed to read %s\n", wav_filename);
+    }
+    if (max_chan != MAX_CHAN || sample_rate != SAMPLE_RATE) {
+        FATAL("%s: max_chan=%d sample_rate=%d, must be %d and %d\n",
+              wav_filename, max_chan, sample_rate, MAX_CHAN, SAMPLE_RATE);
+    }
+    printf("%s: %0.1f secs\n", wav_filename, (double)max_data / MAX_CHAN / SAMPLE_RATE);
+
+    ref_data = read_ref(wav_filename, &max_ref, &ref_sample_rate);
+
+    for (i = 0; i < max_data; i += MAX_CHAN) {
+        // the echo canceller reference for the frame, resampled to SAMPLE_RATE
+        ref = 0;
+        if (ref_data) {
+            ref_pos = (double)(i / MAX_CHAN) * ref_sample_rate / SAMPLE_RATE;
+            ref_idx = ref_pos;
+            if (ref_idx + 1 < max_ref) {
+                ref = ref_data[ref_idx] + (ref_pos - ref_idx) * (ref_data[ref_idx+1] - ref_data[ref_idx]);
+            }
+        }
+
+        // process the frame
+        start_ns = nanosec_timer();
+        proc_mic_data(data+i, ref);
+        end_ns = nanosec_timer();
+        stage_add(STAGE_PROC_MIC_DATA, end_ns - start_ns);
+        replay_frame_idx++;
+
+        // if proc_mic_data started a cmd then wait for the cmd to complete;
+        // the cmd stage time includes the time for the cmd_thread to notice the cmd
+        if (cmd_active) {
+            while (proc_cmd_in_progress(&succ)) {
+                usleep(100);
+            }
+            stage_add(STAGE_CMD, nanosec_timer() - cmd_start_ns);
+            replay_stub_cmd_complete(succ);
+            cmd_active = false;
+        }
+    }
+
+    free(data);
+    free(ref_data);
+}
+
+// returns NULL if there is no reference wav file
+static short *read_ref(char *wav_filename, int *max_ref, int *ref_sample_rate)
+{
+    char filename[1000], *p;
+    short *ref_data;
+    int max_chan;
+
+    snprintf(filename, sizeof(filename), "%s", wav_filename);
+    p = strrchr(filename, '.');
+    if (p) *p = '\0';
+    strcat(filename, ".ref.wav");
+
+    if (access(filename, F_OK) != 0) {
+        return NULL;
+    }
+    if (sf_read_wav_file(filename, &ref_data, &max_chan, max_ref, ref_sample_rate) < 0) {
+        FATAL("failed to read %s\n", filename);
+    }
+    if (max_chan != 1) {
+        FATAL("%s: max_chan=%d, must be 1\n", filename, max_chan);
+    }
+    printf("%s: %0.1f secs, sample_rate %d\n", filename, (double)*max_ref / *ref_sample_rate, *ref_sample_rate);
+
+    return ref_data;
+}
+
+// -----------------  STAGE WRAPPERS  --------------------------------------------
+
+void __real_doa_feed(const short *frame);
+short __real_beam_feed(const short *frame);
+short __real_aec_feed(short mic, short ref);
+int __real_wwd_feed(short sound_val);
+char *__real_s2t_feed(short sound_val);
+bool __real_grammar_match(char *cmd, hndlr_t *proc, args_t args);
+void __real_proc_cmd_execute(char *transcript, double doa);
+
+void __wrap_doa_feed(const short *frame)
+{
+    uint64_t start_ns = nanosec_timer();
+    __real_doa_feed(frame);
+    stage_add(STAGE_DOA_FEED, nanosec_timer() - start_ns);
+}
+
+short __wrap_beam_feed(const short *frame)
+{
+    uint64_t start_ns = nanosec_timer();
+    short out = __real_beam_feed(frame);
+    stage_add(STAGE_BEAM_FEED, nanosec_timer() - start_ns);
+    return out;
+}
+
+short __wrap_aec_feed(short mic, short ref)
+{
+    uint64_t start_ns = nanosec_timer();
+    short out = __real_aec_feed(mic, ref);
+    stage_add(STAGE_AEC_FEED, nanosec_timer() - start_ns);
+    return out;
+}
+
+int __wrap_wwd_feed(short sound_val)
+{
+    uint64_t start_ns = nanosec_timer();
+    int rc = __real_wwd_feed(sound_val);
+    stage_add(STAGE_WWD_FEED, nanosec_timer() - start_ns);
+    if (rc & WW_KEYWORD_MASK) {
+        replay_stub_wake_detected();
+    }
+    return rc;
+}
+
+char *__wrap_s2t_feed(short sound_val)
+{
+    uint64_t start_ns = nanosec_timer();
+    char *transcript = __real_s2t_feed(sound_val);
+    stage_add(STAGE_S2T_FEED, nanosec_timer() - start_ns);
+    return transcript;
+}
+
+bool __wrap_grammar_match(char *cmd, hndlr_t *proc, args_t args)
+{
+    uint64_t start_ns = nanosec_timer();
+    bool match = __real_grammar_match(cmd, proc, args);
+    stage_add(STAGE_GRAMMAR_MATCH, nanosec_timer() - start_ns);
+    replay_stub_grammar_match(match);
+    return match;
+}
+
+void __wrap_proc_cmd_execute(char *transcript, double doa)
+{
+    cmd_start_ns = nanosec_timer();
+    cmd_active = true;
+    __real_proc_cmd_execute(transcript, doa);
+}
+
+// -----------------  REPORT  ----------------------------------------------------
+
+static void report(double audio_secs, double wall_secs, struct rusage *ru)
+{
+    double cpu_secs;
+    stage_t *s;
+    aec_stats_t aec;
+    int i;
+
+    // write the pending log msgs before the report, when logging to stdout
+    log_flush();
+
+    // print the cmd results from the stubs
+    replay_stub_report();
+
+    // print the stage timing
+    printf("\n");
+    printf("STAGE             COUNT     AVG_US     P99_US   P99.9_US     MAX_US   TOTAL_SECS\n");
+    for (i = 0; i < MAX_STAGE; i++) {
+        s = &stage[i];
+        if (s->count == 0) {
+            printf("%-14s %8d\n", s->name, 0);
+            continue;
+        }
+        printf("%-14s %8lld %10.2f %10.2f %10.2f %10.2f %12.3f\n",
+               s->name, (long long)s->count,
+               s->total_ns / 1000. / s->count,
+               stage_percentile(s, 0.99) / 1000.,
+               stage_percentile(s, 0.999) / 1000.,
+               s->max_ns / 1000.,
+               s->total_ns / 1e9);
+    }
+
+    // print the beamformer steering, and the echo canceller results
+    printf("\n");
+    if (beam_get_doa() < 0) {
+        printf("beam: not steered\n");
+    } else {
+        printf("beam: steered to %0.0f degs\n", beam_get_doa());
+    }
+    aec_get_stats(&aec);
+    if (aec.active_blocks == 0) {
+        printf("aec: reference was not active\n");
+    } else {
+        printf("aec: delay=%d ms  erle=%0.1f dB  ref_active=%0.1f secs  double_talk=%0.1f secs  resets=%lld\n",
+               aec.delay_ms, aec.erle_db,
+               (double)aec.active_blocks / aec.blocks * audio_secs,
+               (double)aec.dt_blocks / aec.blocks * audio_secs,
+               (long long)aec.resets);
+    }
+
+    // print the cpu usage; the percent of a cpu is what the brain would need
+    // to process the audio in real time
+    cpu_secs = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+               ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    printf("\n");
+    printf("audio=%0.1f secs  wall=%0.3f secs  cpu=%0.3f secs  speedup=%0.1fx  real_time_cpu=%0.1f%%\n",
+           audio_secs, wall_secs, cpu_secs,
+           audio_secs / wall_secs,
+           100 * cpu_secs / audio_secs);
+}
+
+// -----------------  UTILS  -----------------------------------------------------
+
+static uint64_t nanosec_timer(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stage_add(int idx, uint64_t ns)
+{
+    stage_t *s = &stage[idx];
+    int bkt = (ns == 0 ? 0 : 64 - __builtin_clzll(ns));
+
+    s->count++;
+    s->total_ns += ns;
+    if (ns > s->max_ns) {
+        s->max_ns = ns;
+    }
+    s->hist[bkt < MAX_HIST_BKT ? bkt : MAX_HIST_BKT-1]++;
+}
+
+// returns the upper bound of the histogram bucket containing the percentile
+static uint64_t stage_percentile(stage_t *s, double pct)
+{
+    uint64_t sum = 0, target = pct * s->count;
+    int bkt;
+
+    for (bkt = 0; bkt < MAX_HIST_BKT; bkt++) {
+        sum += s->hist[bkt];
+        if (sum > target) {
+            break;
+        }
+    }
+    return (bkt >= MAX_HIST_BKT-1 || (1ULL << bkt) > s->max_ns ? s->max_ns : (1ULL << bkt));
+}
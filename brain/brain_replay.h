@@ -0,0 +1,28 @@
+#ifndef __BRAIN_REPLAY_H__
+#define __BRAIN_REPLAY_H__
+
+// definitions shared by brain_replay.c and brain_replay_stubs.c
+
+#define REPLAY_EVENT_WAKE       1
+#define REPLAY_EVENT_CMD        2
+#define REPLAY_EVENT_TERMINATE  3
+
+typedef struct {
+    int      type;
+    uint64_t frame_idx;         // 48000 sample rate, from the start of the replay
+    char     transcript[200];   // REPLAY_EVENT_CMD only
+    bool     consumed;
+} replay_event_t;
+
+// brain_replay.c ...
+extern replay_event_t replay_event[];
+extern int            replay_max_event;
+extern uint64_t       replay_frame_idx;
+
+// brain_replay_stubs.c ...
+void replay_stub_wake_detected(void);
+void replay_stub_grammar_match(bool match);
+void replay_stub_cmd_complete(bool succ);
+void replay_stub_report(void);
+
+#endif
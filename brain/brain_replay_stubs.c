@@ -0,0 +1,480 @@
+#include <common.h>
+
+#include "brain_replay.h"
+
+// Notes:
+// - These stubs replace the brain functions that use the audio hardware,
+//   leds, network or body, for the brain_replay program.
+// - The wake word detector and speech to text stubs return the events from
+//   the replay script when the replay reaches the event's time. The other
+//   stubs add their output to the result of the cmd being processed, which
+//   is printed by replay_stub_report.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE       48000
+#define S2T_TIMEOUT_SECS  10   // same as s2t.c
+#define MAX_RESULT        1000
+
+//
+// typedefs
+//
+
+typedef struct {
+    uint64_t wake_frame_idx;
+    int      wake_latency_ms;   // -1 if the wake word was not in the script
+    char     transcript[200];
+    bool     match;
+    bool     complete;
+    bool     succ;
+    char     output[1000];
+} result_t;
+
+//
+// variables
+//
+
+static result_t result[MAX_RESULT];
+static int      max_result;
+static result_t *cur;           // the result of the cmd being received or processed
+
+static uint64_t s2t_start_frame_idx;
+
+//
+// prototypes
+//
+
+static void output_add(char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static replay_event_t *event_due(int type, uint64_t min_frame_idx);
+
+// -----------------  RESULTS  ---------------------------------------------------
+
+void replay_stub_wake_detected(void)
+{
+    replay_event_t *ev;
+
+    if (max_result == MAX_RESULT) {
+        FATAL("too many results\n");
+    }
+
+    cur = &result[max_result++];
+    memset(cur, 0, sizeof(*cur));
+    cur->wake_frame_idx = replay_frame_idx;
+
+    // the wake word detection latency is measured from the end of the wake word
+    // in the script; a detection without a script event is a false detection
+    ev = event_due(REPLAY_EVENT_WAKE, 0);
+    if (ev) {
+        ev->consumed = true;
+        cur->wake_latency_ms = (replay_frame_idx - ev->frame_idx) * 1000 / SAMPLE_RATE;
+    } else {
+        cur->wake_latency_ms = -1;
+    }
+
+    s2t_start_frame_idx = replay_frame_idx;
+}
+
+void replay_stub_grammar_match(bool match)
+{
+    if (cur) {
+        cur->match = match;
+    }
+}
+
+void replay_stub_cmd_complete(bool succ)
+{
+    if (cur) {
+        cur->complete = true;
+        cur->succ = succ;
+    }
+}
+
+void replay_stub_report(void)
+{
+    result_t *r;
+    replay_event_t *ev;
+    char wake_ms[20];
+    int i;
+
+    printf("\n");
+    printf("   TIME  WAKE_MS  RESULT    TRANSCRIPT / OUTPUT\n");
+    for (i = 0; i < max_result; i++) {
+        r = &result[i];
+        if (r->wake_latency_ms == -1) {
+            strcpy(wake_ms, "FALSE");
+        } else {
+            sprintf(wake_ms, "%d", r->wake_latency_ms);
+        }
+        printf("%7.2f  %7s  %-8s  '%s'\n",
+               (double)r->wake_frame_idx / SAMPLE_RATE,
+               wake_ms,
+               (!r->complete ? (strcmp(r->transcript, "TIMEDOUT") == 0 ? "TIMEDOUT" : "NONE") :
+                !r->match    ? "NOMATCH" :
+                r->succ      ? "OK" : "ERROR"),
+               r->transcript);
+        if (r->output[0] != '\0') {
+            printf("%27s%s\n", "", r->output);
+        }
+    }
+
+    // the script events that were not used
+    for (i = 0; i < replay_max_event; i++) {
+        ev = &replay_event[i];
+        if (!ev->consumed) {
+            printf("%7.2f  MISSED %s%s%s\n",
+                   (double)ev->frame_idx / SAMPLE_RATE,
+                   (ev->type == REPLAY_EVENT_WAKE ? "wake" :
+                    ev->type == REPLAY_EVENT_CMD  ? "cmd " : "terminate"),
+                   ev->transcript[0] ? " " : "",
+                   ev->transcript);
+        }
+    }
+}
+
+static void output_add(char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (cur == NULL) {
+        return;
+    }
+
+    len = strlen(cur->output);
+    if (len > 0 && len < sizeof(cur->output)-2) {
+        strcat(cur->output, " | ");
+        len += 3;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(cur->output+len, sizeof(cur->output)-len, fmt, ap);
+    va_end(ap);
+}
+
+// returns the first unconsumed event of type whose time has been reached,
+// and is at or after min_frame_idx
+static replay_event_t *event_due(int type, uint64_t min_frame_idx)
+{
+    replay_event_t *ev;
+    int i;
+
+    for (i = 0; i < replay_max_event; i++) {
+        ev = &replay_event[i];
+        if (ev->frame_idx > replay_frame_idx) {
+            break;
+        }
+        if (ev->type == type && !ev->consumed && ev->frame_idx >= min_frame_idx) {
+            return ev;
+        }
+    }
+    return NULL;
+}
+
+// -----------------  WAKE WORD DETECTOR  ----------------------------------------
+
+#ifndef REAL_WWD
+
+void wwd_init(void)
+{
+}
+
+int wwd_feed(short sound_val)
+{
+    replay_event_t *ev;
+
+    // the wake event is consumed by replay_stub_wake_detected
+    if (event_due(REPLAY_EVENT_WAKE, 0)) {
+        return WW_KEYWORD_MASK;
+    }
+
+    if ((ev = event_due(REPLAY_EVENT_TERMINATE, 0))) {
+        ev->consumed = true;
+        return WW_TERMINATE_MASK;
+    }
+
+    return 0;
+}
+
+#endif
+
+// -----------------  SPEECH TO TEXT  --------------------------------------------
+
+void s2t_init(void)
+{
+}
+
+// caller must free returned transcript
+char *s2t_feed(short sound_val)
+{
+    replay_event_t *ev;
+    char *ts = NULL;
+
+    // the transcript must be spoken after the wake word
+    if ((ev = event_due(REPLAY_EVENT_CMD, s2t_start_frame_idx))) {
+        ev->consumed = true;
+        ts = strdup(ev->transcript);
+    } else if (replay_frame_idx - s2t_start_frame_idx > S2T_TIMEOUT_SECS * SAMPLE_RATE) {
+        ts = strdup("TIMEDOUT");
+    }
+
+    if (ts && cur) {
+        snprintf(cur->transcript, sizeof(cur->transcript), "%s", ts);
+    }
+    return ts;
+}
+
+// -----------------  TEXT TO SPEECH  --------------------------------------------
+
+void t2s_init(void)
+{
+}
+
+void t2s_play(char *fmt, ...)
+{
+    char text[1000];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    INFO("PLAY: %s\n", text);
+    output_add("%s", text);
+}
+
+void t2s_play_nocache(char *fmt, ...)
+{
+    char text[1000];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    INFO("PLAY: %s\n", text);
+    output_add("%s", text);
+}
+
+// -----------------  AUDIO  -----------------------------------------------------
+
+void audio_init(int (*proc_mic_data)(short *frame, short ref), int volume)
+{
+}
+
+int audio_in_reset_mic(void)
+{
+    return 0;
+}
+
+void audio_out_beep(int beep_count, bool complete_to_idle)
+{
+    output_add("[beep %d]", beep_count);
+}
+
+void audio_out_play_data(short *data, int max_data, int sample_rate, bool complete_to_idle)
+{
+    output_add("[play data %0.1f secs]", (double)max_data / sample_rate);
+}
+
+void audio_out_play_wav(char *file_name, bool complete_to_idle)
+{
+    output_add("[play %s]", file_name);
+}
+
+void audio_out_wait(void)
+{
+}
+
+bool audio_out_is_complete(bool *cancelled)
+{
+    if (cancelled) {
+        *cancelled = false;
+    }
+    return true;
+}
+
+void audio_out_cancel(void)
+{
+}
+
+void audio_out_set_state_idle(void)
+{
+}
+
+void audio_out_get_low_mid_high(double *low, double *mid, double *high)
+{
+    *low = *mid = *high = 0;
+}
+
+void audio_out_set_volume(int volume)
+{
+    output_add("[volume %d]", volume);
+}
+
+void audio_out_clear_start_time(void)
+{
+}
+
+uint64_t audio_out_get_start_time(void)
+{
+    return 0;
+}
+
+// -----------------  LEDS  ------------------------------------------------------
+
+void leds_init(double sf)
+{
+}
+
+void leds_set_scale_factor(double sf)
+{
+}
+
+void leds_layer_set_led(int layer, int num, unsigned int rgb, int led_brightness)
+{
+}
+
+void leds_layer_set_all(int layer, unsigned int rgb, int led_brightness)
+{
+}
+
+void leds_layer_rotate(int layer, int intvl_us, int mode)
+{
+}
+
+void leds_layer_enable(int layer, int blend, uint64_t duration_us)
+{
+}
+
+void leds_layer_disable(int layer)
+{
+}
+
+void leds_render(int all_brightness)
+{
+}
+
+// -----------------  BRAIN  -----------------------------------------------------
+
+void brain_end_program(void)
+{
+    output_add("[end program]");
+}
+
+void brain_restart_program(void)
+{
+    output_add("[restart program]");
+}
+
+void brain_set_leds(int cmd, int doa)
+{
+}
+
+// -----------------  BODY  ------------------------------------------------------
+
+// the body stub completes all drive requests successfully
+
+void body_init(void)
+{
+}
+
+int body_drive_cmd(int proc_id, int arg0, int arg1, int arg2, int arg3)
+{
+    output_add("[body drive proc %d %d %d %d %d]", proc_id, arg0, arg1, arg2, arg3);
+    return 0;
+}
+
+int body_drive_path(int max_seg, struct drive_path_seg_s *seg)
+{
+    output_add("[body drive path %d segs]", max_seg);
+    return 0;
+}
+
+int body_drive_cmd_submit(int proc_id, int arg0, int arg1, int arg2, int arg3, int timeout_secs)
+{
+    static int handle;
+
+    output_add("[body drive proc %d %d %d %d %d]", proc_id, arg0, arg1, arg2, arg3);
+    return ++handle;
+}
+
+int body_drive_path_submit(int max_seg, struct drive_path_seg_s *seg, int timeout_secs)
+{
+    static int handle;
+
+    output_add("[body drive path %d segs]", max_seg);
+    return ++handle;
+}
+
+int body_req_wait(int handle, char *failure_reason, int failure_reason_len)
+{
+    return 0;
+}
+
+bool body_req_is_complete(int handle)
+{
+    return true;
+}
+
+void body_req_cancel(int handle)
+{
+}
+
+void body_emer_stop(void)
+{
+    output_add("[body emer stop]");
+}
+
+int body_flight_rec_dump(void)
+{
+    output_add("[body flight rec dump]");
+    return 0;
+}
+
+void body_power_on(void)
+{
+    output_add("[body power on]");
+}
+
+void body_power_off(void)
+{
+    output_add("[body power off]");
+}
+
+int body_get_status(struct msg_status_s *s)
+{
+    return -1;
+}
+
+void body_status_report(char *request)
+{
+    t2s_play("Status message has not been received from the body.");
+}
+
+void body_weather_report(void)
+{
+    t2s_play("Status message has not been received from the body.");
+}
+
+// -----------------  MUSIC & SEARCH  --------------------------------------------
+
+int play_music_file(char *filename)
+{
+    output_add("[play music %s]", filename);
+    return 0;
+}
+
+bool play_music_ignore_cancel(void)
+{
+    return false;
+}
+
+#ifndef REAL_SEARCH
+int customsearch(char *transcript, bool *cancel)
+{
+    output_add("[search '%s']", transcript);
+    return 0;
+}
+#endif
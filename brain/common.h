@@ -4,6 +4,8 @@
 #define KEYID_PROG_SETTINGS  1
 #define KEYID_USER_INFO      2
 #define KEYID_COLOR_ORGAN    3
+#define KEYID_LATENCY        4   // also in utils/trace_dump.c
+#define KEYID_SEARCH_CACHE   5
 
 struct {
     int volume;
@@ -13,22 +15,39 @@ struct {
 } settings;
 
 // brain.c ...
-void brain_get_recording(short *mic[4], int max);
+#define LEDS_IDLE              1
+#define LEDS_RECV_AND_PROC_CMD 2
+#define LEDS_ERROR             3
+
 void brain_end_program(void);
 void brain_restart_program(void);
+void brain_set_leds(int cmd, int doa);
+
+// proc_mic_data.c ...
+int proc_mic_data(short *frame, short ref);
+void brain_get_recording(short *mic[4], int max);
 
 // proc_cmd.c ...
 void proc_cmd_init(void);
 void proc_cmd_execute(char *transcript, double doa);
 bool proc_cmd_in_progress(bool *succ);
 void proc_cmd_cancel(void);
+char *proc_cmd_get_hndlr_name(void);
 
 // body.c ...
 void body_init(void);
 int body_drive_cmd(int proc_id, int arg0, int arg1, int arg2, int arg3);
+int body_drive_path(int max_seg, struct drive_path_seg_s *seg);
+int body_drive_cmd_submit(int proc_id, int arg0, int arg1, int arg2, int arg3, int timeout_secs);
+int body_drive_path_submit(int max_seg, struct drive_path_seg_s *seg, int timeout_secs);
+int body_req_wait(int handle, char *failure_reason, int failure_reason_len);
+bool body_req_is_complete(int handle);
+void body_req_cancel(int handle);
 void body_emer_stop(void);
+int body_flight_rec_dump(void);
 void body_power_on(void);
 void body_power_off(void);
+int body_get_status(struct msg_status_s *s);
 void body_status_report(char *request);
 void body_weather_report(void);
 
@@ -37,4 +56,4 @@ int play_music_file(char *filename);
 bool play_music_ignore_cancel(void);
 
 // customsearch.c ...
-int customsearch(char *transcript);
+int customsearch(char *transcript, bool *cancel);
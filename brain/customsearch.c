@@ -1,77 +1,177 @@
 #include <common.h>
 
+// Notes:
+// - customsearch answers a search request with the title and summary of
+//   the wikipedia page that best matches it, using a google custom search
+//   of www.en.wikipedia.org/*.
+// - The answers are cached in the db, keyed by the normalized request, for
+//   CACHE_TTL_SECS; a repeated request is answered without accessing the
+//   network, and the speech for the answer is in the speech_cache.
+// - The answer is played sentence by sentence, so the speech of the first
+//   sentence starts while the following sentences are being synthesized,
+//   and the answer can be cancelled between sentences.
+// - The search result and the page are fetched with curl, and the text of
+//   the page is extracted by html_to_text.
+// - The search url can be set with the CUSTOMSEARCH_URL environment variable;
+//   to test offline, using the search_server and fixture pages in utils/tests:
+//     utils/tests/search_server -p 8080 -d utils/tests/fixtures &
+//     export CUSTOMSEARCH_URL=http://127.0.0.1:8080/customsearch/v1
+//   and run the brain, or brain_replay built with SEARCH=real.
+
+//
+// defines
+//
+
+#define DEFAULT_SEARCH_URL  "https://www.googleapis.com/customsearch/v1"
+#define CACHE_TTL_SECS      (30*86400)
+#define MAX_SENTENCE        20
+#define FETCH_TIMEOUT_SECS  "10"
+#define NO_INFO             "no information available"
+
+//
+// prototypes
+//
+
+static int search(char *request, char *url, int url_len);
+static int get_summary(char *url, char *title, int title_len, char *description, int description_len);
+static char *fetch(char *url);
+static void normalize_request(char *request, char *key, int key_len);
+static void url_encode(char *s, char *out, int out_len);
+static int split_sentences(char *s, char *sentences[], int max);
 static void readline(char *s, int slen, FILE *fp, bool *eof);
-static void cleanup_url(char *url);
 static void cleanup_description(char *description);
 
 // ----------------------------------------------------------------
 
-int customsearch(char *transcript)
+int customsearch(char *transcript, bool *cancel)
 {
-    FILE       *fp;
-    char        title[1000], description[10000];
-    char        cmd[2500], url[1000], wikipedia_page[1000], filename[1100];
-    struct stat statbuf;
-    int         rc, len;
-    bool        eof;
+    char        key[1000], url[1000], title[1000], description[10000];
+    char        value[12000], *sentences[MAX_SENTENCE], *val, *p;
+    unsigned int val_len;
+    int         max_sentence, len;
+    time_t      t;
+    uint64_t    start_us = microsec_timer();
 
     // print search request transcript
     INFO("transcript = '%s'\n", transcript);
+    normalize_request(transcript, key, sizeof(key));
 
-    // perform google customsearch of  www.en.wikipedia.org/*, and
-    // extract the best match url from the result
-    sprintf(cmd, "./customsearch.py \"%s\" | grep htmlFormattedUrl | awk -F\\' '{ print $4}' | head -1", transcript);
-    INFO("customsearch cmd = '%s'\n", cmd);
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        ERROR("popen customsearch.py failed, %s\n", strerror(errno));
-        return -1;
+    // if the answer is in the cache, and has not expired, then use it;
+    // the cached value is the time, title and sentences, on separate lines
+    value[0] = '\0';
+    if (db_get(KEYID_SEARCH_CACHE, key, (void**)&val, &val_len) == 0 &&
+        val_len <= sizeof(value) &&
+        sscanf(val, "%ld", &t) == 1 &&
+        time(NULL) - t < CACHE_TTL_SECS)
+    {
+        char *saveptr;
+        memcpy(value, val, val_len);
+        strtok_r(value, "\n", &saveptr);
+        p = strtok_r(NULL, "\n", &saveptr);
+        snprintf(title, sizeof(title), "%s", p ? p : "");
+        max_sentence = 0;
+        while (max_sentence < MAX_SENTENCE && (p = strtok_r(NULL, "\n", &saveptr)) != NULL) {
+            sentences[max_sentence++] = p;
+        }
+        INFO("'%s' answered from cache, %lld us\n", key, (long long)(microsec_timer() - start_us));
     }
-    readline(url, sizeof(url), fp, &eof);
-    pclose(fp);
-    if (eof) {
-        ERROR("failed to read url from customsearch.py\n");
-        return -1;
+
+    // otherwise search for the page, and get its summary; the summary is
+    // cached if it was found
+    if (value[0] == '\0') {
+        if (search(transcript, url, sizeof(url)) < 0 ||
+            get_summary(url, title, sizeof(title), description, sizeof(description)) < 0)
+        {
+            return -1;
+        }
+        INFO("description len=%zd - '%s'\n", strlen(description), description);
+
+        max_sentence = split_sentences(description, sentences, MAX_SENTENCE);
+        len = snprintf(value, sizeof(value), "%ld\n%s\n", (long)time(NULL), title);
+        for (int i = 0; i < max_sentence && len < sizeof(value); i++) {
+            len += snprintf(value+len, sizeof(value)-len, "%s\n", sentences[i]);
+        }
+        if (strcmp(description, NO_INFO) != 0) {
+            db_set(KEYID_SEARCH_CACHE, key, value, strlen(value)+1);
+        }
+        INFO("'%s' answered from %s, %lld us\n", key, url, (long long)(microsec_timer() - start_us));
+    }
+
+    // play title, and the description sentence by sentence
+    t2s_play("title: %s", title);
+    for (int i = 0; i < max_sentence; i++) {
+        if (*cancel) break;
+        t2s_play("%s", sentences[i]);
     }
-    cleanup_url(url);
-    INFO("url = '%s'\n", url);
 
-    // generate scrape filename from url
-    if (sscanf(url, "https://en.wikipedia.org/wiki/%s", wikipedia_page) != 1) {
-        ERROR("bad url '%s'\n", url);
+    // done
+    return 0;
+}
+
+// -----------------  SEARCH AND SUMMARY  -----------------------------------
+
+// perform google customsearch of www.en.wikipedia.org/*, and return the
+// url of the best match
+static int search(char *request, char *url, int url_len)
+{
+    char  search_url[2000], request_enc[1000], *api_key, *engine_id, *env_url;
+    char *json, *p, *end;
+
+    api_key   = getenv("GOOGLE_CUSTOM_SEARCH_API_KEY");
+    engine_id = getenv("GOOGLE_CUSTOM_SEARCH_ENGINE_ID");
+    env_url   = getenv("CUSTOMSEARCH_URL");
+
+    url_encode(request, request_enc, sizeof(request_enc));
+    snprintf(search_url, sizeof(search_url), "%s?key=%s&cx=%s&q=%s",
+             env_url ? env_url : DEFAULT_SEARCH_URL,
+             api_key ? api_key : "", engine_id ? engine_id : "", request_enc);
+
+    json = fetch(search_url);
+    if (json == NULL) {
         return -1;
     }
-    sprintf(filename, "scrape/%s", wikipedia_page);
-    INFO("filename = '%s'\n", filename);
-
-    // if file scrape file does not exist
-    //   run beautifulsoup web scraper on the url
-    // endif
-    if (stat(filename, &statbuf) < 0) {
-        sprintf(cmd, "./beautifulsoup.py '%s' > '%s'", url, filename);
-        INFO("beautifysoup cmd = '%s'\n", cmd);
-        if ((rc = system(cmd)) != 0) {
-            ERROR("beautifysoup.py rc=0x%xx\n", rc);
-            return -1;
-        }
-    } else {
-        INFO("file %s already exists\n", filename);
+
+    // the url is the link of the first item
+    p = strstr(json, "\"items\"");
+    if (p) p = strstr(p, "\"link\"");
+    if (p) p = strchr(p+6, '"');
+    if (p == NULL || (end = strchr(p+1, '"')) == NULL) {
+        ERROR("no search result for '%s'\n", request);
+        free(json);
+        return -1;
     }
+    snprintf(url, url_len, "%.*s", (int)(end - (p+1)), p+1);
+    free(json);
+
+    INFO("url = '%s'\n", url);
+    return 0;
+}
 
-    // open the scrape file
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
-        ERROR("failed to open %s, %s\n", filename, strerror(errno));
+// get the title of the page, and a description from the first paragraph
+// that is long enough
+static int get_summary(char *url, char *title, int title_len, char *description, int description_len)
+{
+    char *html, *text;
+    FILE *fp;
+    bool  eof;
+    int   len;
+
+    html = fetch(url);
+    if (html == NULL) {
         return -1;
     }
+    text = html_to_text(html, "firstHeading");
+    free(html);
+
+    fp = fmemopen(text, strlen(text), "r");
 
-    // get title from the scrape file
-    readline(title, sizeof(title), fp, &eof);
+    // get title from the first line of the text
+    readline(title, title_len, fp, &eof);
 
-    // get description from the scrape file
+    // get description from the following lines
     while (true) {
         // get candidate for description
-        readline(description, sizeof(description), fp, &eof);
+        readline(description, description_len, fp, &eof);
 
         // if eof then we have failed to get a description
         if (eof) break;
@@ -83,60 +183,146 @@ int customsearch(char *transcript)
 
         // this description will be used; also append the contents of the
         // next line to description
-        readline(description+len, sizeof(description)-len, fp, &eof);
+        if (len < description_len-1) {
+            description[len++] = ' ';
+            readline(description+len, description_len-len, fp, &eof);
+        }
         break;
     }
     if (description[0] == '\0') {
-        strcpy(description, "no information available");
+        strcpy(description, NO_INFO);
     }
 
-    // close scrape file
     fclose(fp);
+    free(text);
 
-    // play title
-    t2s_play("title: %s", title);
-
-    // cleanup and play description
     cleanup_description(description);
-    INFO("description len=%zd - '%s'\n", strlen(description), description);
-    t2s_play("%s", description);
-
-    // done
     return 0;
 }
 
-void readline(char *s, int slen, FILE *fp, bool *eof)
+// caller must free the returned data; returns NULL on failure
+static char *fetch(char *url)
 {
-    if (fgets(s, slen, fp) == NULL) {
-        s[0] = '\0';
-        *eof = true;
-        return;
+    pid_t pid;
+    int   fd_to, fd_from, len = 0, alloc = 0, rc, status;
+    char *data = NULL;
+
+    run_program(&pid, &fd_to, &fd_from, "curl", "-s", "-f", "-L", "--max-time", FETCH_TIMEOUT_SECS, url, NULL);
+    close(fd_to);
+
+    while (true) {
+        if (len + 1 >= alloc) {
+            alloc = (alloc ? 2 * alloc : 100000);
+            data = realloc(data, alloc);
+        }
+        rc = read(fd_from, data+len, alloc-1-len);
+        if (rc <= 0) break;
+        len += rc;
     }
+    data[len] = '\0';
+    close(fd_from);
+    waitpid(pid, &status, 0);
 
-    s[strcspn(s, "\n")] = '\0';
-    *eof = false;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ERROR("curl '%s' failed, status=0x%x\n", url, status);
+        free(data);
+        return NULL;
+    }
+    return data;
 }
 
-void cleanup_url(char *url)
+// -----------------  SUPPORT  ----------------------------------------------
+
+// lower case words, separated by a single space, without leading articles;
+// so that 'The Honey Bee' and 'honey bee?' are the same request
+static void normalize_request(char *request, char *key, int key_len)
 {
-    char *p;
+    char *p, *out = key;
 
-    // remove <b> from url
-    while (true) {
-        p = strstr(url, "<b>");
-        if (p == NULL) break;
-        memmove(p, p+3, strlen(p+3)+1);
+    for (p = request; *p && out - key < key_len-2; p++) {
+        if (isalnum(*p)) {
+            *out++ = tolower(*p);
+        } else if (out > key && out[-1] != ' ') {
+            *out++ = ' ';
+        }
     }
+    if (out > key && out[-1] == ' ') out--;
+    *out = '\0';
 
-    // remove </b> from url
-    while (true) {
-        p = strstr(url, "</b>");
-        if (p == NULL) break;
-        memmove(p, p+4, strlen(p+4)+1);
+    while (strncmp(key, "the ", 4) == 0 || strncmp(key, "a ", 2) == 0 || strncmp(key, "an ", 3) == 0) {
+        p = strchr(key, ' ') + 1;
+        memmove(key, p, strlen(p)+1);
     }
 }
 
-void cleanup_description(char *description)
+static void url_encode(char *s, char *out, int out_len)
+{
+    int len = 0;
+
+    for (; *s && len < out_len-4; s++) {
+        if (isalnum(*s) || strchr("-_.~", *s)) {
+            out[len++] = *s;
+        } else if (*s == ' ') {
+            out[len++] = '+';
+        } else {
+            len += sprintf(out+len, "%%%02X", (unsigned char)*s);
+        }
+    }
+    out[len] = '\0';
+}
+
+// splits s, in place, at the end of each sentence; a period does not end
+// a sentence if it follows an initial or an abbreviation
+static int split_sentences(char *s, char *sentences[], int max)
+{
+    static char *abbrevs[] = { "Dr", "Mr", "Mrs", "Ms", "St", "Mt", "Jr", "Sr", "vs", "approx", "etc" };
+    int   max_sentence = 0;
+    char *start = s, *p, *word;
+    bool  abbrev;
+
+    for (p = s; *p && max_sentence < max-1; p++) {
+        if (*p == '\n') *p = ' ';
+        if (!strchr(".?!", *p) || p[1] != ' ' || !(isupper(p[2]) || isdigit(p[2]))) {
+            continue;
+        }
+
+        for (word = p; word > start && word[-1] != ' '; word--) ;
+        abbrev = (*p == '.' && p - word == 1 && isupper(*word));
+        for (int i = 0; i < sizeof(abbrevs)/sizeof(abbrevs[0]); i++) {
+            if (*p == '.' && p - word == strlen(abbrevs[i]) && strncmp(word, abbrevs[i], p - word) == 0) {
+                abbrev = true;
+            }
+        }
+        if (abbrev) {
+            continue;
+        }
+
+        p[1] = '\0';
+        sentences[max_sentence++] = start;
+        start = p + 2;
+        p++;
+    }
+
+    start[strcspn(start, "\n")] = '\0';
+    if (*start) {
+        sentences[max_sentence++] = start;
+    }
+    return max_sentence;
+}
+
+static void readline(char *s, int slen, FILE *fp, bool *eof)
+{
+    if (fgets(s, slen, fp) == NULL) {
+        s[0] = '\0';
+        *eof = true;
+        return;
+    }
+
+    s[strcspn(s, "\n")] = '\0';
+    *eof = false;
+}
+
+static void cleanup_description(char *description)
 {
     char *p, *end, *start;
     int level;
@@ -194,11 +380,11 @@ void cleanup_description(char *description)
 
     // remove these strings
     static char *strs[] = {
-        ".mw-parser-output", 
-        ".frac", 
-        ".num", 
-        ".den", 
-        ".sr-only", 
+        ".mw-parser-output",
+        ".frac",
+        ".num",
+        ".den",
+        ".sr-only",
                 };
     for (int i = 0; i < sizeof(strs)/sizeof(strs[0]); i++) {
         p = description;
@@ -52,6 +52,7 @@ func main() {
 					SampleRateHertz: 16000,
 					LanguageCode:    "en-US",
 				},
+				InterimResults: true,
 			},
 		},
 	}); err != nil {
@@ -107,6 +108,10 @@ func main() {
                                 os.Exit(0)
                         }
 		}
+		// interim results are used by the brain to trace latency
+		if len(resp.Results) > 0 && len(resp.Results[0].Alternatives) > 0 {
+			fmt.Printf("PARTIAL: %s\n", resp.Results[0].Alternatives[0].Transcript)
+		}
 	}
 }
 
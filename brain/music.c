@@ -117,68 +117,57 @@ bool play_music_ignore_cancel(void)
     
 // -----------------  COLOR ORGAN REV1  --------------------------------------------
 
+// The music leds layer is updated at 10 ms intervals by a periodic reactor
+// timer proc, while the calling thread waits for the song to complete.
+
+#define COLOR_ORGAN_INTVL (10*MS)
+
+typedef struct {
+    double low_cal;
+    double mid_cal;
+    double high_cal;
+    bool   precal;
+    int    cnt;
+} rev1_cx_t;
+
+static void color_organ_rev1_update(void *cx);
+
 static void color_organ_rev1(char *filename)
 {
-    double   low_cal, mid_cal, high_cal;
-    double   low, mid, high;
-    bool     precal;
-    int      cnt = 0;
-    uint64_t start_time = microsec_timer();
-    bool     cancelled;
+    rev1_cx_t cx;
+    int       timer;
+    uint64_t  start_time = microsec_timer();
+    bool      cancelled;
 
     INFO("starting color_organ_rev1 for %s\n", filename);
 
     // precalibrated values are used for the white_noise and frequency_sweep files
     if (strcmp(filename, "white_noise.wav") == 0) {
-        low_cal  = 2845.6;
-        mid_cal  = 38.6;
-        high_cal = 9866.3;
-        precal   = true;
+        cx.low_cal  = 2845.6;
+        cx.mid_cal  = 38.6;
+        cx.high_cal = 9866.3;
+        cx.precal   = true;
     } else if (strcmp(filename, "frequency_sweep.wav") == 0) {
-        low_cal  = 20857.3;
-        mid_cal  = 236.5;
-        high_cal = 13083.4;
-        precal   = true;
+        cx.low_cal  = 20857.3;
+        cx.mid_cal  = 236.5;
+        cx.high_cal = 13083.4;
+        cx.precal   = true;
     } else {
-        low_cal  = 1;
-        mid_cal  = 1;
-        high_cal = 1;
-        precal   = false;
+        cx.low_cal  = 1;
+        cx.mid_cal  = 1;
+        cx.high_cal = 1;
+        cx.precal   = false;
     }
+    cx.cnt = 0;
 
     // while song is playing, update the leds based on sound intensity
-    while (audio_out_is_complete(&cancelled) == false) {
-        // update leds at 10 ms interval
-        usleep(10*MS);
-
-        // ignore the first 100 ms because of possible startup sound glitches
-        if (cnt++ < 10) {
-            continue;
-        }
-
-        // get the intensity of sound in the low, mid, and high frequency ranges
-        audio_out_get_low_mid_high(&low, &mid, &high);
-
-        // if not using precalibrated values then the calibration values are
-        // cpomputed as the song is playing; the calibrated values directly track increases
-        // to low,mid,high; and slowly ramp down during quiet intervals
-        if (!precal) {
-            bool flag = false;
-            if (low > low_cal) { low_cal = low; flag = true; } else { low_cal *= .9999; }
-            if (mid > mid_cal) { mid_cal = mid; flag = true; } else { mid_cal *= .9999; }
-            if (high > high_cal) { high_cal = high; flag = true; } else { high_cal *= .9999; }
-            if (flag) INFO("AUTOCAL: %0.1f %0.1f %0.1f\n", low_cal, mid_cal, high_cal);
-        }
-
-        // set the leds, based on the sound intensity and the calibration values
-        #define MAX_BRIGHTNESS 100
-        for (int i = 0; i < 4; i++) {
-            leds_stage_led(i+0, LED_RED,   low * (MAX_BRIGHTNESS / low_cal));
-            leds_stage_led(i+4, LED_GREEN, mid * (MAX_BRIGHTNESS / mid_cal));
-            leds_stage_led(i+8, LED_BLUE, high * (MAX_BRIGHTNESS / high_cal));
-        }
-        leds_commit(settings.brightness);
-    }
+    leds_layer_set_all(LEDS_LAYER_MUSIC, LED_OFF, 0);
+    leds_layer_enable(LEDS_LAYER_MUSIC, LEDS_BLEND_REPLACE, 0);
+    timer = reactor_timer_start(COLOR_ORGAN_INTVL, COLOR_ORGAN_INTVL, color_organ_rev1_update, &cx);
+    audio_out_wait();
+    reactor_timer_cancel(timer);
+    leds_layer_disable(LEDS_LAYER_MUSIC);
+    audio_out_is_complete(&cancelled);
 
     // if the music audio output was cancelled then print the time into the
     // song that the cancel occurred
@@ -192,6 +181,39 @@ static void color_organ_rev1(char *filename)
     audio_out_set_state_idle();
 }
 
+static void color_organ_rev1_update(void *cx_arg)
+{
+    rev1_cx_t *cx = cx_arg;
+    double     low, mid, high;
+
+    // ignore the first 100 ms because of possible startup sound glitches
+    if (cx->cnt++ < 10) {
+        return;
+    }
+
+    // get the intensity of sound in the low, mid, and high frequency ranges
+    audio_out_get_low_mid_high(&low, &mid, &high);
+
+    // if not using precalibrated values then the calibration values are
+    // cpomputed as the song is playing; the calibrated values directly track increases
+    // to low,mid,high; and slowly ramp down during quiet intervals
+    if (!cx->precal) {
+        bool flag = false;
+        if (low > cx->low_cal) { cx->low_cal = low; flag = true; } else { cx->low_cal *= .9999; }
+        if (mid > cx->mid_cal) { cx->mid_cal = mid; flag = true; } else { cx->mid_cal *= .9999; }
+        if (high > cx->high_cal) { cx->high_cal = high; flag = true; } else { cx->high_cal *= .9999; }
+        if (flag) INFO("AUTOCAL: %0.1f %0.1f %0.1f\n", cx->low_cal, cx->mid_cal, cx->high_cal);
+    }
+
+    // set the leds, based on the sound intensity and the calibration values
+    #define MAX_BRIGHTNESS 100
+    for (int i = 0; i < 4; i++) {
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+0, LED_RED,   low * (MAX_BRIGHTNESS / cx->low_cal));
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+4, LED_GREEN, mid * (MAX_BRIGHTNESS / cx->mid_cal));
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+8, LED_BLUE, high * (MAX_BRIGHTNESS / cx->high_cal));
+    }
+}
+
 // -----------------  COLOR ORGAN REV2  --------------------------------------------
 
 typedef struct {
@@ -204,65 +226,44 @@ typedef struct {
     int    n;
 } avg_vals_t;
 
+typedef struct {
+    avg_vals_t new_avg_vals;
+    avg_vals_t db_avg_vals;
+} rev2_cx_t;
+
+static void color_organ_rev2_update(void *cx);
+
 static void color_organ_rev2(char *filename)
 {
-    avg_vals_t   new_avg_vals, db_avg_vals, *tmp, *avg_vals;
-    double       low, mid, high;
+    rev2_cx_t    cx;
+    avg_vals_t  *tmp;
     unsigned int tmp_len;
+    int          timer;
     uint64_t     start_time = microsec_timer();
     bool         cancelled;
 
     INFO("starting color_organ_rev2 for %s\n", filename);
 
     // init new_avg_vals and db_avg_vals to zero
-    memset(&new_avg_vals, 0, sizeof(new_avg_vals));
-    memset(&db_avg_vals, 0, sizeof(db_avg_vals));
+    memset(&cx, 0, sizeof(cx));
 
     // get song average values of low,mid,high from db, if they exist
     db_get(KEYID_COLOR_ORGAN, filename, (void**)&tmp, &tmp_len);
     if (tmp) {
         assert(tmp_len == sizeof(avg_vals_t));
-        db_avg_vals = *tmp;
+        cx.db_avg_vals = *tmp;
         INFO("got db_avg_vals %8d %8.0f %8.0f %8.0f\n", 
-             db_avg_vals.n, db_avg_vals.low, db_avg_vals.mid, db_avg_vals.high);
+             cx.db_avg_vals.n, cx.db_avg_vals.low, cx.db_avg_vals.mid, cx.db_avg_vals.high);
     }
 
     // while song is playing, update the leds based on sound intensity
-    while (audio_out_is_complete(&cancelled) == false) {
-        // update leds at 10 ms interval
-        usleep(10*MS);
-
-        // get the intensity of sound in the low, mid, and high frequency ranges
-        audio_out_get_low_mid_high(&low, &mid, &high);
-
-        // compute new_avg_vals; these will be saved to db before returining if
-        // the new_avg_vals are for a longer period of the song than the db_avg_vals
-        new_avg_vals.sum_low += low;
-        new_avg_vals.sum_mid += mid;
-        new_avg_vals.sum_high += high;
-        new_avg_vals.n++;
-
-        new_avg_vals.low = new_avg_vals.sum_low / new_avg_vals.n;
-        new_avg_vals.mid = new_avg_vals.sum_mid / new_avg_vals.n;
-        new_avg_vals.high = new_avg_vals.sum_high / new_avg_vals.n;
-
-        // select if the new_avg_vals or the avg_vals retrieved from db will be
-        // used when setting the leds below
-        avg_vals = (new_avg_vals.n > db_avg_vals.n ? &new_avg_vals : &db_avg_vals);
-
-        // if any of the avg_vals is zero then continue
-        if (avg_vals->low == 0 || avg_vals->mid == 0 || avg_vals->high == 0) {
-            continue;
-        }
-
-        // set the leds
-        for (int i = 0; i < 4; i++) {
-            leds_stage_led(i+0, LED_RED,   low * (15 / avg_vals->low));
-            leds_stage_led(i+4, LED_GREEN, mid * (15 / avg_vals->mid));
-            leds_stage_led(i+8, LED_BLUE, high * (15 / avg_vals->high));
-        }
-        leds_commit(settings.brightness);
-    }
+    leds_layer_set_all(LEDS_LAYER_MUSIC, LED_OFF, 0);
+    leds_layer_enable(LEDS_LAYER_MUSIC, LEDS_BLEND_REPLACE, 0);
+    timer = reactor_timer_start(COLOR_ORGAN_INTVL, COLOR_ORGAN_INTVL, color_organ_rev2_update, &cx);
+    audio_out_wait();
+    reactor_timer_cancel(timer);
+    leds_layer_disable(LEDS_LAYER_MUSIC);
+    audio_out_is_complete(&cancelled);
 
     // if the music audio output was cancelled then print the time into the
     // song that the cancel occurred
@@ -273,15 +274,53 @@ static void color_organ_rev2(char *filename)
 
     // store avg low,mid,high in db (but only if we have a more complete average)
     INFO("new_avg_vals.n = %d  db_avg_vals.n = %d - %s to db\n", 
-         new_avg_vals.n, db_avg_vals.n,
-         new_avg_vals.n > db_avg_vals.n ? "writing" : "not writiing");
-    if (new_avg_vals.n > db_avg_vals.n) {
-        db_set(KEYID_COLOR_ORGAN, filename, &new_avg_vals, sizeof(new_avg_vals));
+         cx.new_avg_vals.n, cx.db_avg_vals.n,
+         cx.new_avg_vals.n > cx.db_avg_vals.n ? "writing" : "not writiing");
+    if (cx.new_avg_vals.n > cx.db_avg_vals.n) {
+        db_set(KEYID_COLOR_ORGAN, filename, &cx.new_avg_vals, sizeof(cx.new_avg_vals));
         INFO("set db_avg_vals %8d %8.0f %8.0f %8.0f\n", 
-             new_avg_vals.n, new_avg_vals.low, new_avg_vals.mid, new_avg_vals.high);
+             cx.new_avg_vals.n, cx.new_avg_vals.low, cx.new_avg_vals.mid, cx.new_avg_vals.high);
     }
 
     // since the audio output was started with complete_to_idle set false,
     // call audio_out_set_state_idle
     audio_out_set_state_idle();
 }
+
+static void color_organ_rev2_update(void *cx_arg)
+{
+    rev2_cx_t  *cx = cx_arg;
+    avg_vals_t *new_avg_vals = &cx->new_avg_vals;
+    avg_vals_t *avg_vals;
+    double      low, mid, high;
+
+    // get the intensity of sound in the low, mid, and high frequency ranges
+    audio_out_get_low_mid_high(&low, &mid, &high);
+
+    // compute new_avg_vals; these will be saved to db before returining if
+    // the new_avg_vals are for a longer period of the song than the db_avg_vals
+    new_avg_vals->sum_low += low;
+    new_avg_vals->sum_mid += mid;
+    new_avg_vals->sum_high += high;
+    new_avg_vals->n++;
+
+    new_avg_vals->low = new_avg_vals->sum_low / new_avg_vals->n;
+    new_avg_vals->mid = new_avg_vals->sum_mid / new_avg_vals->n;
+    new_avg_vals->high = new_avg_vals->sum_high / new_avg_vals->n;
+
+    // select if the new_avg_vals or the avg_vals retrieved from db will be
+    // used when setting the leds below
+    avg_vals = (new_avg_vals->n > cx->db_avg_vals.n ? new_avg_vals : &cx->db_avg_vals);
+
+    // if any of the avg_vals is zero then return
+    if (avg_vals->low == 0 || avg_vals->mid == 0 || avg_vals->high == 0) {
+        return;
+    }
+
+    // set the leds
+    for (int i = 0; i < 4; i++) {
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+0, LED_RED,   low * (15 / avg_vals->low));
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+4, LED_GREEN, mid * (15 / avg_vals->mid));
+        leds_layer_set_led(LEDS_LAYER_MUSIC, i+8, LED_BLUE, high * (15 / avg_vals->high));
+    }
+}
@@ -1,4 +1,4 @@
-// gcc -g -O2 -Wall -I../utils gen.c ../utils/sf.c ../utils/logging.c ../utils/misc.c -lm -lsndfile -o gen
+// gcc -g -O2 -Wall -I../utils gen.c ../utils/sf.c ../utils/logging.c ../utils/misc.c -lm -lsndfile -lpthread -o gen
 
 #include <utils.h>
 
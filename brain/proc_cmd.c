@@ -7,6 +7,10 @@
 static char  *cmd;
 static double doa;
 static bool   cancel;
+static char  *hndlr_name = "";
+
+static pthread_mutex_t cmd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cmd_cond  = PTHREAD_COND_INITIALIZER;
 
 //
 // prototypes
@@ -26,6 +30,7 @@ static int hndlr_restart_program(args_t args);
 static int hndlr_reset_mic(args_t args);
 static int hndlr_playback(args_t args);
 static int hndlr_system_shutdown(args_t args);
+static int hndlr_latency_report(args_t args);
 // program settings
 static int hndlr_set(args_t args);
 static int hndlr_get(args_t args);
@@ -43,6 +48,10 @@ static int hndlr_body_turn(args_t args);
 static int hndlr_body_turn_to_hdg(args_t args);
 static int hndlr_body_turn_to_doa(args_t args);
 static int hndlr_body_test(args_t args);
+static int hndlr_body_home(args_t args);
+static int hndlr_body_set_origin(args_t args);
+static int hndlr_body_drive_shape(args_t args);
+static int hndlr_body_flight_rec(args_t args);
 // misc
 static int hndlr_time(args_t args);
 static int hndlr_weather_report(args_t args);
@@ -63,6 +72,7 @@ static hndlr_lookup_t hndlr_lookup_tbl[] = {
     HNDLR(reset_mic),
     HNDLR(playback),
     HNDLR(system_shutdown),
+    HNDLR(latency_report),
     // program settings
     HNDLR(set),
     HNDLR(get),
@@ -80,6 +90,10 @@ static hndlr_lookup_t hndlr_lookup_tbl[] = {
     HNDLR(body_turn_to_hdg),
     HNDLR(body_turn_to_doa),
     HNDLR(body_test),
+    HNDLR(body_home),
+    HNDLR(body_set_origin),
+    HNDLR(body_drive_shape),
+    HNDLR(body_flight_rec),
     // misc
     HNDLR(time),
     HNDLR(weather_report),
@@ -107,8 +121,11 @@ void proc_cmd_init(void)
 
 void proc_cmd_execute(char *transcript, double doa_arg)
 {
+    pthread_mutex_lock(&cmd_mutex);
     doa = doa_arg;
     cmd = transcript;
+    pthread_cond_signal(&cmd_cond);
+    pthread_mutex_unlock(&cmd_mutex);
 }
 
 bool proc_cmd_in_progress(bool *succ)
@@ -124,6 +141,12 @@ bool proc_cmd_in_progress(bool *succ)
     }
 }
 
+// returns the name of the hndlr of the last cmd, or "" if it did not match
+char *proc_cmd_get_hndlr_name(void)
+{
+    return hndlr_name;
+}
+
 void proc_cmd_cancel(void)
 {
     if (play_music_ignore_cancel()) {
@@ -146,16 +169,31 @@ static void *cmd_thread(void *cx)
 
     while (true) {
         // wait for cmd
+        pthread_mutex_lock(&cmd_mutex);
         while (cmd == NULL || cmd == (void*)1) {
-            usleep(10*MS);
+            pthread_cond_wait(&cmd_cond, &cmd_mutex);
         }
+        pthread_mutex_unlock(&cmd_mutex);
 
-        // check if cmd matches known grammar, and call hndlr proc
+        // check if cmd matches known grammar, and call hndlr proc;
+        // the time that the first audio output of the response starts is
+        // obtained from the audio pgm, for the latency trace
+        audio_out_clear_start_time();
         bool match = grammar_match(cmd, &proc, args);
+        trace_point(TRACE_GRAMMAR_MATCH);
+        hndlr_name = "";
+        for (int i = 0; match && hndlr_lookup_tbl[i].name; i++) {
+            if (hndlr_lookup_tbl[i].proc == proc) {
+                hndlr_name = hndlr_lookup_tbl[i].name;
+                break;
+            }
+        }
         INFO("match=%d, args=  '%s'  '%s'  '%s'  '%s'\n", match, args[0], args[1], args[2], args[3]);
         if (match) {
             cancel = false;
+            trace_point(TRACE_HNDLR_START);
             rc = proc(args);
+            trace_point(TRACE_HNDLR_END);
         } else {
             audio_out_beep(2, true);
             rc = -1;
@@ -163,6 +201,9 @@ static void *cmd_thread(void *cx)
 
         // wait for audio output to complete
         audio_out_wait();
+        trace_point_at(TRACE_AUDIO_OUT, audio_out_get_start_time());
+        trace_end();
+        trace_save();
 
         // done with this cmd
         free(cmd);
@@ -232,6 +273,33 @@ static int hndlr_system_shutdown(args_t args)
     return 0;
 }
 
+static int hndlr_latency_report(args_t args)
+{
+    char *desc;
+    double p50, p95;
+    unsigned int n;
+    int cnt = 0;
+
+    for (int span = 0; span < MAX_TRACE_SPAN; span++) {
+        if (trace_get_span(span, &desc, &p50, &p95, &n) < 0) {
+            continue;
+        }
+        if (p95 < 1000) {
+            t2s_play_nocache("%s, median %.0f, 95th percentile %.0f milliseconds", desc, p50, p95);
+        } else {
+            t2s_play_nocache("%s, median %.1f, 95th percentile %.1f seconds", desc, p50/1000, p95/1000);
+        }
+        cnt++;
+        if (cancel) break;
+    }
+
+    if (cnt == 0) {
+        t2s_play("there are no latency measurements");
+    }
+
+    return 0;
+}
+
 // ----------------------
 // program settings
 // ----------------------
@@ -467,6 +535,65 @@ static int hndlr_body_test(args_t args)
     return body_drive_cmd(testnum+(DRIVE_TST1-1), 0, 0, 0, 0);
 }
 
+static int hndlr_body_home(args_t args)
+{
+    t2s_play("returning to the starting point");
+
+    return body_drive_cmd(DRIVE_HOME, 0, 0, 0, 0);
+}
+
+static int hndlr_body_set_origin(args_t args)
+{
+    t2s_play("setting the starting point");
+
+    return body_drive_cmd(DRIVE_ORIG, 0, 0, 0, 0);
+}
+
+static int hndlr_body_drive_shape(args_t args)
+{
+    struct drive_path_seg_s seg[8];
+    int max_seg = 0;
+
+    #define ADD_SEG(_type,_arg0,_arg1) \
+        do { \
+            memset(&seg[max_seg], 0, sizeof(seg[0])); \
+            seg[max_seg].type = (_type); \
+            seg[max_seg].arg[0] = (_arg0); \
+            seg[max_seg].arg[1] = (_arg1); \
+            max_seg++; \
+        } while (0)
+
+    if (strcmp(args[0], "square") == 0) {
+        for (int i = 0; i < 4; i++) {
+            ADD_SEG(DRIVE_PATH_LINE, 2, 0);
+            ADD_SEG(DRIVE_PATH_ARC, 90, 1);
+        }
+    } else if (strcmp(args[0], "circle") == 0) {
+        ADD_SEG(DRIVE_PATH_ARC, 360, 1);
+    } else if (strcmp(args[0], "figure eight") == 0) {
+        ADD_SEG(DRIVE_PATH_ARC, 360, 1);
+        ADD_SEG(DRIVE_PATH_ARC, -360, 1);
+    } else {
+        t2s_play("I don't know how to drive in a %s", args[0]);
+        return -1;
+    }
+
+    t2s_play("driving in a %s", args[0]);
+
+    return body_drive_path(max_seg, seg);
+}
+
+static int hndlr_body_flight_rec(args_t args)
+{
+    if (body_flight_rec_dump() < 0) {
+        t2s_play("brain is not connected to body");
+        return -1;
+    }
+
+    t2s_play("saving the flight recorder");
+    return 0;
+}
+
 // ----------------------
 // misc
 // ----------------------
@@ -698,7 +825,7 @@ static int hndlr_search(args_t args)
     char *transcript = args[0];
 
     t2s_play("searching wikipedia for %s", transcript);
-    return customsearch(transcript);
+    return customsearch(transcript, &cancel);
 }
 
 // -----------------  SUPPORT  ----------------------------------------------
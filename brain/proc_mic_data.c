@@ -0,0 +1,268 @@
+#include <common.h>
+
+// Notes:
+// - proc_mic_data is called by the audio proc_mic_data_thread in the brain
+//   program, and by the brain_replay program with the frames from wav files.
+// - The ref arg is the audio output sample that was being played when the
+//   frame was received, or 0 if none. The echo canceller uses it to remove
+//   the audio output from the mic data that is passed to the wake word
+//   detector and speech to text.
+// - The 4 mic channels are combined by the beamformer, steered toward the
+//   talker. While waiting for the wake word the steering follows the doa,
+//   except while the audio output is playing because then the doa is that
+//   of the speaker. When the wake word is detected the steering is set to
+//   the doa of the wake word, and held for the cmd.
+// - The 4 mic channels and the ref, at 48000 sample rate, are saved in the
+//   capture_ring. For each wake word the frames from CAPTURE_PREROLL before
+//   the wake word to the transcript are copied from the capture_ring, and
+//   when the cmd completes they are passed to capture_write, along with the
+//   transcript, doa, hndlr and latency spans. capture_write stores them on
+//   its own thread. The capture_export program exports them to wav files
+//   that can be used by brain_replay.
+
+//
+// defines
+//
+
+#define MAX_RECORDING (60*16000)
+
+#define BEAM_TRACK_INTVL  (16000 / 4)   // 250 ms
+#define BEAM_MIN_CHANGE   15            // degrees
+
+#define MAX_CAPTURE_RING  (30*48000)
+#define CAPTURE_PREROLL   (2*48000)
+#define CAPTURE_CHAN      5             // 4 mics and the ref
+
+//
+// variables
+//
+
+static short recording[4][MAX_RECORDING];
+static int   recording_idx;
+
+static short          capture_ring[MAX_CAPTURE_RING][CAPTURE_CHAN];
+static uint64_t       capture_idx;       // total number of frames saved in the capture_ring
+static uint64_t       capture_wake_idx;
+static capture_info_t capture_info;
+static short        * capture_data;
+
+//
+// prototypes
+//
+
+static void beam_track(double doa);
+static void capture_start(void);
+static void capture_snapshot(char *transcript, double doa);
+static void capture_complete(int rc);
+
+// -----------------  RECORDING  -------------------------------------------------
+
+void brain_get_recording(short *mic[4], int max)
+{
+    int ri = recording_idx;
+
+    assert(max < MAX_RECORDING - 1*16000);
+
+    for (int i = 0; i < 4; i++) {
+        if (ri-max >= 0) {
+            memcpy(mic[i], recording[i]+(ri-max), max*sizeof(short));
+        } else {
+            int tmp = -(ri-max);
+            memcpy(mic[i], recording[i]+(MAX_RECORDING-tmp), tmp*sizeof(short));
+            memcpy(mic[i]+tmp, recording[i], (max-tmp)*sizeof(short));
+        }
+    }
+}
+
+// -----------------  PROCESS MIC DATA FRAME  ------------------------------------
+
+// called at sample rate 48000
+int proc_mic_data(short *frame, short ref)
+{
+    #define STATE_WAITING_FOR_WAKE_WORD  0
+    #define STATE_RECEIVING_CMD          1
+    #define STATE_PROCESSING_CMD         2
+    #define STATE_COMPLETED_CMD_OKAY     3
+    #define STATE_COMPLETED_CMD_ERROR    4
+
+    static int    state = STATE_WAITING_FOR_WAKE_WORD;
+    static double doa;
+    static double filter_cx[4];
+    static double ref_filter_cx;
+    static int    beam_track_cnt;
+    static bool   beam_track_ref_active;
+
+    short filtered_frame[4];
+    short filtered_ref;
+    short sound_val;
+
+    // save the frame and ref in the capture_ring
+    short *x = capture_ring[capture_idx % MAX_CAPTURE_RING];
+    memcpy(x, frame, 4*sizeof(short));
+    x[4] = ref;
+    capture_idx++;
+
+    // supply the frame for doa analysis, frame is 4 shorts
+    doa_feed(frame);
+
+    // discard 2 out of 3 frames, so the sample rate for the code following is 16000
+    static int discard_cnt;
+    if (++discard_cnt < 3) {
+        return 0;
+    }
+    discard_cnt = 0;
+
+    // filter the 4 microphone channels to remove some of the high pitch background noise,
+    // and filter the echo canceller reference the same way; the reference is not
+    // amplified because the audio output data may be full scale
+    for (int mic = 0; mic < 4; mic++) {
+        int tmp = 4 * low_pass_filter(frame[mic], &filter_cx[mic], 0.90);
+        filtered_frame[mic] = clip_int(tmp, -32767, 32767);
+    }
+    filtered_ref = low_pass_filter(ref, &ref_filter_cx, 0.90);
+
+    // save sound recording so it can be played to test audio quality
+    for (int mic = 0; mic < 4; mic++) {
+        recording[mic][recording_idx] = filtered_frame[mic];
+    }
+    recording_idx = (recording_idx == MAX_RECORDING-1 ? 0 : recording_idx+1);
+
+    // steer the beamformer toward the talker, see Notes at top of file
+    if (state == STATE_WAITING_FOR_WAKE_WORD) {
+        if (filtered_ref != 0) {
+            beam_track_ref_active = true;
+        }
+        if (++beam_track_cnt == BEAM_TRACK_INTVL) {
+            if (!beam_track_ref_active) {
+                beam_track(doa_get());
+            }
+            beam_track_cnt = 0;
+            beam_track_ref_active = false;
+        }
+    }
+
+    // the code following uses the beamformed sound, with the audio output echo removed
+    sound_val = aec_feed(beam_feed(filtered_frame), filtered_ref);
+
+    // process mic data state machine
+    switch (state) {
+    case STATE_WAITING_FOR_WAKE_WORD: {
+        if (wwd_feed(sound_val) & WW_KEYWORD_MASK) {
+            trace_begin();
+            capture_start();
+            state = STATE_RECEIVING_CMD;
+            doa = doa_get();
+            if (doa >= 0) {
+                beam_set_doa(doa);
+            }
+            brain_set_leds(LEDS_RECV_AND_PROC_CMD, doa);
+        }
+        break; }
+    case STATE_RECEIVING_CMD: {
+        char *transcript = s2t_feed(sound_val);
+        if (transcript) {
+            capture_snapshot(transcript, doa);
+            if (strcmp(transcript, "TIMEDOUT") == 0) {
+                free(transcript);
+                trace_end();
+                capture_complete(-1);
+                brain_set_leds(LEDS_IDLE, -1);
+                state = STATE_WAITING_FOR_WAKE_WORD;
+                break;
+            }
+            proc_cmd_execute(transcript, doa);
+            state = STATE_PROCESSING_CMD;
+        }
+        break; }
+    case STATE_PROCESSING_CMD: {
+        bool succ;
+        if (proc_cmd_in_progress(&succ) == false) {
+            state = (succ ? STATE_COMPLETED_CMD_OKAY : STATE_COMPLETED_CMD_ERROR);
+            break;
+        }
+        if (wwd_feed(sound_val) & WW_TERMINATE_MASK) {
+            proc_cmd_cancel();
+        }
+        break; }
+    case STATE_COMPLETED_CMD_OKAY: {
+        capture_complete(0);
+        brain_set_leds(LEDS_IDLE, -1);
+        state = STATE_WAITING_FOR_WAKE_WORD;
+        break; }
+    case STATE_COMPLETED_CMD_ERROR: {
+        capture_complete(-1);
+        brain_set_leds(LEDS_ERROR, -1);
+        state = STATE_WAITING_FOR_WAKE_WORD;
+        break; }
+    }
+        
+    // return 0 to continue
+    return 0;
+}
+
+// change the beamformer steering when the doa has moved by more than
+// BEAM_MIN_CHANGE, so that the steering does not dither
+static void beam_track(double doa)
+{
+    double cur = beam_get_doa();
+
+    if (doa < 0) {
+        return;
+    }
+    if (cur < 0 || fabs(normalize_angle(doa - cur + 180) - 180) > BEAM_MIN_CHANGE) {
+        beam_set_doa(doa);
+    }
+}
+
+// -----------------  CAPTURE  ---------------------------------------------------
+
+static void capture_start(void)
+{
+    capture_wake_idx = capture_idx;
+    memset(&capture_info, 0, sizeof(capture_info));
+    capture_info.time = time(NULL);
+}
+
+// copy the frames, from CAPTURE_PREROLL before the wake word to now, from
+// the capture_ring
+static void capture_snapshot(char *transcript, double doa)
+{
+    uint64_t start;
+    int n, first;
+
+    start = (capture_wake_idx > CAPTURE_PREROLL ? capture_wake_idx - CAPTURE_PREROLL : 0);
+    if (capture_idx - start > MAX_CAPTURE_RING) {
+        start = capture_idx - MAX_CAPTURE_RING;
+    }
+    n = capture_idx - start;
+
+    free(capture_data);
+    capture_data = malloc(n * sizeof(capture_ring[0]));
+    first = MAX_CAPTURE_RING - start % MAX_CAPTURE_RING;
+    if (first > n) first = n;
+    memcpy(capture_data, capture_ring[start % MAX_CAPTURE_RING], first * sizeof(capture_ring[0]));
+    memcpy(capture_data + first * CAPTURE_CHAN, capture_ring[0], (n - first) * sizeof(capture_ring[0]));
+
+    capture_info.sample_rate      = 48000;
+    capture_info.max_chan         = CAPTURE_CHAN;
+    capture_info.max_frames       = n;
+    capture_info.wake_frame       = (capture_wake_idx > start ? capture_wake_idx - start : 0);
+    capture_info.transcript_frame = n;
+    capture_info.doa              = doa;
+    snprintf(capture_info.transcript, sizeof(capture_info.transcript), "%s", transcript);
+}
+
+// called after trace_end, so the latency spans of the cmd are available
+static void capture_complete(int rc)
+{
+    if (capture_data == NULL) {
+        return;
+    }
+
+    capture_info.rc = rc;
+    snprintf(capture_info.hndlr, sizeof(capture_info.hndlr), "%s", proc_cmd_get_hndlr_name());
+    trace_get_last(capture_info.span_ms);
+
+    capture_write(&capture_info, capture_data);
+    capture_data = NULL;
+}
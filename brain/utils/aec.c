@@ -0,0 +1,485 @@
+#include <utils.h>
+
+#include <complex.h>
+
+// Notes:
+// - Acoustic echo canceller. Removes the audio output (music and speech),
+//   as picked up by the mics, from the mic data before it is passed to the
+//   wake word detector and speech to text.
+// - aec_feed is called at 16000 sample rate with a mic sample and the audio
+//   output reference sample, which must be time aligned to within about
+//   MAX_DELAY_MS. It returns the echo cancelled mic sample; the output is
+//   delayed by B samples (8 ms).
+// - The echo is estimated by a partitioned block frequency domain adaptive
+//   filter (overlap-save, P partitions of B taps each) with per frequency bin
+//   normalized LMS step size, and gradient constraint.
+// - The bulk delay from the reference to its echo, which includes the audio
+//   output and input buffering, is estimated by cross correlating the
+//   decimated and pre-whitened mic and reference signals. The reference is
+//   delayed by the estimate, less DELAY_MARGIN, so that the adaptive filter
+//   only needs to model the room's echo tail.
+// - Double talk (near end speech while the audio output is playing) is
+//   detected when, once the filter has converged, the correlation of the mic
+//   data and the estimated echo drops, and the mic power also exceeds the
+//   echo power expected from the reference power, over the filter's span, and
+//   the learned echo path gain. The power test prevents a new note of music,
+//   at frequencies the filter has not yet adapted to, from being mistaken for
+//   double talk. The filter adaptation is frozen during double talk, so that
+//   the filter does not diverge and cancel the speech; and the step size is
+//   reduced for a block whose error power jumps, which may be double talk
+//   that has not yet been detected.
+// - The step size is normalized by the reference power spectrum summed over
+//   the P partitions, which keeps the filter stable for tonal references.
+// - The cpu usage is 3 + 2*P fft's of size N per block, the gradient
+//   constraint being most of it; see the utils/tests/aec_test benchmark.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE          16000
+#define B                    128         // block size, and partition size
+#define N                    (2*B)       // fft size
+#define NB                   (B+1)       // number of unique fft bins
+#define P                    8           // number of partitions, filter length is P*B taps = 64 ms
+
+#define MU                   0.2         // nlms step size
+#define PX_SMOOTH            0.9         // smoothing of the reference power spectrum, over the filter's span
+#define PX_MIN               (1e3 * N)   // regularization of the reference power spectrum
+
+#define REF_ACTIVE_RMS       100         // reference block rms above which the filter adapts
+#define MAX_REF_HIST         8192        // reference history, must be power of 2
+
+#define MAX_DELAY_MS         400
+#define DELAY_DECIMATE       4
+#define MAX_DELAY_LAG        (MAX_DELAY_MS * SAMPLE_RATE / 1000 / DELAY_DECIMATE)
+#define DELAY_INTVL          (SAMPLE_RATE / DELAY_DECIMATE / 4)   // delay estimate every 250 ms
+#define DELAY_CORR_DECAY     0.75
+#define DELAY_PEAK_RATIO     4.0         // min peak to mean cross correlation ratio
+#define DELAY_MARGIN         (B/2)       // samples of the filter preceding the estimated delay
+
+#define DTD_SMOOTH           0.7         // smoothing of the mic and estimated echo correlation
+#define DTD_CORR_THRESHOLD   0.8         // correlation below which may be double talk
+#define DTD_PWR_THRESHOLD    2.0         // mic power above the expected echo power, 3 dB
+#define ECHO_GAIN_SMOOTH     0.99
+#define DTD_HOLD_BLOCKS      (SAMPLE_RATE / B / 4)   // adaptation remains frozen for 250 ms
+#define DTD_MAX_BLOCKS       (SAMPLE_RATE / B * 5)   // after 5 secs assume the echo path changed
+#define CONVERGED_ERLE       4.0         // 6 dB
+#define DIVERGED_ERLE        0.5         // -3 dB
+#define ERLE_SMOOTH          0.98
+#define ROBUST_ERR_RATIO     4.0         // error power above the recent level that reduces the step size
+
+#define REF_HIST(_i)  (ref_hist[(_i) & (MAX_REF_HIST-1)])
+
+//
+// variables
+//
+
+// fft
+static complex float twiddle[N/2];
+static int           bit_rev[N];
+
+// input and output blocks
+static short  mic_blk[B];
+static short  out_blk[B];
+static int    blk_idx;
+
+// reference history, and bulk delay
+static float    ref_hist[MAX_REF_HIST];
+static uint64_t ref_hist_idx;
+static int      delay = -1;      // samples, -1 until estimated
+static int      delay_est = -1;  // estimated echo delay, delay is this less DELAY_MARGIN
+
+// adaptive filter
+static complex float W[P][NB];   // filter partitions
+static complex float X[P][NB];   // reference spectra of the last P blocks, X[0] is the newest
+static float         Px[NB];     // reference power spectrum, summed over the filter's span
+static float         ref_prev_blk[B];
+
+// delay estimator
+static float  dly_mic_prev, dly_ref_prev, dly_ref_hist[MAX_DELAY_LAG];
+static float  dly_mic_acc, dly_ref_acc;
+static int    dly_dec_cnt, dly_ref_idx, dly_intvl_cnt;
+static float  dly_acc[MAX_DELAY_LAG];
+static float  dly_corr[MAX_DELAY_LAG];
+static int    dly_candidate = -1;
+
+// double talk detection and convergence
+static double dtd_r_dy, dtd_r_dd, dtd_r_yy;
+static double echo_gain_d, echo_gain_x; // smoothed mic and reference power, while not double talk
+static float  ref_pwr_hist[P];         // reference power of the blocks in the filter's span
+static int    dtd_hold, dtd_blocks;
+static double erle_d, erle_e;
+static bool   converged;
+static bool   double_talk;
+
+// stats
+static uint64_t stat_blocks, stat_active_blocks, stat_dt_blocks, stat_resets;
+static double   stat_erle_d, stat_erle_e;
+
+//
+// prototypes
+//
+
+static void process_block(void);
+static void adapt(complex float *E, float mu);
+static void filter_reset(void);
+static void delay_feed(short mic, short ref);
+static void delay_estimate(void);
+static void fft(complex float *x, bool inverse);
+
+// -----------------  API  -------------------------------------------------------
+
+void aec_init(void)
+{
+    int i, j, bits;
+
+    // fft twiddle factors and bit reversal table
+    for (i = 0; i < N/2; i++) {
+        twiddle[i] = cexpf(-2 * M_PI * I * i / N);
+    }
+    for (bits = 0; (1 << bits) < N; bits++) ;
+    for (i = 0; i < N; i++) {
+        for (bit_rev[i] = 0, j = 0; j < bits; j++) {
+            if (i & (1 << j)) bit_rev[i] |= 1 << (bits-1-j);
+        }
+    }
+
+    filter_reset();
+}
+
+short aec_feed(short mic, short ref)
+{
+    short out;
+
+    // save the mic and reference, and return the output of the prior block
+    mic_blk[blk_idx] = mic;
+    out = out_blk[blk_idx];
+
+    REF_HIST(ref_hist_idx++) = ref;
+    delay_feed(mic, ref);
+
+    if (++blk_idx == B) {
+        process_block();
+        blk_idx = 0;
+    }
+
+    return out;
+}
+
+void aec_get_stats(aec_stats_t *s)
+{
+    s->delay_ms      = (delay_est == -1 ? -1 : delay_est * 1000 / SAMPLE_RATE);
+    s->converged     = converged;
+    s->double_talk   = double_talk;
+    s->erle_db       = (stat_erle_e > 0 ? 10 * log10(stat_erle_d / stat_erle_e) : 0);
+    s->blocks        = stat_blocks;
+    s->active_blocks = stat_active_blocks;
+    s->dt_blocks     = stat_dt_blocks;
+    s->resets        = stat_resets;
+}
+
+// -----------------  ADAPTIVE FILTER  -------------------------------------------
+
+static void process_block(void)
+{
+    complex float x[N], y[N], E[N];
+    float e[B], d, yv, ref_pwr = 0, mu;
+    double blk_dd = 0, blk_ee = 0, blk_dy = 0, blk_yy = 0, ref_span_pwr = 0, corr;
+    int i, k, p;
+    uint64_t start;
+
+    stat_blocks++;
+
+    // the reference for this block, delayed by the bulk delay;
+    // until the delay has been estimated the echo is not cancelled
+    if (delay == -1) {
+        for (i = 0; i < B; i++) {
+            out_blk[i] = mic_blk[i];
+        }
+        return;
+    }
+
+    start = ref_hist_idx - B - delay;
+    for (i = 0; i < B; i++) {
+        x[i]   = ref_prev_blk[i];
+        x[i+B] = ref_prev_blk[i] = REF_HIST(start+i);
+        ref_pwr += crealf(x[i+B]) * crealf(x[i+B]);
+    }
+    ref_pwr /= B;
+
+    memmove(ref_pwr_hist+1, ref_pwr_hist, (P-1) * sizeof(ref_pwr_hist[0]));
+    ref_pwr_hist[0] = ref_pwr;
+    for (p = 0; p < P; p++) {
+        ref_span_pwr = fmax(ref_span_pwr, ref_pwr_hist[p]);
+    }
+
+    // shift the reference spectra, and compute the spectrum of the newest 2 blocks
+    memmove(X[1], X[0], (P-1) * sizeof(X[0]));
+    fft(x, false);
+    memcpy(X[0], x, sizeof(X[0]));
+
+    // estimated echo: y = last B samples of ifft(sum over p of W[p] * X[p])
+    for (k = 0; k < NB; k++) {
+        complex float sum = 0;
+        for (p = 0; p < P; p++) {
+            sum += W[p][k] * X[p][k];
+        }
+        y[k] = sum;
+    }
+    for (k = NB; k < N; k++) {
+        y[k] = conjf(y[N-k]);
+    }
+    fft(y, true);
+
+    // error, which is the output
+    for (i = 0; i < B; i++) {
+        d = mic_blk[i];
+        yv = crealf(y[i+B]);
+        e[i] = d - yv;
+        out_blk[i] = clip_int(lrintf(e[i]), -32767, 32767);
+
+        blk_dd += d * d;
+        blk_ee += e[i] * e[i];
+        blk_dy += d * yv;
+        blk_yy += yv * yv;
+    }
+
+    // when the reference is silent there is nothing to adapt to
+    if (ref_pwr < REF_ACTIVE_RMS * REF_ACTIVE_RMS) {
+        double_talk = false;
+        dtd_hold = dtd_blocks = 0;
+        return;
+    }
+    stat_active_blocks++;
+
+    // double talk detection: once the filter has converged the estimated echo
+    // is highly correlated with the mic data, unless there is near end speech,
+    // or the reference contains frequencies that the filter has not adapted to;
+    // the latter is distinguished by the mic power being as expected from the
+    // reference power and the echo path gain
+    dtd_r_dy = DTD_SMOOTH * dtd_r_dy + (1-DTD_SMOOTH) * blk_dy;
+    dtd_r_dd = DTD_SMOOTH * dtd_r_dd + (1-DTD_SMOOTH) * blk_dd;
+    dtd_r_yy = DTD_SMOOTH * dtd_r_yy + (1-DTD_SMOOTH) * blk_yy;
+    corr = (dtd_r_dd > 0 && dtd_r_yy > 0 ? dtd_r_dy / sqrt(dtd_r_dd * dtd_r_yy) : 0);
+    if (converged && corr < DTD_CORR_THRESHOLD &&
+        blk_dd / B > DTD_PWR_THRESHOLD * (echo_gain_d / echo_gain_x) * ref_span_pwr)
+    {
+        dtd_hold = DTD_HOLD_BLOCKS;
+    }
+    double_talk = (dtd_hold > 0);
+    if (double_talk) {
+        dtd_hold--;
+        stat_dt_blocks++;
+        // continuous double talk is more likely an echo path change, such as
+        // the robot moving, so resume adaptation
+        if (++dtd_blocks < DTD_MAX_BLOCKS) {
+            return;
+        }
+        converged = false;
+        double_talk = false;
+        dtd_hold = 0;
+        echo_gain_d = echo_gain_x = 0;
+    }
+    dtd_blocks = 0;
+
+    // echo path gain
+    echo_gain_d = ECHO_GAIN_SMOOTH * echo_gain_d + (1-ECHO_GAIN_SMOOTH) * blk_dd / B;
+    echo_gain_x = ECHO_GAIN_SMOOTH * echo_gain_x + (1-ECHO_GAIN_SMOOTH) * ref_span_pwr;
+
+    // once converged, a block whose error power is well above the recent level
+    // is likely the start of double talk that has not yet been detected, so
+    // the step size is reduced
+    mu = MU;
+    if (converged && blk_ee > ROBUST_ERR_RATIO * erle_e) {
+        mu *= ROBUST_ERR_RATIO * erle_e / blk_ee;
+    }
+
+    // echo return loss enhancement, excluding double talk, is used to
+    // determine whether the filter has converged or diverged
+    erle_d = ERLE_SMOOTH * erle_d + (1-ERLE_SMOOTH) * blk_dd;
+    erle_e = ERLE_SMOOTH * erle_e + (1-ERLE_SMOOTH) * blk_ee;
+    stat_erle_d += blk_dd;
+    stat_erle_e += blk_ee;
+    converged = (erle_d > CONVERGED_ERLE * erle_e);
+    if (erle_d < DIVERGED_ERLE * erle_e && stat_active_blocks > 10) {
+        WARN("aec filter diverged, erle %0.1f dB\n", 10*log10(erle_d/erle_e));
+        filter_reset();
+        return;
+    }
+
+    // adapt the filter
+    for (i = 0; i < B; i++) {
+        E[i]   = 0;
+        E[i+B] = e[i];
+    }
+    fft(E, false);
+    adapt(E, mu);
+}
+
+static void adapt(complex float *E, float mu)
+{
+    complex float g[N];
+    int k, p, i;
+
+    // reference power spectrum, summed over the partitions; so that a bin's step
+    // size is not large when the bin's power in the newest block is small but
+    // is large in older blocks
+    for (k = 0; k < NB; k++) {
+        float pwr = 0;
+        for (p = 0; p < P; p++) {
+            pwr += crealf(X[p][k]) * crealf(X[p][k]) + cimagf(X[p][k]) * cimagf(X[p][k]);
+        }
+        Px[k] = PX_SMOOTH * Px[k] + (1-PX_SMOOTH) * pwr;
+    }
+
+    // normalized gradient for each partition, constrained to B taps so that
+    // the circular convolution is equivalent to linear convolution
+    for (p = 0; p < P; p++) {
+        for (k = 0; k < NB; k++) {
+            g[k] = mu * conjf(X[p][k]) * E[k] / (Px[k] + PX_MIN);
+        }
+        for (k = NB; k < N; k++) {
+            g[k] = conjf(g[N-k]);
+        }
+        fft(g, true);
+        for (i = B; i < N; i++) {
+            g[i] = 0;
+        }
+        fft(g, false);
+        for (k = 0; k < NB; k++) {
+            W[p][k] += g[k];
+        }
+    }
+}
+
+static void filter_reset(void)
+{
+    memset(W, 0, sizeof(W));
+    memset(X, 0, sizeof(X));
+    memset(Px, 0, sizeof(Px));
+    memset(ref_prev_blk, 0, sizeof(ref_prev_blk));
+
+    memset(ref_pwr_hist, 0, sizeof(ref_pwr_hist));
+    dtd_r_dy = dtd_r_dd = dtd_r_yy = 0;
+    echo_gain_d = echo_gain_x = 0;
+    dtd_hold = dtd_blocks = 0;
+    erle_d = erle_e = 0;
+    converged = false;
+    double_talk = false;
+
+    stat_resets++;
+}
+
+// -----------------  DELAY ESTIMATOR  -------------------------------------------
+
+// the mic and reference are pre-whitened by differencing, so that the
+// cross correlation of music has a sharp peak, and decimated
+static void delay_feed(short mic, short ref)
+{
+    float m, r;
+    int lag, idx;
+
+    dly_mic_acc += mic - dly_mic_prev;
+    dly_ref_acc += ref - dly_ref_prev;
+    dly_mic_prev = mic;
+    dly_ref_prev = ref;
+    if (++dly_dec_cnt < DELAY_DECIMATE) {
+        return;
+    }
+    m = dly_mic_acc;
+    r = dly_ref_acc;
+    dly_mic_acc = dly_ref_acc = 0;
+    dly_dec_cnt = 0;
+
+    // save the decimated reference
+    dly_ref_hist[dly_ref_idx] = r;
+
+    // accumulate the cross correlation of the mic with the delayed reference,
+    // when the reference is active
+    if (fabsf(r) > REF_ACTIVE_RMS / 4) {
+        for (lag = 0, idx = dly_ref_idx; lag < MAX_DELAY_LAG; lag++) {
+            dly_acc[lag] += m * dly_ref_hist[idx];
+            if (--idx < 0) idx = MAX_DELAY_LAG-1;
+        }
+    }
+    dly_ref_idx = (dly_ref_idx + 1) % MAX_DELAY_LAG;
+
+    if (++dly_intvl_cnt == DELAY_INTVL) {
+        delay_estimate();
+        dly_intvl_cnt = 0;
+    }
+}
+
+static void delay_estimate(void)
+{
+    double sum = 0, mean, peak = 0;
+    int lag, peak_lag = 0, est;
+
+    for (lag = 0; lag < MAX_DELAY_LAG; lag++) {
+        dly_corr[lag] = DELAY_CORR_DECAY * dly_corr[lag] + dly_acc[lag];
+        dly_acc[lag] = 0;
+        sum += fabsf(dly_corr[lag]);
+        if (fabsf(dly_corr[lag]) > peak) {
+            peak = fabsf(dly_corr[lag]);
+            peak_lag = lag;
+        }
+    }
+    mean = sum / MAX_DELAY_LAG;
+    if (peak == 0 || peak < DELAY_PEAK_RATIO * mean) {
+        dly_candidate = -1;
+        return;
+    }
+
+    // the estimate must be repeated before the delay is changed;
+    // and the delay is only changed if the echo's direct path is not near
+    // the start of the adaptive filter
+    est = peak_lag * DELAY_DECIMATE;
+    if (dly_candidate == -1 || abs(est - dly_candidate) > DELAY_MARGIN/2) {
+        dly_candidate = est;
+        return;
+    }
+    if (delay_est != -1 && abs(est - delay_est) <= DELAY_MARGIN/2) {
+        return;
+    }
+
+    delay_est = est;
+    delay = (est > DELAY_MARGIN ? est - DELAY_MARGIN : 0);
+    INFO("aec delay %d ms\n", delay_est * 1000 / SAMPLE_RATE);
+    filter_reset();
+}
+
+// -----------------  FFT  -------------------------------------------------------
+
+// in place radix 2 fft of size N; the inverse is scaled by 1/N
+static void fft(complex float *x, bool inverse)
+{
+    int i, j, len, half, step;
+    complex float t, w;
+
+    for (i = 0; i < N; i++) {
+        j = bit_rev[i];
+        if (i < j) {
+            t = x[i]; x[i] = x[j]; x[j] = t;
+        }
+    }
+
+    for (len = 2; len <= N; len <<= 1) {
+        half = len / 2;
+        step = N / len;
+        for (i = 0; i < N; i += len) {
+            for (j = 0; j < half; j++) {
+                w = (inverse ? conjf(twiddle[j*step]) : twiddle[j*step]);
+                t = w * x[i+j+half];
+                x[i+j+half] = x[i+j] - t;
+                x[i+j] += t;
+            }
+        }
+    }
+
+    if (inverse) {
+        for (i = 0; i < N; i++) {
+            x[i] *= (1.0f / N);
+        }
+    }
+}
@@ -10,6 +10,9 @@
 #define BEEP_AMPLITUDE   6000
 #define MAX_BEEP_DATA    (BEEP_SAMPLE_RATE * BEEP_DURATION_MS / 1000)
 
+#define MIC_SAMPLE_RATE  48000
+#define REF_POS_GAIN     0.01    // correction of the reference position, per output data_idx update
+
 // variables
 static pthread_t proc_mic_data_tid;
 static audio_shm_t *shm;
@@ -20,10 +23,15 @@ static short beep_data[MAX_BEEP_DATA];
 // prototypes
 static void audio_exit(void);
 static void *proc_mic_data_thread(void *cx);
+static short audio_out_ref(int fidx);
+static void audio_out_wait_state(bool (*cond)(int state));
+static void audio_out_set_state(int state);
+static bool state_is_idle(int state);
+static bool state_is_idle_or_done(int state);
 
 // -----------------  INIT  -------------------------------------------------
 
-void audio_init(int (*proc_mic_data)(short *frame), int volume)
+void audio_init(int (*proc_mic_data)(short *frame, short ref), int volume)
 {
     int rc, fd;
 
@@ -89,7 +97,7 @@ static void * proc_mic_data_thread(void *cx)
 {
     int curr_fidx;
     int last_fidx = 0;
-    int (*proc_mic_data)(short *frame) = cx;
+    int (*proc_mic_data)(short *frame, short ref) = cx;
 
     while (true) {
         if (audio_exitting) {
@@ -98,25 +106,69 @@ static void * proc_mic_data_thread(void *cx)
 
         curr_fidx = shm->fidx;
         while (last_fidx != curr_fidx) {
-            proc_mic_data(shm->frames[last_fidx]);
+            proc_mic_data(shm->frames[last_fidx], audio_out_ref(last_fidx));
             last_fidx = (last_fidx + 1) % 48000;
         }
 
-        usleep(1*MS);
+        // wait for the audio pgm to publish more frames; the timeout is
+        // so that audio_exitting is checked
+        futex_wait(&shm->fidx, curr_fidx, 100*MS);
     }
 
     return NULL;
 }
 
+// Returns the audio output sample that was being played when the mic frame
+// was received, resampled to the mic sample rate; this is the reference for
+// the echo canceller.
+//
+// The audio pgm's output data_idx advances in bursts, as portaudio requests
+// buffers. So the reference position advances at the audio output sample rate,
+// and is corrected by a fraction of its difference from data_idx when data_idx
+// is updated. The remaining constant offset is part of the echo delay that
+// is estimated by the echo canceller.
+static short audio_out_ref(int fidx)
+{
+    static double pos = -1;
+    static int    last_out_pos = -1;
+    int out_pos = shm->out_pos[fidx];
+    int idx;
+    double frac;
+
+    if (out_pos < 0 || shm->sample_rate <= 0) {
+        pos = last_out_pos = -1;
+        return 0;
+    }
+
+    // advance the reference position
+    if (pos < 0 || fabs(out_pos - pos) > shm->sample_rate / 10) {
+        pos = out_pos;
+    } else {
+        pos += (double)shm->sample_rate / MIC_SAMPLE_RATE;
+        if (out_pos != last_out_pos) {
+            pos += REF_POS_GAIN * (out_pos - pos);
+        }
+    }
+    last_out_pos = out_pos;
+
+    // interpolate the audio output data at the reference position
+    idx = pos;
+    frac = pos - idx;
+    if (idx + 1 >= shm->max_data) {
+        return 0;
+    }
+    return shm->data[idx] + frac * (shm->data[idx+1] - shm->data[idx]);
+}
+
 // -----------------  AUDIO IN API ROUTINES  ---------------------------------
 
 int audio_in_reset_mic(void)
 {
-    int count = 0;
+    uint64_t start = microsec_timer();
 
     shm->reset_mic = true;
-    while (shm->reset_mic && count++ < 200) {
-        usleep(10*MS);
+    while (shm->reset_mic && microsec_timer() - start < 2*SECONDS) {
+        futex_wait(&shm->reset_mic, true, 100*MS);
     }
 
     return (shm->reset_mic == false ? 0 : -1);
@@ -128,7 +180,7 @@ int audio_in_reset_mic(void)
 void audio_out_beep(int beep_count, bool complete_to_idle)
 {
     MUTEX_LOCK;
-    while (shm->state != AUDIO_OUT_STATE_IDLE) usleep(10*MS);
+    audio_out_wait_state(state_is_idle);
     shm->state = AUDIO_OUT_STATE_PREP;
     MUTEX_UNLOCK;
     
@@ -140,13 +192,13 @@ void audio_out_beep(int beep_count, bool complete_to_idle)
     shm->complete_to_idle = complete_to_idle;
 
     __sync_synchronize();
-    shm->state = AUDIO_OUT_STATE_PLAY;
+    audio_out_set_state(AUDIO_OUT_STATE_PLAY);
 }
 
 void audio_out_play_data(short *data, int max_data, int sample_rate, bool complete_to_idle)
 {
     MUTEX_LOCK;
-    while (shm->state != AUDIO_OUT_STATE_IDLE) usleep(10*MS);
+    audio_out_wait_state(state_is_idle);
     shm->state = AUDIO_OUT_STATE_PREP;
     MUTEX_UNLOCK;
 
@@ -156,7 +208,7 @@ void audio_out_play_data(short *data, int max_data, int sample_rate, bool comple
     shm->complete_to_idle = complete_to_idle;
 
     __sync_synchronize();
-    shm->state = AUDIO_OUT_STATE_PLAY;
+    audio_out_set_state(AUDIO_OUT_STATE_PLAY);
 }
 
 void audio_out_play_wav(char *file_name, bool complete_to_idle)
@@ -165,7 +217,7 @@ void audio_out_play_wav(char *file_name, bool complete_to_idle)
 
     // wait for AUDIO_OUT_STATE_IDLE, and set state to AUDIO_OUT_STATE_PREP
     MUTEX_LOCK;
-    while (shm->state != AUDIO_OUT_STATE_IDLE) usleep(10*MS);
+    audio_out_wait_state(state_is_idle);
     shm->state = AUDIO_OUT_STATE_PREP;
     MUTEX_UNLOCK;
     
@@ -174,7 +226,7 @@ void audio_out_play_wav(char *file_name, bool complete_to_idle)
     rc = sf_read_wav_file2(file_name, shm->data, &max_chan, &shm->max_data, &shm->sample_rate);
     if (rc < 0) {
         ERROR("sf_read_wav_file failed, %s\n", file_name);
-        shm->state = AUDIO_OUT_STATE_IDLE;
+        audio_out_set_state(AUDIO_OUT_STATE_IDLE);
         return;
     }
     INFO("max_data=%d  max_chan=%d  sample_rate=%d\n", shm->max_data, max_chan, shm->sample_rate);
@@ -188,14 +240,13 @@ void audio_out_play_wav(char *file_name, bool complete_to_idle)
 
     // set AUDIO_OUT_STATE_PLAY
     __sync_synchronize();
-    shm->state = AUDIO_OUT_STATE_PLAY;
+    audio_out_set_state(AUDIO_OUT_STATE_PLAY);
 }
 
 // Wait for audio output to complete.
 void audio_out_wait(void)
 {
-    while (shm->state != AUDIO_OUT_STATE_IDLE && shm->state != AUDIO_OUT_STATE_PLAY_DONE)
-        usleep(10*MS);
+    audio_out_wait_state(state_is_idle_or_done);
 }
 
 // Return true if audio output has completed.
@@ -229,7 +280,34 @@ void audio_out_set_state_idle(void)
         ERROR("audio_out_state = %d, should be AUDIO_OUT_STATE_DONE\n", shm->state);
         return;
     }
-    shm->state = AUDIO_OUT_STATE_IDLE;
+    audio_out_set_state(AUDIO_OUT_STATE_IDLE);
+}
+
+// Wait for the audio output state to satisfy cond. The state is changed by
+// both the audio pgm and this program, and both call futex_wake when changing it.
+static void audio_out_wait_state(bool (*cond)(int state))
+{
+    int state;
+
+    while (state = shm->state, !cond(state)) {
+        futex_wait(&shm->state, state, 100*MS);
+    }
+}
+
+static void audio_out_set_state(int state)
+{
+    shm->state = state;
+    futex_wake(&shm->state);
+}
+
+static bool state_is_idle(int state)
+{
+    return state == AUDIO_OUT_STATE_IDLE;
+}
+
+static bool state_is_idle_or_done(int state)
+{
+    return state == AUDIO_OUT_STATE_IDLE || state == AUDIO_OUT_STATE_PLAY_DONE;
 }
 
 // Return sound level for the low, mid and high frequency bands
@@ -240,6 +318,20 @@ void audio_out_get_low_mid_high(double *low, double *mid, double *high)
     *high = shm->high;
 }
 
+// Clear the time that the first frame of audio output was played, so that
+// the time of the next audio output is returned by audio_out_get_start_time.
+void audio_out_clear_start_time(void)
+{
+    shm->out_start_us = 0;
+}
+
+// Return the microsec_timer value when the first frame of the audio output
+// that started after audio_out_clear_start_time was played, or 0 if none.
+uint64_t audio_out_get_start_time(void)
+{
+    return shm->out_start_us;
+}
+
 // Set audio output volume.
 // Notes:
 // - aplay -l              - displays card numbers
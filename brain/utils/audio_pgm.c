@@ -7,6 +7,7 @@ static bool         end_program;
 static pthread_t    recv_mic_data_tid;
 static int          recv_mic_data_start_fidx;
 static bool         recv_mic_data_workaround;
+static volatile int out_data_idx = -1;
 
 // prototypes
 static void sig_hndlr(int sig);
@@ -97,11 +98,13 @@ static void sig_hndlr(int sig)
 static void *audio_out_thread(void *cx)
 {
     int end_program_cnt = 0;
+    int state;
 
     while (true) {
-        // wait
-        while (shm->state != AUDIO_OUT_STATE_PLAY) {
-            usleep(10*MS);
+        // wait for the brain to set AUDIO_OUT_STATE_PLAY; when terminating,
+        // continue waiting for about 1 second for audio output to be requested
+        while ((state = shm->state) != AUDIO_OUT_STATE_PLAY) {
+            futex_wait(&shm->state, state, end_program ? 10*MS : 1*SECONDS);
             if (end_program && end_program_cnt++ > 100) {
                 return NULL;
             }
@@ -115,6 +118,7 @@ static void *audio_out_thread(void *cx)
         // done
         shm->state = (shm->complete_to_idle ? AUDIO_OUT_STATE_IDLE 
                                             : AUDIO_OUT_STATE_PLAY_DONE);
+        futex_wake(&shm->state);
     }
 
     return NULL;
@@ -131,9 +135,16 @@ static int audio_out_get_frame(void *data_arg, void *cx)
 
     // if no more data, return -1, causing the call to pa_play2 to return
     if (shm->max_data == 0) {
+        out_data_idx = -1;
         return -1;
     }
 
+    // if this is the first frame of the audio output, and the brain has
+    // cleared out_start_us, then set the time the audio output started
+    if (data_idx == 0 && shm->out_start_us == 0) {
+        shm->out_start_us = microsec_timer();
+    }
+
     // keep track of the amplitude in the low, medium and high frequency bands
     lmh(shm->data[data_idx]);
 
@@ -155,6 +166,9 @@ static int audio_out_get_frame(void *data_arg, void *cx)
     }
     data[0] = data[1] = x;
 
+    // publish the data_idx, it is saved with the mic frames for the echo canceller
+    out_data_idx = data_idx;
+
     // increment data_idx;
     // if data_idx is now max_dat then reset data_idx and max_data to zero;
     // resetting max_data to zero will cause this routine to return -1 on the next call
@@ -227,6 +241,7 @@ static int recv_mic_data(const void *frame_arg_as_void, void *cx)
     // stop receiving mic data, and cause the call to pa_record2 to return
     if (shm->reset_mic) {
         shm->reset_mic = false;
+        futex_wake(&shm->reset_mic);
 
         recv_mic_data_workaround = false;
         cnt = 0;
@@ -246,6 +261,9 @@ static int recv_mic_data(const void *frame_arg_as_void, void *cx)
         cnt2++;
     }
 
+    // save the audio output data_idx that is being played, for the echo canceller
+    shm->out_pos[shm->fidx+cnt] = (shm->state == AUDIO_OUT_STATE_PLAY ? out_data_idx : -1);
+
     // store frame in array, to be processed by the proc_mic_data_thread, in brain.c
     if (recv_mic_data_workaround == false) {
         memcpy(shm->frames[shm->fidx+cnt], frame_arg, sizeof(shm->frames[0]));
@@ -263,6 +281,7 @@ static int recv_mic_data(const void *frame_arg_as_void, void *cx)
     if (cnt == 48) {
         __sync_synchronize();
         shm->fidx = (shm->fidx + 48) % 48000;
+        futex_wake(&shm->fidx);
         cnt = 0;
     }
 
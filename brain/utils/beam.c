@@ -0,0 +1,163 @@
+#include <utils.h>
+
+// Notes:
+// - Delay and sum beamformer for the respeaker 4 mic array. The 4 mic
+//   channels are delayed so that sound arriving from the steering direction
+//   is time aligned across the channels, and then averaged. Sound from the
+//   steering direction is unchanged, whereas uncorrelated noise (mic self
+//   noise, and diffuse room noise at higher frequencies) is reduced by up to
+//   6 dB, and sound from other directions is attenuated at the higher
+//   frequencies.
+// - beam_feed is called at 16000 sample rate with the 4 mic samples, and
+//   returns the beamformed sample; the output is delayed by about
+//   BEAM_LATENCY samples (0.5 ms).
+// - beam_set_doa steers the beam; the angle uses the same convention as
+//   doa_get. A doa of -1 selects the unsteered beam, where all channels
+//   have the same delay.
+// - The delays are a fraction of a sample at 16000 sample rate, so each
+//   channel is delayed by a windowed sinc fractional delay filter of MAX_TAPS
+//   taps. When the steering changes the outputs of the old and new filters
+//   are cross faded, to avoid a click.
+// - Mic positions, in the doa_get angle convention (which follows from the
+//   mic pairs and ANGLE_OFFSET used by doa.c), are on a circle of radius
+//   MIC_RADIUS at angles 45, 135, 225 and 315 degrees for mics 0 to 3.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE       16000
+#define MAX_CHAN          4
+#define MAX_TAPS          16
+#define BEAM_LATENCY      ((MAX_TAPS-1) / 2.)
+#define MAX_HIST          (2*MAX_TAPS)
+
+#define MIC_RADIUS        0.040       // meters, half the distance between mics 0 and 2
+#define MIC_ANGLE(_m)     (45 + 90*(_m))
+#define SPEED_OF_SOUND    343.
+#define FILTER_CUTOFF     0.9         // fraction of nyquist
+
+#define XFADE_SAMPLES     (SAMPLE_RATE / 100)   // 10 ms
+
+//
+// variables
+//
+
+// per channel input history; each sample is stored twice, at idx and
+// idx+MAX_TAPS, so that the last MAX_TAPS samples are always contiguous
+static float  hist[MAX_CHAN][MAX_HIST];
+static int    hist_idx;
+
+// fractional delay filters, for the current and the prior steering
+static float  coeffs[MAX_CHAN][MAX_TAPS];
+static float  prior_coeffs[MAX_CHAN][MAX_TAPS];
+static int    xfade_cnt;
+static double steer_doa = -1;
+
+//
+// prototypes
+//
+
+static void compute_coeffs(double doa, float c[MAX_CHAN][MAX_TAPS]);
+static float filter(float c[MAX_CHAN][MAX_TAPS], int start);
+
+// -----------------  API  -------------------------------------------------------
+
+void beam_init(void)
+{
+    memset(hist, 0, sizeof(hist));
+    hist_idx = 0;
+    xfade_cnt = 0;
+    steer_doa = -1;
+    compute_coeffs(steer_doa, coeffs);
+}
+
+short beam_feed(const short *frame)
+{
+    int chan, start;
+    float out;
+
+    // add the frame to the history
+    for (chan = 0; chan < MAX_CHAN; chan++) {
+        hist[chan][hist_idx] = hist[chan][hist_idx+MAX_TAPS] = frame[chan];
+    }
+    hist_idx = (hist_idx + 1) % MAX_TAPS;
+    start = hist_idx;
+
+    // filter and sum the channels; while cross fading, also filter using
+    // the prior steering, and fade from that to the new
+    out = filter(coeffs, start);
+    if (xfade_cnt > 0) {
+        float w = (float)xfade_cnt / XFADE_SAMPLES;
+        out = w * filter(prior_coeffs, start) + (1 - w) * out;
+        xfade_cnt--;
+    }
+
+    return clip_int(lrintf(out), -32767, 32767);
+}
+
+void beam_set_doa(double doa)
+{
+    if (doa == steer_doa) {
+        return;
+    }
+
+    memcpy(prior_coeffs, coeffs, sizeof(coeffs));
+    compute_coeffs(doa, coeffs);
+    xfade_cnt = XFADE_SAMPLES;
+    steer_doa = doa;
+}
+
+double beam_get_doa(void)
+{
+    return steer_doa;
+}
+
+// -----------------  FILTERS  ---------------------------------------------------
+
+// computes the fractional delay filter for each channel; the delay for a mic
+// is larger the closer the mic is to the source, so the channels align
+static void compute_coeffs(double doa, float c[MAX_CHAN][MAX_TAPS])
+{
+    int chan, t;
+    double delay, x, sum;
+
+    for (chan = 0; chan < MAX_CHAN; chan++) {
+        delay = BEAM_LATENCY;
+        if (doa >= 0) {
+            delay += MIC_RADIUS * cos((doa - MIC_ANGLE(chan)) * (M_PI/180)) / SPEED_OF_SOUND * SAMPLE_RATE;
+        }
+
+        // blackman windowed sinc, centered on the delay, and normalized to unity gain
+        sum = 0;
+        for (t = 0; t < MAX_TAPS; t++) {
+            x = t - delay;
+            if (fabs(x) >= MAX_TAPS/2) {
+                c[chan][t] = 0;
+                continue;
+            }
+            c[chan][t] = (x == 0 ? FILTER_CUTOFF : sin(M_PI * FILTER_CUTOFF * x) / (M_PI * x)) *
+                         (0.42 + 0.5 * cos(M_PI * x / (MAX_TAPS/2)) + 0.08 * cos(2 * M_PI * x / (MAX_TAPS/2)));
+            sum += c[chan][t];
+        }
+        for (t = 0; t < MAX_TAPS; t++) {
+            c[chan][t] /= sum * MAX_CHAN;
+        }
+    }
+}
+
+// c[chan][0] applies to the newest sample, which is at hist[chan][start+MAX_TAPS-1]
+static float filter(float c[MAX_CHAN][MAX_TAPS], int start)
+{
+    int chan, t;
+    float sum = 0;
+
+    for (chan = 0; chan < MAX_CHAN; chan++) {
+        const float *h = &hist[chan][start];
+        for (t = 0; t < MAX_TAPS; t++) {
+            sum += c[chan][t] * h[MAX_TAPS-1-t];
+        }
+    }
+
+    return sum;
+}
@@ -0,0 +1,588 @@
+#include <utils.h>
+
+// Notes:
+// - Stores captured utterances: the multi channel audio, and a
+//   capture_info_t that describes it. The brain captures the audio of
+//   each wake word activation, see proc_mic_data.c; and the
+//   capture_export program exports the captures to wav files for the
+//   brain_replay program.
+// - The captures are stored in a directory, containing:
+//   . segment files, seg_NNNNNN.dat, to which the captures are appended
+//   . an index file, with an entry for each capture
+//   When the total size of the segment files exceeds the max_bytes
+//   provided to capture_init, the oldest segment file is deleted, and its
+//   entries are removed from the index.
+// - capture_write queues the capture to the capture_writer_thread, which
+//   compresses and stores it; so capture_write can be called from the
+//   thread that processes the mic data.
+// - The audio is compressed, without loss, similar to FLAC: each channel is
+//   divided into blocks, and for each block the fixed polynomial predictor
+//   (order 0, 1 or 2) with the smallest residual is selected, and the
+//   residuals are rice coded with a parameter computed from their mean.
+//   Mic data compresses to about half of its size.
+
+//
+// defines
+//
+
+#define MAGIC_INDEX       0x43415049   // 'CAPI'
+#define MAGIC_RECORD      0x43415052   // 'CAPR'
+
+#define INDEX_FILENAME    "index"
+#define MAX_SEG_COUNT     8            // the segment size is max_bytes / MAX_SEG_COUNT
+#define MIN_SEG_BYTES     (1*MB)
+
+#define BLOCK_FRAMES      4096
+#define MAX_ORDER         2
+#define MAX_RICE_K        20
+#define ESC_Q             24           // unary quotient that escapes to ESC_BITS raw bits
+#define ESC_BITS          20           // the zigzag of an order 2 residual is less than 2^19
+
+#define MAX_QUEUE         4
+
+#define MUTEX_LOCK   do { pthread_mutex_lock(&mutex); } while (0)
+#define MUTEX_UNLOCK do { pthread_mutex_unlock(&mutex); } while (0)
+
+//
+// typedefs
+//
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t seg;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t pad;
+    uint64_t time;
+} index_t;
+
+typedef struct {
+    uint32_t       magic;
+    uint32_t       len;      // of the record, including this header
+    capture_info_t info;
+    uint32_t       enc_len;
+    uint32_t       pad;
+} record_hdr_t;
+
+typedef struct {
+    unsigned char *buff;
+    int            len;      // bytes
+    uint64_t       acc;
+    int            acc_bits;
+} bits_t;
+
+typedef struct {
+    capture_info_t info;
+    short         *data;
+} job_t;
+
+//
+// variables
+//
+
+static char            dir[200];
+static uint64_t        max_bytes;
+static uint64_t        seg_max_bytes;
+static index_t        *index_tbl;
+static int             max_index;
+static int             index_alloc;
+static uint32_t        cur_seg;
+static uint64_t        cur_seg_len;
+static uint32_t        next_id;
+static bool            writer_enabled;
+
+static job_t           queue[MAX_QUEUE];
+static int             queue_head, queue_tail;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond  = PTHREAD_COND_INITIALIZER;
+
+//
+// prototypes
+//
+
+static void load_index(void);
+static void *capture_writer_thread(void *cx);
+static void store(capture_info_t *info, short *data);
+static void retention(void);
+static char *seg_pathname(uint32_t seg, char *s);
+static int encode(short *data, int max_frames, int max_chan, unsigned char *buff);
+static int decode(unsigned char *buff, int len, short *data, int max_frames, int max_chan);
+static void encode_block(bits_t *b, short *x, int stride, int n);
+static int decode_block(bits_t *b, short *x, int stride, int n);
+static void put_bits(bits_t *b, uint32_t val, int nbits);
+static void flush_bits(bits_t *b);
+static uint32_t get_bits(bits_t *b, int nbits);
+
+// -----------------  INIT  ------------------------------------------------------
+
+// start storing captures in directory dirname; this is used by the program
+// that captures the utterances
+void capture_init(char *dirname, uint64_t max_bytes_arg)
+{
+    pthread_t tid;
+    struct stat buf;
+    char pathname[300];
+
+    capture_open(dirname);
+
+    max_bytes = max_bytes_arg;
+    seg_max_bytes = max_bytes / MAX_SEG_COUNT;
+    if (seg_max_bytes < MIN_SEG_BYTES) seg_max_bytes = MIN_SEG_BYTES;
+
+    // continue appending to the last segment
+    cur_seg = (max_index > 0 ? index_tbl[max_index-1].seg : 1);
+    cur_seg_len = (stat(seg_pathname(cur_seg, pathname), &buf) == 0 ? buf.st_size : 0);
+
+    writer_enabled = true;
+    pthread_create(&tid, NULL, capture_writer_thread, NULL);
+
+    INFO("capture dir=%s count=%d next_id=%d\n", dir, max_index, next_id);
+}
+
+// open directory dirname to read the captures; this is used by the programs
+// that read the captures, and by capture_init
+void capture_open(char *dirname)
+{
+    snprintf(dir, sizeof(dir), "%s", dirname);
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        FATAL("mkdir %s, %s\n", dir, strerror(errno));
+    }
+
+    load_index();
+}
+
+static void load_index(void)
+{
+    char pathname[300];
+    struct stat buf;
+    int fd, len;
+
+    free(index_tbl);
+    index_tbl = NULL;
+    max_index = index_alloc = 0;
+    next_id = 1;
+
+    sprintf(pathname, "%s/%s", dir, INDEX_FILENAME);
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fstat(fd, &buf);
+    max_index = index_alloc = buf.st_size / sizeof(index_t);
+    index_tbl = malloc((index_alloc ? index_alloc : 1) * sizeof(index_t));
+    len = read(fd, index_tbl, max_index * sizeof(index_t));
+    close(fd);
+    if (len != max_index * sizeof(index_t)) {
+        FATAL("read %s, len=%d, %s\n", pathname, len, strerror(errno));
+    }
+
+    // an entry that was partially written when the program terminated
+    // is discarded
+    while (max_index > 0 && index_tbl[max_index-1].magic != MAGIC_INDEX) {
+        max_index--;
+    }
+    if (max_index > 0) {
+        next_id = index_tbl[max_index-1].id + 1;
+    }
+}
+
+// -----------------  WRITE  -----------------------------------------------------
+
+// queue the capture to be stored by the capture_writer_thread; the data is
+// freed when it has been stored, or if it can not be queued
+void capture_write(capture_info_t *info, short *data)
+{
+    int next;
+
+    if (!writer_enabled) {
+        free(data);
+        return;
+    }
+
+    MUTEX_LOCK;
+    next = (queue_tail + 1) % MAX_QUEUE;
+    if (next == queue_head) {
+        MUTEX_UNLOCK;
+        WARN("capture queue full, discarding capture\n");
+        free(data);
+        return;
+    }
+    queue[queue_tail].info = *info;
+    queue[queue_tail].data = data;
+    queue_tail = next;
+    pthread_cond_signal(&cond);
+    MUTEX_UNLOCK;
+}
+
+static void *capture_writer_thread(void *cx)
+{
+    job_t job;
+
+    while (true) {
+        MUTEX_LOCK;
+        while (queue_head == queue_tail) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        job = queue[queue_head];
+        queue_head = (queue_head + 1) % MAX_QUEUE;
+        MUTEX_UNLOCK;
+
+        store(&job.info, job.data);
+        free(job.data);
+    }
+
+    return NULL;
+}
+
+static void store(capture_info_t *info, short *data)
+{
+    record_hdr_t *rec;
+    index_t ent;
+    char pathname[300];
+    int max_data, fd, rc;
+    uint64_t start_us = microsec_timer();
+
+    // compress the data into the record
+    max_data = info->max_frames * info->max_chan;
+    rec = malloc(sizeof(record_hdr_t) + max_data * 6 + 1024);
+    memset(rec, 0, sizeof(record_hdr_t));
+    rec->magic = MAGIC_RECORD;
+    rec->info = *info;
+    rec->info.id = next_id;
+    rec->enc_len = encode(data, info->max_frames, info->max_chan, (unsigned char*)(rec+1));
+    rec->len = sizeof(record_hdr_t) + rec->enc_len;
+
+    // start a new segment if the record doesn't fit in the current segment
+    if (cur_seg_len > 0 && cur_seg_len + rec->len > seg_max_bytes) {
+        cur_seg++;
+        cur_seg_len = 0;
+    }
+
+    // append the record to the segment
+    fd = open(seg_pathname(cur_seg, pathname), O_WRONLY|O_CREAT|O_APPEND, 0666);
+    if (fd < 0) {
+        ERROR("open %s, %s\n", pathname, strerror(errno));
+        free(rec);
+        return;
+    }
+    rc = write(fd, rec, rec->len);
+    close(fd);
+    if (rc != rec->len) {
+        ERROR("write %s, rc=%d, %s\n", pathname, rc, strerror(errno));
+        free(rec);
+        return;
+    }
+
+    // append the index entry
+    memset(&ent, 0, sizeof(ent));
+    ent.magic  = MAGIC_INDEX;
+    ent.id     = next_id++;
+    ent.seg    = cur_seg;
+    ent.offset = cur_seg_len;
+    ent.len    = rec->len;
+    ent.time   = info->time;
+    cur_seg_len += rec->len;
+
+    sprintf(pathname, "%s/%s", dir, INDEX_FILENAME);
+    fd = open(pathname, O_WRONLY|O_CREAT|O_APPEND, 0666);
+    if (fd < 0 || write(fd, &ent, sizeof(ent)) != sizeof(ent)) {
+        ERROR("write %s, %s\n", pathname, strerror(errno));
+    }
+    if (fd >= 0) close(fd);
+
+    MUTEX_LOCK;
+    if (max_index == index_alloc) {
+        index_alloc = (index_alloc ? 2 * index_alloc : 64);
+        index_tbl = realloc(index_tbl, index_alloc * sizeof(index_t));
+    }
+    index_tbl[max_index++] = ent;
+    retention();
+    MUTEX_UNLOCK;
+
+    INFO("capture %d stored: %0.1f secs, %d -> %d bytes, %lld us\n",
+         ent.id, (double)info->max_frames / info->sample_rate,
+         max_data * (int)sizeof(short), rec->len,
+         (long long)(microsec_timer() - start_us));
+    free(rec);
+}
+
+// delete the oldest segments while the total size exceeds max_bytes;
+// caller must hold the mutex
+static void retention(void)
+{
+    uint64_t total;
+    uint32_t seg;
+    char pathname[300], tmp_pathname[300];
+    int i, j, fd;
+
+    while (true) {
+        total = 0;
+        for (i = 0; i < max_index; i++) {
+            total += index_tbl[i].len;
+        }
+        if (total <= max_bytes || max_index == 0 || index_tbl[0].seg == cur_seg) {
+            return;
+        }
+
+        // remove the oldest segment's entries from the index, and rewrite it
+        seg = index_tbl[0].seg;
+        for (i = 0, j = 0; i < max_index; i++) {
+            if (index_tbl[i].seg != seg) {
+                index_tbl[j++] = index_tbl[i];
+            }
+        }
+        INFO("capture deleting segment %d, with %d captures\n", seg, max_index - j);
+        max_index = j;
+
+        sprintf(pathname, "%s/%s", dir, INDEX_FILENAME);
+        sprintf(tmp_pathname, "%s/%s.tmp", dir, INDEX_FILENAME);
+        fd = open(tmp_pathname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (fd < 0 || write(fd, index_tbl, max_index * sizeof(index_t)) != max_index * sizeof(index_t)) {
+            ERROR("write %s, %s\n", tmp_pathname, strerror(errno));
+            if (fd >= 0) close(fd);
+            return;
+        }
+        close(fd);
+        rename(tmp_pathname, pathname);
+
+        // delete the segment
+        unlink(seg_pathname(seg, pathname));
+    }
+}
+
+static char *seg_pathname(uint32_t seg, char *s)
+{
+    sprintf(s, "%s/seg_%06d.dat", dir, seg);
+    return s;
+}
+
+// -----------------  READ  ------------------------------------------------------
+
+int capture_get_count(void)
+{
+    int count;
+
+    MUTEX_LOCK;
+    count = max_index;
+    MUTEX_UNLOCK;
+
+    return count;
+}
+
+// read capture idx, where idx is 0 for the oldest capture; data is
+// optional, if provided the caller must free the returned data
+int capture_read(int idx, capture_info_t *info, short **data)
+{
+    record_hdr_t hdr;
+    unsigned char *enc;
+    char pathname[300];
+    index_t ent;
+    int fd, rc;
+
+    MUTEX_LOCK;
+    if (idx < 0 || idx >= max_index) {
+        MUTEX_UNLOCK;
+        ERROR("invalid idx %d\n", idx);
+        return -1;
+    }
+    ent = index_tbl[idx];
+    MUTEX_UNLOCK;
+
+    fd = open(seg_pathname(ent.seg, pathname), O_RDONLY);
+    if (fd < 0) {
+        ERROR("open %s, %s\n", pathname, strerror(errno));
+        return -1;
+    }
+
+    rc = pread(fd, &hdr, sizeof(hdr), ent.offset);
+    if (rc != sizeof(hdr) || hdr.magic != MAGIC_RECORD || hdr.len != ent.len) {
+        ERROR("capture %d, invalid record hdr\n", ent.id);
+        close(fd);
+        return -1;
+    }
+    *info = hdr.info;
+
+    if (data) {
+        enc = malloc(hdr.enc_len);
+        *data = malloc(info->max_frames * info->max_chan * sizeof(short));
+        rc = pread(fd, enc, hdr.enc_len, ent.offset + sizeof(hdr));
+        if (rc != hdr.enc_len ||
+            decode(enc, hdr.enc_len, *data, info->max_frames, info->max_chan) < 0)
+        {
+            ERROR("capture %d, invalid data\n", ent.id);
+            free(enc);
+            free(*data);
+            *data = NULL;
+            close(fd);
+            return -1;
+        }
+        free(enc);
+    }
+
+    close(fd);
+    return 0;
+}
+
+// -----------------  COMPRESSION  -----------------------------------------------
+
+// buff must have space for max_frames * max_chan * 6 bytes, plus 1024;
+// returns the length of the compressed data
+static int encode(short *data, int max_frames, int max_chan, unsigned char *buff)
+{
+    bits_t b = { buff, 0, 0, 0 };
+    int start, n, chan;
+
+    for (start = 0; start < max_frames; start += BLOCK_FRAMES) {
+        n = (max_frames - start < BLOCK_FRAMES ? max_frames - start : BLOCK_FRAMES);
+        for (chan = 0; chan < max_chan; chan++) {
+            encode_block(&b, data + start * max_chan + chan, max_chan, n);
+        }
+    }
+    flush_bits(&b);
+
+    return b.len;
+}
+
+static int decode(unsigned char *buff, int len, short *data, int max_frames, int max_chan)
+{
+    bits_t b = { buff, 0, 0, 0 };
+    int start, n, chan;
+
+    for (start = 0; start < max_frames; start += BLOCK_FRAMES) {
+        n = (max_frames - start < BLOCK_FRAMES ? max_frames - start : BLOCK_FRAMES);
+        for (chan = 0; chan < max_chan; chan++) {
+            if (decode_block(&b, data + start * max_chan + chan, max_chan, n) < 0) {
+                return -1;
+            }
+            if (b.len > len) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static inline int residual(short *x, int stride, int i, int order)
+{
+    switch (order) {
+    case 0:  return x[i*stride];
+    case 1:  return x[i*stride] - x[(i-1)*stride];
+    default: return x[i*stride] - 2 * x[(i-1)*stride] + x[(i-2)*stride];
+    }
+}
+
+static inline int predict(short *x, int stride, int i, int order)
+{
+    switch (order) {
+    case 0:  return 0;
+    case 1:  return x[(i-1)*stride];
+    default: return 2 * x[(i-1)*stride] - x[(i-2)*stride];
+    }
+}
+
+// block format: order (2 bits), rice k (5 bits), order warm up samples
+// (16 bits each), and the n - order rice coded residuals
+static void encode_block(bits_t *b, short *x, int stride, int n)
+{
+    uint64_t sum[MAX_ORDER+1] = {0}, mean;
+    int i, order, best, k;
+
+    // select the predictor order with the smallest sum of the residuals
+    for (order = 0; order <= MAX_ORDER; order++) {
+        for (i = MAX_ORDER; i < n; i++) {
+            sum[order] += abs(residual(x, stride, i, order));
+        }
+    }
+    best = 0;
+    for (order = 1; order <= MAX_ORDER; order++) {
+        if (sum[order] < sum[best]) best = order;
+    }
+    if (n <= MAX_ORDER) {
+        best = 0;
+    }
+
+    // rice parameter, from the mean of the zigzag coded residuals
+    mean = (n > MAX_ORDER ? 2 * sum[best] / (n - MAX_ORDER) : 0);
+    for (k = 0; k < MAX_RICE_K && (2ULL << k) <= mean; k++) ;
+
+    put_bits(b, best, 2);
+    put_bits(b, k, 5);
+    for (i = 0; i < best; i++) {
+        put_bits(b, (unsigned short)x[i*stride], 16);
+    }
+
+    for (i = best; i < n; i++) {
+        int e = residual(x, stride, i, best);
+        uint32_t u = (e >= 0 ? 2 * e : -2 * e - 1);
+        uint32_t q = u >> k;
+
+        if (q < ESC_Q) {
+            put_bits(b, ((1u << q) - 1) << 1, q + 1);
+            if (k) put_bits(b, u & ((1u << k) - 1), k);
+        } else {
+            put_bits(b, (1u << ESC_Q) - 1, ESC_Q);
+            put_bits(b, u, ESC_BITS);
+        }
+    }
+}
+
+static int decode_block(bits_t *b, short *x, int stride, int n)
+{
+    int i, order, k, q;
+    uint32_t u;
+    int e;
+
+    order = get_bits(b, 2);
+    k = get_bits(b, 5);
+    if (order > MAX_ORDER || k > MAX_RICE_K || order > n) {
+        return -1;
+    }
+
+    for (i = 0; i < order; i++) {
+        x[i*stride] = (short)get_bits(b, 16);
+    }
+
+    for (i = order; i < n; i++) {
+        for (q = 0; q < ESC_Q && get_bits(b, 1); q++) ;
+        if (q < ESC_Q) {
+            u = ((uint32_t)q << k) | (k ? get_bits(b, k) : 0);
+        } else {
+            u = get_bits(b, ESC_BITS);
+        }
+        e = (u & 1 ? -(int)((u + 1) >> 1) : (int)(u >> 1));
+        x[i*stride] = predict(x, stride, i, order) + e;
+    }
+
+    return 0;
+}
+
+// - - - - - - - - - - -
+
+static void put_bits(bits_t *b, uint32_t val, int nbits)
+{
+    b->acc = (b->acc << nbits) | val;
+    b->acc_bits += nbits;
+    while (b->acc_bits >= 8) {
+        b->acc_bits -= 8;
+        b->buff[b->len++] = b->acc >> b->acc_bits;
+    }
+}
+
+static void flush_bits(bits_t *b)
+{
+    if (b->acc_bits > 0) {
+        put_bits(b, 0, 8 - b->acc_bits);
+    }
+}
+
+static uint32_t get_bits(bits_t *b, int nbits)
+{
+    while (b->acc_bits < nbits) {
+        b->acc = (b->acc << 8) | b->buff[b->len++];
+        b->acc_bits += 8;
+    }
+    b->acc_bits -= nbits;
+    return (b->acc >> b->acc_bits) & ((1ULL << nbits) - 1);
+}
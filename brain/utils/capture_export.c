@@ -0,0 +1,154 @@
+#include <utils.h>
+
+// Notes:
+// - Lists and exports the utterances captured by the brain program, see
+//   capture.c and proc_mic_data.c.
+// - usage: capture_export [-d dir] [-l] [-o out_dir] [id ...]
+//   -d: the capture directory, default 'capture'
+//   -l: list the captures, instead of exporting them
+//   -o: the directory for the exported files, default '.'
+//   if no ids are provided then all captures are listed or exported
+// - Each capture is exported to the files used by brain_replay:
+//   . cap_<id>.wav:     the 4 mic channels, 48000 sample rate
+//   . cap_<id>.ref.wav: the echo canceller reference, mono
+//   . cap_<id>.txt:     the replay script, with the wake word and the
+//                       transcript at the times they occurred
+
+char *dir = "capture";
+char *out_dir = ".";
+bool  list;
+
+static void usage(void);
+static void list_capture(capture_info_t *info);
+static void export_capture(capture_info_t *info, short *data);
+
+int main(int argc, char **argv)
+{
+    capture_info_t info;
+    short *data;
+    int i, j, id;
+
+    // init logging
+    log_init(NULL, false, true);
+    misc_init();
+
+    // get and process options
+    while (true) {
+        signed char opt_char = getopt(argc, argv, "d:lo:h");
+        if (opt_char == -1) {
+            break;
+        }
+        switch (opt_char) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'h':
+            usage();
+            return 1;
+        default:
+            return 1;
+            break;
+        }
+    }
+
+    // open the capture directory
+    capture_open(dir);
+
+    // list or export the captures
+    for (i = 0; i < capture_get_count(); i++) {
+        if (capture_read(i, &info, NULL) < 0) {
+            continue;
+        }
+
+        if (optind < argc) {
+            for (j = optind; j < argc; j++) {
+                if (sscanf(argv[j], "%d", &id) == 1 && id == info.id) break;
+            }
+            if (j == argc) {
+                continue;
+            }
+        }
+
+        if (list) {
+            list_capture(&info);
+        } else if (capture_read(i, &info, &data) == 0) {
+            export_capture(&info, data);
+            free(data);
+        }
+    }
+
+    // done
+    return 0;
+}
+
+static void usage(void)
+{
+    ERROR("usage: capture_export [-d dir] [-l] [-o out_dir] [id ...]\n");
+}
+
+static void list_capture(capture_info_t *info)
+{
+    char time_str[100];
+    char spans_str[200] = "";
+    int len = 0;
+
+    for (int i = 0; i < MAX_TRACE_SPAN; i++) {
+        len += snprintf(spans_str+len, sizeof(spans_str)-len, "%d ", info->span_ms[i]);
+    }
+
+    INFO("%5d %s %5.1f secs doa=%3.0f rc=%2d %-20s '%s'\n",
+         info->id, time2str(info->time, time_str),
+         (double)info->max_frames / info->sample_rate,
+         info->doa, info->rc, info->hndlr, info->transcript);
+    INFO("      spans_ms: %s\n", spans_str);
+}
+
+static void export_capture(capture_info_t *info, short *data)
+{
+    char filename[300];
+    short *mic, *ref;
+    int i, n = info->max_frames;
+    FILE *fp;
+
+    if (info->max_chan != 5) {
+        ERROR("capture %d, unsupported max_chan %d\n", info->id, info->max_chan);
+        return;
+    }
+
+    // split the frames into the 4 mic channels and the ref
+    mic = malloc(n * 4 * sizeof(short));
+    ref = malloc(n * sizeof(short));
+    for (i = 0; i < n; i++) {
+        memcpy(mic + i * 4, data + i * 5, 4 * sizeof(short));
+        ref[i] = data[i * 5 + 4];
+    }
+
+    sprintf(filename, "%s/cap_%d.wav", out_dir, info->id);
+    sf_write_wav_file(filename, mic, 4, n * 4, info->sample_rate);
+    sprintf(filename, "%s/cap_%d.ref.wav", out_dir, info->id);
+    sf_write_wav_file(filename, ref, 1, n, info->sample_rate);
+
+    // the transcript is at the end of the capture; it is scripted a few
+    // frames earlier so that brain_replay's s2t_feed stub, which is called
+    // for every third frame, is called after it
+    sprintf(filename, "%s/cap_%d.txt", out_dir, info->id);
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        ERROR("failed to create %s, %s\n", filename, strerror(errno));
+    } else {
+        fprintf(fp, "%0.6f wake\n", (double)info->wake_frame / info->sample_rate);
+        fprintf(fp, "%0.6f cmd %s\n", (double)(info->transcript_frame - 3) / info->sample_rate,
+                info->transcript);
+        fclose(fp);
+    }
+
+    INFO("exported capture %d to %s/cap_%d.*\n", info->id, out_dir, info->id);
+    free(mic);
+    free(ref);
+}
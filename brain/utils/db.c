@@ -15,6 +15,11 @@
 #define MAGIC_RECORD_FREE  0x22222222
 #define MAGIC_RECORD_ENTRY 0x33333333
 
+// the hash function used for the hash table; db files created before
+// hash_version was added to the hdr have 0 in that field
+#define DB_HASH_VERSION_CRC32   0
+#define DB_HASH_VERSION_HASH64  1
+
 #define REC_LEN_AT_END(r)  (*(uint64_t*)((void*)(r) + (r)->len - sizeof(uint64_t)))
 #define SET_REC_LEN(r,l) \
     do { \
@@ -45,7 +50,8 @@ typedef struct {
     uint64_t max_hash_tbl;
     node_t   free_head;
     node_t   keyid_head[MAX_KEYID];
-    char     pad[1984];  // pad to 4096
+    uint64_t hash_version;
+    char     pad[1976];  // pad to 4096
 } hdr_t;
 
 typedef struct {
@@ -78,6 +84,7 @@ static void       * data_end;
 static node_t     * free_head;
 static node_t     * keyid_head;
 static unsigned int max_hash_tbl;
+static unsigned int hash_version;
 
 static pthread_rwlock_t rwlock;
 
@@ -153,6 +160,11 @@ void db_init(char *file_name, bool create, uint64_t file_len)
     if (Hdr.file_len != buf.st_size) {
         FATAL("size %s, 0x%lx should be 0x%llx\n", file_name, buf.st_size, Hdr.file_len);
     }
+
+    // verify the hash_version is supported
+    if (Hdr.hash_version != DB_HASH_VERSION_CRC32 && Hdr.hash_version != DB_HASH_VERSION_HASH64) {
+        FATAL("file %s, unsupported hash_version %lld\n", file_name, Hdr.hash_version);
+    }
     
     // mmap the file
     mmap_addr = mmap(NULL, Hdr.file_len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
@@ -175,6 +187,7 @@ void db_init(char *file_name, bool create, uint64_t file_len)
     free_head    = &hdr->free_head;
     keyid_head   = hdr->keyid_head;
     max_hash_tbl = hdr->max_hash_tbl;
+    hash_version = hdr->hash_version;
 
     // asserts
     assert(data_end == mmap_addr + hdr->file_len);
@@ -221,6 +234,7 @@ static void create_db_file(char *file_name, uint64_t file_len)
     hdr->hash_tbl_len = max_ht * sizeof(node_t);
     hdr->data_len     = file_len - hdr->hdr_len - hdr->hash_tbl_len;
     hdr->max_hash_tbl = max_ht;
+    hdr->hash_version = DB_HASH_VERSION_HASH64;
     init_list_head(&hdr->free_head);
     for (i = 0; i < MAX_KEYID; i++) {
         init_list_head(&hdr->keyid_head[i]);
@@ -234,6 +248,7 @@ static void create_db_file(char *file_name, uint64_t file_len)
     free_head    = &hdr->free_head;
     keyid_head   = hdr->keyid_head;
     max_hash_tbl = hdr->max_hash_tbl;
+    hash_version = hdr->hash_version;
 
     // asserts
     assert(data_end == mmap_addr + hdr->file_len);
@@ -610,10 +625,12 @@ static void combine_free(record_t *rec)
 
 static unsigned int hash(int keyid, char *keystr)
 {
-    unsigned int crc = crc32_multi_buff(2, &keyid, (size_t)1, keystr, strlen(keystr));
-    unsigned int htidx = (crc % max_hash_tbl);
-
-    return htidx;
+    if (hash_version == DB_HASH_VERSION_CRC32) {
+        unsigned int crc = crc32_multi_buff(2, &keyid, (size_t)1, keystr, strlen(keystr));
+        return crc % max_hash_tbl;
+    } else {
+        return hash64(keystr, strlen(keystr), keyid) % max_hash_tbl;
+    }
 }
 
 // boundary must be power of 2
@@ -716,6 +733,10 @@ void db_reset(void)
         init_list_head(&hash_tbl[i]);
     }
 
+    // the db is empty, so it can be switched to the current hash function
+    hdr->hash_version = DB_HASH_VERSION_HASH64;
+    hash_version = hdr->hash_version;
+
     // init data by placing a free record at the begining of data
     record_t *rec = (record_t*)data;
     rec->magic = MAGIC_RECORD_FREE;
@@ -735,6 +756,8 @@ void db_dump(void)
 {
     RW_RDLOCK;
 
+    INFO("hash_version = %d\n", hash_version);
+
     last_keyid_dumped = -1;
     for (int keyid = 0; keyid < MAX_KEYID; keyid++) {
         db_get_keyid(keyid, dump_cb);
@@ -0,0 +1,366 @@
+#include <utils.h>
+
+#if defined(__aarch64__) || defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// Notes:
+// - crc32 is the crc used by zlib and ethernet. Its value must not change,
+//   because it is stored on disk: the speech_cache filenames, and the hash
+//   table index of db files with DB_HASH_VERSION_CRC32.
+// - The crc32 implementation is selected on the first call:
+//   . CRC32_IMPL_ARMV8:  the ARMv8 crc32 instructions, when the cpu has
+//                        them; the Pi 4 does, in both 32 and 64 bit mode
+//   . CRC32_IMPL_SLICE8: slicing-by-8, 8 bytes per step using 8 tables
+//   . CRC32_IMPL_BYTE:   the original table loop, 1 byte per step
+//   crc32_set_impl overrides the selection, it is used by hash_test to
+//   compare and benchmark the implementations.
+// - hash64 is XXH64, a fast non cryptographic hash, for hash table indexing
+//   where the value is not stored on disk or is versioned.
+// - The 32 bit ARM crc32 implementation requires gcc 9 or later, for the
+//   target attribute; with an older gcc slicing-by-8 is used.
+
+//
+// defines
+//
+
+#if defined(__aarch64__)
+#define HAVE_ARMV8_CRC32
+#define ARMV8_TARGET  "+crc"
+#define CRC32B(c,v)   __builtin_aarch64_crc32b(c,v)
+#define CRC32W(c,v)   __builtin_aarch64_crc32w(c,v)
+#elif defined(__arm__) && __GNUC__ >= 9
+#define HAVE_ARMV8_CRC32
+#define ARMV8_TARGET  "arch=armv8-a+crc"
+#define CRC32B(c,v)   __builtin_arm_crc32b(c,v)
+#define CRC32W(c,v)   __builtin_arm_crc32w(c,v)
+#endif
+
+#define PRIME64_1  0x9E3779B185EBCA87ULL
+#define PRIME64_2  0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3  0x165667B19E3779F9ULL
+#define PRIME64_4  0x85EBCA77C2B2AE63ULL
+#define PRIME64_5  0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+//
+// typedefs
+//
+
+typedef uint32_t (*crc32_update_t)(uint32_t crc, const uint8_t *p, size_t size);
+
+//
+// variables
+//
+
+// https://web.mit.edu/freebsd/head/sys/libkern/crc32.c
+static const uint32_t crc32_tab[] = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d };
+
+static uint32_t       crc32_tab8[8][256];
+static crc32_update_t crc32_update;
+static int            crc32_impl = -1;
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static char *crc32_impl_name[] = { "byte", "slice8", "armv8" };
+
+//
+// prototypes
+//
+
+static void crc32_select(void);
+static uint32_t crc32_update_byte(uint32_t crc, const uint8_t *p, size_t size);
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *p, size_t size);
+#ifdef HAVE_ARMV8_CRC32
+static uint32_t crc32_update_armv8(uint32_t crc, const uint8_t *p, size_t size);
+#endif
+
+// -----------------  CRC32  ---------------------------------------------
+
+uint32_t crc32(const void *buf, size_t size)
+{
+    pthread_once(&crc32_once, crc32_select);
+
+    return crc32_update(~0U, buf, size) ^ ~0U;
+}
+
+// example: 
+//   crc32_multi_buff(2, buff1, sizeof(buff1), buff2, sizeof(buff2))
+uint32_t crc32_multi_buff(int n, ...)
+{
+    uint32_t crc = ~0U;
+    va_list ap;
+    int i;
+
+    pthread_once(&crc32_once, crc32_select);
+
+    va_start(ap, n);
+    for (i = 0; i < n; i++) {
+        uint8_t *p = va_arg(ap, uint8_t*);
+        size_t size = va_arg(ap, size_t);
+        crc = crc32_update(crc, p, size);
+    }
+    va_end(ap);
+
+    return crc ^ ~0U;
+}
+
+// returns the name of the selected implementation
+char *crc32_get_impl(void)
+{
+    pthread_once(&crc32_once, crc32_select);
+
+    return crc32_impl_name[crc32_impl];
+}
+
+// returns -1 if the implementation is not supported by this cpu
+int crc32_set_impl(int impl)
+{
+    pthread_once(&crc32_once, crc32_select);
+
+    switch (impl) {
+    case CRC32_IMPL_BYTE:
+        crc32_update = crc32_update_byte;
+        break;
+    case CRC32_IMPL_SLICE8:
+        crc32_update = crc32_update_slice8;
+        break;
+#ifdef HAVE_ARMV8_CRC32
+    case CRC32_IMPL_ARMV8:
+#if defined(__aarch64__)
+        if (!(getauxval(AT_HWCAP) & HWCAP_CRC32)) return -1;
+#else
+        if (!(getauxval(AT_HWCAP2) & HWCAP2_CRC32)) return -1;
+#endif
+        crc32_update = crc32_update_armv8;
+        break;
+#endif
+    default:
+        return -1;
+    }
+
+    crc32_impl = impl;
+    return 0;
+}
+
+static void crc32_select(void)
+{
+    int i, k;
+
+    // the slicing-by-8 tables; crc32_tab8[k][i] is the crc of byte i
+    // followed by k zero bytes
+    for (i = 0; i < 256; i++) {
+        crc32_tab8[0][i] = crc32_tab[i];
+    }
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            uint32_t c = crc32_tab8[k-1][i];
+            crc32_tab8[k][i] = (c >> 8) ^ crc32_tab[c & 0xff];
+        }
+    }
+
+    // select the fastest implementation that this cpu supports
+    crc32_update = crc32_update_slice8;
+    crc32_impl   = CRC32_IMPL_SLICE8;
+#ifdef HAVE_ARMV8_CRC32
+#if defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+#else
+    if (getauxval(AT_HWCAP2) & HWCAP2_CRC32) {
+#endif
+        crc32_update = crc32_update_armv8;
+        crc32_impl   = CRC32_IMPL_ARMV8;
+    }
+#endif
+}
+
+// - - - - - - - - - - -
+
+static uint32_t crc32_update_byte(uint32_t crc, const uint8_t *p, size_t size)
+{
+    while (size--) {
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// this requires a little endian cpu
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+    uint32_t lo, hi;
+
+    while (size && ((uintptr_t)p & 7)) {
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    while (size >= 8) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p+4, 4);
+        lo ^= crc;
+        crc = crc32_tab8[7][lo & 0xff] ^ crc32_tab8[6][(lo >> 8) & 0xff] ^
+              crc32_tab8[5][(lo >> 16) & 0xff] ^ crc32_tab8[4][lo >> 24] ^
+              crc32_tab8[3][hi & 0xff] ^ crc32_tab8[2][(hi >> 8) & 0xff] ^
+              crc32_tab8[1][(hi >> 16) & 0xff] ^ crc32_tab8[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+
+    while (size--) {
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_ARMV8_CRC32
+__attribute__((target(ARMV8_TARGET)))
+static uint32_t crc32_update_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+    uint32_t v;
+
+    while (size && ((uintptr_t)p & 3)) {
+        crc = CRC32B(crc, *p++);
+        size--;
+    }
+
+    while (size >= 4) {
+        memcpy(&v, p, 4);
+        crc = CRC32W(crc, v);
+        p += 4;
+        size -= 4;
+    }
+
+    while (size--) {
+        crc = CRC32B(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+// -----------------  HASH64  --------------------------------------------
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc  = ROTL64(acc, 31);
+    acc *= PRIME64_1;
+    return acc;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    acc  = acc * PRIME64_1 + PRIME64_4;
+    return acc;
+}
+
+// XXH64
+uint64_t hash64(const void *buf, size_t size, uint64_t seed)
+{
+    const uint8_t *p = buf, *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, read64(p));    p += 8;
+            v2 = xxh64_round(v2, read64(p));    p += 8;
+            v3 = xxh64_round(v3, read64(p));    p += 8;
+            v4 = xxh64_round(v4, read64(p));    p += 8;
+        } while (p <= end - 32);
+
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += size;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read64(p));
+        h  = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h  = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * PRIME64_5;
+        h  = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,266 @@
+#include <utils.h>
+
+// Notes:
+// - Extracts the text of a web page, replacing the beautifulsoup.py script
+//   that was used by customsearch. The returned text has the same format as
+//   that script's output: the first line is the text of the element whose id
+//   is title_id, and each following line is the text of a <p> element.
+// - This is not a complete html parser, it handles what is needed to extract
+//   the text of wikipedia pages: tags and their id attribute, comments,
+//   character references, and the content of <script> and <style> elements
+//   is discarded. Whitespace is collapsed to single spaces.
+
+//
+// defines
+//
+
+#define MAX_TAG_NAME  32
+
+//
+// typedefs
+//
+
+typedef struct {
+    char *buff;
+    int   len;
+    int   alloc;
+} text_t;
+
+//
+// prototypes
+//
+
+static char *parse_tag(char *p, char *name, bool *end_tag, char *id, int id_len);
+static char *parse_char_ref(char *p, char *s);
+static void text_add(text_t *t, char *s, int len);
+static void text_add_char(text_t *t, char c);
+static void text_add_line(text_t *t, text_t *line);
+
+// -----------------  HTML TO TEXT  ----------------------------------------------
+
+// caller must free the returned text
+char *html_to_text(char *html, char *title_id)
+{
+    text_t result = {0}, out = {0}, title = {0}, para = {0};
+    char name[MAX_TAG_NAME], id[100], title_tag[MAX_TAG_NAME] = "", s[8];
+    int title_depth = 0, skip_depth = 0;
+    bool end_tag, in_para = false;
+    char *p = html, *end;
+
+    while (*p) {
+        // comment
+        if (strncmp(p, "<!--", 4) == 0) {
+            end = strstr(p+4, "-->");
+            p = (end ? end+3 : p+strlen(p));
+            continue;
+        }
+
+        // tag
+        if (*p == '<' && (isalpha(p[1]) || p[1] == '/' || p[1] == '!')) {
+            p = parse_tag(p, name, &end_tag, id, sizeof(id));
+
+            // the content of script and style elements is not text
+            if (strcmp(name, "script") == 0 || strcmp(name, "style") == 0) {
+                skip_depth += (end_tag ? (skip_depth > 0 ? -1 : 0) : 1);
+                continue;
+            }
+
+            // the title element, nested elements with the same name are counted
+            // so that the title ends at the matching end tag
+            if (!end_tag && title_depth == 0 && title_tag[0] == '\0' && strcmp(id, title_id) == 0) {
+                strcpy(title_tag, name);
+                title_depth = 1;
+                continue;
+            }
+            if (title_depth > 0 && strcmp(name, title_tag) == 0) {
+                title_depth += (end_tag ? -1 : 1);
+                continue;
+            }
+
+            // paragraphs; a <p> start tag ends a paragraph that has no end tag
+            if (strcmp(name, "p") == 0) {
+                if (in_para) {
+                    text_add_line(&out, &para);
+                }
+                in_para = !end_tag;
+                continue;
+            }
+
+            // the text on either side of a <br> is separated
+            if (strcmp(name, "br") == 0) {
+                text_add_char(in_para ? &para : &title, ' ');
+            }
+            continue;
+        }
+
+        // text
+        if (skip_depth > 0 || (!in_para && title_depth == 0)) {
+            p++;
+            continue;
+        }
+        if (*p == '&') {
+            p = parse_char_ref(p, s);
+        } else {
+            s[0] = (isspace((unsigned char)*p) ? ' ' : *p);
+            s[1] = '\0';
+            p++;
+        }
+        text_add((title_depth > 0 ? &title : &para), s, strlen(s));
+    }
+
+    if (in_para) {
+        text_add_line(&out, &para);
+    }
+
+    // the title is the first line, followed by the paragraphs
+    text_add_line(&result, &title);
+    if (out.len > 0) {
+        text_add(&result, out.buff, out.len);
+    }
+    free(out.buff);
+    free(title.buff);
+    free(para.buff);
+    return result.buff;
+}
+
+// returns ptr to the char following the tag; name is returned in lower case,
+// and id is set to the value of the id attribute, or "" if none
+static char *parse_tag(char *p, char *name, bool *end_tag, char *id, int id_len)
+{
+    int len = 0;
+    char quote, *val;
+
+    name[0] = '\0';
+    id[0] = '\0';
+    p++;
+
+    *end_tag = (*p == '/');
+    if (*end_tag) p++;
+
+    while (isalnum(*p) && len < MAX_TAG_NAME-1) {
+        name[len++] = tolower(*p++);
+    }
+    name[len] = '\0';
+
+    // attributes
+    while (*p && *p != '>') {
+        if (strncasecmp(p, "id=", 3) == 0 && isspace(p[-1])) {
+            p += 3;
+            quote = (*p == '"' || *p == '\'' ? *p++ : 0);
+            val = p;
+            while (*p && (quote ? *p != quote : !isspace(*p) && *p != '>')) p++;
+            snprintf(id, id_len, "%.*s", (int)(p - val), val);
+            if (quote && *p) p++;
+            continue;
+        }
+        if (*p == '"' || *p == '\'') {
+            quote = *p++;
+            while (*p && *p != quote) p++;
+            if (*p) p++;
+            continue;
+        }
+        p++;
+    }
+
+    return (*p ? p+1 : p);
+}
+
+// s is set to the utf8 of the character reference, or to "&" if it is not
+// a character reference; returns ptr to the char following it
+static char *parse_char_ref(char *p, char *s)
+{
+    static struct {
+        char *name;
+        int   code;
+    } tbl[] = {
+        { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' },
+        { "apos", '\'' }, { "nbsp", ' ' }, { "ndash", 0x2013 }, { "mdash", 0x2014 },
+        { "lsquo", 0x2018 }, { "rsquo", 0x2019 }, { "ldquo", 0x201c }, { "rdquo", 0x201d },
+        { "hellip", 0x2026 }, { "deg", 0xb0 }, { "times", 0xd7 },
+                };
+    int code = -1, len;
+    char *end;
+
+    end = strchr(p, ';');
+    if (end == NULL || end - p > 10) {
+        strcpy(s, "&");
+        return p+1;
+    }
+    len = end - (p+1);
+
+    if (p[1] == '#') {
+        code = (p[2] == 'x' || p[2] == 'X' ? strtol(p+3, NULL, 16) : strtol(p+2, NULL, 10));
+    } else {
+        for (int i = 0; i < sizeof(tbl)/sizeof(tbl[0]); i++) {
+            if (strlen(tbl[i].name) == len && strncmp(p+1, tbl[i].name, len) == 0) {
+                code = tbl[i].code;
+                break;
+            }
+        }
+    }
+
+    if (code <= 0 || code > 0x10ffff) {
+        strcpy(s, "&");
+        return p+1;
+    }
+
+    // utf8 encode
+    if (code == 0xa0) {
+        code = ' ';
+    }
+    if (code < 0x80) {
+        s[0] = code; s[1] = '\0';
+    } else if (code < 0x800) {
+        s[0] = 0xc0 | (code >> 6); s[1] = 0x80 | (code & 0x3f); s[2] = '\0';
+    } else if (code < 0x10000) {
+        s[0] = 0xe0 | (code >> 12); s[1] = 0x80 | ((code >> 6) & 0x3f);
+        s[2] = 0x80 | (code & 0x3f); s[3] = '\0';
+    } else {
+        s[0] = 0xf0 | (code >> 18); s[1] = 0x80 | ((code >> 12) & 0x3f);
+        s[2] = 0x80 | ((code >> 6) & 0x3f); s[3] = 0x80 | (code & 0x3f); s[4] = '\0';
+    }
+    return end+1;
+}
+
+// -----------------  TEXT BUFFER  -----------------------------------------------
+
+// appends s; to collapse whitespace, s is not appended if it starts with a
+// space and t is empty or ends with a space
+static void text_add(text_t *t, char *s, int len)
+{
+    if (s[0] == ' ' && (t->len == 0 || t->buff[t->len-1] == ' ')) {
+        return;
+    }
+
+    if (t->len + len + 1 > t->alloc) {
+        t->alloc = (t->alloc + len + 1) * 2;
+        t->buff = realloc(t->buff, t->alloc);
+    }
+    memcpy(t->buff + t->len, s, len);
+    t->len += len;
+    t->buff[t->len] = '\0';
+}
+
+static void text_add_char(text_t *t, char c)
+{
+    text_add(t, &c, 1);
+}
+
+// appends line, without trailing whitespace, and a newline to t; and
+// empties line
+static void text_add_line(text_t *t, text_t *line)
+{
+    int len = line->len;
+
+    while (len > 0 && line->buff[len-1] == ' ') len--;
+    if (len > 0) {
+        text_add(t, line->buff, len);
+    }
+    if (t->len + 2 > t->alloc) {
+        t->alloc = (t->alloc + 2) * 2;
+        t->buff = realloc(t->buff, t->alloc);
+    }
+    t->buff[t->len++] = '\n';
+    t->buff[t->len] = '\0';
+    line->len = 0;
+}
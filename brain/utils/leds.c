@@ -6,13 +6,57 @@
 // developed using info from:
 //   brain/devel/repos/4mics_hat/leds.py
 
+// Notes:
+// - The leds are composed from layers, see LEDS_LAYER_xxx in utils.h. The
+//   layers are composed in order, starting with LEDS_LAYER_IDLE, using each
+//   enabled layer's blend mode:
+//   . LEDS_BLEND_REPLACE: the layer replaces the layers below
+//   . LEDS_BLEND_OVER:    the layer's leds that are on replace the layers below
+//   . LEDS_BLEND_ADD:     the layer's leds are added to the layers below
+// - leds_render composes the layers and writes the frame to the spi device,
+//   but only if the frame differs from the last frame written. It is called
+//   at a fixed rate by the program; the layers can be set at any time, by
+//   any thread.
+// - Animations are based on the time, not on the number of calls to
+//   leds_render. A layer can be rotated, and can be enabled for a duration,
+//   after which it is disabled by leds_render.
+// - The led color values are scaled by the led_brightness using a table
+//   that is computed by leds_set_scale_factor, so no floating point is
+//   needed when setting the leds. The table also applies the LED_GAMMA
+//   curve to each color component, because the led's pwm output is linear,
+//   and so the dim color components would otherwise appear too bright.
+
 //
 // defines
 //
 
 #define SPIDEV "/dev/spidev0.1"
 
-#define MAX_LED 12
+#define LED_GAMMA 2.2
+
+#define MUTEX_LOCK   do { pthread_mutex_lock(&mutex); } while (0)
+#define MUTEX_UNLOCK do { pthread_mutex_unlock(&mutex); } while (0)
+
+//
+// typedefs
+//
+
+struct led_s {
+    unsigned char start_and_brightness;
+    unsigned char blue;
+    unsigned char green;
+    unsigned char red;
+};
+
+typedef struct {
+    bool          enabled;
+    int           blend;
+    uint64_t      expire_us;        // 0 if no duration
+    struct led_s  led[MAX_LED];     // scaled by led_brightness
+    int           rotate_intvl_us;  // 0 if not rotating
+    int           rotate_mode;
+    uint64_t      rotate_start_us;
+} layer_t;
 
 //
 // variables
@@ -22,24 +66,21 @@ static int fd;
 
 static struct {
     unsigned char hdr[4];  // hdr bytes are set to zero
-    struct led_s {
-        unsigned char start_and_brightness;
-        unsigned char blue;
-        unsigned char green;
-        unsigned char red;
-    } led[0];
-    // unsigned char trailer[MAX_LED+15)/16], set to zero
-} *tx;
-
-static double leds_scale_factor_tbl[101];
+    struct led_s led[MAX_LED];
+    unsigned char trailer[(MAX_LED+15)/16];  // set to zero
+} tx, tx_last;
 
-static int tx_buff_size;
+static unsigned char   scale_tbl[101][256];
+static layer_t         layer[MAX_LEDS_LAYER];
+static bool            tx_last_valid;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 //
 // prototypes
 //
 
 static void leds_exit(void);
+static void leds_write(void);
 
 // -----------------  LEDS_INIT  ---------------------------------------------------------
 
@@ -61,21 +102,11 @@ void leds_init(double sf)
         FATAL("ioctl SPI_IOC_WR_MAX_SPEED_HZ failed, %s\n", strerror(errno));
     }
 
-    // allocate tx buff, including space for:
-    // - header:  4 bytes
-    // - led[]:   MAX_LED * sizeof(struct_led_s) bytes
-    // - trailer: (MAX_LED+15)/16 bytes
-    // the header and trailer are set to 0
-    tx_buff_size =  4 + MAX_LED*sizeof(struct led_s) + (MAX_LED+15)/16;
-    tx = malloc(tx_buff_size);
-    memset(tx, 0, tx_buff_size);
-
     // initialize led brightness scaling table
     leds_set_scale_factor(sf);
 
-    // set leds off, 
-    leds_stage_all(LED_OFF,0);
-    leds_commit(0);
+    // set leds off
+    leds_render(0);
 
     // register exit handler to turn off the leds when program exits
     atexit(leds_exit);
@@ -83,8 +114,10 @@ void leds_init(double sf)
 
 static void leds_exit(void)
 {
-    leds_stage_all(LED_OFF,0);
-    leds_commit(0);
+    MUTEX_LOCK;
+    memset(&tx, 0, sizeof(tx));
+    leds_write();
+    MUTEX_UNLOCK;
 }
 
 // -----------------  LEDS API  ----------------------------------------------------------
@@ -93,80 +126,167 @@ void leds_set_scale_factor(double sf)
 {
     INFO("settings leds_scale_factor to %0.3f\n", sf);
 
+    MUTEX_LOCK;
     for (int i = 0; i <= 100; i++) {
-        leds_scale_factor_tbl[i] = pow(i*.01, sf);
+        double scale = pow(i*.01, sf);
+        for (int c = 0; c < 256; c++) {
+            scale_tbl[i][c] = nearbyint(255 * pow(c / 255., LED_GAMMA) * scale);
+        }
     }
+    MUTEX_UNLOCK;
 }
 
-void leds_stage_led(int num, unsigned int rgb, int led_brightness)
+void leds_layer_set_led(int l, int num, unsigned int rgb, int led_brightness)
 {
-    struct led_s *x = &tx->led[num];
+    struct led_s *x;
 
-    if (num < 0 || num >= MAX_LED) {
-        ERROR("invalid arg num=%d\n", num);
+    if (l < 0 || l >= MAX_LEDS_LAYER || num < 0 || num >= MAX_LED) {
+        ERROR("invalid arg layer=%d num=%d\n", l, num);
         return;
     }
 
     led_brightness = clip_int(led_brightness, 0, 100);
 
-    x->red   = nearbyint(((rgb >>  0) & 0xff) * leds_scale_factor_tbl[led_brightness]);
-    x->green = nearbyint(((rgb >>  8) & 0xff) * leds_scale_factor_tbl[led_brightness]);
-    x->blue  = nearbyint(((rgb >> 16) & 0xff) * leds_scale_factor_tbl[led_brightness]);
+    MUTEX_LOCK;
+    x = &layer[l].led[num];
+    x->red   = scale_tbl[led_brightness][(rgb >>  0) & 0xff];
+    x->green = scale_tbl[led_brightness][(rgb >>  8) & 0xff];
+    x->blue  = scale_tbl[led_brightness][(rgb >> 16) & 0xff];
+    MUTEX_UNLOCK;
 }
 
-void leds_stage_all(unsigned int rgb, int led_brightness)
+void leds_layer_set_all(int l, unsigned int rgb, int led_brightness)
 {
-    if (rgb == LED_OFF) {
-        memset(tx, 0, tx_buff_size);
-    } else {
-        leds_stage_led(0, rgb, led_brightness);
-        for (int num = 1; num < MAX_LED; num++) {
-            tx->led[num] = tx->led[0];
-        }
+    for (int num = 0; num < MAX_LED; num++) {
+        leds_layer_set_led(l, num, rgb, led_brightness);
+    }
+}
+
+// rotate the layer by one led every intvl_us; intvl_us 0 stops the rotation
+void leds_layer_rotate(int l, int intvl_us, int mode)
+{
+    if (l < 0 || l >= MAX_LEDS_LAYER || (mode != 0 && mode != 1)) {
+        ERROR("invalid arg layer=%d mode=%d\n", l, mode);
+        return;
+    }
+
+    MUTEX_LOCK;
+    layer[l].rotate_intvl_us = intvl_us;
+    layer[l].rotate_mode     = mode;
+    layer[l].rotate_start_us = microsec_timer();
+    MUTEX_UNLOCK;
+}
+
+// duration_us 0 enables the layer until leds_layer_disable is called
+void leds_layer_enable(int l, int blend, uint64_t duration_us)
+{
+    if (l < 0 || l >= MAX_LEDS_LAYER) {
+        ERROR("invalid arg layer=%d\n", l);
+        return;
     }
+
+    MUTEX_LOCK;
+    layer[l].enabled   = true;
+    layer[l].blend     = blend;
+    layer[l].expire_us = (duration_us ? microsec_timer() + duration_us : 0);
+    MUTEX_UNLOCK;
 }
 
-void leds_stage_rotate(int mode)
+void leds_layer_disable(int l)
 {
-    struct led_s x;
-
-    switch (mode) {
-    case 0:  // counterclockwise on respeaker
-        x = tx->led[0];
-        memmove(&tx->led[0], &tx->led[1], (MAX_LED-1)*sizeof(struct led_s));
-        tx->led[MAX_LED-1] = x;
-        break;
-    case 1:  // clockwise on respeaker
-        x = tx->led[MAX_LED-1];
-        memmove(&tx->led[1], &tx->led[0], (MAX_LED-1)*sizeof(struct led_s));
-        tx->led[0] = x;
-        break;
-    default:
-        ERROR("invalid mode %d\n", mode);
-        break;
+    if (l < 0 || l >= MAX_LEDS_LAYER) {
+        ERROR("invalid arg layer=%d\n", l);
+        return;
     }
+
+    MUTEX_LOCK;
+    layer[l].enabled = false;
+    MUTEX_UNLOCK;
 }
 
-void leds_commit(int all_brightness)
+void leds_render(int all_brightness)
 {
-    int rc, num;
+    uint64_t now = microsec_timer();
+    int num, l, r, g, b;
+    bool all_off = true;
 
     all_brightness = clip_int(all_brightness, 0, 100);
-    all_brightness = nearbyint(all_brightness * .31);
+    all_brightness = (all_brightness * 31 + 50) / 100;
 
+    MUTEX_LOCK;
+
+    // disable the layers whose duration has expired
+    for (l = 0; l < MAX_LEDS_LAYER; l++) {
+        if (layer[l].enabled && layer[l].expire_us && now >= layer[l].expire_us) {
+            layer[l].enabled = false;
+        }
+    }
+
+    // compose the layers
     for (num = 0; num < MAX_LED; num++) {
-        if (*(unsigned int*)&tx->led[num] != 0) break;
+        r = g = b = 0;
+        for (l = 0; l < MAX_LEDS_LAYER; l++) {
+            layer_t *ly = &layer[l];
+            struct led_s *x;
+            int src = num;
+
+            if (!ly->enabled) {
+                continue;
+            }
+
+            if (ly->rotate_intvl_us) {
+                int steps = ((now - ly->rotate_start_us) / ly->rotate_intvl_us) % MAX_LED;
+                src = (ly->rotate_mode == 1 ? num - steps + MAX_LED : num + steps) % MAX_LED;
+            }
+            x = &ly->led[src];
+
+            switch (ly->blend) {
+            case LEDS_BLEND_REPLACE:
+                r = x->red; g = x->green; b = x->blue;
+                break;
+            case LEDS_BLEND_OVER:
+                if (x->red || x->green || x->blue) {
+                    r = x->red; g = x->green; b = x->blue;
+                }
+                break;
+            case LEDS_BLEND_ADD:
+                r += x->red; g += x->green; b += x->blue;
+                break;
+            }
+        }
+
+        tx.led[num].red   = (r > 255 ? 255 : r);
+        tx.led[num].green = (g > 255 ? 255 : g);
+        tx.led[num].blue  = (b > 255 ? 255 : b);
+        if (r || g || b) all_off = false;
     }
-    if (num == MAX_LED) all_brightness = 0;
 
     for (num = 0; num < MAX_LED; num++) {
-        struct led_s *x = &tx->led[num];
-        x->start_and_brightness = 0xe0 | all_brightness;
+        tx.led[num].start_and_brightness = 0xe0 | (all_off ? 0 : all_brightness);
+    }
+
+    // write the frame to the spi device if it has changed
+    if (!tx_last_valid || memcmp(&tx, &tx_last, sizeof(tx)) != 0) {
+        leds_write();
     }
 
-    rc = write(fd, tx, tx_buff_size);
-    if (rc != tx_buff_size) {
-        ERROR("leds_commit write rc=%d exp=%d, %s\n", rc, tx_buff_size, strerror(errno));
+    MUTEX_UNLOCK;
+}
+
+// -----------------  PRIVATE  -----------------------------------------------------------
+
+// caller must hold the mutex
+static void leds_write(void)
+{
+    int rc;
+
+    rc = write(fd, &tx, sizeof(tx));
+    if (rc != sizeof(tx)) {
+        ERROR("leds write rc=%d exp=%zd, %s\n", rc, sizeof(tx), strerror(errno));
+        tx_last_valid = false;
         return;
     }
+
+    tx_last = tx;
+    tx_last_valid = true;
 }
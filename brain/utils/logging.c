@@ -1,8 +1,34 @@
 #include <utils.h>
-  
+
+#include "../../common/util/log_defer.h"
+
+// Notes:
+// - After log_deferred_init, log_msg is deferred, see log_defer.h, which is
+//   shared with the body; the log_defer_thread writes the msgs to the log
+//   file. This keeps vsnprintf and the log file's stdio lock off of the audio
+//   threads.
+// - FATAL msgs, and msgs logged before log_deferred_init, are written
+//   directly, after the pending deferred msgs.
+// - The utilities that mix log msgs with printf output to stdout do not
+//   call log_deferred_init, so their output is not reordered.
+
+//
+// variables
+//
+
 static bool log_brief;
 static FILE *log_fp;
 
+//
+// prototypes
+//
+
+static void log_output(char *lvl, uint64_t time_us, char *fmt, va_list ap) __attribute__ ((noinline));
+static void log_direct(char *lvl, const char *func, uint64_t time_us, char *str);
+static uint64_t log_real_time_us(void);
+
+// -----------------  LOG MSG  ---------------------------------------------------
+
 void log_init(char *filename, bool append, bool brief)
 {
     log_brief = brief;
@@ -20,25 +46,74 @@ void log_init(char *filename, bool append, bool brief)
     setlinebuf(log_fp);
 }
 
+void log_deferred_init(void)
+{
+    if (log_fp == NULL) {
+        printf("ERROR: log_fp is not set\n");
+        exit(1);
+    }
+
+    log_defer_init(log_direct);
+}
+
 void log_msg(char *lvl, char *fmt, ...)
 {
-    char str[10000], s[100];
-    va_list ap;
+    va_list  ap;
+    uint64_t time_us;
 
     if (log_fp == NULL) {
         printf("ERROR: log_fp is not set\n");
         exit(1);
     }
 
+    time_us = log_real_time_us();
+
+    // not deferred: FATAL, because the caller exits; and before log_deferred_init
+    if (!log_defer_enabled() || strcmp(lvl, "FATAL") == 0) {
+        log_flush();
+        va_start(ap, fmt);
+        log_output(lvl, time_us, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
     va_start(ap, fmt);
-    vsnprintf(str, sizeof(str), fmt, ap);
+    log_defer_msg(lvl, NULL, time_us, fmt, ap);
     va_end(ap);
+}
+
+// writes the pending deferred msgs, in time order
+void log_flush(void)
+{
+    log_defer_flush();
+}
+
+// not inlined, so that the str is not on the stack of the deferred log_msg calls
+static void log_output(char *lvl, uint64_t time_us, char *fmt, va_list ap)
+{
+    char str[10000];
+
+    vsnprintf(str, sizeof(str), fmt, ap);
+    log_direct(lvl, NULL, time_us, str);
+}
+
+static void log_direct(char *lvl, const char *func, uint64_t time_us, char *str)
+{
+    char s[100];
 
-    if (!log_brief) { 
-        fprintf(log_fp, "%s %s: %s", time2str(time(NULL),s), lvl, str);
-    } else if (strcmp(lvl, "INFO") != 0) { 
+    if (!log_brief) {
+        fprintf(log_fp, "%s %s: %s", time2str(time_us / SECONDS, s), lvl, str);
+    } else if (strcmp(lvl, "INFO") != 0) {
         fprintf(log_fp, "%s: %s", lvl, str);
-    } else { 
+    } else {
         fprintf(log_fp, "%s", str);
-    } 
+    }
+}
+
+static uint64_t log_real_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return  ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
 }
@@ -0,0 +1,567 @@
+#include <utils.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// Notes:
+// - Event loop for the brain's event driven and periodic work, which was
+//   previously done by threads that polled with usleep. reactor_run is
+//   called by the brain's main thread, and calls the following procs on
+//   that thread:
+//   . procs posted by reactor_post, from any thread; for example to
+//     continue, on the reactor thread, work that another thread started
+//   . timer procs, started by reactor_timer_start; one shot or periodic
+//   . fd procs, called when an fd added by reactor_fd_add is readable
+// - The procs must not block. Blocking work, such as the cmd handlers and
+//   text to speech, remains in its own threads.
+// - epoll waits for: an eventfd that is signalled by reactor_post and
+//   reactor_stop, a timerfd that is armed for the earliest timer, and the
+//   added fds. When there is nothing to do there are no wakeups.
+// - The timers are kept in a hierarchical timer wheel with TICK_US
+//   resolution. Level 0 has 256 slots of 1 tick, and each higher level has
+//   64 slots, each spanning a full rotation of the level below. When a
+//   higher level slot comes due its timers are cascaded to the lower levels.
+//   Starting and cancelling a timer do not depend on the number of timers.
+// - reactor_timer_cancel, when called by a thread other than the reactor,
+//   waits for the timer's proc to return if it is running; so the caller
+//   may then free the proc's cx.
+
+//
+// defines
+//
+
+#define MAX_TIMER        64
+#define MAX_FD           16
+#define MAX_POST         256
+#define MAX_EVENTS       (MAX_FD + 2)
+
+#define TICK_US          1000
+#define LVL0_BITS        8
+#define LVLN_BITS        6
+#define MAX_LVL          4
+#define LVL0_SIZE        (1 << LVL0_BITS)
+#define LVLN_SIZE        (1 << LVLN_BITS)
+#define LVL_SHIFT(_l)    (LVL0_BITS + ((_l)-1) * LVLN_BITS)   // for levels above 0
+#define MAX_TICKS        (1ULL << LVL_SHIFT(MAX_LVL))          // 2^26 ticks, 18.6 hours
+
+#define MUTEX_LOCK do { pthread_mutex_lock(&mutex); } while (0)
+#define MUTEX_UNLOCK do { pthread_mutex_unlock(&mutex); } while (0)
+
+//
+// typedefs
+//
+
+typedef struct rtimer_s {
+    int              handle;       // 0 when the entry is free
+    uint64_t         expires;      // tick
+    uint64_t         intvl;        // ticks, 0 for one shot
+    reactor_proc_t   proc;
+    void            *cx;
+    struct rtimer_s *next;
+    struct rtimer_s *prev;
+} rtimer_t;
+
+typedef struct {
+    int            fd;             // -1 when the entry is free
+    reactor_proc_t proc;
+    void          *cx;
+} rfd_t;
+
+typedef struct {
+    reactor_proc_t proc;
+    void          *cx;
+} post_t;
+
+//
+// variables
+//
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  timer_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       reactor_tid;
+static bool            running;
+static volatile bool   stop;
+static int             epfd = -1;
+static int             evfd = -1;
+static int             tmfd = -1;
+
+// timers
+static rtimer_t        timer_tbl[MAX_TIMER];
+static rtimer_t        wheel[MAX_LVL][LVL0_SIZE];   // list heads, levels above 0 use LVLN_SIZE
+static uint64_t        wheel_tick;
+static int             timer_count;
+static int             timer_unique_id;
+static int             timer_running_handle;
+static uint64_t        timer_armed_tick;
+
+// fds
+static rfd_t           fd_tbl[MAX_FD];
+
+// posted procs
+static post_t          post_q[MAX_POST];
+static int             post_head;
+static int             post_tail;
+
+// stats
+static reactor_stats_t stats;
+
+//
+// prototypes
+//
+
+static void wakeup(void);
+static void post_run(void);
+static void fd_run(int fd);
+static void timer_run(void);
+static void timer_arm(void);
+static void timer_insert(rtimer_t *t);
+static void timer_remove(rtimer_t *t);
+static void timer_cascade(int lvl, int slot);
+static void timer_rehash(uint64_t tick);
+static rtimer_t *timer_find(int handle);
+static uint64_t now_tick(void);
+
+// -----------------  INIT, RUN AND STOP  ----------------------------------------
+
+void reactor_init(void)
+{
+    struct epoll_event ev;
+    int lvl, slot, i;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    tmfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || evfd < 0 || tmfd < 0) {
+        FATAL("reactor create fds, %s\n", strerror(errno));
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = evfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev) < 0) {
+        FATAL("reactor epoll_ctl eventfd, %s\n", strerror(errno));
+    }
+    ev.data.fd = tmfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tmfd, &ev) < 0) {
+        FATAL("reactor epoll_ctl timerfd, %s\n", strerror(errno));
+    }
+
+    for (lvl = 0; lvl < MAX_LVL; lvl++) {
+        for (slot = 0; slot < LVL0_SIZE; slot++) {
+            wheel[lvl][slot].next = wheel[lvl][slot].prev = &wheel[lvl][slot];
+        }
+    }
+    wheel_tick = now_tick();
+
+    for (i = 0; i < MAX_FD; i++) {
+        fd_tbl[i].fd = -1;
+    }
+}
+
+// runs on the caller's thread until reactor_stop is called
+void reactor_run(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t v;
+    int n, i;
+
+    reactor_tid = pthread_self();
+    running = true;
+
+    while (!stop) {
+        timer_arm();
+
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            FATAL("reactor epoll_wait, %s\n", strerror(errno));
+        }
+        stats.wakeups++;
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == evfd) {
+                read(evfd, &v, sizeof(v));
+            } else if (events[i].data.fd == tmfd) {
+                read(tmfd, &v, sizeof(v));
+                timer_armed_tick = 0;
+            } else {
+                fd_run(events[i].data.fd);
+            }
+        }
+
+        post_run();
+        timer_run();
+    }
+
+    running = false;
+}
+
+// may be called from a signal handler
+void reactor_stop(void)
+{
+    stop = true;
+    wakeup();
+}
+
+void reactor_get_stats(reactor_stats_t *s)
+{
+    MUTEX_LOCK;
+    *s = stats;
+    MUTEX_UNLOCK;
+}
+
+static void wakeup(void)
+{
+    uint64_t one = 1;
+
+    write(evfd, &one, sizeof(one));
+}
+
+// -----------------  POST  ------------------------------------------------------
+
+void reactor_post(reactor_proc_t proc, void *cx)
+{
+    MUTEX_LOCK;
+    if ((post_tail + 1) % MAX_POST == post_head) {
+        FATAL("reactor post queue is full\n");
+    }
+    post_q[post_tail].proc = proc;
+    post_q[post_tail].cx = cx;
+    post_tail = (post_tail + 1) % MAX_POST;
+    MUTEX_UNLOCK;
+
+    wakeup();
+}
+
+static void post_run(void)
+{
+    post_t p;
+
+    while (true) {
+        MUTEX_LOCK;
+        if (post_head == post_tail) {
+            MUTEX_UNLOCK;
+            break;
+        }
+        p = post_q[post_head];
+        post_head = (post_head + 1) % MAX_POST;
+        stats.posts++;
+        MUTEX_UNLOCK;
+
+        p.proc(p.cx);
+    }
+}
+
+// -----------------  FDS  -------------------------------------------------------
+
+void reactor_fd_add(int fd, reactor_proc_t proc, void *cx)
+{
+    struct epoll_event ev;
+    int i;
+
+    MUTEX_LOCK;
+    for (i = 0; i < MAX_FD; i++) {
+        if (fd_tbl[i].fd == -1) break;
+    }
+    if (i == MAX_FD) {
+        FATAL("reactor too many fds\n");
+    }
+    fd_tbl[i].fd = fd;
+    fd_tbl[i].proc = proc;
+    fd_tbl[i].cx = cx;
+    MUTEX_UNLOCK;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        FATAL("reactor epoll_ctl add fd %d, %s\n", fd, strerror(errno));
+    }
+}
+
+// must be called before the fd is closed
+void reactor_fd_del(int fd)
+{
+    int i;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+
+    MUTEX_LOCK;
+    for (i = 0; i < MAX_FD; i++) {
+        if (fd_tbl[i].fd == fd) {
+            fd_tbl[i].fd = -1;
+        }
+    }
+    MUTEX_UNLOCK;
+}
+
+// the fd may have been deleted by a proc that ran earlier in this wakeup
+static void fd_run(int fd)
+{
+    reactor_proc_t proc = NULL;
+    void *cx = NULL;
+    int i;
+
+    MUTEX_LOCK;
+    for (i = 0; i < MAX_FD; i++) {
+        if (fd_tbl[i].fd == fd) {
+            proc = fd_tbl[i].proc;
+            cx = fd_tbl[i].cx;
+            stats.fd_procs++;
+            break;
+        }
+    }
+    MUTEX_UNLOCK;
+
+    if (proc) {
+        proc(cx);
+    }
+}
+
+// -----------------  TIMERS  ----------------------------------------------------
+
+// returns a handle, which is used to cancel the timer; intvl_us 0 is one shot
+int reactor_timer_start(uint64_t delay_us, uint64_t intvl_us, reactor_proc_t proc, void *cx)
+{
+    rtimer_t *t;
+    int handle;
+
+    MUTEX_LOCK;
+
+    for (t = timer_tbl; t < timer_tbl + MAX_TIMER; t++) {
+        if (t->handle == 0) break;
+    }
+    if (t == timer_tbl + MAX_TIMER) {
+        FATAL("reactor too many timers\n");
+    }
+
+    if (++timer_unique_id <= 0) {
+        timer_unique_id = 1;
+    }
+    t->handle  = handle = timer_unique_id;
+    t->expires = (microsec_timer() + delay_us + TICK_US - 1) / TICK_US;
+    t->intvl   = (intvl_us == 0 ? 0 : (intvl_us + TICK_US/2) / TICK_US);
+    if (intvl_us != 0 && t->intvl == 0) {
+        t->intvl = 1;
+    }
+    t->proc    = proc;
+    t->cx      = cx;
+    timer_insert(t);
+    timer_count++;
+
+    MUTEX_UNLOCK;
+
+    // the reactor thread arms the timerfd before it next waits
+    if (!running || !pthread_equal(pthread_self(), reactor_tid)) {
+        wakeup();
+    }
+
+    return handle;
+}
+
+// handle 0 is ignored
+void reactor_timer_cancel(int handle)
+{
+    rtimer_t *t;
+
+    if (handle == 0) {
+        return;
+    }
+
+    MUTEX_LOCK;
+
+    t = timer_find(handle);
+    if (t) {
+        timer_remove(t);
+        t->handle = 0;
+        timer_count--;
+    }
+
+    if (!running || !pthread_equal(pthread_self(), reactor_tid)) {
+        while (timer_running_handle == handle) {
+            pthread_cond_wait(&timer_done_cond, &mutex);
+        }
+    }
+
+    MUTEX_UNLOCK;
+}
+
+// advance the wheel to the current tick, calling the procs of the timers that are due
+static void timer_run(void)
+{
+    uint64_t now = now_tick();
+    rtimer_t *head, *t;
+    reactor_proc_t proc;
+    void *cx;
+    int lvl, slot;
+
+    MUTEX_LOCK;
+
+    // after a long idle period, rather than stepping through each tick, the
+    // timers are reinserted relative to the current tick
+    if (now > wheel_tick + LVL0_SIZE) {
+        timer_rehash(now - 1);
+    }
+
+    while (wheel_tick < now) {
+        wheel_tick++;
+
+        // at the end of each rotation of a level, cascade the next slot of the level above
+        for (lvl = 1; lvl < MAX_LVL; lvl++) {
+            if (wheel_tick & ((1ULL << LVL_SHIFT(lvl)) - 1)) break;
+            slot = (wheel_tick >> LVL_SHIFT(lvl)) & (LVLN_SIZE-1);
+            timer_cascade(lvl, slot);
+            if (slot != 0) break;
+        }
+
+        // call the procs of the timers in this tick's level 0 slot;
+        // a periodic timer is reinserted first, so that its proc can cancel it
+        head = &wheel[0][wheel_tick & (LVL0_SIZE-1)];
+        while (head->next != head) {
+            t = head->next;
+            timer_remove(t);
+            proc = t->proc;
+            cx = t->cx;
+            timer_running_handle = t->handle;
+            if (t->intvl) {
+                t->expires += t->intvl;
+                if (t->expires <= wheel_tick) {
+                    t->expires = wheel_tick + t->intvl;
+                }
+                timer_insert(t);
+            } else {
+                t->handle = 0;
+                timer_count--;
+            }
+            stats.timer_procs++;
+
+            MUTEX_UNLOCK;
+            proc(cx);
+            MUTEX_LOCK;
+
+            timer_running_handle = 0;
+            pthread_cond_broadcast(&timer_done_cond);
+        }
+    }
+
+    MUTEX_UNLOCK;
+}
+
+// arm the timerfd for the earliest timer; the timers are few, so they are scanned
+static void timer_arm(void)
+{
+    struct itimerspec its;
+    uint64_t next = 0;
+    rtimer_t *t;
+
+    MUTEX_LOCK;
+    if (timer_count > 0) {
+        for (t = timer_tbl; t < timer_tbl + MAX_TIMER; t++) {
+            if (t->handle != 0 && (next == 0 || t->expires < next)) {
+                next = t->expires;
+            }
+        }
+    }
+    MUTEX_UNLOCK;
+
+    if (next == timer_armed_tick) {
+        return;
+    }
+
+    // a next of 0 disarms the timerfd
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = next * TICK_US / SECONDS;
+    its.it_value.tv_nsec = (next * TICK_US % SECONDS) * 1000;
+    if (timerfd_settime(tmfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        FATAL("reactor timerfd_settime, %s\n", strerror(errno));
+    }
+    timer_armed_tick = next;
+}
+
+// - - - - - - - - -  TIMER WHEEL  - - - - - - - - - - - - - - - - - - - - - - -
+
+static void timer_insert(rtimer_t *t)
+{
+    rtimer_t *head;
+    uint64_t delta, expires;
+    int lvl;
+
+    if (t->expires <= wheel_tick) {
+        t->expires = wheel_tick + 1;
+    }
+    delta = t->expires - wheel_tick;
+
+    if (delta < LVL0_SIZE) {
+        head = &wheel[0][t->expires & (LVL0_SIZE-1)];
+    } else {
+        // timers beyond the wheel's span are placed in the last slot, and are
+        // cascaded back into that slot until they are due
+        expires = (delta < MAX_TICKS ? t->expires : wheel_tick + MAX_TICKS - 1);
+        for (lvl = 1; lvl < MAX_LVL-1 && expires - wheel_tick >= (1ULL << LVL_SHIFT(lvl+1)); lvl++) ;
+        head = &wheel[lvl][(expires >> LVL_SHIFT(lvl)) & (LVLN_SIZE-1)];
+    }
+
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void timer_remove(rtimer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = t;
+}
+
+static void timer_cascade(int lvl, int slot)
+{
+    rtimer_t *head = &wheel[lvl][slot], *t;
+    rtimer_t list;
+
+    if (head->next == head) {
+        return;
+    }
+
+    // move the slot's timers to a temporary list, and reinsert them
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->next = head->prev = head;
+
+    while (list.next != &list) {
+        t = list.next;
+        timer_remove(t);
+        timer_insert(t);
+    }
+}
+
+static void timer_rehash(uint64_t tick)
+{
+    rtimer_t *t;
+
+    for (t = timer_tbl; t < timer_tbl + MAX_TIMER; t++) {
+        if (t->handle != 0) timer_remove(t);
+    }
+    wheel_tick = tick;
+    for (t = timer_tbl; t < timer_tbl + MAX_TIMER; t++) {
+        if (t->handle != 0) timer_insert(t);
+    }
+}
+
+static rtimer_t *timer_find(int handle)
+{
+    rtimer_t *t;
+
+    for (t = timer_tbl; t < timer_tbl + MAX_TIMER; t++) {
+        if (t->handle == handle) return t;
+    }
+    return NULL;
+}
+
+static uint64_t now_tick(void)
+{
+    return microsec_timer() / TICK_US;
+}
@@ -1,42 +1,79 @@
 #include <utils.h>
 
+// Notes:
+// - s2t_feed is called by the proc_mic_data thread with the sound values of
+//   the cmd. The first sound value starts the livecaption program, and the
+//   sound values are written to it as they accumulate. The livecaption
+//   session is run by procs on the reactor thread: s2t_start and s2t_write
+//   are posted by s2t_feed, s2t_read is called when livecaption's stdout is
+//   readable, and s2t_timeout is a one shot timer.
+// - livecaption outputs its interim results as lines that start with
+//   PARTIAL_PREFIX, and then the final transcript. The interim results are
+//   only used to trace the latency of the first partial transcript.
+// - When the transcript is ready it is returned by the next call to s2t_feed.
+// - When the session is done livecaption's stdin is closed, and it is reaped
+//   by the s2t_reap timer proc with a non blocking waitpid, so that a slow or
+//   hung livecaption does not block the reactor thread. If it has not exitted
+//   after REAP_KILL_US it is killed.
+
 // defines
 #define MAX_SV 1000000
 #define TIMEOUT_SECS 10
+#define MAX_TS 4096
+#define WRITE_INTVL_SV 160     // sound values, 10 ms
+#define PARTIAL_PREFIX "PARTIAL: "
+#define REAP_INTVL_US (100*MS)
+#define REAP_KILL_US (2*SECONDS)
 
 // use during development to not run livecaption
 //#define NO_LIVECAPTION
 
+// typedefs
+#ifndef NO_LIVECAPTION
+typedef struct {
+    pid_t    pid;
+    int      timer;
+    uint64_t start_us;
+    bool     killed;
+} reap_t;
+#endif
+
 // variables
 static char    * transcript;
-static pthread_t s2t_tid;
 static short     sv[MAX_SV];
 static int       max_sv;
-static bool      terminating;
+
+#ifndef NO_LIVECAPTION
+static pid_t     lc_pid;
+static int       fd_to_lc = -1;
+static int       fd_from_lc = -1;
+static int       sv_idx;
+static int       timeout_timer;
+static char    * ts;
+static int       ts_len;
+#endif
 
 // prototypes
 static void s2t_exit(void);
-static void *s2t_thread(void *cx);
+static void s2t_start(void *cx);
+#ifndef NO_LIVECAPTION
+static void s2t_write(void *cx);
+static void s2t_read(void *cx);
+static void s2t_timeout(void *cx);
+static void s2t_done(void);
+static void s2t_reap(void *cx);
+#endif
 
 // -----------------  INIT AND EXIT  --------------------------------------------
 
 void s2t_init(void)
 {
-    // create s2t_thread
-    pthread_create(&s2t_tid, NULL, s2t_thread, NULL);
-
     // atexit
     atexit(s2t_exit);
 }
 
 static void s2t_exit(void)
 {
-    // set terminating flag, so that the s2t_thread will terminate
-    terminating = true;
-
-    // wait for s2t_thread to exit
-    pthread_join(s2t_tid, NULL);
-
     // be extra sure that the livecaption program is not running
     system("killall livecaption");
 }
@@ -54,129 +91,181 @@ char * s2t_feed(short sound_val)
         return ts;
     }
 
-    sv[max_sv++] = sound_val;
+    sv[max_sv] = sound_val;
+    __sync_synchronize();
+    max_sv++;
+
+    if (max_sv == 1) {
+        reactor_post(s2t_start, NULL);
+#ifndef NO_LIVECAPTION
+    } else if (max_sv % WRITE_INTVL_SV == 0) {
+        reactor_post(s2t_write, NULL);
+#endif
+    }
     return NULL;
 }
 
-// -----------------  THREAD  ---------------------------------------------------
+// -----------------  LIVECAPTION SESSION  --------------------------------------
 
 #ifndef NO_LIVECAPTION
 
-static void *s2t_thread(void *cx)
+static void s2t_start(void *cx)
 {
-    #define MAX_TS 4096
-
-    uint64_t start_time;
-    char    *ts;
-    int      rc, fd_to_lc, fd_from_lc, flags, avail, sv_idx;
-    pid_t    lc_pid;
-
-    while (true) {
-        // wait for indication to start 
-        while (max_sv == 0) {
-            if (terminating) return NULL;
-            usleep(10*MS);
-        }
+    int flags;
+
+    // execute the livecaption go program, and set the fds used to
+    // write to livecaption stdin and read livecaption stdout to non blocking
+    run_program(&lc_pid, &fd_to_lc, &fd_from_lc, "./go/livecaption", NULL);
+    flags = fcntl(fd_from_lc, F_GETFL, 0);
+    fcntl(fd_from_lc, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(fd_to_lc, F_GETFL, 0);
+    fcntl(fd_to_lc, F_SETFL, flags | O_NONBLOCK);
+
+    // init variables
+    ts = calloc(MAX_TS,1);
+    ts_len = 0;
+    sv_idx = 0;
+    trace_point(TRACE_S2T_START);
+
+    reactor_fd_add(fd_from_lc, s2t_read, NULL);
+    timeout_timer = reactor_timer_start(TIMEOUT_SECS*SECONDS, 0, s2t_timeout, NULL);
+
+    s2t_write(NULL);
+}
 
-        // execute the livecaption go program, and
-        // set fd used to read livecaption stdout to non blocking
-        run_program(&lc_pid, &fd_to_lc, &fd_from_lc, "./go/livecaption", NULL);
-        flags = fcntl(fd_from_lc, F_GETFL, 0); 
-        flags |= O_NONBLOCK; 
-        fcntl(fd_from_lc, F_SETFL, flags); 
+// provide the new sound values to the livecaption pgm
+static void s2t_write(void *cx)
+{
+    int avail, rc;
 
-        // int variables
-        ts = calloc(MAX_TS,1);
-        strcpy(ts, "TIMEDOUT");
-        start_time = microsec_timer();
-        sv_idx = 0;
-
-        while (true) {
-            // break out of this loop if terminate is requested
-            if (terminating) break;
-
-            // if more than 100 new sound values are available then 
-            // provide these new sound values to livecaption pgm
-            avail = max_sv - sv_idx - 1;
-            if (avail > 100) {
-                rc = write(fd_to_lc, sv+sv_idx, avail*sizeof(short));
-                if ((rc != avail*sizeof(short)) && (rc != -1 || errno != EPIPE)) {
-                    ERROR("failed write to livecaption, rc=%d, %s\n", rc, strerror(errno));
-                    break;
-                }
-                sv_idx += avail;
-            }
-            
-
-            // perform non blocking read of livecaption stdout
-            rc = read(fd_from_lc, ts, MAX_TS-1);
-            if (rc < 0 && errno != EWOULDBLOCK) {
-                ERROR("failed read from livecaption, %s\n", strerror(errno));
-                break;
-            }
-
-            // if we have a result from livecaption then break
-            if (rc > 0) {
-                break;
-            }
-
-            // check for timeout receiving a result from livecaption
-            if (microsec_timer() - start_time > (TIMEOUT_SECS * 1000000LL)) {
-                WARN("timedout waiting for transcript from livecaption\n");
-                break;
-            }
-
-            // short sleep
-            usleep(10*MS);
-        }
+    if (fd_to_lc == -1) {
+        return;
+    }
 
-        // the transcript is ready to be returned by s2t_feed
-        ts[strcspn(ts, "\n")] = '\0';
-        INFO("TRANSCRIPT: '%s'\n", ts);
-        transcript = ts;
+    avail = max_sv - sv_idx;
+    if (avail <= 0) {
+        return;
+    }
 
-        // close fds and call waitpid
-        close(fd_to_lc);
-        close(fd_from_lc);
-        waitpid(lc_pid, NULL, 0);
+    rc = write(fd_to_lc, sv+sv_idx, avail*sizeof(short));
+    if (rc < 0) {
+        if (errno != EAGAIN && errno != EPIPE) {
+            ERROR("failed write to livecaption, %s\n", strerror(errno));
+            strcpy(ts, "TIMEDOUT");
+            s2t_done();
+        }
+        return;
+    }
+    sv_idx += rc / sizeof(short);
+}
 
-        // wait for s2t_feed to acknowledge that it has the transcript
-        while (transcript) {
-            if (terminating) return NULL;
-            usleep(10*MS);
+// read livecaption stdout; the final transcript completes the session
+static void s2t_read(void *cx)
+{
+    int rc;
+    char *nl;
+
+    rc = read(fd_from_lc, ts+ts_len, MAX_TS-1-ts_len);
+    if (rc < 0) {
+        if (errno != EWOULDBLOCK) {
+            ERROR("failed read from livecaption, %s\n", strerror(errno));
+            strcpy(ts, "TIMEDOUT");
+            s2t_done();
+        }
+        return;
+    }
+    if (rc == 0) {
+        ERROR("livecaption exitted\n");
+        strcpy(ts, "TIMEDOUT");
+        s2t_done();
+        return;
+    }
+    ts_len += rc;
+    ts[ts_len] = '\0';
+
+    // discard the complete interim result lines; the first line that is
+    // not an interim result is the transcript
+    while ((nl = strchr(ts, '\n')) != NULL) {
+        if (strncmp(ts, PARTIAL_PREFIX, strlen(PARTIAL_PREFIX)) != 0) {
+            s2t_done();
+            return;
         }
+        trace_point(TRACE_S2T_FIRST_PARTIAL);
+        ts_len -= (nl + 1 - ts);
+        memmove(ts, nl + 1, ts_len + 1);
     }
 
-    return NULL;
+    // if the buffer is full, without a complete line, then use what has been read
+    if (ts_len == MAX_TS-1) {
+        s2t_done();
+    }
 }
 
-#else
-
-static void *s2t_thread(void *cx)
+static void s2t_timeout(void *cx)
 {
-    char *ts;
+    timeout_timer = 0;
+    WARN("timedout waiting for transcript from livecaption\n");
+    strcpy(ts, "TIMEDOUT");
+    s2t_done();
+}
 
-    while (true) {
-        // wait for indication to start 
-        while (max_sv == 0) {
-            if (terminating) return NULL;
-            usleep(10*MS);
-        }
+static void s2t_done(void)
+{
+    reap_t *r;
+
+    // the transcript is ready to be returned by s2t_feed
+    ts[strcspn(ts, "\n")] = '\0';
+    INFO("TRANSCRIPT: '%s'\n", ts);
+    trace_point(TRACE_S2T_TRANSCRIPT);
+    __sync_synchronize();
+    transcript = ts;
+    ts = NULL;
+
+    // close fds, and start the timer that reaps livecaption
+    reactor_timer_cancel(timeout_timer);
+    timeout_timer = 0;
+    reactor_fd_del(fd_from_lc);
+    close(fd_to_lc);
+    close(fd_from_lc);
+    fd_to_lc = fd_from_lc = -1;
+
+    r = calloc(1, sizeof(reap_t));
+    r->pid = lc_pid;
+    r->start_us = microsec_timer();
+    r->timer = reactor_timer_start(REAP_INTVL_US, REAP_INTVL_US, s2t_reap, r);
+}
 
-        // provide a dummy transcript
-        ts = malloc(100);
-        strcpy(ts, "dummy transcript");
-        INFO("TRANSCRIPT: '%s'\n", ts);
-        transcript = ts;
+static void s2t_reap(void *cx)
+{
+    reap_t *r = cx;
 
-        // wait for s2t_feed to acknowledge that it has the transcript
-        while (transcript) {
-            if (terminating) return NULL;
-            usleep(10*MS);
+    if (waitpid(r->pid, NULL, WNOHANG) == 0) {
+        if (!r->killed && microsec_timer() - r->start_us > REAP_KILL_US) {
+            WARN("livecaption pid %d has not exitted, killing it\n", r->pid);
+            kill(r->pid, SIGKILL);
+            r->killed = true;
         }
+        return;
     }
 
-    return NULL;
+    reactor_timer_cancel(r->timer);
+    free(r);
+}
+
+#else
+
+static void s2t_start(void *cx)
+{
+    char *ts;
+
+    // provide a dummy transcript
+    trace_point(TRACE_S2T_START);
+    ts = malloc(100);
+    strcpy(ts, "dummy transcript");
+    INFO("TRANSCRIPT: '%s'\n", ts);
+    trace_point(TRACE_S2T_TRANSCRIPT);
+    __sync_synchronize();
+    transcript = ts;
 }
 
 #endif
@@ -53,8 +53,9 @@ static void t2s_play_common(bool nocache, char *fmt, va_list ap)
         return;
     }
 
-    // debug print the text
+    // debug print the text, and trace the start of speech synthesis
     INFO("PLAY: %s\n", text);
+    trace_point(TRACE_T2S_START);
 
     // if caller requests to not use the speech cache
     //   create file tmp.wav using synthesize_text
@@ -67,6 +68,7 @@ static void t2s_play_common(bool nocache, char *fmt, va_list ap)
             ERROR("system(synthesize_text)) failed, %s\n", strerror(errno));
             return;
         }
+        trace_point(TRACE_T2S_END);
         audio_out_play_wav("tmp.wav", true);
         return;
     }
@@ -86,5 +88,6 @@ static void t2s_play_common(bool nocache, char *fmt, va_list ap)
             return;
         }
     }
+    trace_point(TRACE_T2S_END);
     audio_out_play_wav(pathname, true);
 }
@@ -0,0 +1,212 @@
+#include <utils.h>
+
+// Notes:
+// - Tests and benchmarks the acoustic echo canceller with synthetic data:
+//   a music like reference, an echo path with a bulk delay and a decaying
+//   room response, mic noise, and bursts of speech like near end signal
+//   during the music (double talk).
+// - usage: aec_test [delay_ms]
+// - Reports the echo return loss enhancement (ERLE) with and without near
+//   end speech, the near end speech distortion, and the cpu time as a
+//   percentage of real time.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE     16000
+#define DURATION_SECS   40
+#define MAX_DATA        (DURATION_SECS * SAMPLE_RATE)
+#define AEC_LATENCY     128          // aec output delay, and block size, samples
+
+#define ECHO_GAIN       0.7
+#define ECHO_TAIL_MS    40
+#define NOISE_RMS       20
+
+#define CONVERGE_SECS   5            // the echo only results exclude this initial period
+#define PASS_ERLE_DB    20
+#define PASS_DISTORTION_DB  15
+
+//
+// variables
+//
+
+static short ref[MAX_DATA];
+static float echo[MAX_DATA];
+static float near[MAX_DATA];
+static short mic[MAX_DATA];
+static short out[MAX_DATA];
+
+//
+// prototypes
+//
+
+static void gen_ref(void);
+static void gen_echo(int delay);
+static void gen_near(void);
+static float noise(void);
+static uint64_t cpu_time_us(void);
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int delay_ms = 150, i;
+    uint64_t start_us, cpu_us;
+    double echo_pwr = 0, resid_pwr = 0, dt_echo_pwr = 0, dt_resid_pwr = 0;
+    double near_pwr = 0, dist_pwr = 0, erle_db, dt_erle_db, dist_db;
+    aec_stats_t stats;
+    bool pass;
+
+    log_init(NULL, false, true);
+
+    if (argc > 1 && (sscanf(argv[1], "%d", &delay_ms) != 1 || delay_ms < 0 || delay_ms > 350)) {
+        printf("usage: aec_test [delay_ms]   (0 to 350)\n");
+        return 1;
+    }
+
+    // generate the test data
+    srandom(1);
+    gen_ref();
+    gen_echo(delay_ms * SAMPLE_RATE / 1000);
+    gen_near();
+    for (i = 0; i < MAX_DATA; i++) {
+        mic[i] = clip_int(lrintf(echo[i] + near[i] + noise() * NOISE_RMS), -32767, 32767);
+    }
+
+    // run the echo canceller
+    aec_init();
+    start_us = cpu_time_us();
+    for (i = 0; i < MAX_DATA; i++) {
+        out[i] = aec_feed(mic[i], ref[i]);
+    }
+    cpu_us = cpu_time_us() - start_us;
+    aec_get_stats(&stats);
+
+    // measure the residual echo, and the near end distortion;
+    // the aec output lags the input by AEC_LATENCY samples
+    for (i = CONVERGE_SECS * SAMPLE_RATE; i < MAX_DATA - AEC_LATENCY; i++) {
+        double resid = out[i+AEC_LATENCY] - near[i];
+        if (near[i] == 0) {
+            echo_pwr  += echo[i] * echo[i];
+            resid_pwr += resid * resid;
+        } else {
+            dt_echo_pwr  += echo[i] * echo[i];
+            dt_resid_pwr += resid * resid;
+            near_pwr     += near[i] * near[i];
+            dist_pwr     += resid * resid;
+        }
+    }
+    erle_db    = 10 * log10(echo_pwr / resid_pwr);
+    dt_erle_db = 10 * log10(dt_echo_pwr / dt_resid_pwr);
+    dist_db    = 10 * log10(near_pwr / dist_pwr);
+
+    // print results
+    printf("delay           %d ms, estimated %d ms\n", delay_ms, stats.delay_ms);
+    printf("erle            %0.1f dB echo only, %0.1f dB double talk, %0.1f dB aec estimate\n",
+           erle_db, dt_erle_db, stats.erle_db);
+    printf("near end        signal to residual echo %0.1f dB during double talk\n", dist_db);
+    printf("double talk     %0.1f secs detected\n", (double)stats.dt_blocks * AEC_LATENCY / SAMPLE_RATE);
+    printf("filter resets   %lld\n", (long long)stats.resets);
+    printf("cpu             %0.1f ms per sec of audio, %0.2f%% of real time\n",
+           cpu_us / 1000. / DURATION_SECS, cpu_us / (DURATION_SECS * 1e6) * 100);
+
+    pass = (stats.delay_ms >= 0 && abs(stats.delay_ms - delay_ms) <= 10 &&
+            erle_db >= PASS_ERLE_DB && dist_db >= PASS_DISTORTION_DB);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// -----------------  TEST DATA  -------------------------------------------------
+
+// music like: a sequence of notes, each with harmonics and a decaying
+// envelope, plus some filtered noise
+static void gen_ref(void)
+{
+    static const double notes[] = { 220, 247, 262, 294, 330, 349, 392, 440 };
+    double freq = 0, env = 0, lp = 0;
+    int i, h;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        double v = 0, t = (double)i / SAMPLE_RATE;
+        if (i % (SAMPLE_RATE / 4) == 0) {
+            freq = notes[random() % 8] * (random() % 2 ? 1 : 2);
+            env = 1;
+        }
+        for (h = 1; h <= 5; h++) {
+            v += sin(2 * M_PI * freq * h * t) / h;
+        }
+        v = v * env * 3000;
+        env *= 0.99985;
+        v += low_pass_filter(noise() * 2000, &lp, 0.7);
+        ref[i] = clip_int(lrint(v), -32767, 32767);
+    }
+}
+
+// bulk delay, followed by a direct path and a decaying random room response
+static void gen_echo(int delay)
+{
+    int max_h = ECHO_TAIL_MS * SAMPLE_RATE / 1000, i, j;
+    float h[max_h];
+
+    for (j = 0; j < max_h; j++) {
+        h[j] = noise() * 0.15 * exp(-5.0 * j / max_h);
+    }
+    h[0] = 1;
+    h[3] = -0.4;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        double v = 0;
+        for (j = 0; j < max_h; j++) {
+            int k = i - delay - j;
+            if (k >= 0) v += h[j] * ref[k];
+        }
+        echo[i] = v * ECHO_GAIN;
+    }
+}
+
+// speech like bursts, with a varying pitch and amplitude, at 10 secs and
+// every 6 secs after, each 2 secs long
+static void gen_near(void)
+{
+    double phase = 0, lp1 = 0, lp2 = 0;
+    int i, h;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        double t = (double)i / SAMPLE_RATE;
+        double burst_t = fmod(t - 10, 6);
+        double v = 0, pitch, am;
+
+        if (t < 10 || burst_t >= 2) {
+            near[i] = 0;
+            continue;
+        }
+        pitch = 140 + 30 * sin(2 * M_PI * 0.7 * t);
+        am = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        phase += 2 * M_PI * pitch / SAMPLE_RATE;
+        for (h = 1; h <= 10; h++) {
+            v += sin(h * phase) / h;
+        }
+        v = low_pass_filter(v, &lp1, 0.5);
+        v = low_pass_filter(v, &lp2, 0.5);
+        near[i] = v * am * 4000 + 1e-3;   // nonzero while speaking
+    }
+}
+
+static float noise(void)
+{
+    // approximately gaussian, unit variance
+    double sum = 0;
+    for (int i = 0; i < 12; i++) {
+        sum += (double)random() / RAND_MAX;
+    }
+    return sum - 6;
+}
+
+static uint64_t cpu_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
@@ -0,0 +1,225 @@
+#include <utils.h>
+
+// Notes:
+// - Tests and benchmarks the beamformer with synthetic data: a speech like
+//   talker, and a noise interferer, each arriving as a plane wave at the mic
+//   array, plus uncorrelated mic noise.
+// - usage: beam_test [talker_doa] [interferer_doa]
+// - The beamformer is linear, so each of the 3 signals is passed through it
+//   separately, and the gain for each is reported: the talker should be
+//   unchanged, the uncorrelated noise reduced by about 6 dB, and the
+//   interferer reduced at the higher frequencies. The results are also
+//   reported for the beam steered away from the talker, and unsteered.
+
+//
+// defines
+//
+
+#define SAMPLE_RATE     16000
+#define DURATION_SECS   20
+#define MAX_DATA        (DURATION_SECS * SAMPLE_RATE)
+#define MAX_CHAN        4
+
+// must match beam.c
+#define MIC_RADIUS      0.040
+#define MIC_ANGLE(_m)   (45 + 90*(_m))
+#define SPEED_OF_SOUND  343.
+
+#define MAX_DELAY_TAPS  64           // plane wave fractional delay filter
+
+#define PASS_TALKER_DB  1.0          // max talker gain deviation from 0 dB
+#define PASS_NOISE_DB   5.0          // min uncorrelated noise reduction
+
+//
+// variables
+//
+
+static float source[MAX_DATA];
+static short talker[MAX_DATA][MAX_CHAN];
+static short interferer[MAX_DATA][MAX_CHAN];
+static short mic_noise[MAX_DATA][MAX_CHAN];
+
+//
+// prototypes
+//
+
+static void gen_talker(double doa);
+static void gen_interferer(double doa);
+static void gen_mic_noise(void);
+static void plane_wave(double doa, short out[MAX_DATA][MAX_CHAN]);
+static double gain_db(short in[MAX_DATA][MAX_CHAN], double steer_doa, uint64_t *cpu_us);
+static float noise(void);
+static uint64_t cpu_time_us(void);
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    double talker_doa = 0, interferer_doa = 120;
+    double steer[3], talker_db, interferer_db, noise_db;
+    char *steer_str[3] = { "toward talker", "away from talker", "unsteered" };
+    uint64_t cpu_us = 0;
+    bool pass = true;
+    int i;
+
+    log_init(NULL, false, true);
+
+    if ((argc > 1 && (sscanf(argv[1], "%lf", &talker_doa) != 1 || talker_doa < 0 || talker_doa >= 360)) ||
+        (argc > 2 && (sscanf(argv[2], "%lf", &interferer_doa) != 1 || interferer_doa < 0 || interferer_doa >= 360)))
+    {
+        printf("usage: beam_test [talker_doa] [interferer_doa]   (0 to 359)\n");
+        return 1;
+    }
+
+    // generate the test data
+    srandom(1);
+    gen_talker(talker_doa);
+    gen_interferer(interferer_doa);
+    gen_mic_noise();
+
+    // determine the beamformer gains for the talker, the interferer, and the
+    // mic noise, with the beam steered toward, and away from, the talker
+    steer[0] = talker_doa;
+    steer[1] = normalize_angle(talker_doa + 180);
+    steer[2] = -1;
+    printf("talker %0.0f degs, interferer %0.0f degs\n", talker_doa, interferer_doa);
+    printf("STEERING            TALKER_DB  INTERFERER_DB  MIC_NOISE_DB  SNR_GAIN_DB\n");
+    for (i = 0; i < 3; i++) {
+        talker_db     = gain_db(talker, steer[i], &cpu_us);
+        interferer_db = gain_db(interferer, steer[i], &cpu_us);
+        noise_db      = gain_db(mic_noise, steer[i], &cpu_us);
+        printf("%-18s %10.1f %14.1f %13.1f %12.1f\n",
+               steer_str[i], talker_db, interferer_db, noise_db, talker_db - noise_db);
+
+        if (i == 0) {
+            pass = (fabs(talker_db) <= PASS_TALKER_DB && talker_db - noise_db >= PASS_NOISE_DB);
+        }
+    }
+
+    printf("cpu                %0.1f ms per sec of audio, %0.2f%% of real time\n",
+           cpu_us / 1000. / (9 * DURATION_SECS), cpu_us / (9 * DURATION_SECS * 1e6) * 100);
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// returns the power gain, of the beamformer output relative to mic 0
+static double gain_db(short in[MAX_DATA][MAX_CHAN], double steer_doa, uint64_t *cpu_us)
+{
+    static short out[MAX_DATA];
+    double in_pwr = 0, out_pwr = 0;
+    uint64_t start_us;
+    int i;
+
+    beam_init();
+    beam_set_doa(steer_doa);
+
+    start_us = cpu_time_us();
+    for (i = 0; i < MAX_DATA; i++) {
+        out[i] = beam_feed(in[i]);
+    }
+    *cpu_us += cpu_time_us() - start_us;
+
+    // skip the first second, which includes the cross fade to the steering
+    for (i = SAMPLE_RATE; i < MAX_DATA; i++) {
+        in_pwr  += (double)in[i][0] * in[i][0];
+        out_pwr += (double)out[i] * out[i];
+    }
+
+    return 10 * log10(out_pwr / in_pwr);
+}
+
+// -----------------  TEST DATA  -------------------------------------------------
+
+// speech like, with a varying pitch and amplitude, plus some breath noise
+static void gen_talker(double doa)
+{
+    double phase = 0, lp1 = 0, lp2 = 0;
+    int i, h;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        double t = (double)i / SAMPLE_RATE;
+        double v = 0, pitch, am;
+
+        pitch = 140 + 30 * sin(2 * M_PI * 0.7 * t);
+        am = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        phase += 2 * M_PI * pitch / SAMPLE_RATE;
+        for (h = 1; h <= 20; h++) {
+            v += sin(h * phase) / h;
+        }
+        v = low_pass_filter(v, &lp1, 0.3);
+        v = low_pass_filter(v, &lp2, 0.3);
+        source[i] = v * am * 4000 + noise() * 200;
+    }
+
+    plane_wave(doa, talker);
+}
+
+// white noise
+static void gen_interferer(double doa)
+{
+    int i;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        source[i] = noise() * 1000;
+    }
+
+    plane_wave(doa, interferer);
+}
+
+static void gen_mic_noise(void)
+{
+    int i, chan;
+
+    for (i = 0; i < MAX_DATA; i++) {
+        for (chan = 0; chan < MAX_CHAN; chan++) {
+            mic_noise[i][chan] = lrintf(noise() * 300);
+        }
+    }
+}
+
+// the source arriving from doa at each mic; the mics closer to the source
+// receive it earlier, the delays are relative to the center of the array
+static void plane_wave(double doa, short out[MAX_DATA][MAX_CHAN])
+{
+    int i, chan, t, k;
+    double delay, x, v, h[MAX_DELAY_TAPS];
+
+    for (chan = 0; chan < MAX_CHAN; chan++) {
+        // windowed sinc fractional delay filter
+        delay = MAX_DELAY_TAPS / 2 -
+                MIC_RADIUS * cos((doa - MIC_ANGLE(chan)) * (M_PI/180)) / SPEED_OF_SOUND * SAMPLE_RATE;
+        for (t = 0; t < MAX_DELAY_TAPS; t++) {
+            x = t - delay;
+            h[t] = (x == 0 ? 1 : sin(M_PI * x) / (M_PI * x)) *
+                   (0.5 + 0.5 * cos(M_PI * x / (MAX_DELAY_TAPS/2)));
+        }
+
+        for (i = 0; i < MAX_DATA; i++) {
+            v = 0;
+            for (t = 0; t < MAX_DELAY_TAPS; t++) {
+                k = i - t;
+                if (k >= 0) v += h[t] * source[k];
+            }
+            out[i][chan] = clip_int(lrint(v), -32767, 32767);
+        }
+    }
+}
+
+static float noise(void)
+{
+    // approximately gaussian, unit variance
+    double sum = 0;
+    for (int i = 0; i < 12; i++) {
+        sum += (double)random() / RAND_MAX;
+    }
+    return sum - 6;
+}
+
+static uint64_t cpu_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
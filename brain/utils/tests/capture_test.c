@@ -0,0 +1,205 @@
+#include <utils.h>
+
+// Notes:
+// - Tests the utterance capture store: that the captures are read back
+//   exactly as written, including full scale noise which uses the rice
+//   coding escape, that mic like data is compressed, that the oldest
+//   segments are deleted when the size limit is exceeded, and that the
+//   index is reloaded by capture_open.
+
+//
+// defines
+//
+
+#define TEST_DIR         "capture_test_dir"
+#define MAX_BYTES        (8*MB)
+#define SAMPLE_RATE      48000
+#define MAX_CHAN         5
+#define MAX_FRAMES       (5*SAMPLE_RATE)
+#define MAX_RETENTION    30
+
+#define SIGNAL_MIC       0
+#define SIGNAL_NOISE     1
+#define SIGNAL_SILENCE   2
+
+//
+// prototypes
+//
+
+static short *make_data(int signal, int max_frames);
+static bool write_and_read(int signal, int max_frames, double *ratio);
+static void wait_stored(int count);
+static off_t dir_bytes(void);
+static bool check(bool cond, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    capture_info_t info;
+    double ratio;
+    bool pass = true, ok;
+    int i, count;
+    uint32_t first_id, last_id;
+
+    log_init(NULL, false, true);
+    system("rm -rf " TEST_DIR);
+    capture_init(TEST_DIR, MAX_BYTES);
+
+    // lossless
+    ok = write_and_read(SIGNAL_MIC, MAX_FRAMES, &ratio);
+    pass &= check(ok, "mic data read back");
+    pass &= check(ratio < 0.6, "mic data compressed, ratio=%0.2f", ratio);
+    ok = write_and_read(SIGNAL_NOISE, MAX_FRAMES, &ratio);
+    pass &= check(ok, "full scale noise read back, ratio=%0.2f", ratio);
+    ok = write_and_read(SIGNAL_SILENCE, MAX_FRAMES, &ratio);
+    pass &= check(ok, "silence read back, ratio=%0.3f", ratio);
+    pass &= check(write_and_read(SIGNAL_MIC, 4097, &ratio), "partial block read back");
+    pass &= check(write_and_read(SIGNAL_MIC, 1, &ratio), "single frame read back");
+
+    // retention: the oldest segments are deleted
+    for (i = 0; i < MAX_RETENTION; i++) {
+        write_and_read(SIGNAL_MIC, MAX_FRAMES, &ratio);
+    }
+    count = capture_get_count();
+    capture_read(0, &info, NULL);
+    first_id = info.id;
+    capture_read(count-1, &info, NULL);
+    last_id = info.id;
+    pass &= check(count < MAX_RETENTION && first_id > 1 && last_id == MAX_RETENTION + 5,
+                  "retention: count=%d first_id=%d last_id=%d", count, first_id, last_id);
+
+    // the index is reloaded
+    capture_open(TEST_DIR);
+    capture_read(0, &info, NULL);
+    pass &= check(capture_get_count() == count && info.id == first_id,
+                  "capture_open: count=%d first_id=%d", capture_get_count(), info.id);
+
+    system("rm -rf " TEST_DIR);
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// write a capture, and read it back and compare; the ratio is the increase
+// in the size of the capture directory divided by the size of the data,
+// which is not valid if the oldest segments were deleted
+static bool write_and_read(int signal, int max_frames, double *ratio)
+{
+    capture_info_t info, info2;
+    short *data, *data2;
+    off_t bytes_before;
+    int count, rc;
+    bool ok;
+
+    data = make_data(signal, max_frames);
+    memset(&info, 0, sizeof(info));
+    info.time = time(NULL);
+    info.sample_rate = SAMPLE_RATE;
+    info.max_chan = MAX_CHAN;
+    info.max_frames = max_frames;
+    info.wake_frame = max_frames / 4;
+    info.transcript_frame = max_frames;
+    info.doa = 123;
+    strcpy(info.transcript, "what time is it");
+    strcpy(info.hndlr, "time");
+
+    count = capture_get_count();
+    bytes_before = dir_bytes();
+    data2 = malloc(max_frames * MAX_CHAN * sizeof(short));
+    memcpy(data2, data, max_frames * MAX_CHAN * sizeof(short));
+    capture_write(&info, data2);
+    wait_stored(count + 1);
+    *ratio = (double)(dir_bytes() - bytes_before) / (max_frames * MAX_CHAN * sizeof(short));
+
+    count = capture_get_count();
+    rc = capture_read(count-1, &info2, &data2);
+    ok = (rc == 0 &&
+          info2.max_frames == max_frames &&
+          info2.doa == 123 &&
+          strcmp(info2.transcript, info.transcript) == 0 &&
+          memcmp(data, data2, max_frames * MAX_CHAN * sizeof(short)) == 0);
+
+    free(data);
+    if (rc == 0) free(data2);
+    return ok;
+}
+
+// the mic data is a mix of tones with some noise, similar for each mic
+static short *make_data(int signal, int max_frames)
+{
+    short *data = malloc(max_frames * MAX_CHAN * sizeof(short));
+    double t, v;
+    int i, chan;
+
+    for (i = 0; i < max_frames; i++) {
+        t = (double)i / SAMPLE_RATE;
+        v = 2000 * sin(2*M_PI*220*t) + 1000 * sin(2*M_PI*470*t) + 500 * sin(2*M_PI*1230*t);
+        for (chan = 0; chan < MAX_CHAN; chan++) {
+            switch (signal) {
+            case SIGNAL_MIC:
+                data[i*MAX_CHAN+chan] = v * (1 + 0.1 * chan) + (random() % 41) - 20;
+                break;
+            case SIGNAL_NOISE:
+                data[i*MAX_CHAN+chan] = (random() & 0xffff) - 32768;
+                break;
+            case SIGNAL_SILENCE:
+                data[i*MAX_CHAN+chan] = 0;
+                break;
+            }
+        }
+    }
+
+    return data;
+}
+
+// the capture is stored by the capture_writer_thread; wait for it to be
+// added to the index, which may also delete the oldest captures
+static void wait_stored(int count)
+{
+    static uint32_t last_id;
+    capture_info_t info;
+
+    for (int i = 0; i < 1000; i++) {
+        usleep(10000);
+        int n = capture_get_count();
+        if (n > 0 && capture_read(n-1, &info, NULL) == 0 && info.id > last_id) {
+            last_id = info.id;
+            return;
+        }
+    }
+    ERROR("timedout waiting for capture to be stored, count=%d\n", count);
+}
+
+// the total size of the segment files and the index
+static off_t dir_bytes(void)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat buf;
+    char pathname[300];
+    off_t total = 0;
+
+    d = opendir(TEST_DIR);
+    while ((de = readdir(d)) != NULL) {
+        sprintf(pathname, "%s/%s", TEST_DIR, de->d_name);
+        if (de->d_name[0] != '.' && stat(pathname, &buf) == 0) {
+            total += buf.st_size;
+        }
+    }
+    closedir(d);
+
+    return total;
+}
+
+static bool check(bool cond, char *fmt, ...)
+{
+    va_list ap;
+
+    printf("%-6s ", cond ? "ok" : "FAILED");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    return cond;
+}
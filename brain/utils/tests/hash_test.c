@@ -0,0 +1,280 @@
+#include <utils.h>
+
+// Notes:
+// - Tests crc32, crc32_multi_buff, and hash64 against known values; and
+//   that each crc32 implementation supported by this cpu returns the same
+//   value as the original byte at a time implementation, for random lengths
+//   and alignments.
+// - Tests that a db file that was created before the db hash_version was
+//   added, which has hash_version 0, still finds its keys.
+// - Prints the throughput of each implementation, and hash64, for a range
+//   of buffer sizes.
+
+//
+// defines
+//
+
+#define DB_FILE             "hash_test.dat"
+#define DB_HASH_VERSION_OFF 2112  // offset of hash_version in the db hdr_t
+#define MAX_DB_KEYS         1000
+
+#define MAX_BUFF            (1*MB)
+#define MAX_RANDOM_TESTS    10000
+
+//
+// variables
+//
+
+// xxh64 with seed 0 and 5, and crc32, of the first len bytes of test_data
+static struct {
+    int      len;
+    uint64_t xxh64_seed0;
+    uint64_t xxh64_seed5;
+    uint32_t crc32;
+} vectors[] = {
+    {   0, 0xef46db3751d8e999, 0x4be1d406981cfd3b, 0x00000000 },
+    {   1, 0x2078e1ad38ad738b, 0xa0ad02c7b968c762, 0xacb39330 },
+    {   3, 0x634d95fc01a189cd, 0x5e2d3f769329eb98, 0x8b89a981 },
+    {   4, 0xeed340908a1ac6c6, 0x7effb15878866083, 0xa638b4be },
+    {   7, 0x0da493621d6dc898, 0x0dd957a253cefce8, 0xd7e18588 },
+    {   8, 0x76f916c7bb523126, 0x180b341a5d5a3de5, 0x2601bb59 },
+    {  31, 0xba180c5cdd27ad99, 0xbee86cdd35ea137e, 0x8aa6407a },
+    {  32, 0xf40f4b95694fde42, 0x8fbff20d0df5f7be, 0x64ee64f0 },
+    {  33, 0x7d3e875dfd87c981, 0xbe4a82b30e36b1b8, 0xb60da929 },
+    {  64, 0x72afba644577daab, 0xa6bb384ac24bf6b3, 0xbc549c15 },
+    { 100, 0x71bfb6319c7fcfc1, 0x75eb3d41035bc3f4, 0xc3fc8485 },
+    { 300, 0xf4869810419f3823, 0xb698df5bc2d85079, 0xcec43d12 },
+                };
+
+static uint8_t test_data[300];
+
+//
+// prototypes
+//
+
+static bool test_vectors(void);
+static bool test_impls(void);
+static bool test_db(void);
+static bool db_keys_found(void);
+static void set_db_hash_version(uint64_t version);
+static void benchmark(void);
+static bool check(bool cond, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    bool pass = true;
+
+    log_init(NULL, false, true);
+
+    for (int i = 0; i < sizeof(test_data); i++) {
+        test_data[i] = ((i*167 + 13) ^ (i >> 3)) & 0xff;
+    }
+
+    printf("crc32 implementation: %s\n", crc32_get_impl());
+    pass &= test_vectors();
+    pass &= test_impls();
+    pass &= test_db();
+    benchmark();
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// -----------------  TESTS  -----------------------------------------------------
+
+static bool test_vectors(void)
+{
+    bool pass = true, ok;
+    int impl, i, len;
+
+    pass &= check(crc32("123456789", 9) == 0xcbf43926, "crc32 check value");
+
+    for (impl = CRC32_IMPL_BYTE; impl <= CRC32_IMPL_ARMV8; impl++) {
+        if (crc32_set_impl(impl) < 0) {
+            continue;
+        }
+        ok = true;
+        for (i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+            len = vectors[i].len;
+            ok &= (crc32(test_data, len) == vectors[i].crc32);
+            ok &= (crc32_multi_buff(2, test_data, (size_t)len/2, test_data+len/2, (size_t)(len-len/2)) ==
+                   vectors[i].crc32);
+        }
+        pass &= check(ok, "crc32 %s vectors", crc32_get_impl());
+    }
+
+    ok = true;
+    for (i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+        len = vectors[i].len;
+        ok &= (hash64(test_data, len, 0) == vectors[i].xxh64_seed0);
+        ok &= (hash64(test_data, len, 5) == vectors[i].xxh64_seed5);
+    }
+    pass &= check(ok, "hash64 vectors");
+
+    return pass;
+}
+
+// compare each implementation with the byte at a time implementation
+static bool test_impls(void)
+{
+    uint8_t *buff = malloc(MAX_BUFF);
+    uint32_t expected, actual;
+    int impl, i, off, len;
+    bool pass = true, ok;
+
+    for (i = 0; i < MAX_BUFF; i++) {
+        buff[i] = random();
+    }
+
+    for (impl = CRC32_IMPL_SLICE8; impl <= CRC32_IMPL_ARMV8; impl++) {
+        if (crc32_set_impl(impl) < 0) {
+            printf("%-6s crc32 impl %d not supported by this cpu\n", "skip", impl);
+            continue;
+        }
+        ok = true;
+        srandom(1);
+        for (i = 0; i < MAX_RANDOM_TESTS && ok; i++) {
+            off = random() % 64;
+            len = (i < MAX_RANDOM_TESTS/2 ? random() % 100 : random() % (MAX_BUFF/16));
+            crc32_set_impl(CRC32_IMPL_BYTE);
+            expected = crc32(buff+off, len);
+            crc32_set_impl(impl);
+            actual = crc32(buff+off, len);
+            ok = (actual == expected);
+        }
+        pass &= check(ok, "crc32 %s matches byte, random lengths and alignments", crc32_get_impl());
+    }
+
+    free(buff);
+    return pass;
+}
+
+// the db file is created with the current hash_version, its hash_version is
+// then set to 0 before keys are added, to simulate a db file created before
+// the hash_version was added to the hdr
+static bool test_db(void)
+{
+    bool pass = true;
+
+    unlink(DB_FILE);
+    db_init(DB_FILE, true, MB);
+    set_db_hash_version(0);
+
+    db_init(DB_FILE, false, 0);
+    for (int i = 0; i < MAX_DB_KEYS; i++) {
+        char keystr[32];
+        sprintf(keystr, "key_%d", i);
+        db_set(i % 4, keystr, &i, sizeof(i));
+    }
+    pass &= check(db_keys_found(), "db hash_version 0, keys found");
+
+    db_init(DB_FILE, false, 0);
+    pass &= check(db_keys_found(), "db hash_version 0, keys found after reopen");
+
+    db_reset();
+    for (int i = 0; i < MAX_DB_KEYS; i++) {
+        char keystr[32];
+        sprintf(keystr, "key_%d", i);
+        db_set(i % 4, keystr, &i, sizeof(i));
+    }
+    db_init(DB_FILE, false, 0);
+    pass &= check(db_keys_found(), "db reset to current hash_version, keys found after reopen");
+
+    unlink(DB_FILE);
+    return pass;
+}
+
+static bool db_keys_found(void)
+{
+    char keystr[32];
+    unsigned int val_len;
+    void *val;
+
+    for (int i = 0; i < MAX_DB_KEYS; i++) {
+        sprintf(keystr, "key_%d", i);
+        if (db_get(i % 4, keystr, &val, &val_len) != 0 || val_len != sizeof(i) || *(int*)val != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_db_hash_version(uint64_t version)
+{
+    int fd;
+
+    fd = open(DB_FILE, O_RDWR);
+    if (fd < 0 || pwrite(fd, &version, sizeof(version), DB_HASH_VERSION_OFF) != sizeof(version)) {
+        FATAL("set hash_version of %s, %s\n", DB_FILE, strerror(errno));
+    }
+    close(fd);
+}
+
+// -----------------  BENCHMARK  -------------------------------------------------
+
+static void benchmark(void)
+{
+    static int sizes[] = { 8, 64, 512, 4096, 65536, 1*MB };
+    uint8_t *buff = malloc(MAX_BUFF);
+    volatile uint64_t sink = 0;
+    uint64_t start, total;
+    int impl, i, j, iters;
+    double mbs[4];
+
+    for (i = 0; i < MAX_BUFF; i++) {
+        buff[i] = random();
+    }
+
+    printf("\nthroughput MB/s\n");
+    printf("%8s %10s %10s %10s %10s\n", "size", "byte", "slice8", "armv8", "hash64");
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        iters = (64 * MB) / sizes[i];
+        total = (uint64_t)iters * sizes[i];
+
+        for (impl = CRC32_IMPL_BYTE; impl <= CRC32_IMPL_ARMV8; impl++) {
+            mbs[impl] = 0;
+            if (crc32_set_impl(impl) < 0) {
+                continue;
+            }
+            start = microsec_timer();
+            for (j = 0; j < iters; j++) {
+                sink += crc32(buff, sizes[i]);
+            }
+            mbs[impl] = (double)total / (microsec_timer() - start + 1);
+        }
+
+        start = microsec_timer();
+        for (j = 0; j < iters; j++) {
+            sink += hash64(buff, sizes[i], 0);
+        }
+        mbs[3] = (double)total / (microsec_timer() - start + 1);
+
+        printf("%8d", sizes[i]);
+        for (j = 0; j < 4; j++) {
+            if (mbs[j] == 0) {
+                printf(" %10s", "-");
+            } else {
+                printf(" %10.0f", mbs[j]);
+            }
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    free(buff);
+}
+
+static bool check(bool cond, char *fmt, ...)
+{
+    va_list ap;
+
+    printf("%-6s ", cond ? "ok" : "FAILED");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    return cond;
+}
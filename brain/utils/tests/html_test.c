@@ -0,0 +1,106 @@
+#include <utils.h>
+
+// Notes:
+// - Tests html_to_text using the wikipedia like pages in the fixtures
+//   directory, which are also served by the search_server.
+
+//
+// prototypes
+//
+
+static char *extract(char *filename);
+static char *get_line(char *text, int n, char *s);
+static bool check(bool cond, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    char *text, line[2000];
+    bool pass = true;
+
+    log_init(NULL, false, true);
+
+    // title in a nested element, comment, empty paragraph, character
+    // references, reference link, and script and style in the head
+    text = extract("fixtures/Mount_Everest.html");
+    pass &= check(strcmp(get_line(text,0,line), "Mount Everest") == 0, "title: '%s'", line);
+    pass &= check(strcmp(get_line(text,1,line), "") == 0, "empty paragraph: '%s'", line);
+    pass &= check(strcmp(get_line(text,2,line), "Coordinates: 27°59′N 86°55′E") == 0, "char refs: '%s'", line);
+    pass &= check(strcmp(get_line(text,4,line),
+                         "Mount Everest is the highest mountain above sea level, located in the "
+                         "Mahalangur Himal range of the Himalayas.[1] Its summit is 8,849 m (29,032 ft) "
+                         "above sea level. The border between Nepal and China runs across its summit point.") == 0,
+                  "paragraph: '%s'", line);
+    pass &= check(strstr(text, "comment") == NULL && strstr(text, "client-js") == NULL &&
+                  strstr(text, "nowrap") == NULL,
+                  "comment, script and style discarded");
+    pass &= check(get_line(text,6,line) == NULL, "number of lines");
+    free(text);
+
+    // title with markup, style within a paragraph, and a paragraph without an end tag
+    text = extract("fixtures/Honey_bee.html");
+    pass &= check(strcmp(get_line(text,0,line), "Honey bee") == 0, "title: '%s'", line);
+    pass &= check(strncmp(get_line(text,1,line), "A honey bee (also spelled honeybee) is a eusocial flying insect "
+                          "within the genus Apis of the bee clade. They are known", 100) == 0 &&
+                  strstr(line, "sr-only") == NULL && strstr(line, "honey & wax") != NULL,
+                  "paragraph: '%s'", line);
+    pass &= check(strcmp(get_line(text,2,line), "Honey bees appeared about 34 million years ago.") == 0,
+                  "paragraph without end tag: '%s'", line);
+    free(text);
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+static char *extract(char *filename)
+{
+    char *html, *text;
+    struct stat buf;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        FATAL("open %s, %s\n", filename, strerror(errno));
+    }
+    fstat(fd, &buf);
+    html = calloc(buf.st_size+1, 1);
+    if (read(fd, html, buf.st_size) != buf.st_size) {
+        FATAL("read %s, %s\n", filename, strerror(errno));
+    }
+    close(fd);
+
+    text = html_to_text(html, "firstHeading");
+    free(html);
+    return text;
+}
+
+// returns line n of text, or NULL if text has less lines
+static char *get_line(char *text, int n, char *s)
+{
+    char *p = text;
+
+    s[0] = '\0';
+    for (int i = 0; i < n; i++) {
+        p = strchr(p, '\n');
+        if (p == NULL) return NULL;
+        p++;
+    }
+    if (*p == '\0') {
+        return NULL;
+    }
+    sprintf(s, "%.*s", (int)strcspn(p, "\n"), p);
+    return s;
+}
+
+static bool check(bool cond, char *fmt, ...)
+{
+    va_list ap;
+
+    printf("%-6s ", cond ? "ok" : "FAILED");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    return cond;
+}
@@ -8,10 +8,19 @@ unsigned int colors[] = {
 
 #define LEDS_ALL_OFF \
     do { \
-        leds_stage_all(LED_OFF,0); \
-        leds_commit(); \
+        for (int l = 0; l < MAX_LEDS_LAYER; l++) leds_layer_disable(l); \
+        render(1000); \
     } while (0)
 
+// call leds_render at 10 ms intervals, for the duration
+static void render(int duration_ms)
+{
+    for (int i = 0; i < duration_ms / 10; i++) {
+        leds_render(100);
+        usleep(10000);
+    }
+}
+
 int main(int argc, char **argv)
 {
     int i, wavelen, led_brightness;
@@ -20,7 +29,7 @@ int main(int argc, char **argv)
     log_init(NULL,false,true);
 
     // init leds led device
-    leds_init();
+    leds_init(3.0);
 
     // if 'off' requested then exit, leds are now off due to above call to leds_init
     if (argc == 2 && strcmp(argv[1], "off") == 0) {
@@ -29,52 +38,61 @@ int main(int argc, char **argv)
 
     // tests follow ...
     INFO("Colors test ...\n");
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
     for (i = 0; i < MAX_COLORS; i++) {
-        leds_stage_all(colors[i], 100);
-        leds_commit();
-        sleep(1);
+        leds_layer_set_all(LEDS_LAYER_IDLE, colors[i], 100);
+        render(1000);
     }
     LEDS_ALL_OFF;
-    sleep(1);
 
     INFO("Wavelen test ...\n");
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
     for (wavelen = 400; wavelen <= 700; wavelen += 2) {
         unsigned int rgb = wavelen_to_rgb(wavelen);
-        leds_stage_all(rgb, 100);
-        leds_commit();
-        usleep(100000);
+        leds_layer_set_all(LEDS_LAYER_IDLE, rgb, 100);
+        render(100);
     }
     LEDS_ALL_OFF;
-    sleep(1);
 
     INFO("LED brightness test ...\n");
-    int color = LED_WHITE;
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
     for (led_brightness = 0; led_brightness <= 100; led_brightness++) {
-        for (i = 0; i < MAX_LED; i++) {
-            leds_stage_led(i, color, led_brightness);
-        }
-        leds_commit();
-        usleep(100000);
+        leds_layer_set_all(LEDS_LAYER_IDLE, LED_WHITE, led_brightness);
+        render(100);
     }
     LEDS_ALL_OFF;
-    sleep(1);
 
     INFO("Rotate test ...\n");
     for (i = 0; i < MAX_LED; i++) {
-        leds_stage_led(i, 
-                       LED_LIGHT_BLUE, 
-                       i * 100 / (MAX_LED-1));
+        leds_layer_set_led(LEDS_LAYER_IDLE, i, LED_LIGHT_BLUE, i * 100 / (MAX_LED-1));
     }
-    for (int cnt = 0; cnt < 100; cnt++) {
-        leds_stage_rotate(0);
-        leds_commit();
-        usleep(100000);
-    }
-    for (int cnt = 0; cnt < 100; cnt++) {
-        leds_stage_rotate(1);
-        leds_commit();
-        usleep(100000);
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
+    leds_layer_rotate(LEDS_LAYER_IDLE, 100000, 0);
+    render(10000);
+    leds_layer_rotate(LEDS_LAYER_IDLE, 100000, 1);
+    render(10000);
+    LEDS_ALL_OFF;
+
+    INFO("Layers test ...\n");
+    for (i = 0; i < MAX_LED; i++) {
+        leds_layer_set_led(LEDS_LAYER_IDLE, i, LED_BLUE, 50 * (i + 4) / MAX_LED);
     }
+    leds_layer_rotate(LEDS_LAYER_IDLE, 200000, 1);
+    leds_layer_enable(LEDS_LAYER_IDLE, LEDS_BLEND_REPLACE, 0);
+    render(2000);
+    INFO("  doa led over the idle layer\n");
+    leds_layer_set_all(LEDS_LAYER_DOA, LED_OFF, 0);
+    leds_layer_set_led(LEDS_LAYER_DOA, 3, LED_WHITE, 80);
+    leds_layer_enable(LEDS_LAYER_DOA, LEDS_BLEND_OVER, 0);
+    render(3000);
+    INFO("  error layer for 1 second, replacing the lower layers\n");
+    leds_layer_set_all(LEDS_LAYER_ERROR, LED_RED, 50);
+    leds_layer_enable(LEDS_LAYER_ERROR, LEDS_BLEND_REPLACE, 1000000);
+    render(3000);
+    INFO("  green added to the lower layers\n");
+    leds_layer_set_all(LEDS_LAYER_MUSIC, LED_GREEN, 30);
+    leds_layer_enable(LEDS_LAYER_MUSIC, LEDS_BLEND_ADD, 0);
+    render(3000);
 
     // done
     LEDS_ALL_OFF;
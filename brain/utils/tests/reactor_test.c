@@ -0,0 +1,198 @@
+#include <utils.h>
+
+// Notes:
+// - Tests the reactor: idle wakeups, one shot timer accuracy across the
+//   timer wheel levels, timer cancel, periodic timers, reactor_post latency
+//   from another thread, and fd procs.
+// - usage: reactor_test [-l]
+//   -l: include timers of 17 secs, which are cascaded from wheel level 2
+
+//
+// defines
+//
+
+#define MAX_ONESHOT       48        // less than the reactor's MAX_TIMER
+#define MAX_POST_TEST     1000
+#define MAX_LATE_US       100000    // generous, for a loaded machine; the max late is printed
+
+//
+// variables
+//
+
+static uint64_t oneshot_due[MAX_ONESHOT];
+static int64_t  oneshot_late[MAX_ONESHOT];
+static int      oneshot_handle[MAX_ONESHOT];
+static bool     oneshot_cancelled[MAX_ONESHOT];
+static int      periodic_cnt;
+static uint64_t post_time;
+static uint64_t post_latency_total, post_latency_max;
+static int      post_cnt;
+static int      fd_cnt;
+static int      pipe_fds[2];
+static bool     slow_proc_done;
+
+//
+// prototypes
+//
+
+static void *reactor_thread(void *cx);
+static void oneshot_proc(void *cx);
+static void periodic_proc(void *cx);
+static void post_proc(void *cx);
+static void fd_proc(void *cx);
+static void slow_proc(void *cx);
+static bool check(bool cond, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    reactor_stats_t s0, s1;
+    pthread_t tid;
+    bool pass = true, long_timers = false;
+    int i, h, max_oneshot_ms, late_cnt = 0, early_cnt = 0, fired_cnt = 0, cancelled_fired = 0;
+    int64_t max_late = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+        long_timers = true;
+    }
+
+    log_init(NULL, false, true);
+    reactor_init();
+    pthread_create(&tid, NULL, reactor_thread, NULL);
+    usleep(100*MS);
+
+    // idle: there should be no wakeups
+    reactor_get_stats(&s0);
+    sleep(2);
+    reactor_get_stats(&s1);
+    pass &= check(s1.wakeups - s0.wakeups == 0, "idle 2 secs: %lld wakeups",
+                  (long long)(s1.wakeups - s0.wakeups));
+
+    // one shot timers, at random delays across wheel levels 0 and 1, and
+    // optionally level 2; cancel every 4th
+    srandom(1);
+    max_oneshot_ms = 0;
+    for (i = 0; i < MAX_ONESHOT; i++) {
+        int delay_ms = (long_timers && i % 8 == 0 ? 17000 + random() % 500 : random() % 3000);
+        oneshot_due[i] = microsec_timer() + delay_ms * MS;
+        oneshot_late[i] = INT64_MIN;
+        oneshot_handle[i] = reactor_timer_start(delay_ms * MS, 0, oneshot_proc, (void*)(intptr_t)i);
+        if (delay_ms > max_oneshot_ms) max_oneshot_ms = delay_ms;
+    }
+    for (i = 0; i < MAX_ONESHOT; i += 4) {
+        reactor_timer_cancel(oneshot_handle[i]);
+        oneshot_cancelled[i] = true;
+    }
+    usleep((max_oneshot_ms + MAX_LATE_US/MS + 100) * MS);
+    for (i = 0; i < MAX_ONESHOT; i++) {
+        if (oneshot_late[i] == INT64_MIN) continue;
+        if (oneshot_cancelled[i]) { cancelled_fired++; continue; }
+        fired_cnt++;
+        if (oneshot_late[i] < 0) early_cnt++;
+        if (oneshot_late[i] > MAX_LATE_US) late_cnt++;
+        if (oneshot_late[i] > max_late) max_late = oneshot_late[i];
+    }
+    pass &= check(fired_cnt == MAX_ONESHOT - MAX_ONESHOT/4 && cancelled_fired == 0,
+                  "one shot timers: %d fired, %d cancelled fired", fired_cnt, cancelled_fired);
+    pass &= check(early_cnt == 0 && late_cnt == 0,
+                  "one shot timers: %d early, %d late, max late %lld us",
+                  early_cnt, late_cnt, (long long)max_late);
+
+    // periodic timer, 10 ms for 2 secs
+    reactor_get_stats(&s0);
+    h = reactor_timer_start(10*MS, 10*MS, periodic_proc, NULL);
+    usleep(2005*MS);
+    reactor_timer_cancel(h);
+    reactor_get_stats(&s1);
+    pass &= check(periodic_cnt >= 199 && periodic_cnt <= 201, "periodic 10 ms timer for 2 secs: %d calls, %lld wakeups",
+                  periodic_cnt, (long long)(s1.wakeups - s0.wakeups));
+
+    // post latency
+    for (i = 0; i < MAX_POST_TEST; i++) {
+        post_time = microsec_timer();
+        reactor_post(post_proc, NULL);
+        while (post_cnt == i) usleep(100);
+    }
+    pass &= check(post_cnt == MAX_POST_TEST, "post: avg latency %0.1f us, max %lld us",
+                  (double)post_latency_total / post_cnt, (long long)post_latency_max);
+
+    // fd proc
+    pipe(pipe_fds);
+    reactor_fd_add(pipe_fds[0], fd_proc, NULL);
+    for (i = 0; i < 10; i++) {
+        write(pipe_fds[1], "x", 1);
+        usleep(10*MS);
+    }
+    reactor_fd_del(pipe_fds[0]);
+    pass &= check(fd_cnt == 10, "fd: %d of 10 procs called", fd_cnt);
+
+    // cancel waits for a running proc to complete
+    h = reactor_timer_start(0, 0, slow_proc, NULL);
+    usleep(10*MS);
+    reactor_timer_cancel(h);
+    pass &= check(slow_proc_done, "cancel waited for running proc");
+
+    reactor_stop();
+    pthread_join(tid, NULL);
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+static void *reactor_thread(void *cx)
+{
+    reactor_run();
+    return NULL;
+}
+
+static bool check(bool cond, char *fmt, ...)
+{
+    va_list ap;
+
+    printf("%-6s ", cond ? "ok" : "FAILED");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    return cond;
+}
+
+// -----------------  PROCS  -----------------------------------------------------
+
+static void oneshot_proc(void *cx)
+{
+    int i = (intptr_t)cx;
+
+    oneshot_late[i] = (int64_t)(microsec_timer() - oneshot_due[i]);
+}
+
+static void periodic_proc(void *cx)
+{
+    periodic_cnt++;
+}
+
+static void post_proc(void *cx)
+{
+    uint64_t latency = microsec_timer() - post_time;
+
+    post_latency_total += latency;
+    if (latency > post_latency_max) post_latency_max = latency;
+    __sync_synchronize();
+    post_cnt++;
+}
+
+static void fd_proc(void *cx)
+{
+    char c;
+
+    if (read(pipe_fds[0], &c, 1) == 1) {
+        fd_cnt++;
+    }
+}
+
+static void slow_proc(void *cx)
+{
+    usleep(50*MS);
+    slow_proc_done = true;
+}
@@ -0,0 +1,244 @@
+#include <utils.h>
+
+// Notes:
+// - A local stand-in for the google custom search api and wikipedia, so
+//   that customsearch can be tested offline, see customsearch.c.
+// - usage: search_server [-p port] [-d fixtures_dir]
+// - Requests:
+//   . /customsearch/v1?q=<query>  - returns a search result in the json
+//       format of the custom search api, with a link to the first fixture
+//       page whose name's words are all in the query; the other params
+//       are ignored
+//   . /wiki/<name>                - returns fixtures_dir/<name>.html
+
+//
+// defines
+//
+
+#define MAX_REQ   8000
+
+//
+// variables
+//
+
+static int   port = 8080;
+static char *dir  = "fixtures";
+
+//
+// prototypes
+//
+
+static void usage(void);
+static void serve(int sfd);
+static void search(int sfd, char *params);
+static void page(int sfd, char *name);
+static void reply(int sfd, int status, char *content_type, char *body, int body_len);
+static void url_decode(char *s);
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    int lfd, sfd, optval = 1;
+
+    log_init(NULL, false, true);
+
+    while (true) {
+        signed char opt_char = getopt(argc, argv, "p:d:h");
+        if (opt_char == -1) {
+            break;
+        }
+        switch (opt_char) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'h':
+            usage();
+            return 1;
+        default:
+            return 1;
+        }
+    }
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 10) < 0) {
+        FATAL("bind/listen port %d, %s\n", port, strerror(errno));
+    }
+    INFO("listening on port %d, fixtures %s\n", port, dir);
+
+    while (true) {
+        sfd = accept(lfd, NULL, NULL);
+        if (sfd < 0) {
+            ERROR("accept, %s\n", strerror(errno));
+            continue;
+        }
+        serve(sfd);
+        close(sfd);
+    }
+
+    return 0;
+}
+
+static void usage(void)
+{
+    ERROR("usage: search_server [-p port] [-d fixtures_dir]\n");
+}
+
+// -----------------  REQUESTS  --------------------------------------------------
+
+static void serve(int sfd)
+{
+    char req[MAX_REQ], path[MAX_REQ], *params;
+    int len = 0, rc;
+
+    // read the request hdr
+    while (len < MAX_REQ-1) {
+        rc = read(sfd, req+len, MAX_REQ-1-len);
+        if (rc <= 0) break;
+        len += rc;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+    req[len] = '\0';
+
+    if (sscanf(req, "GET %s HTTP", path) != 1) {
+        reply(sfd, 400, "text/plain", "bad request\n", 12);
+        return;
+    }
+    INFO("GET %s\n", path);
+
+    params = strchr(path, '?');
+    if (params) {
+        *params++ = '\0';
+    }
+
+    if (strcmp(path, "/customsearch/v1") == 0) {
+        search(sfd, params ? params : "");
+    } else if (strncmp(path, "/wiki/", 6) == 0) {
+        page(sfd, path+6);
+    } else {
+        reply(sfd, 404, "text/plain", "not found\n", 10);
+    }
+}
+
+static void search(int sfd, char *params)
+{
+    char query[MAX_REQ] = "", name[300], words[300], body[1000];
+    char *p, *word, *saveptr;
+    struct dirent *de;
+    bool match = false;
+    DIR *d;
+
+    // get the query param
+    for (p = strtok_r(params, "&", &saveptr); p; p = strtok_r(NULL, "&", &saveptr)) {
+        if (strncmp(p, "q=", 2) == 0) {
+            strcpy(query, p+2);
+            url_decode(query);
+        }
+    }
+    for (p = query; *p; p++) *p = tolower(*p);
+
+    // find the fixture whose name's words are all in the query
+    d = opendir(dir);
+    if (d == NULL) {
+        FATAL("opendir %s, %s\n", dir, strerror(errno));
+    }
+    while (!match && (de = readdir(d)) != NULL) {
+        if (sscanf(de->d_name, "%[^.].html", name) != 1 || strstr(de->d_name, ".html") == NULL) {
+            continue;
+        }
+        strcpy(words, name);
+        match = true;
+        for (p = words; *p; p++) *p = tolower(*p);
+        for (word = strtok_r(words, "_", &saveptr); word; word = strtok_r(NULL, "_", &saveptr)) {
+            if (strstr(query, word) == NULL) {
+                match = false;
+                break;
+            }
+        }
+    }
+    closedir(d);
+
+    if (match) {
+        sprintf(body,
+                "{\n"
+                "  \"kind\": \"customsearch#search\",\n"
+                "  \"items\": [\n"
+                "    {\n"
+                "      \"title\": \"%s - Wikipedia\",\n"
+                "      \"link\": \"http://127.0.0.1:%d/wiki/%s\"\n"
+                "    }\n"
+                "  ]\n"
+                "}\n",
+                name, port, name);
+    } else {
+        sprintf(body,
+                "{\n"
+                "  \"kind\": \"customsearch#search\",\n"
+                "  \"searchInformation\": { \"totalResults\": \"0\" }\n"
+                "}\n");
+    }
+    reply(sfd, 200, "application/json", body, strlen(body));
+}
+
+static void page(int sfd, char *name)
+{
+    char pathname[MAX_REQ+100], *body;
+    struct stat buf;
+    int fd;
+
+    sprintf(pathname, "%s/%s.html", dir, name);
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0 || strstr(name, "..")) {
+        reply(sfd, 404, "text/plain", "not found\n", 10);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    fstat(fd, &buf);
+    body = malloc(buf.st_size);
+    if (read(fd, body, buf.st_size) != buf.st_size) {
+        ERROR("read %s, %s\n", pathname, strerror(errno));
+    }
+    close(fd);
+
+    reply(sfd, 200, "text/html; charset=UTF-8", body, buf.st_size);
+    free(body);
+}
+
+static void reply(int sfd, int status, char *content_type, char *body, int body_len)
+{
+    char hdr[200];
+    int len;
+
+    len = sprintf(hdr, "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                  status, status == 200 ? "OK" : "Error", content_type, body_len);
+    if (write(sfd, hdr, len) != len || write(sfd, body, body_len) != body_len) {
+        ERROR("write, %s\n", strerror(errno));
+    }
+}
+
+static void url_decode(char *s)
+{
+    char *out = s;
+    unsigned int c;
+
+    while (*s) {
+        if (*s == '%' && sscanf(s+1, "%2x", &c) == 1) {
+            *out++ = c;
+            s += 3;
+        } else {
+            *out++ = (*s == '+' ? ' ' : *s);
+            s++;
+        }
+    }
+    *out = '\0';
+}
@@ -0,0 +1,125 @@
+#include <utils.h>
+
+// Notes:
+// - Tests the cmd latency tracing: the spans computed from the trace points,
+//   the percentiles of the rolling histograms, and that the histograms are
+//   saved in the db by trace_save and restored by trace_init.
+
+//
+// defines
+//
+
+#define KEYID_TEST    1
+#define MAX_CMD       200
+#define MAX_ERR_PCT   20     // the histogram buckets are 19% wide
+
+//
+// prototypes
+//
+
+static void cmd(uint64_t s2t_ms, uint64_t hndlr_ms, uint64_t audio_out_ms);
+static bool check_span(int span, double exp_p50, double exp_p95);
+static bool check(bool cond, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// -----------------  MAIN  ------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    char *desc;
+    double p50, p95;
+    unsigned int n;
+    bool pass = true;
+    int i;
+
+    log_init(NULL, false, true);
+    unlink("trace_test.dat");
+    db_init("trace_test.dat", true, GB);
+    trace_init(KEYID_TEST);
+
+    // no samples
+    pass &= check(trace_get_span(0, &desc, &p50, &p95, &n) < 0, "no samples before the first cmd");
+
+    // trace points without a cmd being traced are ignored
+    trace_point(TRACE_T2S_START);
+    trace_end();
+    pass &= check(trace_get_span(0, &desc, &p50, &p95, &n) < 0, "trace points without a cmd are ignored");
+
+    // cmds with the transcript latency repeatedly stepping from 1 to 2 secs,
+    // and the handler latency 100 ms for 90% of the cmds and 1 sec for the others
+    for (i = 0; i < MAX_CMD; i++) {
+        cmd(1000 + 1000 * (i % 20) / 20, i % 10 == 0 ? 1000 : 100, 20);
+    }
+    pass &= check_span(2, 1500, 1950);   // s2t_transcript
+    pass &= check_span(4, 100, 1000);    // hndlr
+    pass &= check_span(6, 20, 20);       // hndlr_to_audio
+
+    // a cmd without audio output does not add to the spans that end with
+    // the audio output
+    trace_get_span(8, &desc, &p50, &p95, &n);
+    cmd(1000, 100, 0);
+    pass &= check(trace_get_span(8, &desc, &p50, &p95, &n) == 0 && n == MAX_CMD,
+                  "cmd without audio output: %s n=%d", desc, n);
+
+    // the histograms are rolling, the old samples decay
+    for (i = 0; i < MAX_CMD; i++) {
+        cmd(300, 100, 20);
+    }
+    pass &= check_span(2, 300, 300);
+
+    // the histograms are saved in the db, and restored
+    trace_get_span(2, &desc, &p50, &p95, &n);
+    trace_save();
+    trace_init(KEYID_TEST);
+    pass &= check_span(2, 300, 300);
+
+    printf("\n");
+    trace_dump(KEYID_TEST);
+    unlink("trace_test.dat");
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// trace a cmd, with the trace points at the times provided; this takes
+// s2t_ms + hndlr_ms + audio_out_ms of real time
+static void cmd(uint64_t s2t_ms, uint64_t hndlr_ms, uint64_t audio_out_ms)
+{
+    uint64_t t;
+
+    trace_begin();
+    t = microsec_timer();
+    trace_point_at(TRACE_S2T_START, t);
+    trace_point_at(TRACE_S2T_TRANSCRIPT, t + s2t_ms*MS);
+    trace_point_at(TRACE_GRAMMAR_MATCH, t + s2t_ms*MS);
+    trace_point_at(TRACE_HNDLR_START, t + s2t_ms*MS);
+    trace_point_at(TRACE_HNDLR_END, t + (s2t_ms + hndlr_ms)*MS);
+    if (audio_out_ms) {
+        trace_point_at(TRACE_AUDIO_OUT, t + (s2t_ms + audio_out_ms)*MS);
+    }
+    trace_end();
+}
+
+static bool check_span(int span, double exp_p50, double exp_p95)
+{
+    char *desc = "";
+    double p50 = 0, p95 = 0;
+    unsigned int n = 0;
+
+    trace_get_span(span, &desc, &p50, &p95, &n);
+    return check(fabs(p50 - exp_p50) <= exp_p50 * MAX_ERR_PCT / 100 &&
+                 fabs(p95 - exp_p95) <= exp_p95 * MAX_ERR_PCT / 100,
+                 "%s: n=%d p50=%0.0f (expected %0.0f) p95=%0.0f (expected %0.0f)",
+                 desc, n, p50, exp_p50, p95, exp_p95);
+}
+
+static bool check(bool cond, char *fmt, ...)
+{
+    va_list ap;
+
+    printf("%-6s ", cond ? "ok" : "FAILED");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    return cond;
+}
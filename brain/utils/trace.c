@@ -0,0 +1,291 @@
+#include <utils.h>
+
+// Notes:
+// - Measures the latency of the stages of a cmd, from the wake word to the
+//   first audio output of the response. trace_begin is called when the wake
+//   word is detected, trace_point records the time of a trace point, and
+//   trace_end computes the spans between trace points and adds them to the
+//   span histograms.
+// - trace_point only records the first occurrence of a trace point in a cmd,
+//   for example the first call to t2s_play. Trace points that occur when
+//   there is no cmd being traced are ignored.
+// - The histograms are rolling: the counts decay by TRACE_DECAY for each
+//   sample added, so that they represent about the last 50 cmds. The bucket
+//   sizes are logarithmic, 4 per octave, from 1 ms to 65 secs.
+// - The histograms are saved in the db, using the keyid provided to
+//   trace_init, with the span name as the keystr. If trace_init is not
+//   called then the histograms are not saved.
+// - trace_end is called on the audio thread for a cmd that timed out, so it
+//   does not write the db; it marks the updated histograms, and they are
+//   saved by the next call to trace_save, which is made by the cmd thread.
+
+//
+// defines
+//
+
+#define MAX_BUCKET        64
+#define BUCKETS_PER_OCT   4
+#define TRACE_DECAY       0.98
+
+#define MUTEX_LOCK   do { pthread_mutex_lock(&mutex); } while (0)
+#define MUTEX_UNLOCK do { pthread_mutex_unlock(&mutex); } while (0)
+
+//
+// typedefs
+//
+
+typedef struct {
+    float        count[MAX_BUCKET];
+    unsigned int n;           // total number of samples added
+} hist_t;
+
+typedef struct {
+    char *name;               // db keystr
+    char *desc;               // spoken by the latency report
+    int   start;
+    int   end;
+} span_t;
+
+//
+// variables
+//
+
+static span_t span_tbl[MAX_TRACE_SPAN] = {
+    { "s2t_startup",         "speech to text startup",   TRACE_WAKE_WORD,     TRACE_S2T_START        },
+    { "s2t_first_partial",   "first partial transcript", TRACE_S2T_START,     TRACE_S2T_FIRST_PARTIAL },
+    { "s2t_transcript",      "transcript",               TRACE_S2T_START,     TRACE_S2T_TRANSCRIPT   },
+    { "grammar_match",       "grammar match",            TRACE_S2T_TRANSCRIPT, TRACE_GRAMMAR_MATCH   },
+    { "hndlr",               "command handler",          TRACE_HNDLR_START,   TRACE_HNDLR_END        },
+    { "t2s_synth",           "speech synthesis",         TRACE_T2S_START,     TRACE_T2S_END          },
+    { "hndlr_to_audio",      "handler to audio out",     TRACE_HNDLR_START,   TRACE_AUDIO_OUT        },
+    { "transcript_to_audio", "transcript to audio out",  TRACE_S2T_TRANSCRIPT, TRACE_AUDIO_OUT       },
+    { "wake_to_audio",       "wake word to audio out",   TRACE_WAKE_WORD,     TRACE_AUDIO_OUT        },
+};
+
+static hist_t          hist[MAX_TRACE_SPAN];
+static uint64_t        tp_time[MAX_TRACE_POINT];
+static int             last_span_ms[MAX_TRACE_SPAN];
+static bool            active;
+static unsigned int    save_pending;   // bit mask of the spans whose histogram is not saved
+static int             db_keyid = -1;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// prototypes
+//
+
+static void hist_add(hist_t *h, uint64_t us);
+static double hist_percentile(hist_t *h, double pct);
+static void dump_cb(int keyid, char *keystr, void *val, unsigned int val_len);
+
+// -----------------  INIT  ----------------------------------------------------
+
+void trace_init(int keyid)
+{
+    hist_t *h;
+    unsigned int len;
+
+    db_keyid = keyid;
+
+    // restore the histograms that were saved in the db
+    for (int i = 0; i < MAX_TRACE_SPAN; i++) {
+        if (db_get(db_keyid, span_tbl[i].name, (void**)&h, &len) < 0) {
+            continue;
+        }
+        if (len != sizeof(hist_t)) {
+            WARN("ignoring saved hist %s, len=%d\n", span_tbl[i].name, len);
+            continue;
+        }
+        hist[i] = *h;
+    }
+}
+
+// -----------------  RUNTIME  -------------------------------------------------
+
+void trace_begin(void)
+{
+    MUTEX_LOCK;
+    memset(tp_time, 0, sizeof(tp_time));
+    tp_time[TRACE_WAKE_WORD] = microsec_timer();
+    active = true;
+    MUTEX_UNLOCK;
+}
+
+void trace_point(int tp)
+{
+    trace_point_at(tp, microsec_timer());
+}
+
+// t is a microsec_timer value, 0 is ignored
+void trace_point_at(int tp, uint64_t t)
+{
+    assert(tp >= 0 && tp < MAX_TRACE_POINT);
+
+    if (!active || t == 0) {
+        return;
+    }
+
+    MUTEX_LOCK;
+    if (active && tp_time[tp] == 0) {
+        tp_time[tp] = t;
+    }
+    MUTEX_UNLOCK;
+}
+
+void trace_end(void)
+{
+    span_t *s;
+    char str[1000] = "";
+    int len = 0;
+
+    MUTEX_LOCK;
+
+    if (!active) {
+        MUTEX_UNLOCK;
+        return;
+    }
+    active = false;
+
+    // add the spans whose start and end trace points both occurred to the
+    // histograms, and mark the updated histograms to be saved by trace_save
+    for (int i = 0; i < MAX_TRACE_SPAN; i++) {
+        s = &span_tbl[i];
+        last_span_ms[i] = -1;
+        if (tp_time[s->start] == 0 || tp_time[s->end] < tp_time[s->start]) {
+            continue;
+        }
+        last_span_ms[i] = (tp_time[s->end] - tp_time[s->start]) / 1000;
+
+        hist_add(&hist[i], tp_time[s->end] - tp_time[s->start]);
+        save_pending |= (1 << i);
+
+        len += snprintf(str+len, sizeof(str)-len, "%s=%lld ",
+                        s->name, (long long)(tp_time[s->end] - tp_time[s->start]) / 1000);
+    }
+
+    MUTEX_UNLOCK;
+
+    INFO("LATENCY MS: %s\n", str);
+}
+
+// saves the histograms updated by trace_end in the db; the histograms are
+// copied while holding the mutex, and written to the db after releasing it
+void trace_save(void)
+{
+    hist_t       h[MAX_TRACE_SPAN];
+    unsigned int pending;
+
+    MUTEX_LOCK;
+    pending = save_pending;
+    save_pending = 0;
+    memcpy(h, hist, sizeof(hist));
+    MUTEX_UNLOCK;
+
+    if (db_keyid < 0) {
+        return;
+    }
+    for (int i = 0; i < MAX_TRACE_SPAN; i++) {
+        if (pending & (1 << i)) {
+            db_set(db_keyid, span_tbl[i].name, &h[i], sizeof(hist_t));
+        }
+    }
+}
+
+// returns -1 if there are no samples for the span
+int trace_get_span(int span, char **desc, double *p50_ms, double *p95_ms, unsigned int *n)
+{
+    int rc = -1;
+
+    assert(span >= 0 && span < MAX_TRACE_SPAN);
+
+    MUTEX_LOCK;
+    if (hist[span].n > 0) {
+        *desc   = span_tbl[span].desc;
+        *p50_ms = hist_percentile(&hist[span], 50);
+        *p95_ms = hist_percentile(&hist[span], 95);
+        *n      = hist[span].n;
+        rc = 0;
+    }
+    MUTEX_UNLOCK;
+
+    return rc;
+}
+
+// returns the spans of the last cmd traced, -1 for the spans that did not occur
+void trace_get_last(int span_ms[MAX_TRACE_SPAN])
+{
+    MUTEX_LOCK;
+    memcpy(span_ms, last_span_ms, sizeof(last_span_ms));
+    MUTEX_UNLOCK;
+}
+
+// -----------------  HISTOGRAM  -----------------------------------------------
+
+// bucket b contains values from 2^(b/4) to 2^((b+1)/4) ms; bucket 0 also
+// contains values less than 1 ms
+static void hist_add(hist_t *h, uint64_t us)
+{
+    int b;
+
+    b = (us < 1000 ? 0 : BUCKETS_PER_OCT * log2(us / 1000.));
+    if (b >= MAX_BUCKET) b = MAX_BUCKET - 1;
+
+    for (int i = 0; i < MAX_BUCKET; i++) {
+        h->count[i] *= TRACE_DECAY;
+    }
+    h->count[b] += 1;
+    h->n++;
+}
+
+// returns ms, interpolated within the bucket that contains the percentile
+static double hist_percentile(hist_t *h, double pct)
+{
+    double total = 0, target, cum = 0;
+    int b;
+
+    for (b = 0; b < MAX_BUCKET; b++) {
+        total += h->count[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    target = total * pct / 100;
+    for (b = 0; b < MAX_BUCKET; b++) {
+        if (h->count[b] > 0 && cum + h->count[b] >= target) {
+            break;
+        }
+        cum += h->count[b];
+    }
+    if (b == MAX_BUCKET) {
+        return pow(2, (double)MAX_BUCKET / BUCKETS_PER_OCT);
+    }
+
+    // bucket 0 is interpolated from 0, the others logarithmically
+    if (b == 0) {
+        return (target - cum) / h->count[0] * pow(2, 1. / BUCKETS_PER_OCT);
+    }
+    return pow(2, (b + (target - cum) / h->count[b]) / BUCKETS_PER_OCT);
+}
+
+// -----------------  DUMP  ----------------------------------------------------
+
+// prints the histograms saved in the db, used by the trace_dump program
+void trace_dump(int keyid)
+{
+    INFO("%-20s %8s %10s %10s\n", "SPAN", "N", "P50_MS", "P95_MS");
+    db_get_keyid(keyid, dump_cb);
+}
+
+static void dump_cb(int keyid, char *keystr, void *val, unsigned int val_len)
+{
+    hist_t *h = val;
+
+    if (val_len != sizeof(hist_t)) {
+        INFO("%-20s invalid len %d\n", keystr, val_len);
+        return;
+    }
+
+    INFO("%-20s %8d %10.1f %10.1f\n",
+         keystr, h->n, hist_percentile(h, 50), hist_percentile(h, 95));
+}
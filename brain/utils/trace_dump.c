@@ -0,0 +1,49 @@
+#include <utils.h>
+
+#define KEYID_LATENCY 4   // must match common.h
+
+char *file_name = "db.dat";
+
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    // init logging
+    log_init(NULL, false, true);
+    misc_init();
+
+    // get and process options
+    while (true) {
+        signed char opt_char = getopt(argc, argv, "f:h");
+        if (opt_char == -1) {
+            break;
+        }
+        switch (opt_char) {
+        case 'f':
+            file_name = optarg;
+            break;
+        case 'h':
+            usage();
+            return 1;
+        default:
+            return 1;
+            break;
+        }
+    }
+
+    // open database
+    INFO("OPENING %s\n\n", file_name);
+    db_init(file_name, false, 0);
+
+    // dump the cmd latency histograms
+    INFO("DUMPING LATENCY ...\n\n");
+    trace_dump(KEYID_LATENCY);
+
+    // done
+    return 0;
+}
+
+static void usage(void)
+{
+    ERROR("usage: trace_dump [-f db_file]\n");
+}
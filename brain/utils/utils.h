@@ -80,6 +80,8 @@
 bool log_verbose[MAX_VERBOSE];
 
 void log_init(char *filename, bool append, bool brief);
+void log_deferred_init(void);
+void log_flush(void);
 void log_msg(char *lvl, char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 
 // -------- misc.c --------
@@ -89,6 +91,9 @@ void misc_init(void);
 uint64_t microsec_timer(void);
 char *time2str(time_t t, char *s);
 
+void futex_wait(int *addr, int val, uint64_t timeout_us);
+void futex_wake(int *addr);
+
 int getsockaddr(char * node, int port, struct sockaddr_in * ret_addr);
 char * sock_addr_to_str(char * s, int slen, struct sockaddr * addr);
 
@@ -98,9 +103,6 @@ void run_program(pid_t *prog_pid, int *fd_to_prog, int *fd_from_prog, char *prog
 
 void poly_fit(int max_data, double *x_data, double *y_data, int degree_of_poly, double *coefficients);
 
-uint32_t crc32(const void *buf, size_t size);
-uint32_t crc32_multi_buff(int n, ...);  // buff,sizeof(buff),repeat
-
 double normalize_angle(double angle);
 double max_doubles(double *x, int n, int *max_idx);
 double min_doubles(double *x, int n, int *min_idx);
@@ -141,6 +143,28 @@ static inline double high_pass_filter_ex(double v, double *cx, int k1, double k2
     return v;
 }
 
+// -------- reactor.c --------
+
+typedef void (*reactor_proc_t)(void *cx);
+
+typedef struct {
+    uint64_t wakeups;
+    uint64_t posts;
+    uint64_t timer_procs;
+    uint64_t fd_procs;
+} reactor_stats_t;
+
+void reactor_init(void);
+void reactor_run(void);
+void reactor_stop(void);
+void reactor_get_stats(reactor_stats_t *s);
+
+void reactor_post(reactor_proc_t proc, void *cx);
+int reactor_timer_start(uint64_t delay_us, uint64_t intvl_us, reactor_proc_t proc, void *cx);
+void reactor_timer_cancel(int handle);
+void reactor_fd_add(int fd, reactor_proc_t proc, void *cx);
+void reactor_fd_del(int fd);
+
 // -------- pa.c --------
 
 #define DEFAULT_OUTPUT_DEVICE "DEFAULT_OUTPUT_DEVICE"
@@ -185,9 +209,20 @@ int sf_gen_white_wav(char *filename, int duration, int max_chan, int sample_rate
 // - led_brightness range  0 - 100
 // - all_brightness range  0 - 100
 // - mode: 0=counterclockwise, 1=clockwise (on respeaker)
+// - layers are composed in the order listed, see leds.c Notes
 
 #define MAX_LED 12
 
+#define LEDS_LAYER_IDLE     0
+#define LEDS_LAYER_DOA      1
+#define LEDS_LAYER_MUSIC    2
+#define LEDS_LAYER_ERROR    3
+#define MAX_LEDS_LAYER      4
+
+#define LEDS_BLEND_REPLACE  0
+#define LEDS_BLEND_OVER     1
+#define LEDS_BLEND_ADD      2
+
 #define LED_RGB(r,g,b) ((unsigned int)(((r) << 0) | ((g) << 8) | ((b) << 16)))
 
 #define LED_WHITE      LED_RGB(255,255,255)
@@ -204,11 +239,13 @@ int sf_gen_white_wav(char *filename, int duration, int max_chan, int sample_rate
 void leds_init(double sf);  // xxx notes on sf
 
 void leds_set_scale_factor(double sf);
-void leds_stage_led(int num, unsigned int rgb, int led_brightness);
-void leds_stage_all(unsigned int rgb, int led_brightness);
-void leds_stage_rotate(int mode);
+void leds_layer_set_led(int layer, int num, unsigned int rgb, int led_brightness);
+void leds_layer_set_all(int layer, unsigned int rgb, int led_brightness);
+void leds_layer_rotate(int layer, int intvl_us, int mode);
+void leds_layer_enable(int layer, int blend, uint64_t duration_us);
+void leds_layer_disable(int layer);
 
-void leds_commit(int all_brightness);
+void leds_render(int all_brightness);
 
 // -------- s2t.c --------
 
@@ -239,6 +276,32 @@ void doa_init(void);
 void doa_feed(const short *frame);
 double doa_get(void);
 
+// -------- beam.c --------
+
+void beam_init(void);
+
+short beam_feed(const short *frame);
+void beam_set_doa(double doa);
+double beam_get_doa(void);
+
+// -------- aec.c --------
+
+typedef struct {
+    int      delay_ms;        // estimated echo delay, -1 until estimated
+    bool     converged;
+    bool     double_talk;
+    double   erle_db;         // echo return loss enhancement, while the reference is active
+    uint64_t blocks;
+    uint64_t active_blocks;   // blocks with the reference active
+    uint64_t dt_blocks;       // blocks with double talk detected
+    uint64_t resets;
+} aec_stats_t;
+
+void aec_init(void);
+
+short aec_feed(short mic, short ref);
+void aec_get_stats(aec_stats_t *s);
+
 // -------- grammar.c --------
 
 typedef char args_t[10][200];
@@ -270,6 +333,72 @@ unsigned int db_get_free_list_len(void);
 void db_reset(void);
 void db_dump(void);
 
+// -------- trace.c --------
+
+#define TRACE_WAKE_WORD          0
+#define TRACE_S2T_START          1
+#define TRACE_S2T_FIRST_PARTIAL  2
+#define TRACE_S2T_TRANSCRIPT     3
+#define TRACE_GRAMMAR_MATCH      4
+#define TRACE_HNDLR_START        5
+#define TRACE_HNDLR_END          6
+#define TRACE_T2S_START          7
+#define TRACE_T2S_END            8
+#define TRACE_AUDIO_OUT          9   // first audio frame output
+#define MAX_TRACE_POINT          10
+
+#define MAX_TRACE_SPAN           9
+
+void trace_init(int keyid);
+void trace_begin(void);
+void trace_point(int tp);
+void trace_point_at(int tp, uint64_t t);
+void trace_end(void);
+void trace_save(void);
+int trace_get_span(int span, char **desc, double *p50_ms, double *p95_ms, unsigned int *n);
+void trace_get_last(int span_ms[MAX_TRACE_SPAN]);
+void trace_dump(int keyid);
+
+// -------- hash.c --------
+
+#define CRC32_IMPL_BYTE    0
+#define CRC32_IMPL_SLICE8  1
+#define CRC32_IMPL_ARMV8   2
+
+uint32_t crc32(const void *buf, size_t size);
+uint32_t crc32_multi_buff(int n, ...);  // buff,sizeof(buff),repeat
+char *crc32_get_impl(void);
+int crc32_set_impl(int impl);
+uint64_t hash64(const void *buf, size_t size, uint64_t seed);
+
+// -------- html.c --------
+
+char *html_to_text(char *html, char *title_id);
+
+// -------- capture.c --------
+
+typedef struct {
+    uint32_t id;               // assigned when stored
+    uint32_t pad;
+    uint64_t time;             // time(NULL) of the wake word
+    int32_t  sample_rate;
+    int32_t  max_chan;
+    int32_t  max_frames;
+    int32_t  wake_frame;       // frame idx of the wake word detection
+    int32_t  transcript_frame; // frame idx of the transcript
+    int32_t  rc;               // of the cmd hndlr, -1 if no transcript or no match
+    double   doa;
+    char     transcript[256];
+    char     hndlr[32];
+    int32_t  span_ms[MAX_TRACE_SPAN];  // -1 if the span did not occur
+} capture_info_t;
+
+void capture_init(char *dir, uint64_t max_bytes);
+void capture_write(capture_info_t *info, short *data);
+void capture_open(char *dir);
+int capture_get_count(void);
+int capture_read(int idx, capture_info_t *info, short **data);
+
 // -------- audio.c --------
 
 #define AUDIO_SHM "/audio_shm"
@@ -282,22 +411,26 @@ void db_dump(void);
 typedef struct {
     // audio input ...
     short frames[48000][4];
-    int   fidx;
-    bool  reset_mic;
+    int   out_pos[48000];    // audio output data idx being played when the frame was
+                             //  received, -1 if none; used as the echo canceller reference
+    int   fidx;          // futex; the audio pgm wakes waiters when fidx is published
+    int   reset_mic;     // futex; the audio pgm wakes waiters when reset_mic is cleared
     // audio output ...
     short data[3600*24000];
     int   max_data;
     int   sample_rate;
-    int   state;
+    int   state;         // futex; waiters are woken when state is changed
     bool  cancel;
     bool  complete_to_idle;
+    uint64_t out_start_us;   // microsec_timer when the first frame of an audio output was
+                             //  played; set by the audio pgm when 0, cleared by the brain
     // audio output amplitude of low, mid and high freq ranges
     double low;
     double mid;
     double high;
 } audio_shm_t;
 
-void audio_init(int (*proc_mic_data)(short *frame), int volume);
+void audio_init(int (*proc_mic_data)(short *frame, short ref), int volume);
 
 int audio_in_reset_mic(void);
 
@@ -313,3 +446,6 @@ void audio_out_get_low_mid_high(double *low, double *mid, double *high);
 
 void audio_out_set_volume(int volume);
 
+void audio_out_clear_start_time(void);
+uint64_t audio_out_get_start_time(void);
+
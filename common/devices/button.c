@@ -3,15 +3,21 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
-#include <pthread.h>
-#include <sched.h>
 #include <string.h>
 #include <errno.h>
 
 #include <button.h>
+#include <gpio_sampler.h>
 #include <gpio.h>
 #include <misc.h>
 
+//
+// defines
+//
+
+#define INTVL_US       5000
+#define DEBOUNCE_CNT   4      // state must be stable for 4 samples (20 ms)
+
 //
 // variables
 //
@@ -19,8 +25,11 @@
 static struct info_s {
     int gpio;
     bool last_state;
+    bool sample_state;
+    int  sample_cnt;
     uint64_t pressed_time_us;
     button_cb_t cb;
+    button_edge_cb_t edge_cb;
 } info_tbl[10];
 static int max_info;
 
@@ -28,24 +37,25 @@ static int max_info;
 // prototypes
 //
 
-static void *button_thread(void *cx);
+static void button_decoder(void *cx, unsigned int gpio_all, uint64_t time_now);
 
 // -----------------  API  ---------------------------------------------
 
 int button_init(int max_info_arg, ...)   // int gpio_pin, ...
 {
-    static pthread_t tid;
+    static bool initialized;
+    int handle;
     va_list ap;
 
     // check that button_init has not already been called
-    if (tid) {
+    if (initialized) {
         ERROR("already initialized\n");
         return -1;
     }
 
-    // init gpio
-    if (gpio_init() < 0) {
-        ERROR("gpio_init failed\n");
+    // init the gpio sampler
+    if (gpio_sampler_init() < 0) {
+        ERROR("gpio_sampler_init failed\n");
         return -1;
     }
 
@@ -58,9 +68,11 @@ int button_init(int max_info_arg, ...)   // int gpio_pin, ...
     max_info = max_info_arg;
     va_end(ap);
 
-    // create the thread to process the button gpio sig values, and to
-    // keep track of accumulated shaft position
-    pthread_create(&tid, NULL, button_thread, NULL);
+    // register the decoder which processes the button gpio values;
+    // the buttons are always monitored
+    handle = gpio_sampler_register("button", INTVL_US, button_decoder, NULL);
+    gpio_sampler_set_active(handle, true);
+    initialized = true;
 
     // success
     return 0;
@@ -76,59 +88,57 @@ void button_register_cb(int id, button_cb_t cb)
     info_tbl[id].cb = cb;
 }
 
-// -----------------  THREAD--------------------------------------------
-
-static void *button_thread(void *cx)
+void button_register_edge_cb(int id, button_edge_cb_t edge_cb)
 {
-    int rc, id;
-    unsigned int gpio_all;
-    struct sched_param param;
-
-    // set realtime priority
-    memset(&param, 0, sizeof(param));
-    param.sched_priority = 85;
-    rc = sched_setscheduler(0, SCHED_FIFO, &param);
-    if (rc < 0) {
-        FATAL("sched_setscheduler, %s\n", strerror(errno));
-    }
+    info_tbl[id].edge_cb = edge_cb;
+}
 
-    // loop forever
-    while (true) {
-        // read all gpio pins
-        gpio_all = gpio_read_all();
-
-        // loop over defined buttons, and determine if the button has 
-        // just been pressed or released, and make appropriate callback
-        for (id = 0; id < max_info; id++) {
-            struct info_s *x = &info_tbl[id];
-            bool curr_state;
-
-            curr_state = IS_BIT_CLR(gpio_all, x->gpio);
-            if (curr_state != x->last_state) {
-                if (curr_state) {
-                    // button has just been pressed
-                    if (x->cb != NULL) {
-                        x->cb(id, true, 0);
-                    }
-                    x->pressed_time_us = microsec_timer();
-                } else {
-                    // button has just been released
-                    uint64_t duration_us = (x->pressed_time_us != 0 
-                                            ? microsec_timer() - x->pressed_time_us 
-                                            : 0);
-                    if (x->cb != NULL) {
-                        x->cb(id, false, duration_us);
-                    }
-                    x->pressed_time_us = 0;
-                }
+// -----------------  DECODER  -------------------------------------------
+
+// called from the gpio sampler thread
+static void button_decoder(void *cx, unsigned int gpio_all, uint64_t time_now)
+{
+    int id;
+
+    // loop over defined buttons, and determine if the button has 
+    // just been pressed or released, and make appropriate callback;
+    // a change of state is accepted once it has been stable for DEBOUNCE_CNT samples,
+    // except that the edge_cb is called on the first pressed sample
+    for (id = 0; id < max_info; id++) {
+        struct info_s *x = &info_tbl[id];
+        bool curr_state;
+
+        curr_state = IS_BIT_CLR(gpio_all, x->gpio);
+        if (curr_state != x->sample_state) {
+            if (curr_state && x->edge_cb != NULL) {
+                x->edge_cb(id);
             }
+            x->sample_state = curr_state;
+            x->sample_cnt = 1;
+        } else if (x->sample_cnt < DEBOUNCE_CNT) {
+            x->sample_cnt++;
+        }
+        if (x->sample_cnt < DEBOUNCE_CNT || curr_state == x->last_state) {
+            continue;
+        }
 
-            x->last_state = curr_state;
+        if (curr_state) {
+            // button has just been pressed
+            if (x->cb != NULL) {
+                x->cb(id, true, 0);
+            }
+            x->pressed_time_us = time_now;
+        } else {
+            // button has just been released
+            uint64_t duration_us = (x->pressed_time_us != 0 
+                                    ? time_now - x->pressed_time_us 
+                                    : 0);
+            if (x->cb != NULL) {
+                x->cb(id, false, duration_us);
+            }
+            x->pressed_time_us = 0;
         }
 
-        // sleep for 10 ms
-        usleep(10000);  // 10 ms
+        x->last_state = curr_state;
     }
-
-    return NULL;
 }
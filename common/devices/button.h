@@ -7,11 +7,18 @@ extern "C" {
 
 // Notes:
 // - button_init varargs: int gpio_pin, ...
+// - the callbacks are called from the gpio sampler thread, and must not block
+// - the cb is called when the debounced state changes; the edge_cb is called
+//   on the first sample of a press, before it is debounced, for uses such as
+//   an emergency stop that should not wait for the debounce; it may be called
+//   more than once per press when the contacts bounce
 
 typedef void (*button_cb_t)(int id, bool pressed, int pressed_duration_us);
+typedef void (*button_edge_cb_t)(int id);
 
 int button_init(int max_info, ...);        // returns -1 on error, else 0
 void button_register_cb(int id, button_cb_t cb);
+void button_register_edge_cb(int id, button_edge_cb_t edge_cb);
 bool button_is_pressed(int id);
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@
 
 #include <current.h>
 #include <STM32_adc.h>
+#include <hal.h>
 #include <misc.h>
 
 static struct info_s {
@@ -34,7 +35,7 @@ int current_init(int max_info_arg, ...)  // int adc_chan, ...
     }
 
     // init ADC I2C device XXX can this be called multiple times
-    if (STM32_adc_init(0) < 0) {
+    if ((hal ? hal->adc_init(0) : STM32_adc_init(0)) < 0) {
         ERROR("STM32_adc_init failed\n");
         return -1;
     }
@@ -63,12 +64,18 @@ double current_get(int id)
 
 static void * current_thread(void *cx)
 {
+    int loop_timing;
+
+    loop_timing = loop_timing_register("current", 10000);
+
     while (true) {
+        loop_timing_start(loop_timing);
         for (int id = 0; id < max_info; id++) {
             info_tbl[id].current_smoothed = 
                 0.99 * info_tbl[id].current_smoothed + 
                 0.01 * read_current_unsmoothed(id);
         }
+        loop_timing_end(loop_timing);
         usleep(10000);  // 10 ms
     }
 
@@ -79,6 +86,10 @@ static double read_current_unsmoothed(int id)
 {
     double v;
 
-    STM32_adc_read(info_tbl[id].adc_chan, &v);
+    if (hal) {
+        hal->adc_read(info_tbl[id].adc_chan, &v);
+    } else {
+        STM32_adc_read(info_tbl[id].adc_chan, &v);
+    }
     return (v - 0.322) * (1. / .264);
 }
@@ -2,12 +2,11 @@
 
 #include <stdint.h>
 #include <stdarg.h>
-#include <pthread.h>
-#include <sched.h>
 #include <string.h>
 #include <errno.h>
 
 #include <encoder.h>
+#include <gpio_sampler.h>
 #include <gpio.h>
 #include <timer.h>
 #include <misc.h>
@@ -24,6 +23,7 @@
 //
 
 #define MAX_HISTORY 1024
+#define INTVL_US    10
 
 //
 // variables
@@ -52,24 +52,26 @@ static struct info_s {
 } info_tbl[10];
 static int max_info;
 
-static unsigned int poll_rate;   // units = persec
+static int decoder_handle;
+
+static encoder_error_cb_t error_cb;
 
 //
 // prototypes
 //
 
-static void *encoder_thread(void *cx);
+static void encoder_decoder(void *cx, unsigned int gpio_all, uint64_t time_now);
 static bool all_disabled(void);
 
 // -----------------  API  ----------------------------------------
 
 int encoder_init(int max_info_arg, ...)  // int gpio_a, int gpio_b, ...
 {
-    static pthread_t tid;
+    static bool initialized;
     va_list ap;
 
     // if already initialized then return success
-    if (tid) {
+    if (initialized) {
         return 0;
     }
 
@@ -83,19 +85,14 @@ int encoder_init(int max_info_arg, ...)  // int gpio_a, int gpio_b, ...
     max_info = max_info_arg;
     va_end(ap);
 
-    // init gpio and timer functions
-    if (gpio_init() < 0) {
-        ERROR("gpio_init failed\n");
-        return -1;
-    }
-    if (timer_init() < 0) {
-        ERROR("timer_init failed\n");
+    // init the gpio sampler, and register the decoder which processes the
+    // encoder gpio values, and keeps track of accumulated encoder count
+    if (gpio_sampler_init() < 0) {
+        ERROR("gpio_sampler_init failed\n");
         return -1;
     }
-
-    // create the thread to process the encoder gpio values, and to
-    // keep track of accumulated encoder count
-    pthread_create(&tid, NULL,*encoder_thread, NULL);
+    decoder_handle = gpio_sampler_register("encoder", INTVL_US, encoder_decoder, NULL);
+    initialized = true;
 
     // success
     return 0;
@@ -104,12 +101,14 @@ int encoder_init(int max_info_arg, ...)  // int gpio_a, int gpio_b, ...
 void encoder_enable(int id)
 {
     info_tbl[id].enabled = true;
+    gpio_sampler_set_active(decoder_handle, true);
 }
 
 void encoder_disable(int id)
 {
     info_tbl[id].enabled = false;
     info_tbl[id].was_disabled = true;
+    gpio_sampler_set_active(decoder_handle, !all_disabled());
 }
 
 void encoder_count_reset(int id)
@@ -127,6 +126,11 @@ int encoder_get_count(int id)
     return info_tbl[id].count - info_tbl[id].count_offset;
 }
 
+int encoder_get_total_count(int id)
+{
+    return info_tbl[id].count;
+}
+
 int encoder_get_speed(int id)
 {
     struct info_s *info = &info_tbl[id];
@@ -156,114 +160,60 @@ int encoder_get_errors(int id)
 
 int encoder_get_poll_intvl_us(void)
 {
-    int lcl_poll_rate = poll_rate;
+    int lcl_poll_rate = gpio_sampler_get_call_rate(decoder_handle);
 
     return (lcl_poll_rate > 0 ? 1000000 / lcl_poll_rate : -1);
 }
 
-// -----------------  ENCODER THREAD  -----------------------------
-
-static void *encoder_thread(void *cx)
+void encoder_register_error_cb(encoder_error_cb_t cb)
 {
-    int val, x, rc, id;
-    unsigned int gpio_all;
-    struct timespec ts;
-    struct sched_param param;
-    cpu_set_t cpu_set;
-    uint64_t time_now;
-
-    static uint64_t poll_count, poll_count_t_last;
-
-    // used to determine poll_rate stat
-    poll_count_t_last = timer_get();
-
-    // set affinity to cpu 3
-    CPU_ZERO(&cpu_set);
-    CPU_SET(3, &cpu_set);
-    rc = sched_setaffinity(0,sizeof(cpu_set_t),&cpu_set);
-    if (rc < 0) {
-        FATAL("sched_setaffinity, %s\n", strerror(errno));
-    }
-
-    // set realtime priority
-    memset(&param, 0, sizeof(param));
-    param.sched_priority = 95;
-    rc = sched_setscheduler(0, SCHED_FIFO, &param);
-    if (rc < 0) {
-        FATAL("sched_setscheduler, %s\n", strerror(errno));
-    }
-
-    // loop forever
-    while (true) {
-        // if all encoder sensors are disabled then
-        // relatively long sleep and continue; 
-        // purpose is to save power
-        if (all_disabled()) {
-            poll_rate = 0;
-            poll_count_t_last = timer_get();
-            poll_count = 0;
-            usleep(10000);  // 10 ms
-            continue;
-        }
-
-        // read all gpio pins, and get the time_now
-        gpio_all = gpio_read_all();
-        time_now = timer_get();
+    error_cb = cb;
+}
 
-        // loop over encoders
-        for (id = 0; id < max_info; id++) {
-            struct info_s * info = &info_tbl[id];
+// -----------------  ENCODER DECODER  ----------------------------
 
-            // if this encoder was_disabled then get it's last value
-            if (info->was_disabled) {
-                info->last_val = (IS_BIT_SET(gpio_all,info->gpio_a) << 1) | 
-                                  IS_BIT_SET(gpio_all,info->gpio_b);
-                info->was_disabled = false;
-            }
+// called from the gpio sampler thread, when any encoder is enabled
+static void encoder_decoder(void *cx, unsigned int gpio_all, uint64_t time_now)
+{
+    int val, x, id;
 
-            // determine whether encoder indicates one of the following:
-            // - x == 0         no change
-            // - x == 1 or -1   increment or decrement
-            // - x == 2         error, encoder bits out of sequence
-            //                  probably because the encoder values were not read quickly enough
-            val = (IS_BIT_SET(gpio_all,info->gpio_a) << 1) | IS_BIT_SET(gpio_all,info->gpio_b);
-            x = encoder_tbl[info->last_val][val];
-            info->last_val = val;
-
-            // process the 'x'
-            if (x == 2) {
-                info->errors++;
-            } else {
-                info->count += x;
-            }
+    // loop over encoders
+    for (id = 0; id < max_info; id++) {
+        struct info_s * info = &info_tbl[id];
 
-            // save history of encoder count values, used to determine speed
-            int tail = info->history_tail;
-            info->history[tail].count = info->count;
-            info->history[tail].time = time_now;
-            __sync_synchronize();
-            info->history_tail = (tail + 1) % MAX_HISTORY;
+        // if this encoder was_disabled then get it's last value
+        if (info->was_disabled) {
+            info->last_val = (IS_BIT_SET(gpio_all,info->gpio_a) << 1) | 
+                              IS_BIT_SET(gpio_all,info->gpio_b);
+            info->was_disabled = false;
         }
 
-        // this is used to determine the frequency of this code, which 
-        // should ideally be 100000 per second when the sleep below is 10 us;
-        // however the measured poll_rate is about 47000 per sec
-        poll_count++;
-        if ((poll_count & 0xfff) == 0) {
-            if (time_now > poll_count_t_last + 1000000) {
-                poll_rate = 1000000LL * poll_count / (time_now - poll_count_t_last);
-                poll_count_t_last = time_now;
-                poll_count = 0;
+        // determine whether encoder indicates one of the following:
+        // - x == 0         no change
+        // - x == 1 or -1   increment or decrement
+        // - x == 2         error, encoder bits out of sequence
+        //                  probably because the encoder values were not read quickly enough
+        val = (IS_BIT_SET(gpio_all,info->gpio_a) << 1) | IS_BIT_SET(gpio_all,info->gpio_b);
+        x = encoder_tbl[info->last_val][val];
+        info->last_val = val;
+
+        // process the 'x'
+        if (x == 2) {
+            info->errors++;
+            if (error_cb != NULL) {
+                error_cb(id, info->errors);
             }
+        } else {
+            info->count += x;
         }
 
-        // sleep for 10 us (measured actual sleep is 20 us)
-        ts.tv_sec = 0;
-        ts.tv_nsec = 10000;
-        nanosleep(&ts, NULL);  // 10 us
+        // save history of encoder count values, used to determine speed
+        int tail = info->history_tail;
+        info->history[tail].count = info->count;
+        info->history[tail].time = time_now;
+        __sync_synchronize();
+        info->history_tail = (tail + 1) % MAX_HISTORY;
     }
-
-    return NULL;
 }
 
 static bool all_disabled(void)
@@ -9,6 +9,10 @@ extern "C" {
 
 // Notes:
 // - encoder_init varargs: int gpio_pin_a, int gpio_pin_b, ...
+// - the error callback is called from the gpio sampler thread each time an
+//   encoder error is detected, and must not block
+
+typedef void (*encoder_error_cb_t)(int id, int errors);
 
 int encoder_init(int max_info, ...);   // return -1 on error, else 0
 
@@ -18,9 +22,11 @@ void encoder_count_reset(int id);
 
 bool encoder_get_enabled(int id);     // these return values
 int encoder_get_count(int id);
+int encoder_get_total_count(int id);  // not affected by encoder_count_reset
 int encoder_get_speed(int id);
 int encoder_get_errors(int id);
 int encoder_get_poll_intvl_us(void);
+void encoder_register_error_cb(encoder_error_cb_t cb);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <gpio_sampler.h>
+#include <gpio.h>
+#include <timer.h>
+#include <misc.h>
+
+// notes:
+// - the sampler replaces the separate encoder, proximity and button polling
+//   threads; it runs with the encoder thread's former priority and affinity,
+//   because the encoder decoder has the tightest timing requirement
+// - the decoder_tbl is lock free: an entry is filled in before max_decoder is
+//   incremented, and entries are never removed
+// - the snapshot uses a sequence count; the count is odd while the snapshot
+//   is being updated
+// - the loop timing of the sampler, and of each decoder, is recorded; to keep
+//   the cost off of the sampler, a decoder's timing is recorded for only 1 in
+//   timing_n of its calls, about once per DECODER_TIMING_INTVL_US, and the
+//   start time is the sampler's time_now; so the decoder's period is the time
+//   between its timed calls; the encoder decoder's interval is shorter than
+//   the sampler can tick, so its periods are not checked for late
+
+//
+// defines
+//
+
+#define MAX_DECODER        10
+#define IDLE_INTVL_US      10000
+#define MIN_SLEEP_NS       10000
+#define MIN_LATE_INTVL_US  100     // shorter decoder intervals are not checked for late
+#define DECODER_TIMING_INTVL_US 1000
+
+//
+// variables
+//
+
+static struct decoder_s {
+    char           name[32];
+    int            intvl_us;
+    gpio_decoder_t decoder;
+    void         * cx;
+    volatile bool  active;
+    uint64_t       last_call_us;
+    int            call_count;
+    int            call_rate;
+    int            loop_timing;
+    int            timing_n;      // 1 in timing_n calls are timed
+    int            timing_count;
+} decoder_tbl[MAX_DECODER];
+static volatile int max_decoder;
+
+static struct {
+    volatile unsigned int seq;
+    unsigned int          gpio_all;
+    uint64_t              time_us;
+} snapshot;
+
+static gpio_sampler_stats_t stats;
+static volatile bool        stats_reset_req;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// prototypes
+//
+
+static void *gpio_sampler_thread(void *cx);
+
+// -----------------  API  ---------------------------------------------
+
+int gpio_sampler_init(void)
+{
+    static pthread_t tid;
+    int rc = 0;
+
+    pthread_mutex_lock(&mutex);
+
+    // if already initialized then return success
+    if (tid) {
+        goto done;
+    }
+
+    // init gpio and timer functions
+    if (gpio_init() < 0) {
+        ERROR("gpio_init failed\n");
+        rc = -1;
+        goto done;
+    }
+    if (timer_init() < 0) {
+        ERROR("timer_init failed\n");
+        rc = -1;
+        goto done;
+    }
+
+    // create the sampler thread
+    pthread_create(&tid, NULL, gpio_sampler_thread, NULL);
+
+done:
+    pthread_mutex_unlock(&mutex);
+    return rc;
+}
+
+int gpio_sampler_register(char *name, int intvl_us, gpio_decoder_t decoder, void *cx)
+{
+    struct decoder_s *d;
+    int handle;
+
+    pthread_mutex_lock(&mutex);
+
+    if (max_decoder == MAX_DECODER) {
+        pthread_mutex_unlock(&mutex);
+        FATAL("too many decoders\n");
+    }
+
+    // fill in the entry before publishing it by incrementing max_decoder
+    handle = max_decoder;
+    d = &decoder_tbl[handle];
+    strncpy(d->name, name, sizeof(d->name)-1);
+    d->intvl_us = intvl_us;
+    d->decoder  = decoder;
+    d->cx       = cx;
+    d->active   = false;
+    d->timing_n = (intvl_us > 0 && intvl_us < DECODER_TIMING_INTVL_US ? DECODER_TIMING_INTVL_US / intvl_us : 1);
+    d->loop_timing = loop_timing_register(name, intvl_us >= MIN_LATE_INTVL_US ? d->timing_n * intvl_us : 0);
+    __sync_synchronize();
+    max_decoder = handle + 1;
+
+    pthread_mutex_unlock(&mutex);
+
+    return handle;
+}
+
+void gpio_sampler_set_active(int handle, bool active)
+{
+    decoder_tbl[handle].active = active;
+}
+
+int gpio_sampler_get_call_rate(int handle)
+{
+    struct decoder_s *d = &decoder_tbl[handle];
+
+    return d->active ? d->call_rate : 0;
+}
+
+void gpio_sampler_get_snapshot(unsigned int *gpio_all, uint64_t *time_us)
+{
+    unsigned int seq;
+
+    do {
+        seq = snapshot.seq;
+        __sync_synchronize();
+        *gpio_all = snapshot.gpio_all;
+        *time_us  = snapshot.time_us;
+        __sync_synchronize();
+    } while ((seq & 1) || seq != snapshot.seq);
+}
+
+void gpio_sampler_get_stats(gpio_sampler_stats_t *stats_arg)
+{
+    *stats_arg = stats;
+}
+
+void gpio_sampler_reset_stats(void)
+{
+    stats_reset_req = true;
+}
+
+void gpio_sampler_print_stats(void)
+{
+    int handle;
+
+    INFO("ticks=%lld  tick_rate=%d/s  tick_max_late=%d us  sample_max_latency=%d us\n",
+         stats.tick_count, stats.tick_rate, stats.tick_max_late_us, stats.sample_max_latency_us);
+    for (handle = 0; handle < max_decoder; handle++) {
+        struct decoder_s *d = &decoder_tbl[handle];
+        INFO("  %-12s intvl=%-6d active=%d  call_rate=%d/s\n",
+             d->name, d->intvl_us, d->active, gpio_sampler_get_call_rate(handle));
+    }
+}
+
+// -----------------  THREAD  ------------------------------------------
+
+static void *gpio_sampler_thread(void *cx)
+{
+    int rc, handle, n, tick_intvl_us, last_tick_intvl_us=0, rate_count=0, late, latency;
+    unsigned int gpio_all;
+    uint64_t time_now, time_last=0, rate_t_last;
+    struct timespec ts;
+    struct sched_param param;
+    cpu_set_t cpu_set;
+    int loop_timing;
+
+    loop_timing = loop_timing_register("gpio_sampler", 0);
+
+    // set affinity to cpu 3
+    CPU_ZERO(&cpu_set);
+    CPU_SET(3, &cpu_set);
+    rc = sched_setaffinity(0,sizeof(cpu_set_t),&cpu_set);
+    if (rc < 0) {
+        FATAL("sched_setaffinity, %s\n", strerror(errno));
+    }
+
+    // set realtime priority
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = 95;
+    rc = sched_setscheduler(0, SCHED_FIFO, &param);
+    if (rc < 0) {
+        FATAL("sched_setscheduler, %s\n", strerror(errno));
+    }
+
+    // loop forever
+    rate_t_last = timer_get();
+    while (true) {
+        loop_timing_start(loop_timing);
+
+        // read all gpio pins, and get the time_now
+        gpio_all = gpio_read_all();
+        time_now = timer_get();
+
+        // publish the snapshot
+        snapshot.seq++;
+        __sync_synchronize();
+        snapshot.gpio_all = gpio_all;
+        snapshot.time_us  = time_now;
+        __sync_synchronize();
+        snapshot.seq++;
+
+        // call the active decoders whose interval has elapsed, and
+        // determine the tick interval from the active decoders
+        n = max_decoder;
+        tick_intvl_us = IDLE_INTVL_US;
+        for (handle = 0; handle < n; handle++) {
+            struct decoder_s *d = &decoder_tbl[handle];
+
+            if (!d->active) {
+                if (d->last_call_us != 0) {
+                    loop_timing_idle(d->loop_timing);
+                    d->last_call_us = 0;
+                }
+                continue;
+            }
+            if (d->intvl_us < tick_intvl_us) {
+                tick_intvl_us = d->intvl_us;
+            }
+            if (d->last_call_us != 0 && time_now - d->last_call_us < d->intvl_us) {
+                continue;
+            }
+
+            if (++d->timing_count >= d->timing_n) {
+                d->timing_count = 0;
+                loop_timing_start_at(d->loop_timing, time_now);
+                d->decoder(d->cx, gpio_all, time_now);
+                loop_timing_end(d->loop_timing);
+            } else {
+                d->decoder(d->cx, gpio_all, time_now);
+            }
+            d->last_call_us = time_now;
+            d->call_count++;
+        }
+
+        // stats
+        if (stats_reset_req) {
+            stats.tick_max_late_us = 0;
+            stats.sample_max_latency_us = 0;
+            stats_reset_req = false;
+        }
+        stats.tick_count++;
+        late = (time_last != 0 ? (int64_t)(time_now - time_last) - last_tick_intvl_us : 0);
+        if (late > stats.tick_max_late_us) {
+            stats.tick_max_late_us = late;
+        }
+        time_last = time_now;
+        last_tick_intvl_us = tick_intvl_us;
+        latency = timer_get() - time_now;
+        if (latency > stats.sample_max_latency_us) {
+            stats.sample_max_latency_us = latency;
+        }
+
+        // once per second determine the tick rate and the decoder call rates
+        rate_count++;
+        if (time_now > rate_t_last + 1000000) {
+            int64_t dt = time_now - rate_t_last;
+            stats.tick_rate = 1000000LL * rate_count / dt;
+            for (handle = 0; handle < n; handle++) {
+                struct decoder_s *d = &decoder_tbl[handle];
+                d->call_rate = 1000000LL * d->call_count / dt;
+                d->call_count = 0;
+            }
+            rate_t_last = time_now;
+            rate_count = 0;
+        }
+
+        loop_timing_end(loop_timing);
+
+        // sleep for the tick interval; note that the measured actual
+        // sleep is about 10 us longer than requested
+        ts.tv_sec = 0;
+        ts.tv_nsec = tick_intvl_us * 1000;
+        if (ts.tv_nsec < MIN_SLEEP_NS) {
+            ts.tv_nsec = MIN_SLEEP_NS;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
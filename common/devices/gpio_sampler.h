@@ -0,0 +1,47 @@
+#ifndef __GPIO_SAMPLER_H__
+#define __GPIO_SAMPLER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Notes:
+// - The gpio sampler thread reads the gpio level register once per tick,
+//   timestamps it with timer_get, and calls the registered decoders.
+// - Each decoder declares its interval; it is called when at least intvl_us
+//   has elapsed since its last call. The tick interval is the smallest
+//   interval of the active decoders, so when only slow decoders are active
+//   the sampler sleeps longer.
+// - Decoders are called from the sampler thread, which is realtime priority,
+//   and must not block.
+// - gpio_sampler_get_snapshot returns the most recent sample, without locking.
+
+typedef void (*gpio_decoder_t)(void *cx, unsigned int gpio_all, uint64_t time_us);
+
+typedef struct {
+    uint64_t tick_count;
+    int      tick_rate;             // ticks per sec
+    int      tick_max_late_us;      // max tick start beyond the requested interval
+    int      sample_max_latency_us; // time from register read to last decoder done
+} gpio_sampler_stats_t;
+
+int gpio_sampler_init(void);        // returns -1 on error, else 0
+
+int gpio_sampler_register(char *name, int intvl_us, gpio_decoder_t decoder, void *cx);  // returns handle
+void gpio_sampler_set_active(int handle, bool active);
+int gpio_sampler_get_call_rate(int handle);   // calls per sec, 0 if not active
+
+void gpio_sampler_get_snapshot(unsigned int *gpio_all, uint64_t *time_us);
+
+void gpio_sampler_get_stats(gpio_sampler_stats_t *stats);
+void gpio_sampler_reset_stats(void);
+void gpio_sampler_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __HAL_H__
+#define __HAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Notes:
+// - The hardware abstraction layer allows the device drivers to run without
+//   the robot's hardware. When hal is NULL (the default) the drivers access
+//   the hardware directly; otherwise the drivers call the backend.
+// - hal_set_backend must be called prior to initializing any driver.
+// - The backend provides:
+//   . timer and gpio       - used by timer.h, gpio.h; and so by the encoder,
+//                            proximity and button drivers
+//   . motor ctlr           - the serial port used by mc.c, the backend 
+//                            implements the motor ctlr's serial protocol
+//   . imu                  - the MPU9250 routines used by imu.c
+//   . current              - the STM32 adc routines used by current.c
+
+typedef struct {
+    char *name;
+
+    // timer and gpio
+    uint64_t     (*timer_get)(void);         // us
+    unsigned int (*gpio_read_all)(void);
+    int          (*gpio_read)(int pin);
+    void         (*gpio_write)(int pin, int value);
+
+    // motor ctlr serial port
+    int     (*mc_open)(const char *devname);
+    int     (*mc_write)(int fd, const uint8_t *buffer, size_t size);
+    ssize_t (*mc_read)(int fd, uint8_t *buffer, size_t size);
+    void    (*mc_flush)(int fd);
+
+    // imu
+    int (*imu_init)(int dev_addr);
+    int (*imu_get_rotation)(int *rx, int *ry, int *rz);
+    int (*imu_get_accel_and_rot)(int *ax, int *ay, int *az, int *rx, int *ry, int *rz);
+    int (*imu_get_magnetometer)(int *mx, int *my, int *mz);
+    int (*imu_get_temperature)(double *degc);
+
+    // current sensor adc
+    int (*adc_init)(int dev_addr);
+    int (*adc_read)(int chan, double *voltage);
+} hal_backend_t;
+
+__attribute__((weak)) hal_backend_t *hal;
+
+static inline void hal_set_backend(hal_backend_t *backend)
+{
+    hal = backend;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
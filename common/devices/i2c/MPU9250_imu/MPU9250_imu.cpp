@@ -26,6 +26,10 @@ int MPU9250_imu_init(int dev_addr)
         return -1;
     }
 
+    // the accel/rotation reads are time critical; the magnetometer (which
+    // has its own i2c address) is left at the default low priority
+    i2c_set_priority(dev_addr, I2C_PRIO_REALTIME);
+
     // create new mpu9250, and initialize
     mpu9250 = new MPU9250 (dev_addr);
     mpu9250->initialize();
@@ -71,6 +75,16 @@ int MPU9250_imu_get_accel_and_rot(int *ax_arg, int *ay_arg, int *az_arg,
     return 0;
 }
 
+int MPU9250_imu_get_temperature(double *degc_arg)
+{
+    int16_t t;
+
+    // conversion from the MPU9250 register map: 333.87 LSB/degC, 0 = 21 degC
+    t = mpu9250->getTemperature();
+    *degc_arg = t / 333.87 + 21.0;
+    return 0;
+}
+
 int MPU9250_imu_get_magnetometer(int *mx_arg, int *my_arg, int *mz_arg)
 {
     int16_t mx, my, mz;
@@ -142,7 +156,7 @@ int main(int argc, char **argv)
     setlinebuf(stdout);
 
     if (argc != 2) {
-        printf("USAGE: %s <cal|mag|accel|gyro>\n", argv[0]);
+        printf("USAGE: %s <cal|mag|accel|gyro|temp>\n", argv[0]);
         return 1;
     }
 
@@ -257,6 +271,23 @@ int main(int argc, char **argv)
                 time_last_print = time_now;
             }
         }
+    } else if (strcmp(argv[1], "temp") == 0) {
+        int x, y, z, count;
+        double degc, z_sum;
+
+        // print temperature and the average raw gyro z value once per second;
+        // the robot should be stationary, this is used to characterize gyro
+        // bias as a function of temperature
+        while (true) {
+            z_sum = 0;
+            for (count = 0; count < 200; count++) {
+                MPU9250_imu_get_rotation(&x, &y, &z);
+                z_sum += z;
+                usleep(5000);
+            }
+            MPU9250_imu_get_temperature(&degc);
+            printf("temp %0.2f C   gyro z avg %0.2f\n", degc, z_sum / count);
+        }
     } else {
         printf("ERROR: invalid arg '%s'\n", argv[1]);
         return 1;
@@ -2,34 +2,73 @@
 // https://github.com/olikraus/u8g2/wiki/u8g2reference
 
 #include <string.h>
+#include <stdbool.h>
 
 #include "SSD1306_oled.h"
 #include "../i2c/i2c.h"
 #include "../u8g2/u8g2.h"
 #include "misc.h"
 
+// Notes:
+// - u8g2 is used to render into its full frame buffer; the transfer to the
+//   display is done here rather than by u8g2_SendBuffer, so that only the 8x8
+//   tiles that differ from what is currently displayed are sent
+// - the display is put in horizontal addressing mode; each dirty rectangle of
+//   tiles is sent by setting the column and page range, followed by the tile
+//   data, which the display wraps within the range
+
 #define SSD1306_OLED_DEFAULT_ADDR  0x3c
 
-static u8g2_t *u8g2_tbl[256];
+#define SSD1306_CTRL_CMD           0x00
+#define SSD1306_CTRL_DATA          0x40
+#define SSD1306_CMD_ADDR_MODE      0x20
+#define SSD1306_CMD_COLUMN_RANGE   0x21
+#define SSD1306_CMD_PAGE_RANGE     0x22
+
+#define MAX_TILE_W    16
+#define MAX_TILE_H    8
+#define MAX_XFER      64   // max data bytes per i2c write, limits time the bus is held
+#define MAX_GAP       1    // clean tiles between dirty tiles, that are sent rather than
+                           // starting a new rectangle, because a new rectangle costs
+                           // about the same as 1 tile of data
+
+typedef struct {
+    u8g2_t  u8g2;
+    int     dev_addr;
+    int     tile_w, tile_h;
+    uint8_t shadow[MAX_TILE_W*MAX_TILE_H*8];  // what is currently on the display
+    bool    shadow_valid;
+    uint64_t tiles_sent;
+    uint64_t bytes_sent;
+} oled_t;
+
+static oled_t *oled_tbl[256];
 
 static uint8_t u8x8_byte_linux_i2c(u8x8_t * u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
 static uint8_t u8x8_linux_i2c_delay(u8x8_t * u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
+static oled_t *get_oled(int dev_addr_arg);
+static int send_rect(oled_t *oled, int tx0, int tx1, int ty0, int ty1);
+static const uint8_t *font_lookup(int font);
 
 // -----------------  C LANGUAGE API  -----------------------------------
 
 int SSD1306_oled_init(int dev_addr_arg)
 {
     int dev_addr;
+    oled_t *oled;
     u8g2_t *u8g2;
+    uint8_t cmd[2];
 
     // init i2c
     if (i2c_init() < 0) {
         return -1;
     }
 
-    // determine  dev_addr, and allocate u8g2
+    // determine  dev_addr, and allocate oled and u8g2
     dev_addr = (dev_addr_arg == 0 ? SSD1306_OLED_DEFAULT_ADDR : dev_addr_arg);
-    u8g2 = u8g2_tbl[dev_addr] = calloc(1, sizeof(u8g2_t));
+    oled = oled_tbl[dev_addr] = calloc(1, sizeof(oled_t));
+    oled->dev_addr = dev_addr;
+    u8g2 = &oled->u8g2;
 
     // call setup constructor
     u8g2_Setup_ssd1306_i2c_128x32_univision_f(
@@ -47,6 +86,20 @@ int SSD1306_oled_init(int dev_addr_arg)
     // de-activate power-save; becaue if activated nothing is displayed
     u8g2_SetPowerSave(u8g2, 0);
 
+    // select horizontal addressing mode, used by send_rect
+    cmd[0] = SSD1306_CMD_ADDR_MODE;
+    cmd[1] = 0;
+    if (i2c_write(dev_addr, SSD1306_CTRL_CMD, cmd, 2) < 0) {
+        ERROR("failed to set addressing mode\n");
+        return -1;
+    }
+    oled->tile_w = u8g2_GetBufferTileWidth(u8g2);
+    oled->tile_h = u8g2_GetBufferTileHeight(u8g2);
+    if (oled->tile_w > MAX_TILE_W || oled->tile_h > MAX_TILE_H) {
+        ERROR("unsupported display size %d x %d tiles\n", oled->tile_w, oled->tile_h);
+        return -1;
+    }
+
     // clears the memory frame buffer
     u8g2_ClearBuffer(u8g2);
 
@@ -63,8 +116,9 @@ int SSD1306_oled_init(int dev_addr_arg)
     // calls to ssd1306_oled_u8g2_drawstr
     u8g2_DrawStr(u8g2, 0, 0, "  ---  ");
 
-    // send the contents of the memory frame buffer to the display
-    u8g2_SendBuffer(u8g2);
+    // send the contents of the memory frame buffer to the display; the
+    // shadow is not yet valid so all tiles are sent
+    SSD1306_oled_update(dev_addr);
 
     // success
     return 0;
@@ -72,17 +126,217 @@ int SSD1306_oled_init(int dev_addr_arg)
 
 int SSD1306_oled_drawstr(int dev_addr_arg, int x, int y, char *s)
 {
-    int dev_addr = (dev_addr_arg == 0 ? SSD1306_OLED_DEFAULT_ADDR : dev_addr_arg);
-    u8g2_t *u8g2 = u8g2_tbl[dev_addr];
+    oled_t *oled = get_oled(dev_addr_arg);
 
-    u8g2_ClearBuffer(u8g2);
+    if (oled == NULL) {
+        return -1;
+    }
+
+    u8g2_ClearBuffer(&oled->u8g2);
+    u8g2_SetFont(&oled->u8g2, u8g2_font_logisoso32_tf);
+    u8g2_DrawStr(&oled->u8g2, x, y, s);
+    return SSD1306_oled_update(dev_addr_arg);
+}
+
+int SSD1306_oled_clear(int dev_addr_arg)
+{
+    oled_t *oled = get_oled(dev_addr_arg);
+
+    if (oled == NULL) {
+        return -1;
+    }
+
+    u8g2_ClearBuffer(&oled->u8g2);
+    return 0;
+}
+
+int SSD1306_oled_drawstr_region(int dev_addr_arg, int x, int y, int w, int h, int font, char *s)
+{
+    oled_t *oled = get_oled(dev_addr_arg);
+    u8g2_t *u8g2;
+
+    if (oled == NULL) {
+        return -1;
+    }
+    u8g2 = &oled->u8g2;
+
+    // clear the region, and draw the str clipped to the region;
+    // the display is not updated until SSD1306_oled_update is called
+    u8g2_SetMaxClipWindow(u8g2);
+    u8g2_SetDrawColor(u8g2, 0);
+    u8g2_DrawBox(u8g2, x, y, w, h);
+    u8g2_SetDrawColor(u8g2, 1);
+    u8g2_SetClipWindow(u8g2, x, y, x+w, y+h);
+    u8g2_SetFont(u8g2, font_lookup(font));
     u8g2_DrawStr(u8g2, x, y, s);
-    u8g2_SendBuffer(u8g2);
+    u8g2_SetMaxClipWindow(u8g2);
+    return 0;
+}
+
+int SSD1306_oled_update(int dev_addr_arg)
+{
+    oled_t *oled = get_oled(dev_addr_arg);
+    uint8_t *buf;
+    int tx, ty, tx0, tx1, i;
+    int run_tx0[MAX_TILE_H][MAX_TILE_W], run_tx1[MAX_TILE_H][MAX_TILE_W], nrun[MAX_TILE_H];
+    bool dirty[MAX_TILE_H][MAX_TILE_W];
+
+    if (oled == NULL) {
+        return -1;
+    }
+    buf = u8g2_GetBufferPtr(&oled->u8g2);
+
+    // determine which tiles differ from the display;
+    // the u8g2 buffer is organized as tile rows (pages), each tile row
+    // contains tile_w*8 bytes, and each byte is a vertical column of 8 pixels
+    for (ty = 0; ty < oled->tile_h; ty++) {
+        for (tx = 0; tx < oled->tile_w; tx++) {
+            i = (ty * oled->tile_w + tx) * 8;
+            dirty[ty][tx] = !oled->shadow_valid || memcmp(buf+i, oled->shadow+i, 8) != 0;
+        }
+    }
+
+    // for each tile row, find runs of dirty tiles; runs separated by a gap
+    // of MAX_GAP or fewer clean tiles are combined
+    for (ty = 0; ty < oled->tile_h; ty++) {
+        nrun[ty] = 0;
+        for (tx = 0; tx < oled->tile_w; tx++) {
+            if (!dirty[ty][tx]) {
+                continue;
+            }
+            if (nrun[ty] > 0 && tx - run_tx1[ty][nrun[ty]-1] - 1 <= MAX_GAP) {
+                run_tx1[ty][nrun[ty]-1] = tx;
+            } else {
+                run_tx0[ty][nrun[ty]] = tx;
+                run_tx1[ty][nrun[ty]] = tx;
+                nrun[ty]++;
+            }
+        }
+    }
+
+    // send the runs; a run is extended down through the following tile rows
+    // that have a run with the same columns, so that it is sent as one rectangle
+    for (ty = 0; ty < oled->tile_h; ty++) {
+        while (nrun[ty] > 0) {
+            int ty1, r;
+
+            tx0 = run_tx0[ty][0];
+            tx1 = run_tx1[ty][0];
+            for (i = 1; i < nrun[ty]; i++) {
+                run_tx0[ty][i-1] = run_tx0[ty][i];
+                run_tx1[ty][i-1] = run_tx1[ty][i];
+            }
+            nrun[ty]--;
+
+            for (ty1 = ty; ty1+1 < oled->tile_h; ty1++) {
+                for (r = 0; r < nrun[ty1+1]; r++) {
+                    if (run_tx0[ty1+1][r] == tx0 && run_tx1[ty1+1][r] == tx1) break;
+                }
+                if (r == nrun[ty1+1]) {
+                    break;
+                }
+                for (i = r+1; i < nrun[ty1+1]; i++) {
+                    run_tx0[ty1+1][i-1] = run_tx0[ty1+1][i];
+                    run_tx1[ty1+1][i-1] = run_tx1[ty1+1][i];
+                }
+                nrun[ty1+1]--;
+            }
+
+            if (send_rect(oled, tx0, tx1, ty, ty1) < 0) {
+                oled->shadow_valid = false;
+                return -1;
+            }
+        }
+    }
+
+    // the display now matches the buffer
+    memcpy(oled->shadow, buf, oled->tile_w * oled->tile_h * 8);
+    oled->shadow_valid = true;
     return 0;
 }
 
+void SSD1306_oled_get_stats(int dev_addr_arg, uint64_t *tiles_sent, uint64_t *bytes_sent)
+{
+    oled_t *oled = get_oled(dev_addr_arg);
+
+    *tiles_sent = (oled ? oled->tiles_sent : 0);
+    *bytes_sent = (oled ? oled->bytes_sent : 0);
+}
+
 // -----------------  PRIVATE ROUTINES  -----------------------------------
 
+static oled_t *get_oled(int dev_addr_arg)
+{
+    int dev_addr = (dev_addr_arg == 0 ? SSD1306_OLED_DEFAULT_ADDR : dev_addr_arg);
+
+    if (dev_addr < 0 || dev_addr > 255 || oled_tbl[dev_addr] == NULL) {
+        ERROR("dev_addr 0x%x not initialized\n", dev_addr);
+        return NULL;
+    }
+    return oled_tbl[dev_addr];
+}
+
+static int send_rect(oled_t *oled, int tx0, int tx1, int ty0, int ty1)
+{
+    uint8_t *buf = u8g2_GetBufferPtr(&oled->u8g2);
+    uint8_t  cmd[6], data[MAX_XFER];
+    int      ty, len, n, row_bytes, row_offset;
+
+    // set the display's column and page range to the rectangle
+    cmd[0] = SSD1306_CMD_COLUMN_RANGE;
+    cmd[1] = tx0 * 8;
+    cmd[2] = tx1 * 8 + 7;
+    cmd[3] = SSD1306_CMD_PAGE_RANGE;
+    cmd[4] = ty0;
+    cmd[5] = ty1;
+    if (i2c_write(oled->dev_addr, SSD1306_CTRL_CMD, cmd, sizeof(cmd)) < 0) {
+        ERROR("i2c_write cmd\n");
+        return -1;
+    }
+
+    // send the rectangle's data, in tile row order, packing as much as
+    // possible into each i2c write
+    row_bytes = (tx1 - tx0 + 1) * 8;
+    len = 0;
+    for (ty = ty0; ty <= ty1; ty++) {
+        row_offset = 0;
+        while (row_offset < row_bytes) {
+            n = row_bytes - row_offset;
+            if (n > MAX_XFER - len) n = MAX_XFER - len;
+            memcpy(data+len, buf + (ty * oled->tile_w + tx0) * 8 + row_offset, n);
+            len += n;
+            row_offset += n;
+            if (len == MAX_XFER) {
+                if (i2c_write(oled->dev_addr, SSD1306_CTRL_DATA, data, len) < 0) {
+                    ERROR("i2c_write data\n");
+                    return -1;
+                }
+                oled->bytes_sent += len;
+                len = 0;
+            }
+        }
+    }
+    if (len > 0) {
+        if (i2c_write(oled->dev_addr, SSD1306_CTRL_DATA, data, len) < 0) {
+            ERROR("i2c_write data\n");
+            return -1;
+        }
+        oled->bytes_sent += len;
+    }
+
+    oled->tiles_sent += (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+    return 0;
+}
+
+static const uint8_t *font_lookup(int font)
+{
+    switch (font) {
+    case SSD1306_FONT_SMALL:  return u8g2_font_6x10_tf;
+    case SSD1306_FONT_LARGE:  return u8g2_font_logisoso32_tf;
+    default:                  return u8g2_font_6x10_tf;
+    }
+}
+
 // return 1 for success, 0 for failure
 static uint8_t u8x8_byte_linux_i2c(u8x8_t * u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr)
 {
@@ -164,10 +418,27 @@ int main(int argc, char **argv)
     }
 
     while (true) {
+        uint64_t tiles, bytes;
+        char s[20];
+        int i;
+
         SSD1306_oled_drawstr(0, 0,0, "HELLO");
         sleep(1);
         SSD1306_oled_drawstr(0, 0,0, "WORLD");
         sleep(1);
+
+        // multiple regions, with only one region changing
+        SSD1306_oled_clear(0);
+        SSD1306_oled_drawstr_region(0, 0, 0, 64, 10, SSD1306_FONT_SMALL, "REGION 1");
+        SSD1306_oled_drawstr_region(0, 64, 0, 64, 10, SSD1306_FONT_SMALL, "REGION 2");
+        for (i = 0; i < 20; i++) {
+            sprintf(s, "COUNT %d", i);
+            SSD1306_oled_drawstr_region(0, 0, 11, 64, 10, SSD1306_FONT_SMALL, s);
+            SSD1306_oled_update(0);
+            usleep(100000);
+        }
+        SSD1306_oled_get_stats(0, &tiles, &bytes);
+        printf("tiles_sent = %lld  bytes_sent = %lld\n", tiles, bytes);
     }
 
     return 0;
@@ -5,9 +5,24 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
+#define SSD1306_FONT_SMALL  0   // 6x10
+#define SSD1306_FONT_LARGE  1   // 32 pixels high
+
 int SSD1306_oled_init(int dev_addr);
+
+// clears the display and draws s in the large font, then updates the display
 int SSD1306_oled_drawstr(int dev_addr, int x, int y, char *s);
 
+// draw into the frame buffer, then call SSD1306_oled_update to send
+// the changed tiles to the display
+int SSD1306_oled_clear(int dev_addr);
+int SSD1306_oled_drawstr_region(int dev_addr, int x, int y, int w, int h, int font, char *s);
+int SSD1306_oled_update(int dev_addr);
+
+void SSD1306_oled_get_stats(int dev_addr, uint64_t *tiles_sent, uint64_t *bytes_sent);
+
 #ifdef __cplusplus
 }
 #endif
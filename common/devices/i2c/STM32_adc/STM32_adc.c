@@ -21,6 +21,7 @@ int STM32_adc_init(int dev_addr_arg)
     if (i2c_init() < 0) {
         return -1;
     }
+    i2c_set_priority(dev_addr, I2C_PRIO_HIGH);
 
     return 0;
 }
@@ -1,7 +1,11 @@
+#include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
@@ -9,88 +13,159 @@
 #include "i2c.h"
 #include "misc.h"
 
+// Notes:
+// - All i2c transfers are performed by the bus manager thread, which owns the bus.
+//   Callers of i2c_read/i2c_write queue a request and block until it completes.
+// - Requests are serviced in priority order; the priority of a request is the
+//   priority assigned to its device address by i2c_set_priority (default I2C_PRIO_LOW).
+// - Pending requests are merged into a single I2C_RDWR ioctl. Lower priority
+//   requests are only merged when the batch is small, so that a realtime request
+//   is not held up behind a long batch.
+// - The Pi's i2c-bcm2835 driver rejects a transfer that has a read msg other
+//   than the last msg. So a batch is made of write only requests, and at most
+//   one request that has a read, which is placed at the end of the batch.
+// - A failed batch is not retried, because some of its msgs may have reached
+//   the devices; all of the requests in the batch fail. To limit the damage
+//   done by a failing device, a device's requests are only merged after a
+//   transfer to it has succeeded; following a failure they are sent alone
+//   until a transfer succeeds again.
+
+//
+// defines
+//
+
 #define I2C_DEVICE "/dev/i2c-1"
 
-static int fd;
+#define MAX_DEV_ADDR        128
+#define MAX_BATCH_MSGS      I2C_RDWR_IOCTL_MAX_MSGS
+#define MAX_BATCH_BYTES     64
+#define MAX_REQ_MSGS        2
+
+//
+// typedefs
+//
+
+typedef struct req_s {
+    struct req_s  * next;
+    int             dev_addr;
+    int             nmsgs;
+    struct i2c_msg  msgs[MAX_REQ_MSGS];
+    int             bytes;
+    bool            has_read;
+    uint64_t        submit_us;
+    int             rc;
+    bool            done;
+} req_t;
+
+//
+// variables
+//
+
+static int             init_state;  // 0 = not initialized, 1 = okay, -1 = failed
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static i2c_backend_t * backend;
+static int             fd = -1;
+
+static pthread_mutex_t req_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  req_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;
+static req_t         * req_head[I2C_MAX_PRIO];
+static req_t         * req_tail[I2C_MAX_PRIO];
+
+static uint8_t         dev_prio[MAX_DEV_ADDR];
+static bool            dev_ok[MAX_DEV_ADDR];  // the last transfer to dev succeeded
+static i2c_stats_t     dev_stats[MAX_DEV_ADDR];
+static uint64_t        ioctl_count;
+
+//
+// prototypes
+//
+
+static int linux_open(void);
+static int linux_transfer(struct i2c_msg *msgs, int nmsgs);
+static int submit(req_t *req);
+static void * bus_manager_thread(void *cx);
+static bool can_merge(req_t *req, req_t *first_req, req_t *read_req, int nmsgs, int bytes);
+static void complete(req_t *req, int rc, uint64_t now_us);
+
+i2c_backend_t i2c_linux_backend = { "linux", linux_open, linux_transfer };
+
+// -----------------  INIT  ---------------------------------------------
+
+void i2c_set_backend(i2c_backend_t *backend_arg)
+{
+    // must be called prior to i2c_init
+    if (init_state != 0) {
+        ERROR("already initialized\n");
+        return;
+    }
+    backend = backend_arg;
+}
 
 int i2c_init(void)
 {
-    // if I2C_DEVICE has already been opened successfully then return success
-    if (fd > 0) {
-        return 0;
+    pthread_t tid;
+    int rc = 0, i;
+
+    pthread_mutex_lock(&init_mutex);
+
+    // if already initialized successfully then return success,
+    // if previously failed to initialize then return error
+    if (init_state != 0) {
+        rc = (init_state > 0 ? 0 : -1);
+        goto done;
     }
 
-    // if previously failed to open I2C_DEVICE then return error
-    if (fd < 0) {
-        return -1;
+    // all devices default to low priority
+    for (i = 0; i < MAX_DEV_ADDR; i++) {
+        dev_prio[i] = I2C_PRIO_LOW;
     }
 
-    // open I2C_DEVICE
-    fd = open(I2C_DEVICE, O_RDWR);
-    if (fd < 0) {
-        ERROR("open %s, %s\n", I2C_DEVICE, strerror(errno));
-        return -1;
+    // open the bus
+    if (backend == NULL) {
+        backend = &i2c_linux_backend;
+    }
+    if (backend->open() < 0) {
+        ERROR("%s backend open failed\n", backend->name);
+        init_state = -1;
+        rc = -1;
+        goto done;
     }
 
-    // success
-    return 0;
+    // create the bus manager thread
+    pthread_create(&tid, NULL, bus_manager_thread, NULL);
+    init_state = 1;
+
+done:
+    pthread_mutex_unlock(&init_mutex);
+    return rc;
 }
 
+// -----------------  READ / WRITE API  ---------------------------------
+
 int i2c_read(int dev_addr, uint8_t reg_addr, uint8_t *reg_data, int len)
 {
-    struct i2c_msg messages[] = {
-        { dev_addr, 0,        1,   &reg_addr },
-        { dev_addr, I2C_M_RD, len, reg_data  } };
-    struct i2c_rdwr_ioctl_data ioctl_data = { messages, 2 };
-    int rc;
-
-    if (fd <= 0) {
-        ERROR("not initialized\n");
-        return -1;
-    }
+    req_t req = { .dev_addr = dev_addr, .nmsgs = 2, .bytes = 1 + len, .has_read = true,
+                  .msgs = { { dev_addr, 0,        1,   &reg_addr },
+                            { dev_addr, I2C_M_RD, len, reg_data  } } };
 
-    rc = ioctl(fd, I2C_RDWR, &ioctl_data);
-    if (rc < 0) {
-        ERROR("ioctl I2C_RDWR, %s\n", strerror(errno));
-        return -1;
-    }
-
-    return 0;
+    return submit(&req);
 }
 
 int8_t i2c_read_data(uint8_t dev_addr, uint8_t *reg_data, uint16_t len)
 {
-    struct i2c_msg messages[] = {
-        { dev_addr, I2C_M_RD, len, reg_data  } };
-    struct i2c_rdwr_ioctl_data ioctl_data = { messages, 1 };
-    int rc;
-
-    if (fd == 0) {
-        ERROR("not initialized\n");
-        return -1;
-    }
+    req_t req = { .dev_addr = dev_addr, .nmsgs = 1, .bytes = len, .has_read = true,
+                  .msgs = { { dev_addr, I2C_M_RD, len, reg_data } } };
 
-    rc = ioctl(fd, I2C_RDWR, &ioctl_data);
-    if (rc < 0) {
-        ERROR("ioctl I2C_RDWR, %s\n", strerror(errno));
-        return -1;
-    }
-
-    return 0;
+    return submit(&req);
 }
 
 int i2c_write(int dev_addr, uint8_t reg_addr, uint8_t * reg_data, int len)
 {
     uint8_t tmp[100];
-    struct i2c_msg messages[] = {
-        { dev_addr, 0, len+1, tmp  } };
-    struct i2c_rdwr_ioctl_data ioctl_data = { messages, 1 };
-    int rc;
-
-    if (fd <= 0) {
-        ERROR("not initialized\n");
-        return -1;
-    }
+    req_t req = { .dev_addr = dev_addr, .nmsgs = 1, .bytes = len + 1,
+                  .msgs = { { dev_addr, 0, len+1, tmp } } };
 
     if (len+1 > sizeof(tmp)) {
         ERROR("len %d too large\n", len);
@@ -100,13 +175,7 @@ int i2c_write(int dev_addr, uint8_t reg_addr, uint8_t * reg_data, int len)
     tmp[0] = reg_addr;
     memcpy(tmp+1, reg_data, len);
 
-    rc = ioctl(fd, I2C_RDWR, &ioctl_data);
-    if (rc < 0) {
-        ERROR("ioctl I2C_RDWR, %s\n", strerror(errno));
-        return -1;
-    }
-
-    return 0;
+    return submit(&req);
 }
 
 void i2c_delay_ns(unsigned int ns)
@@ -126,3 +195,235 @@ void i2c_delay_ns(unsigned int ns)
     }
 }
 
+// -----------------  PRIORITY AND STATS  -------------------------------
+
+void i2c_set_priority(int dev_addr, int prio)
+{
+    if (dev_addr < 0 || dev_addr >= MAX_DEV_ADDR || prio < 0 || prio >= I2C_MAX_PRIO) {
+        ERROR("invalid dev_addr 0x%x or prio %d\n", dev_addr, prio);
+        return;
+    }
+    dev_prio[dev_addr] = prio;
+}
+
+int i2c_get_stats(int dev_addr, i2c_stats_t *stats)
+{
+    if (dev_addr < 0 || dev_addr >= MAX_DEV_ADDR) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&req_mutex);
+    *stats = dev_stats[dev_addr];
+    pthread_mutex_unlock(&req_mutex);
+    return 0;
+}
+
+void i2c_reset_stats(void)
+{
+    pthread_mutex_lock(&req_mutex);
+    memset(dev_stats, 0, sizeof(dev_stats));
+    ioctl_count = 0;
+    pthread_mutex_unlock(&req_mutex);
+}
+
+void i2c_print_stats(void)
+{
+    i2c_stats_t s;
+    uint64_t ioctls;
+    int addr;
+
+    pthread_mutex_lock(&req_mutex);
+    ioctls = ioctl_count;
+    pthread_mutex_unlock(&req_mutex);
+
+    INFO("dev  prio    count  errors   avg_us   max_us  ioctls=%lld\n", ioctls);
+    for (addr = 0; addr < MAX_DEV_ADDR; addr++) {
+        i2c_get_stats(addr, &s);
+        if (s.count == 0) {
+            continue;
+        }
+        INFO("0x%02x  %d  %8lld %7lld %8lld %8lld\n",
+             addr, dev_prio[addr], s.count, s.errors,
+             s.total_latency_us / s.count, s.max_latency_us);
+    }
+}
+
+// -----------------  BUS MANAGER  --------------------------------------
+
+static int submit(req_t *req)
+{
+    int prio;
+
+    if (init_state <= 0) {
+        ERROR("not initialized\n");
+        return -1;
+    }
+    if (req->dev_addr < 0 || req->dev_addr >= MAX_DEV_ADDR) {
+        ERROR("invalid dev_addr 0x%x\n", req->dev_addr);
+        return -1;
+    }
+
+    // add req to the tail of its priority queue, and
+    // wake the bus manager
+    prio = dev_prio[req->dev_addr];
+    req->submit_us = microsec_timer();
+
+    pthread_mutex_lock(&req_mutex);
+    if (req_tail[prio]) {
+        req_tail[prio]->next = req;
+    } else {
+        req_head[prio] = req;
+    }
+    req_tail[prio] = req;
+    pthread_cond_signal(&req_cond);
+
+    // wait for the request to be completed by the bus manager
+    while (!req->done) {
+        pthread_cond_wait(&done_cond, &req_mutex);
+    }
+    pthread_mutex_unlock(&req_mutex);
+
+    return req->rc;
+}
+
+static void * bus_manager_thread(void *cx)
+{
+    req_t * batch[MAX_BATCH_MSGS];
+    struct i2c_msg msgs[MAX_BATCH_MSGS];
+    int     nreq, nmsgs, bytes, prio, i, rc;
+    req_t * req, * read_req;
+    uint64_t now_us;
+
+    while (true) {
+        // wait for a request
+        pthread_mutex_lock(&req_mutex);
+        while (true) {
+            for (prio = 0; prio < I2C_MAX_PRIO; prio++) {
+                if (req_head[prio]) break;
+            }
+            if (prio < I2C_MAX_PRIO) break;
+            pthread_cond_wait(&req_cond, &req_mutex);
+        }
+
+        // build a batch, starting with the highest priority request; additional
+        // requests are merged, in priority order, while the batch remains small;
+        // the write only requests' msgs are copied to msgs as they are added, and
+        // the read request's msgs are appended last
+        nreq = nmsgs = bytes = 0;
+        read_req = NULL;
+        for (prio = 0; prio < I2C_MAX_PRIO; prio++) {
+            while ((req = req_head[prio]) != NULL) {
+                if (nreq > 0 && !can_merge(req, batch[0], read_req, nmsgs, bytes)) {
+                    break;
+                }
+                req_head[prio] = req->next;
+                if (req_head[prio] == NULL) {
+                    req_tail[prio] = NULL;
+                }
+                req->next = NULL;
+
+                if (req->has_read) {
+                    read_req = req;
+                } else {
+                    memcpy(&msgs[nmsgs - (read_req ? read_req->nmsgs : 0)], req->msgs,
+                           req->nmsgs * sizeof(struct i2c_msg));
+                }
+                nmsgs += req->nmsgs;
+                bytes += req->bytes;
+                batch[nreq++] = req;
+            }
+            if (req != NULL) {
+                break;
+            }
+        }
+        if (read_req) {
+            memcpy(&msgs[nmsgs - read_req->nmsgs], read_req->msgs, read_req->nmsgs * sizeof(struct i2c_msg));
+        }
+        ioctl_count++;
+        pthread_mutex_unlock(&req_mutex);
+
+        // perform the transfer; if it fails then all of the requests in the batch
+        // fail, they are not retried because some of the msgs may have been applied
+        rc = backend->transfer(msgs, nmsgs);
+
+        // complete the requests, and wake the waiters
+        now_us = microsec_timer();
+        pthread_mutex_lock(&req_mutex);
+        for (i = 0; i < nreq; i++) {
+            dev_ok[batch[i]->dev_addr] = (rc == 0);
+            complete(batch[i], rc, now_us);
+        }
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&req_mutex);
+    }
+
+    return NULL;
+}
+
+// returns true if req can be added to the batch;
+// caller must hold req_mutex
+static bool can_merge(req_t *req, req_t *first_req, req_t *read_req, int nmsgs, int bytes)
+{
+    // the batch must remain small
+    if (nmsgs + req->nmsgs > MAX_BATCH_MSGS || bytes + req->bytes > MAX_BATCH_BYTES) {
+        return false;
+    }
+
+    // a device that has failed, or has not yet succeeded, is sent alone
+    if (!dev_ok[req->dev_addr] || !dev_ok[first_req->dev_addr]) {
+        return false;
+    }
+
+    // only one read request per batch; and a write to the read request's
+    // device can not be moved ahead of the read
+    if (read_req != NULL && (req->has_read || req->dev_addr == read_req->dev_addr)) {
+        return false;
+    }
+
+    return true;
+}
+
+static void complete(req_t *req, int rc, uint64_t now_us)
+{
+    i2c_stats_t *s = &dev_stats[req->dev_addr];
+    uint64_t latency_us = now_us - req->submit_us;
+
+    // caller must hold req_mutex
+    s->count++;
+    if (rc < 0) {
+        s->errors++;
+    }
+    s->total_latency_us += latency_us;
+    if (latency_us > s->max_latency_us) {
+        s->max_latency_us = latency_us;
+    }
+
+    req->rc = rc;
+    req->done = true;
+}
+
+// -----------------  LINUX I2C-DEV BACKEND  ----------------------------
+
+static int linux_open(void)
+{
+    fd = open(I2C_DEVICE, O_RDWR);
+    if (fd < 0) {
+        ERROR("open %s, %s\n", I2C_DEVICE, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int linux_transfer(struct i2c_msg *msgs, int nmsgs)
+{
+    struct i2c_rdwr_ioctl_data ioctl_data = { msgs, nmsgs };
+    int rc;
+
+    rc = ioctl(fd, I2C_RDWR, &ioctl_data);
+    if (rc < 0) {
+        ERROR("ioctl I2C_RDWR, %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
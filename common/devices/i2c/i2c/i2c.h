@@ -6,6 +6,26 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <linux/i2c.h>
+
+// request priorities, lower value is serviced first
+#define I2C_PRIO_REALTIME   0   // imu accel/rotation
+#define I2C_PRIO_HIGH       1   // adc
+#define I2C_PRIO_LOW        2   // env, oled, magnetometer; this is the default
+#define I2C_MAX_PRIO        3
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_latency_us;  // time from request submit to completion
+    uint64_t max_latency_us;
+} i2c_stats_t;
+
+typedef struct {
+    char *name;
+    int (*open)(void);
+    int (*transfer)(struct i2c_msg *msgs, int nmsgs);
+} i2c_backend_t;
 
 int i2c_init(void);
 
@@ -15,6 +35,23 @@ int8_t i2c_read_data(uint8_t dev_addr, uint8_t *reg_data, uint16_t len);
 int i2c_write(int dev_addr, uint8_t reg_addr, uint8_t * reg_data, int len);
 void i2c_delay_ns(unsigned int ns);
 
+void i2c_set_priority(int dev_addr, int prio);
+int i2c_get_stats(int dev_addr, i2c_stats_t *stats);
+void i2c_reset_stats(void);
+void i2c_print_stats(void);
+
+// the default backend is the linux i2c-dev driver; the fake backend
+// (i2c_fake.c) can be selected, prior to i2c_init, for testing on a PC
+extern i2c_backend_t i2c_linux_backend;
+extern i2c_backend_t i2c_fake_backend;
+void i2c_set_backend(i2c_backend_t *backend);
+
+void i2c_fake_add_device(int dev_addr);
+void i2c_fake_set_regs(int dev_addr, uint8_t reg_addr, uint8_t *data, int len);
+void i2c_fake_get_regs(int dev_addr, uint8_t reg_addr, uint8_t *data, int len);
+void i2c_fake_set_bus_speed(int hz);
+uint64_t i2c_fake_get_transfer_count(void);
+
 #ifdef __cplusplus
 }
 #endif
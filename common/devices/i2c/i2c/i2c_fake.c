@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "i2c.h"
+#include "misc.h"
+
+// Notes:
+// - fake i2c bus, for testing on a PC
+// - each device is modelled as 256 byte registers with an auto incrementing
+//   register pointer; a write msg sets the register pointer from its first
+//   byte, and writes the remaining bytes; a read msg reads from the register
+//   pointer
+// - the transfer time is simulated using the bus speed, 9 bit times per byte
+// - like the Pi's i2c-bcm2835 driver, a transfer that has a read msg other
+//   than the last msg is rejected
+
+//
+// defines
+//
+
+#define MAX_DEV_ADDR 128
+
+//
+// variables
+//
+
+static struct {
+    bool    present;
+    uint8_t reg_ptr;
+    uint8_t regs[256];
+} dev[MAX_DEV_ADDR];
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int             byte_time_ns = 90000;  // 100 khz
+static uint64_t        transfer_count;
+
+//
+// prototypes
+//
+
+static int fake_open(void);
+static int fake_transfer(struct i2c_msg *msgs, int nmsgs);
+
+i2c_backend_t i2c_fake_backend = { "fake", fake_open, fake_transfer };
+
+// -----------------  FAKE DEVICE CONFIG  -------------------------------
+
+void i2c_fake_add_device(int dev_addr)
+{
+    dev[dev_addr].present = true;
+}
+
+void i2c_fake_set_regs(int dev_addr, uint8_t reg_addr, uint8_t *data, int len)
+{
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < len; i++) {
+        dev[dev_addr].regs[(uint8_t)(reg_addr+i)] = data[i];
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void i2c_fake_get_regs(int dev_addr, uint8_t reg_addr, uint8_t *data, int len)
+{
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < len; i++) {
+        data[i] = dev[dev_addr].regs[(uint8_t)(reg_addr+i)];
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void i2c_fake_set_bus_speed(int hz)
+{
+    byte_time_ns = 9 * (1000000000 / hz);
+}
+
+uint64_t i2c_fake_get_transfer_count(void)
+{
+    return transfer_count;
+}
+
+// -----------------  BACKEND  ------------------------------------------
+
+static int fake_open(void)
+{
+    return 0;
+}
+
+static int fake_transfer(struct i2c_msg *msgs, int nmsgs)
+{
+    int i, j, bytes = 0, rc = 0;
+
+    for (i = 0; i < nmsgs - 1; i++) {
+        if (msgs[i].flags & I2C_M_RD) {
+            ERROR("only one read msg supported, has to be last\n");
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    transfer_count++;
+    for (i = 0; i < nmsgs; i++) {
+        struct i2c_msg *m = &msgs[i];
+
+        // address byte
+        bytes++;
+
+        // a device that is not present does not ack its address,
+        // the remaining msgs are not transferred
+        if (m->addr >= MAX_DEV_ADDR || !dev[m->addr].present) {
+            rc = -1;
+            break;
+        }
+
+        if (m->flags & I2C_M_RD) {
+            for (j = 0; j < m->len; j++) {
+                m->buf[j] = dev[m->addr].regs[dev[m->addr].reg_ptr++];
+            }
+        } else if (m->len > 0) {
+            dev[m->addr].reg_ptr = m->buf[0];
+            for (j = 1; j < m->len; j++) {
+                dev[m->addr].regs[dev[m->addr].reg_ptr++] = m->buf[j];
+            }
+        }
+        bytes += m->len;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    // simulate the time the transfer takes on the bus
+    i2c_delay_ns(bytes * byte_time_ns);
+
+    return rc;
+}
@@ -6,6 +6,7 @@
 
 #include <imu.h>
 #include <MPU9250_imu.h>
+#include <hal.h>
 #include <misc.h>
 
 // defines
@@ -14,6 +15,26 @@
 
 #define DEFAULT_ACCEL_ALERT_LIMIT 1.5
 #define MAG_CAL_FILENAME "imu_mag.cal"
+#define GYRO_CAL_FILENAME "imu_gyro.cal"
+
+// gyro bias model, in raw gyro units (131 per deg/sec):
+//   bias = b0 + b1 * (temperature - GYRO_REF_TEMP)
+// the default b0 corresponds to the 0.0689 deg/sec offset that was
+// previously hard coded
+#define GYRO_REF_TEMP              35.0
+#define GYRO_DEFAULT_B0            (0.0689 * 131.)
+#define GYRO_DEFAULT_B1            0.0
+#define GYRO_MAX_B1                5.0        // raw units per degC
+#define GYRO_RLS_LAMBDA            0.995      // forgetting factor, per window
+#define GYRO_STATIONARY_WINDOW     100        // 1 sec of 10 ms samples
+#define GYRO_STATIONARY_MAX_SDEV   15.0       // raw units, ~0.11 deg/sec
+#define GYRO_STATIONARY_MAX_ERR    100.0      // raw units, ~0.75 deg/sec
+#define GYRO_CAL_WRITE_INTVL_US    60000000   // 60 secs
+#define GYRO_MAX_DELTA_T           0.1        // secs
+
+// call the MPU9250 routine, or the hal backend's equivalent
+#define IMU_DEV(func, args...) \
+    (hal ? hal->imu_##func(args) : MPU9250_imu_##func(args))
 
 // prototypes
 
@@ -25,6 +46,12 @@ static void * accel_rot_thread(void *cx);
 static void process_raw_accel_values(int ax, int ay, int az);
 static void process_raw_rot_values(int rx, int ry, int rz);
 
+static void gyro_bias_learn(int rz);
+static double gyro_bias(void);
+static void read_temperature(void);
+static int read_gyro_cal_file(void);
+static int write_gyro_cal_file(void);
+
 // -----------------  INIT  -------------------------------------
 
 int imu_init(int dev_addr)  // multiple instances not supported
@@ -39,7 +66,7 @@ int imu_init(int dev_addr)  // multiple instances not supported
     }
 
     // init MPU9250 imu device
-    if (MPU9250_imu_init(0) < 0) {
+    if (IMU_DEV(init, 0) < 0) {
         ERROR("MPU9250_imu_init failed\n");
         return -1;
     }
@@ -49,6 +76,11 @@ int imu_init(int dev_addr)  // multiple instances not supported
         WARN("failed to read magnetometer calibration file\n");
     }
 
+    // read gyro bias calibration file
+    if (read_gyro_cal_file() < 0) {
+        WARN("failed to read gyro calibration file, using defaults\n");
+    }
+
     // create threads to read the magnetometer and accelerometer/rotation
     pthread_create(&mag_tid, NULL, magnetometer_thread, NULL);
     pthread_create(&accel_rot_tid, NULL, accel_rot_thread, NULL);
@@ -88,13 +120,19 @@ static void * magnetometer_thread(void *cx)
     int mx_cal_min, my_cal_min, mz_cal_min, mx_cal_max, my_cal_max, mz_cal_max;
     int mag_cal_ctrl_lcl;
     int mag_cal_ctrl_last = MAG_CAL_CTRL_DISABLED;
+    int loop_timing;
 
     mx_cal_min = my_cal_min = mz_cal_min = +1000000;
     mx_cal_max = my_cal_max = mz_cal_max = -1000000;
 
+    // the period is determined by the 10 ms delay in the magnetometer read
+    loop_timing = loop_timing_register("imu_mag", 10000);
+
     while (true) {
+        loop_timing_start(loop_timing);
+
         // read raw magnetometer values
-        MPU9250_imu_get_magnetometer(&mx_raw, &my_raw, &mz_raw);
+        IMU_DEV(get_magnetometer, &mx_raw, &my_raw, &mz_raw);
 
         // publish smoothed magnetometer values
         mx_smoothed = 0.9 * mx_smoothed + 0.1 * mx_raw;
@@ -129,6 +167,8 @@ static void * magnetometer_thread(void *cx)
         }
         mag_cal_ctrl_last = mag_cal_ctrl_lcl;
 
+        loop_timing_end(loop_timing);
+
         // no delay needed because the call to read the
         // magnetometer includes a 10 ms delay
     }
@@ -180,13 +220,16 @@ static bool accel_rot_enabled;
 static bool accel_alert;
 static double accel_alet_g_value;
 static double accel_alert_limit = DEFAULT_ACCEL_ALERT_LIMIT;
+static imu_accel_alert_cb_t accel_alert_cb;
 
 static double rotation;
 static double rotation_offset;
+static bool   rotation_restart = true;
 
 void imu_set_accel_rot_ctrl(bool enable)
 {
     accel_alert = 0;
+    rotation_restart = true;
     __sync_synchronize();
 
     accel_rot_enabled = enable;
@@ -224,6 +267,11 @@ bool imu_check_accel_alert(double *accel_alet_g_value_arg)
     return ret;
 }
 
+void imu_register_accel_alert_cb(imu_accel_alert_cb_t cb)
+{
+    accel_alert_cb = cb;
+}
+
 // - - - - - - - - -  rotation  - - - - - - - - - - - - - - - - -
 
 double imu_get_rotation(void)
@@ -236,28 +284,51 @@ void imu_reset_rotation(void)
     rotation_offset = rotation;
 }
 
+double imu_get_total_rotation(void)
+{
+    return rotation;
+}
+
 // - - - - - - - - -  acceleration and rotation thread  - - - - -
 
 static void * accel_rot_thread(void *cx)
 {
     int ax, ay, az;
     int rx, ry, rz;
+    uint64_t time_now_us, time_temp_read_us = 0;
+    int loop_timing;
+
+    loop_timing = loop_timing_register("imu_accel_rot", 1000);
 
     while (true) {
-        // if accel/rotation monitoring is not enabled then delay and continue,
-        // skipping the processing that follows
+        // read the temperature once per second, it is used by the gyro bias model
+        time_now_us = microsec_timer();
+        if (time_now_us - time_temp_read_us > 1000000) {
+            read_temperature();
+            time_temp_read_us = time_now_us;
+        }
+
+        // if accel/rotation monitoring is not enabled then the motors are
+        // disabled; use this time to learn the gyro bias, and
+        // delay and continue, skipping the processing that follows
         if (!accel_rot_enabled) {
+            loop_timing_idle(loop_timing);
+            IMU_DEV(get_rotation, &rx, &ry, &rz);
+            gyro_bias_learn(rz);
             usleep(10000);  // 10 ms
             continue;
         }
+        loop_timing_start(loop_timing);
 
         // read raw acceleromter and rotation values from i2c device
-        MPU9250_imu_get_accel_and_rot(&ax, &ay, &az, &rx, &ry, &rz);
+        IMU_DEV(get_accel_and_rot, &ax, &ay, &az, &rx, &ry, &rz);
 
         // process accel and rotation values
         process_raw_accel_values(ax, ay, az);
         process_raw_rot_values(rx, ry, rz);
 
+        loop_timing_end(loop_timing);
+
         // sleep 1 ms
         usleep(1000);  // 1 ms
     }
@@ -291,6 +362,9 @@ static void process_raw_accel_values(int ax, int ay, int az)
     if (accel_total_squared > (accel_alert_limit * accel_alert_limit)) {
         accel_alert = true;
         accel_alet_g_value = sqrt(accel_total_squared);
+        if (accel_alert_cb != NULL) {
+            accel_alert_cb(accel_alet_g_value);
+        }
         INFO("ALERT: ax,ay,az = %5.2f %5.2f %5.2f  total = %5.2f\n",
              axd, ayd, azd, accel_alet_g_value);
     }
@@ -299,15 +373,165 @@ static void process_raw_accel_values(int ax, int ay, int az)
 static void process_raw_rot_values(int rx, int ry, int rz)
 {
     uint64_t time_now_us = microsec_timer();
-    double delta_t;
+    double delta_t, rate;
     static uint64_t time_last_us;
+    static double rate_last;
 
+    // convert to deg/sec, with the bias model removed
+    rate = (rz - gyro_bias()) * (-1./131.);
+
+    // the first sample after enable establishes the time base
     delta_t = (time_now_us - time_last_us) / 1000000.;
     time_last_us = time_now_us;
-    if (delta_t > .03) {
+    if (rotation_restart) {
+        rotation_restart = false;
+        rate_last = rate;
+        return;
+    }
+
+    // a late sample is still integrated (trapezoidal), rather than
+    // discarded, because discarding loses the rotation that occurred
+    // during the gap; only a very long gap is skipped
+    if (delta_t > GYRO_MAX_DELTA_T) {
         WARN("discarding value because delta_t %0.3f secs is too large\n", delta_t);
+        rate_last = rate;
+        return;
+    }
+
+    rotation += (rate + rate_last) / 2 * delta_t;
+    rate_last = rate;
+}
+
+// - - - - - - - - -  gyro bias model   - - - - - - - - - - - - -
+
+// The gyro z bias is learned while the robot is stationary. The accel_rot_thread
+// samples the gyro every 10 ms while accel/rotation is disabled (which is when the
+// drive code has the motors disabled). Each 1 sec window whose standard deviation
+// is small is considered stationary, and the window mean is used to update a
+// 2 parameter recursive least squares fit of bias versus temperature.
+
+static double temperature = GYRO_REF_TEMP;
+static double gyro_b0 = GYRO_DEFAULT_B0;
+static double gyro_b1 = GYRO_DEFAULT_B1;
+static double gyro_P[2][2] = { {100, 0}, {0, 1} };
+static int    gyro_windows;
+
+double imu_get_temperature(void)
+{
+    return temperature;
+}
+
+double imu_get_gyro_bias(void)
+{
+    return gyro_bias() / 131.;
+}
+
+static double gyro_bias(void)
+{
+    return gyro_b0 + gyro_b1 * (temperature - GYRO_REF_TEMP);
+}
+
+static void read_temperature(void)
+{
+    double t;
+
+    if (IMU_DEV(get_temperature, &t) == 0 && t > -40 && t < 85) {
+        temperature = t;
+    }
+}
+
+static void gyro_bias_learn(int rz)
+{
+    static int    n;
+    static double sum, sum_sq;
+    static uint64_t time_last_write_us;
+    double mean, sdev, x1, err, Px0, Px1, denom, k0, k1;
+    uint64_t time_now_us;
+
+    // accumulate a window of samples
+    sum += rz;
+    sum_sq += (double)rz * rz;
+    if (++n < GYRO_STATIONARY_WINDOW) {
         return;
     }
+    mean = sum / n;
+    sdev = sqrt(fmax(0, sum_sq / n - mean * mean));
+    n = 0;
+    sum = sum_sq = 0;
+
+    // if not stationary then discard the window; the max_err check rejects
+    // a slow steady rotation, such as the robot being carried
+    x1 = temperature - GYRO_REF_TEMP;
+    err = mean - (gyro_b0 + gyro_b1 * x1);
+    if (sdev > GYRO_STATIONARY_MAX_SDEV || fabs(err) > GYRO_STATIONARY_MAX_ERR) {
+        return;
+    }
+
+    // rls update, with x = [1, x1]
+    Px0 = gyro_P[0][0] + gyro_P[0][1] * x1;
+    Px1 = gyro_P[1][0] + gyro_P[1][1] * x1;
+    denom = GYRO_RLS_LAMBDA + Px0 + x1 * Px1;
+    k0 = Px0 / denom;
+    k1 = Px1 / denom;
+    gyro_b0 += k0 * err;
+    gyro_b1 += k1 * err;
+    if (gyro_b1 > GYRO_MAX_B1) gyro_b1 = GYRO_MAX_B1;
+    if (gyro_b1 < -GYRO_MAX_B1) gyro_b1 = -GYRO_MAX_B1;
+    gyro_P[0][0] = (gyro_P[0][0] - k0 * Px0) / GYRO_RLS_LAMBDA;
+    gyro_P[0][1] = (gyro_P[0][1] - k0 * Px1) / GYRO_RLS_LAMBDA;
+    gyro_P[1][0] = (gyro_P[1][0] - k1 * Px0) / GYRO_RLS_LAMBDA;
+    gyro_P[1][1] = (gyro_P[1][1] - k1 * Px1) / GYRO_RLS_LAMBDA;
+    gyro_windows++;
+
+    // periodically save the model
+    time_now_us = microsec_timer();
+    if (time_now_us - time_last_write_us > GYRO_CAL_WRITE_INTVL_US) {
+        write_gyro_cal_file();
+        time_last_write_us = time_now_us;
+    }
+}
+
+static int read_gyro_cal_file(void)
+{
+    FILE *fp;
+
+    fp = fopen(GYRO_CAL_FILENAME, "r");
+    if (fp == NULL) {
+        ERROR("failed to open %s\n", GYRO_CAL_FILENAME);
+        return -1;
+    }
 
-    rotation += (rz * (-1./131.) + 0.0689) * delta_t;
+    if (fscanf(fp, "%lf %lf", &gyro_b0, &gyro_b1) != 2) {
+        ERROR("invalid format %s\n", GYRO_CAL_FILENAME);
+        gyro_b0 = GYRO_DEFAULT_B0;
+        gyro_b1 = GYRO_DEFAULT_B1;
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    INFO("read gyro calibration values: %0.3f %0.4f\n", gyro_b0, gyro_b1);
+
+    // a saved model is trusted more than the default
+    gyro_P[0][0] = 1;
+    gyro_P[1][1] = 0.1;
+
+    return 0;
+}
+
+static int write_gyro_cal_file(void)
+{
+    FILE *fp;
+
+    fp = fopen(GYRO_CAL_FILENAME, "w");
+    if (fp == NULL) {
+        ERROR("failed to open %s\n", GYRO_CAL_FILENAME);
+        return -1;
+    }
+
+    fprintf(fp, "%0.3f %0.4f\n", gyro_b0, gyro_b1);
+    fclose(fp);
+    INFO("write gyro calibration values: %0.3f %0.4f  (temp=%0.1f windows=%d)\n",
+         gyro_b0, gyro_b1, temperature, gyro_windows);
+
+    return 0;
 }
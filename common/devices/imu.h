@@ -25,13 +25,23 @@ void imu_set_accel_rot_ctrl(bool enable);
 bool imu_get_accel_rot_ctrl(void);
 
 // accel elert
+// - the alert callback is called from the imu thread when accel/rotation is
+//   enabled and the accel exceeds the limit, and must not block
+typedef void (*imu_accel_alert_cb_t)(double accel_alert_value);
 void imu_set_accel_alert_limit(double accel_alert_limit);
 double imu_get_accel_alert_limit(void);
 bool imu_check_accel_alert(double *accel_alert_value);  // optional arg
+void imu_register_accel_alert_cb(imu_accel_alert_cb_t cb);
 
 // rotation
 double imu_get_rotation(void);
 void imu_reset_rotation(void);
+double imu_get_total_rotation(void);  // not affected by imu_reset_rotation
+
+// gyro bias model, learned while accel/rotation is disabled and
+// the robot is stationary; bias is returned in deg/sec
+double imu_get_gyro_bias(void);
+double imu_get_temperature(void);  // degC
 
 #ifdef __cplusplus
 }
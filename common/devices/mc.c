@@ -10,6 +10,7 @@
 #include <termios.h>
 
 #include <mc.h>
+#include <hal.h>
 #include <misc.h>
 
 //
@@ -85,6 +86,8 @@
 
 // misc
 #define SECS_TO_US(secs)  ((secs) * 1000000)
+#define MAX_BATCH_CMDS    16
+#define MAX_CMD_LEN       8
 
 #define SET_STATE(_state) \
     do { \
@@ -95,6 +98,14 @@
 // typedefs
 //
 
+typedef struct {
+    unsigned char   cmd[MAX_CMD_LEN];
+    int             cmdlen;
+    unsigned char * resp;
+    int             resplen;
+    int             rc;
+} cmd_t;
+
 //
 // variables
 //
@@ -109,10 +120,29 @@ static struct info_s {
         int input_voltage;
         int current;
     } vars;
+    // write_mutex serializes the writes to the serial port, each port is
+    // independent; it is not held while the responses are read, instead the
+    // resp tickets order the reading of the responses in the order that the
+    // cmds were written; speed_mutex protects the pending speed cmd, which is
+    // sent ahead of any other cmds by whichever thread next writes to the port
+    pthread_mutex_t write_mutex;
+    pthread_mutex_t resp_mutex;
+    pthread_cond_t  resp_cond;
+    uint64_t        resp_ticket_next;
+    uint64_t        resp_ticket_serving;
+    pthread_mutex_t speed_mutex;
+    unsigned char   speed_cmd[MAX_CMD_LEN];
+    bool            speed_cmd_pending;
+    uint64_t        speed_cmd_time_us;
+    // the stop cmd, with crc, is encoded at init for mc_emer_stop_all, which
+    // writes it to emer_fd; emer_fd is a second, non blocking, open of devname
+    unsigned char   stop_cmd[2];
+    int             emer_fd;
 } info_tbl[10];
 static int max_info;
 
 static mc_status_t     status;
+static int             emer_stop_write_errors;
 //static int             accel  = DEFAULT_ACCEL;
 //static int             decel  = DEFAULT_ACCEL;
 static pthread_mutex_t mutex  = PTHREAD_MUTEX_INITIALIZER;
@@ -125,6 +155,7 @@ static int mc_enable(int id);
 static int mc_speed(int id, int speed);
 static int mc_stop(int id);
 static int mc_get_variable(int id, int variable_id, int *value);
+static int mc_get_variables(int id, int n, int *variable_ids, int **values);
 static int mc_set_motor_limit(int id, int limit_id, int value);
 static int mc_get_fw_ver(int id, int *product_id, int *fw_ver_maj_bcd, int *fw_ver_min_bcd) __attribute__((unused));
 
@@ -132,6 +163,8 @@ static void *monitor_thread(void *cx);
 static bool any_mc_error_indication(char *reason_str, int reason_str_size);
 
 static int issue_cmd(int id, unsigned char *cmd, int cmdlen, unsigned char *resp, int resplen);
+static int issue_cmds(int id, cmd_t *cmds, int ncmds);
+static void queue_speed_cmd(int id, int speed);
 static int open_serial_port(const char * device, uint32_t baud_rate);
 static int write_port(int id, const uint8_t * buffer, size_t size);
 static ssize_t read_port(int id, uint8_t * buffer, size_t size);
@@ -158,12 +191,21 @@ int mc_init(int max_info_arg, ...)  // char *devname, ...
     for (int i = 0; i < max_info_arg; i++) {
         strcpy(info_tbl[i].devname, va_arg(ap, char*));
         info_tbl[i].fd = -1;
+        info_tbl[i].emer_fd = -1;
+        pthread_mutex_init(&info_tbl[i].write_mutex, NULL);
+        pthread_mutex_init(&info_tbl[i].resp_mutex, NULL);
+        pthread_cond_init(&info_tbl[i].resp_cond, NULL);
+        pthread_mutex_init(&info_tbl[i].speed_mutex, NULL);
     }
     max_info = max_info_arg;
     va_end(ap);
 
-    // init crc table
+    // init crc table, and encode the stop cmds
     crc_init();
+    for (id = 0; id < max_info; id++) {
+        info_tbl[id].stop_cmd[0] = 0xe0;
+        info_tbl[id].stop_cmd[1] = crc(info_tbl[id].stop_cmd, 1);
+    }
 
     // open the motor ctlrs
     for (id = 0; id < max_info; id++) {
@@ -176,9 +218,22 @@ int mc_init(int max_info_arg, ...)  // char *devname, ...
             return -1;
         }
 
+        // open devname again, non blocking, for the emergency stop cmd
+        if (hal) {
+            info->emer_fd = info->fd;
+        } else {
+            info->emer_fd = open(info->devname, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+            if (info->emer_fd < 0) {
+                ERROR("open %s for emer stop, %s\n", info->devname, strerror(errno));
+                close(info->fd);
+                info->fd = -1;
+                return -1;
+            }
+        }
+
         // get error status, to confirm we can communicate to the ctlr
         if (mc_get_variable(id, VAR_ERROR_STATUS, &error_status) < 0) {
-            close(info->fd);
+            if (!hal) close(info->fd);
             info->fd = -1;
             return -1;
         }
@@ -257,11 +312,62 @@ void mc_disable_all(void)
     pthread_mutex_unlock(&mutex);
 }
 
+// emergency stop, with minimal latency:
+// - the pre-encoded stop cmd is written directly to each mtr ctlr, without
+//   acquiring the mutex or write_mutex, so it is not delayed by another
+//   thread's cmds, such as the monitor_thread waiting for a response
+// - the write is to emer_fd, which is non blocking, so this may be called
+//   from the realtime sensor decoders; a write error is not logged here,
+//   it is counted and logged by mc_emer_stop_complete
+// - a single write to the serial port is not interleaved with the bytes of
+//   another write, and the stop cmd has no response, so the other threads'
+//   cmd/response sequences are not disturbed
+// - after the stop cmd the mtr ctlr is in safe start, and ignores speed cmds
+//   until mc_enable_all is called
+void mc_emer_stop_all(void)
+{
+    struct info_s *x;
+    int id, rc;
+
+    for (id = 0; id < max_info; id++) {
+        x = &info_tbl[id];
+        rc = (hal ? hal->mc_write(x->emer_fd, x->stop_cmd, sizeof(x->stop_cmd))
+                  : (write(x->emer_fd, x->stop_cmd, sizeof(x->stop_cmd)) == sizeof(x->stop_cmd) ? 0 : -1));
+        if (rc < 0) {
+            __sync_fetch_and_add(&emer_stop_write_errors, 1);
+        }
+    }
+}
+
+// called after mc_emer_stop_all, from a thread that may block, to set the
+// state to DISABLED and update the emer stop status
+void mc_emer_stop_complete(int latency_us)
+{
+    int write_errors;
+
+    pthread_mutex_lock(&mutex);
+
+    SET_STATE(MC_STATE_DISABLED);
+    status.emer_stop_latency_us = latency_us;
+    if (latency_us > status.emer_stop_latency_max_us) {
+        status.emer_stop_latency_max_us = latency_us;
+    }
+    status.emer_stop_count++;
+
+    pthread_mutex_unlock(&mutex);
+
+    write_errors = __sync_fetch_and_and(&emer_stop_write_errors, 0);
+    if (write_errors) {
+        ERROR("emer stop cmd, %d write errors\n", write_errors);
+    }
+}
+
 // -----------------  API - SET SPEED ROUTINES  ----------------------------
 
 int mc_set_speed(int id, int speed)
 {
     struct info_s *x = &info_tbl[id];
+    int rc;
 
     // acquire mutex
     pthread_mutex_lock(&mutex);
@@ -279,18 +385,18 @@ int mc_set_speed(int id, int speed)
     status.target_speed[id] = speed;
 
     // set the motor's speed
-    mc_speed(id, speed);
+    rc = mc_speed(id, speed);
 
     // release mutex
     pthread_mutex_unlock(&mutex);
 
-    return 0;
+    return rc;
 }
 
 int mc_set_speed_all(int speed0, ...)
 {
     va_list ap;
-    int id;
+    int id, rc = 0;
 
     pthread_mutex_lock(&mutex);
 
@@ -300,6 +406,8 @@ int mc_set_speed_all(int speed0, ...)
         return -1;
     }
 
+    // queue the speed cmds for all motors before sending any of them,
+    // so that the motors' speeds change at nearly the same time
     va_start(ap, speed0);
     for (id = 0; id < max_info; id++) {
         struct info_s *x = &info_tbl[id];
@@ -308,13 +416,19 @@ int mc_set_speed_all(int speed0, ...)
         x->target_speed = speed;
         status.target_speed[id] = speed;
 
-        mc_speed(id, speed);
+        queue_speed_cmd(id, speed);
     }
     va_end(ap);
 
+    for (id = 0; id < max_info; id++) {
+        if (issue_cmds(id, NULL, 0) < 0) {
+            rc = -1;
+        }
+    }
+
     pthread_mutex_unlock(&mutex);
 
-    return 0;
+    return rc;
 }
 
 // -----------------  API - MISC ROUTINES  ---------------------------------
@@ -348,8 +462,13 @@ void mc_debug_mode(bool enable)
 static void *monitor_thread(void *cx)
 {
     static uint64_t time_last_status_vin_update;
+    int loop_timing;
+
+    loop_timing = loop_timing_register("mc_monitor", 100000);
 
     while (true) {
+        loop_timing_start(loop_timing);
+
         if (status.state == MC_STATE_ENABLED) {
             double motors_current;
             char error_str[80];
@@ -360,13 +479,13 @@ static void *monitor_thread(void *cx)
             // - VAR_CURRENT_LIMITTING_OCCUR_CNT
             // - VAR_INPUT_VOLTAGE
             // - VAR_CURRENT
+            // these are read in a single pipelined batch per mtr ctlr
             for (id = 0; id < max_info; id++) {
                 struct info_s *x = &info_tbl[id];
                 int error_status=0xffff, curr_limit_cnt=0, input_voltage=0, current=0;
-                mc_get_variable(id, VAR_ERROR_STATUS, &error_status);
-                mc_get_variable(id, VAR_CURRENT_LIMITTING_OCCUR_CNT, &curr_limit_cnt);
-                mc_get_variable(id, VAR_INPUT_VOLTAGE, &input_voltage);
-                mc_get_variable(id, VAR_CURRENT, &current);
+                mc_get_variables(id, 4,
+                    (int[]){VAR_ERROR_STATUS, VAR_CURRENT_LIMITTING_OCCUR_CNT, VAR_INPUT_VOLTAGE, VAR_CURRENT},
+                    (int*[]){&error_status, &curr_limit_cnt, &input_voltage, &current});
                 x->vars.error_status   = error_status;
                 x->vars.curr_limit_cnt = curr_limit_cnt;
                 x->vars.input_voltage  = input_voltage;
@@ -407,17 +526,18 @@ static void *monitor_thread(void *cx)
         if (status.debug_mode_enabled) {
             for (int id = 0; id < max_info; id++) {
                 struct debug_mode_mtr_vars_s *x = &status.debug_mode_mtr_vars[id];
-                mc_get_variable(id, VAR_ERROR_STATUS, &x->error_status);
-                mc_get_variable(id, VAR_TARGET_SPEED, &x->target_speed);
-                mc_get_variable(id, VAR_CURRENT_SPEED, &x->current_speed);
-                mc_get_variable(id, VAR_MAX_ACCEL_FORWARD, &x->max_accel);
-                mc_get_variable(id, VAR_MAX_DECEL_FORWARD, &x->max_decel);
-                mc_get_variable(id, VAR_INPUT_VOLTAGE, &x->input_voltage);
-                mc_get_variable(id, VAR_CURRENT, &x->current);
+                mc_get_variables(id, 7,
+                    (int[]){VAR_ERROR_STATUS, VAR_TARGET_SPEED, VAR_CURRENT_SPEED,
+                            VAR_MAX_ACCEL_FORWARD, VAR_MAX_DECEL_FORWARD,
+                            VAR_INPUT_VOLTAGE, VAR_CURRENT},
+                    (int*[]){&x->error_status, &x->target_speed, &x->current_speed,
+                             &x->max_accel, &x->max_decel,
+                             &x->input_voltage, &x->current});
             }
         }
 
         // sleep for 100 ms
+        loop_timing_end(loop_timing);
         usleep(100000);  // 100 ms
     }
 
@@ -486,15 +606,36 @@ static int mc_enable(int id)
     return error_status == 0 ? 0 : -1;
 }
 
-// set speed, forward or reverse based on speed arg
+// set speed, forward or reverse based on speed arg;
+// the speed cmd is queued, and sent ahead of any other cmds; if another
+// thread takes the queued speed cmd and fails to write it, then it is
+// requeued, so the issue_cmds call here sends it and returns the result
 static int mc_speed(int id, int speed)
 {
+    queue_speed_cmd(id, speed);
+    return issue_cmds(id, NULL, 0);
+}
+
+static void queue_speed_cmd(int id, int speed)
+{
+    struct info_s *info = &info_tbl[id];
+
+    // a newer speed cmd replaces a pending speed cmd that has not yet been sent
+    pthread_mutex_lock(&info->speed_mutex);
     if (speed >= 0) {
-        return issue_cmd(id, (unsigned char []){0x85, speed & 0x1f, speed >> 5 & 0x7f}, 3, NULL, 0);
+        info->speed_cmd[0] = 0x85;
     } else {
+        info->speed_cmd[0] = 0x86;
         speed = -speed;
-        return issue_cmd(id, (unsigned char []){0x86, speed & 0x1f, speed >> 5 & 0x7f}, 3, NULL, 0);
     }
+    info->speed_cmd[1] = speed & 0x1f;
+    info->speed_cmd[2] = speed >> 5 & 0x7f;
+    info->speed_cmd[3] = crc(info->speed_cmd, 3);
+    if (!info->speed_cmd_pending) {
+        info->speed_cmd_time_us = microsec_timer();
+    }
+    info->speed_cmd_pending = true;
+    pthread_mutex_unlock(&info->speed_mutex);
 }
 
 // stop motor, observe decel limit, enter safe start violation
@@ -527,6 +668,47 @@ static int mc_get_variable(int id, int variable_id, int *value)
     return 0;
 }
 
+// get multiple variables' values;
+// the SMC has no multi-variable read cmd, so the GET_VARIABLE cmds are
+// pipelined: all are written at once, and then all responses are read;
+// values whose cmd failed are not set
+static int mc_get_variables(int id, int n, int *variable_ids, int **values)
+{
+    cmd_t cmds[MAX_BATCH_CMDS];
+    unsigned char resp[MAX_BATCH_CMDS][2];
+    bool value_is_signed;
+    int i, rc;
+
+    if (n > MAX_BATCH_CMDS) {
+        ERROR("n=%d too large\n", n);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        cmds[i].cmd[0]  = 0xa1;
+        cmds[i].cmd[1]  = variable_ids[i];
+        cmds[i].cmdlen  = 2;
+        cmds[i].resp    = resp[i];
+        cmds[i].resplen = 2;
+    }
+
+    rc = issue_cmds(id, cmds, n);
+
+    for (i = 0; i < n; i++) {
+        if (cmds[i].rc < 0) {
+            continue;
+        }
+        *values[i] = resp[i][0] + 256 * resp[i][1];
+        value_is_signed = (variable_ids[i] == VAR_TARGET_SPEED) ||
+                          (variable_ids[i] == VAR_CURRENT_SPEED);
+        if (value_is_signed && *values[i] > 32767 ) {
+            *values[i] -= 65536;
+        }
+    }
+
+    return rc;
+}
+
 // set motor limit
 static int mc_set_motor_limit(int id, int limit_id, int value)
 {
@@ -560,50 +742,165 @@ static int mc_get_fw_ver(int id, int *product_id, int *fw_ver_maj_bcd, int *fw_v
 
 static int issue_cmd(int id, unsigned char *cmd, int cmdlen, unsigned char *resp, int resplen)
 {
-    unsigned char lcl_cmd[64], lcl_resp[64];
-    int rc;
-    char err_str[100];
+    cmd_t c;
+
+    if (cmdlen > MAX_CMD_LEN-1) {
+        ERROR("cmdlen %d too large\n", cmdlen);
+        return -1;
+    }
 
-    static pthread_mutex_t issue_cmd_mutex = PTHREAD_MUTEX_INITIALIZER;
+    memcpy(c.cmd, cmd, cmdlen);
+    c.cmdlen  = cmdlen;
+    c.resp    = resp;
+    c.resplen = resplen;
 
-    // acquire issue_cmd_mutex
-    pthread_mutex_lock(&issue_cmd_mutex);
+    return issue_cmds(id, &c, 1);
+}
 
-    // copy cmd to lcl_cmd, and append crc byte, and send
-    memcpy(lcl_cmd, cmd, cmdlen);
-    lcl_cmd[cmdlen] = crc(lcl_cmd, cmdlen);
-    rc = write_port(id, lcl_cmd, cmdlen+1);
-    if (rc < 0) {
-        sprintf(err_str, "write_port");
-        goto err; 
+// issue a batch of cmds to a mtr ctlr:
+// - a pending speed cmd is placed at the start of the batch
+// - all of the cmds are sent in a single write; write_mutex is then released,
+//   so that another thread's speed cmd is not delayed while the responses are
+//   read; the responses are read in order, each is crc checked
+// - if the write fails, a pending speed cmd that was taken is requeued,
+//   unless it has been replaced by a newer speed cmd
+// - cmds[i].rc is set to 0 on success, else -1; the return value is
+//   -1 if any cmd (including a pending speed cmd) failed
+static int issue_cmds(int id, cmd_t *cmds, int ncmds)
+{
+    struct info_s * info = &info_tbl[id];
+    unsigned char   lcl_cmd[MAX_BATCH_CMDS*MAX_CMD_LEN], lcl_resp[64];
+    int             i, len = 0, rc, ret = 0;
+    bool            speed_cmd_sent = false, resp_expected = false;
+    uint64_t        speed_cmd_time_us = 0, ticket = 0;
+    char            err_str[100];
+
+    if (ncmds > MAX_BATCH_CMDS-1) {
+        ERROR("ncmds %d too large\n", ncmds);
+        return -1;
     }
 
-    // if resplen then read the response, verify the crc, and 
-    // copy the lcl_resp to caller's buffer
-    if (resplen) {
-        rc = read_port(id, lcl_resp, resplen+1);
-        if (rc != resplen+1) {
-            sprintf(err_str, "read_port rc=%d != exp=%d", rc, resplen+1);
-            goto err; 
+    // acquire the write_mutex
+    pthread_mutex_lock(&info->write_mutex);
+
+    // if there is a pending speed cmd then it goes first
+    pthread_mutex_lock(&info->speed_mutex);
+    if (info->speed_cmd_pending) {
+        memcpy(lcl_cmd, info->speed_cmd, 4);
+        len = 4;
+        info->speed_cmd_pending = false;
+        speed_cmd_sent = true;
+        speed_cmd_time_us = info->speed_cmd_time_us;
+    }
+    pthread_mutex_unlock(&info->speed_mutex);
+
+    // append the cmds, each with its crc byte
+    for (i = 0; i < ncmds; i++) {
+        memcpy(lcl_cmd+len, cmds[i].cmd, cmds[i].cmdlen);
+        lcl_cmd[len+cmds[i].cmdlen] = crc(cmds[i].cmd, cmds[i].cmdlen);
+        len += cmds[i].cmdlen + 1;
+        cmds[i].rc = 0;
+        if (cmds[i].resplen > 0) {
+            resp_expected = true;
         }
-        if (lcl_resp[resplen] != crc(lcl_resp, resplen)) {
-            sprintf(err_str, "crc");
-            goto err; 
+    }
+
+    // nothing to do if the pending speed cmd was already sent by another thread
+    if (len == 0) {
+        pthread_mutex_unlock(&info->write_mutex);
+        return 0;
+    }
+
+    // send all cmds
+    if (write_port(id, lcl_cmd, len) < 0) {
+        ERROR("id=%d cmd=%s - write_port\n", 
+              id, CMD_STR(speed_cmd_sent ? lcl_cmd[0] : cmds[0].cmd[0]));
+        if (speed_cmd_sent) {
+            pthread_mutex_lock(&info->speed_mutex);
+            if (!info->speed_cmd_pending) {
+                memcpy(info->speed_cmd, lcl_cmd, 4);
+                info->speed_cmd_time_us = speed_cmd_time_us;
+                info->speed_cmd_pending = true;
+            }
+            pthread_mutex_unlock(&info->speed_mutex);
+        }
+        for (i = 0; i < ncmds; i++) {
+            cmds[i].rc = -1;
+        }
+        pthread_mutex_unlock(&info->write_mutex);
+        return -1;
+    }
+    if (speed_cmd_sent) {
+        uint64_t latency_us = microsec_timer() - speed_cmd_time_us;
+        status.speed_cmd_latency_us = latency_us;
+        if (latency_us > status.speed_cmd_latency_max_us) {
+            status.speed_cmd_latency_max_us = latency_us;
         }
-        memcpy(resp, lcl_resp, resplen);
     }
 
-    // release issue_cmd_mutex
-    pthread_mutex_unlock(&issue_cmd_mutex);
+    // take a ticket for reading the responses, and release write_mutex
+    if (resp_expected) {
+        pthread_mutex_lock(&info->resp_mutex);
+        ticket = info->resp_ticket_next++;
+        pthread_mutex_unlock(&info->resp_mutex);
+    }
+    pthread_mutex_unlock(&info->write_mutex);
+    if (!resp_expected) {
+        return 0;
+    }
 
-    // return success
-    return 0;
+    // wait for the responses of the cmds written before these to be read
+    pthread_mutex_lock(&info->resp_mutex);
+    while (info->resp_ticket_serving != ticket) {
+        pthread_cond_wait(&info->resp_cond, &info->resp_mutex);
+    }
+    pthread_mutex_unlock(&info->resp_mutex);
+
+    // read the responses, verify the crc, and copy to the caller's buffers;
+    // after a read error the remaining responses can not be trusted, so
+    // they are flushed and failed
+    for (i = 0; i < ncmds; i++) {
+        cmd_t *c = &cmds[i];
+
+        if (c->resplen == 0) {
+            continue;
+        }
+        if (ret < 0) {
+            c->rc = -1;
+            continue;
+        }
+
+        rc = read_port(id, lcl_resp, c->resplen+1);
+        if (rc != c->resplen+1) {
+            sprintf(err_str, "read_port rc=%d != exp=%d", rc, c->resplen+1);
+            goto err;
+        }
+        if (lcl_resp[c->resplen] != crc(lcl_resp, c->resplen)) {
+            sprintf(err_str, "crc");
+            goto err;
+        }
+        memcpy(c->resp, lcl_resp, c->resplen);
+        continue;
 
 err:
-    // print and return error
-    ERROR("id=%d cmd=%s - %s\n", id, CMD_STR(cmd[0]), err_str);
-    pthread_mutex_unlock(&issue_cmd_mutex);
-    return -1;
+        ERROR("id=%d cmd=%s - %s\n", id, CMD_STR(c->cmd[0]), err_str);
+        c->rc = -1;
+        ret = -1;
+        if (hal) {
+            hal->mc_flush(info->fd);
+        } else {
+            tcflush(info->fd, TCIFLUSH);
+        }
+    }
+
+    // let the next ticket holder read its responses
+    pthread_mutex_lock(&info->resp_mutex);
+    info->resp_ticket_serving++;
+    pthread_cond_broadcast(&info->resp_cond);
+    pthread_mutex_unlock(&info->resp_mutex);
+
+    // return status
+    return ret;
 }
 
 // -----------------  PRIVATE: SERIAL PORT  ---------------------------------
@@ -618,6 +915,10 @@ static int open_serial_port(const char * device, uint32_t baud_rate)
 {
     int fd;
 
+    if (hal) {
+        return hal->mc_open(device);
+    }
+
     fd = open(device, O_RDWR | O_NOCTTY);
     if (fd == -1) {
         ERROR("open %s, %s\n", device, strerror(errno));
@@ -681,6 +982,10 @@ static int write_port(int id, const uint8_t * buffer, size_t size)
     ssize_t result;
     struct info_s * info = &info_tbl[id];
 
+    if (hal) {
+        return hal->mc_write(info->fd, buffer, size);
+    }
+
     result = write(info->fd, buffer, size);
     if (result != (ssize_t)size) {
         ERROR("write %s, %s\n", info->devname, strerror(errno));
@@ -701,7 +1006,8 @@ static ssize_t read_port(int id, uint8_t * buffer, size_t size)
     struct info_s * info = &info_tbl[id];
 
     while (received < size) {
-        ssize_t r = read(info->fd, buffer + received, size - received);
+        ssize_t r = (hal ? hal->mc_read(info->fd, buffer + received, size - received)
+                         : read(info->fd, buffer + received, size - received));
         if (r < 0) {
             ERROR("read %s, %s\n", info->devname, strerror(errno));
             return -1;
@@ -5,6 +5,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 // notes regarding accel:
 // - Value    Time_0_to_3200
 //      1           3200 ms
@@ -26,6 +28,11 @@ typedef struct {
     double voltage;
     double motors_current;
     int target_speed[10];
+    int speed_cmd_latency_us;       // from speed request until written to the mtr ctlr
+    int speed_cmd_latency_max_us;
+    int emer_stop_latency_us;       // from detection until the stop cmd is written
+    int emer_stop_latency_max_us;
+    int emer_stop_count;
     bool debug_mode_enabled;
     struct debug_mode_mtr_vars_s {
         int error_status;
@@ -40,6 +47,10 @@ typedef struct {
 
 // Notes:
 // - call to mc_set_speed_all must supply speeds for all instances
+// - mc_emer_stop_all may be called from any thread, including sensor callbacks;
+//   it does not block; mc_emer_stop_complete must be called afterward, from a
+//   thread that may block, to set the state and the emer stop status, and
+//   mc_disable_all should be called to complete the disable
 // - Enabling debug_mode will cause the debug_mode_mtr_vars to be 
 //   read at 100 ms interval, even when in MC_STATE_QUIESCED or 
 //   MC_STATE_ERROR. This increases power usage.
@@ -47,6 +58,8 @@ typedef struct {
 int mc_init(int max_info, ...);  // these return -1 on error, else 0
 int mc_enable_all(void);
 void mc_disable_all(void);
+void mc_emer_stop_all(void);
+void mc_emer_stop_complete(int latency_us);
 int mc_set_speed(int id, int speed);
 int mc_set_speed_all(int speed0, ...);
 
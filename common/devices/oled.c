@@ -53,3 +53,25 @@ void oled_draw_str(int id, char *str)
 {
     SSD1306_oled_drawstr(info_tbl[id].dev_addr, 0, 0, str);
 }
+
+void oled_draw_multi_str(int id, int n, char **strs)
+{
+    int dev_addr = info_tbl[id].dev_addr;
+    int i, x, y;
+
+    // draw the strs using the small font, in a grid of OLED_MULTI_STR_COLS
+    // columns and OLED_MULTI_STR_ROWS rows; only the tiles that change are
+    // sent to the display
+    if (n > OLED_MULTI_STR_COLS * OLED_MULTI_STR_ROWS) {
+        n = OLED_MULTI_STR_COLS * OLED_MULTI_STR_ROWS;
+    }
+    SSD1306_oled_clear(dev_addr);
+    for (i = 0; i < n; i++) {
+        x = (i % OLED_MULTI_STR_COLS) * (128 / OLED_MULTI_STR_COLS);
+        y = (i / OLED_MULTI_STR_COLS) * (32 / OLED_MULTI_STR_ROWS);
+        SSD1306_oled_drawstr_region(dev_addr, x, y, 
+                                    128 / OLED_MULTI_STR_COLS, 32 / OLED_MULTI_STR_ROWS,
+                                    SSD1306_FONT_SMALL, strs[i]);
+    }
+    SSD1306_oled_update(dev_addr);
+}
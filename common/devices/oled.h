@@ -12,6 +12,11 @@ extern "C" {
 int oled_init(int max_info, ...);  // returns -1 on error, else 0
 void oled_draw_str(int id, char *str);
 
+// draws up to 6 strs at once, in a small font, 2 columns by 3 rows
+#define OLED_MULTI_STR_COLS 2
+#define OLED_MULTI_STR_ROWS 3
+void oled_draw_multi_str(int id, int n, char **strs);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,14 +3,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
-#include <pthread.h>
-#include <sched.h>
 #include <string.h>
 #include <errno.h>
 
 #include <proximity.h>
+#include <gpio_sampler.h>
 #include <gpio.h>
-#include <timer.h>
 #include <misc.h>
 
 //
@@ -18,6 +16,7 @@
 //
 
 #define DEFAULT_PROXIMITY_SIG_LIMIT  0.1
+#define INTVL_US                     100
 
 //
 // variables
@@ -28,41 +27,40 @@ static struct info_s {
     int gpio_enable;
     bool enabled;
     double sig;
+    bool alerted;
 } info_tbl[10];
 static int max_info;
 
-static int poll_rate;
+static int decoder_handle;
 
 static double sig_limit = DEFAULT_PROXIMITY_SIG_LIMIT;
 
+static proximity_alert_cb_t alert_cb;
+
 //
 // prototypes
 //
 
-static void *proximity_thread(void *cx);
+static void proximity_decoder(void *cx, unsigned int gpio_all, uint64_t time_now);
 static bool all_disabled(void);
 
 // -----------------  API  ---------------------------------------------
 
 int proximity_init(int max_info_arg, ...)  // int gpio_sig, int gpio_enable
 {
-    static pthread_t tid;
+    static bool initialized;
     int id;
     va_list ap;
 
     // sanity check that proximity_init has not already been called
-    if (tid) {
+    if (initialized) {
         ERROR("already initialized\n");
         return -1;
     }
 
-    // init timer and gpio functions
-    if (gpio_init() < 0) {
-        ERROR("gpio_init failed\n");
-        return -1;
-    }
-    if (timer_init() < 0) {
-        ERROR("timer_init failed\n");
+    // init the gpio sampler
+    if (gpio_sampler_init() < 0) {
+        ERROR("gpio_sampler_init failed\n");
         return -1;
     }
 
@@ -82,9 +80,9 @@ int proximity_init(int max_info_arg, ...)  // int gpio_sig, int gpio_enable
         gpio_write(info->gpio_enable, 0);
     }
 
-    // create the thread to process the proximity gpio sig values, and to
-    // keep track of accumulated shaft position
-    pthread_create(&tid, NULL, proximity_thread, NULL);
+    // register the decoder which processes the proximity gpio sig values
+    decoder_handle = gpio_sampler_register("proximity", INTVL_US, proximity_decoder, NULL);
+    initialized = true;
 
     // success
     return 0;
@@ -103,12 +101,15 @@ void proximity_enable(int id)
 {
     gpio_write(info_tbl[id].gpio_enable, 1);
     info_tbl[id].enabled = true;
+    gpio_sampler_set_active(decoder_handle, true);
 }
 
 void proximity_disable(int id)
 {
     gpio_write(info_tbl[id].gpio_enable, 0);
     info_tbl[id].enabled = false;
+    info_tbl[id].sig = 0;
+    gpio_sampler_set_active(decoder_handle, !all_disabled());
 }
 
 void proximity_set_sig_limit(double sig_limit_arg)
@@ -129,79 +130,50 @@ double proximity_get_sig_limit(void)
 
 int proximity_get_poll_intvl_us(void)
 {
-    int lcl_poll_rate = poll_rate;
+    int lcl_poll_rate = gpio_sampler_get_call_rate(decoder_handle);
     return (lcl_poll_rate > 0 ? 1000000 / lcl_poll_rate : -1);
 }
 
-// -----------------  THREAD--------------------------------------------
-
-static void *proximity_thread(void *cx)
+void proximity_register_alert_cb(proximity_alert_cb_t cb)
 {
-    int rc, id;
-    unsigned int gpio_all;
-    struct sched_param param;
-    int poll_count=0;
-    uint64_t t_now, t_last=timer_get();
-
-    // set realtime priority
-    memset(&param, 0, sizeof(param));
-    param.sched_priority = 90;
-    rc = sched_setscheduler(0, SCHED_FIFO, &param);
-    if (rc < 0) {
-        FATAL("sched_setscheduler, %s\n", strerror(errno));
-    }
-
-    // loop forever
-    while (true) {
-        // if all proximity sensors are disabled then
-        // relatively long sleep and continue; 
-        // purpose is to save power
-        if (all_disabled()) {
-            for (int id = 0; id < max_info; id++) {
-                info_tbl[id].sig = 0;
-            }
-            poll_rate = 0;
-            t_last = timer_get();;
-            poll_count = 0;
-            usleep(10000);  // 10 ms
-            continue;
-        }
+    alert_cb = cb;
+}
 
-        // read all gpio pins
-        gpio_all = gpio_read_all();
+// -----------------  DECODER  -------------------------------------------
 
-        // loop over proximity sensors
-        for (id = 0; id < max_info; id++) {
-            struct info_s * info = &info_tbl[id];
-            int sig;
+// called from the gpio sampler thread, when any proximity sensor is enabled
+static void proximity_decoder(void *cx, unsigned int gpio_all, uint64_t time_now)
+{
+    int id;
 
-            if (info->enabled == false) {
-                info->sig = 0;
-                continue;
-            }
+    // loop over proximity sensors
+    for (id = 0; id < max_info; id++) {
+        struct info_s * info = &info_tbl[id];
+        int sig;
 
-            sig = ((gpio_all >> info->gpio_sig) & 1) ? 0 : 1;
-            if (sig == 0) {
-                info->sig = 0.99 * info->sig;
-            } else {
-                info->sig = 0.99 * info->sig + 0.01;
-            }
+        if (info->enabled == false) {
+            info->sig = 0;
+            info->alerted = false;
+            continue;
         }
 
-        // used to confirm poll rate
-        poll_count++;
-        t_now = timer_get();
-        if (t_now > t_last + 1000000) {
-            poll_rate = 1000000LL * poll_count / (t_now - t_last);
-            t_last = t_now;
-            poll_count = 0;
+        sig = ((gpio_all >> info->gpio_sig) & 1) ? 0 : 1;
+        if (sig == 0) {
+            info->sig = 0.99 * info->sig;
+        } else {
+            info->sig = 0.99 * info->sig + 0.01;
         }
 
-        // sleep for 100 us
-        usleep(100);  // 100 us
+        // call the alert callback when the sig rises above the limit
+        if (info->sig > sig_limit) {
+            if (!info->alerted && alert_cb != NULL) {
+                alert_cb(id, info->sig);
+            }
+            info->alerted = true;
+        } else {
+            info->alerted = false;
+        }
     }
-
-    return NULL;
 }
 
 static bool all_disabled(void)
@@ -10,6 +10,10 @@ extern "C" {
 // Notes:
 // - proximity_init varargs: int gpio_pin_sig, int gpio_pin_enable, ...
 // - call to proximity_set_sig_limit sets the limit for all proximity sensors
+// - the alert callback is called from the gpio sampler thread when an enabled
+//   sensor's sig rises above the sig limit, and must not block
+
+typedef void (*proximity_alert_cb_t)(int id, double sig);
 
 int proximity_init(int max_info, ...);  // returns -1 on error, else 0
 
@@ -22,6 +26,7 @@ void proximity_set_sig_limit(double sig_limit);
 bool proximity_get_enabled(int id);
 double proximity_get_sig_limit(void);
 int proximity_get_poll_intvl_us(void);
+void proximity_register_alert_cb(proximity_alert_cb_t cb);
 
 #ifdef __cplusplus
 }
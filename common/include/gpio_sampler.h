@@ -0,0 +1 @@
+../devices/gpio_sampler.h
\ No newline at end of file
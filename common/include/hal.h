@@ -0,0 +1 @@
+../devices/hal.h
\ No newline at end of file
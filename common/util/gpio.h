@@ -14,6 +14,7 @@ extern "C" {
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <misc.h>
+#include <hal.h>
 #else
 #include <linux/module.h>
 #endif
@@ -31,12 +32,21 @@ extern "C" {
 
 volatile unsigned int *gpio_regs;
 
+// when the hal backend is set, the gpio regs are not mapped; the
+// configuration routines do nothing, and read/write are done by the backend
+
 // -----------------  GPIO: CONFIGURATION  ----------------
 
 static inline int get_gpio_func(int pin)
 {
     int regidx, bit;
 
+#ifndef __KERNEL__
+    if (hal) {
+        return FUNC_IN;
+    }
+#endif
+
     regidx = 0 + (pin / 10);
     bit = (pin % 10) * 3;
 
@@ -47,6 +57,12 @@ static inline void set_gpio_func(int pin, int func)
 {
     int regidx, bit, curr_func;
     unsigned int tmp;
+
+#ifndef __KERNEL__
+    if (hal) {
+        return;
+    }
+#endif
     
     curr_func = get_gpio_func(pin);
     if (curr_func != FUNC_IN && curr_func != FUNC_OUT) {
@@ -73,6 +89,12 @@ static inline void set_gpio_pull(int pin, int pull)
     int regidx, bit;
     unsigned int tmp;
 
+#ifndef __KERNEL__
+    if (hal) {
+        return;
+    }
+#endif
+
     regidx = 57 + (pin / 16);
     bit = (pin % 16) * 2;
 
@@ -90,16 +112,32 @@ static inline void set_gpio_pull(int pin, int pull)
 
 static inline int gpio_read(int pin)
 {
+#ifndef __KERNEL__
+    if (hal) {
+        return hal->gpio_read(pin);
+    }
+#endif
     return (gpio_regs[13] & (1 << pin)) != 0;
 }
 
 static inline unsigned int gpio_read_all(void)
 {
+#ifndef __KERNEL__
+    if (hal) {
+        return hal->gpio_read_all();
+    }
+#endif
     return gpio_regs[13];
 }
 
 static inline void gpio_write(int pin, int value)
 {
+#ifndef __KERNEL__
+    if (hal) {
+        hal->gpio_write(pin, value);
+        return;
+    }
+#endif
     if (value) {
         gpio_regs[7] = (1 << pin);
     } else {
@@ -122,6 +160,13 @@ static inline int gpio_init(void)
         return 0;
     }
 
+#ifndef __KERNEL__
+    // if using the hal backend then there are no gpio regs to map
+    if (hal) {
+        return 0;
+    }
+#endif
+
 #ifndef __KERNEL__
     // verify bcm version
     rc = system("grep BCM2711 /proc/cpuinfo > /dev/null");
@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "log_defer.h"
+
+// Notes:
+// - See log_defer.h.
+// - Each record is a log_defer_rec_t hdr, followed by the raw args. A record
+//   does not wrap around the end of the ring; it is preceded by a pad record,
+//   or by a gap too small for a record hdr.
+// - When a thread exits, the log_defer_ring_key destructor marks its ring
+//   orphaned. After the log_defer_flush has output the orphaned ring's msgs
+//   the ring is marked free, and it is reused by the next thread that
+//   allocates a ring; so the ring list is bounded by the max number of
+//   threads that have logged at the same time, and not by the number of
+//   threads created, such as the body's per connection threads.
+
+//
+// defines
+//
+
+#define LOG_DEFER_RING_SIZE      65536   // must be a multiple of 8
+#define LOG_DEFER_MAX_ARGS_LEN   1024
+#define LOG_DEFER_MAX_STR_ARG    256
+#define LOG_DEFER_FLUSH_INTVL_US 10000
+
+#define LOG_DEFER_ARG_NONE     0
+#define LOG_DEFER_ARG_INT      1   // stored as long long
+#define LOG_DEFER_ARG_UINT     2   // stored as unsigned long long
+#define LOG_DEFER_ARG_CHAR     3   // stored as int
+#define LOG_DEFER_ARG_DOUBLE   4
+#define LOG_DEFER_ARG_LDOUBLE  5
+#define LOG_DEFER_ARG_STR      6
+#define LOG_DEFER_ARG_PTR      7
+#define LOG_DEFER_ARG_INVALID  8
+
+#define LOG_DEFER_RING_ACTIVE   0
+#define LOG_DEFER_RING_ORPHANED 1   // the thread has exitted
+#define LOG_DEFER_RING_FREE     2   // the msgs have been output, available for reuse
+
+#define LOG_DEFER_ALIGN(n) (((n) + 7) & ~7)
+
+//
+// typedefs
+//
+
+typedef struct {
+    uint64_t    time_us;   // real time
+    char       *lvl;       // NULL for a pad record at the end of the ring
+    const char *func;
+    char       *fmt;
+    uint32_t    len;       // record length, including the raw args
+    uint32_t    args_len;
+} log_defer_rec_t;
+
+#define LOG_DEFER_REC_HDR_LEN LOG_DEFER_ALIGN(sizeof(log_defer_rec_t))
+
+typedef struct log_defer_ring_s {
+    struct log_defer_ring_s *next;
+    volatile uint64_t        head;   // written by the producer
+    volatile uint64_t        tail;   // written by the consumer
+    volatile int             state;
+    uint64_t                 dropped;
+    uint64_t                 dropped_reported;
+    char                     buff[LOG_DEFER_RING_SIZE] __attribute__((aligned(8)));
+} log_defer_ring_t;
+
+typedef struct {
+    int  arg_type;
+    int  num_star;     // number of '*' width and precision args
+    char spec[32];     // the conversion spec, without the length modifier
+} log_defer_spec_t;
+
+//
+// variables
+//
+
+static log_defer_output_t         log_defer_output;
+static log_defer_ring_t          *log_defer_ring_list;
+static __thread log_defer_ring_t *log_defer_ring;
+static pthread_mutex_t            log_defer_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t              log_defer_ring_key;
+static pthread_once_t             log_defer_ring_key_once = PTHREAD_ONCE_INIT;
+
+//
+// prototypes
+//
+
+static void *log_defer_thread(void *cx);
+static uint64_t log_defer_real_time_us(void);
+static log_defer_ring_t *log_defer_ring_alloc(void);
+static void log_defer_ring_key_create(void);
+static void log_defer_ring_orphan(void *cx);
+static int log_defer_encode_args(char *fmt, va_list ap, char *buff);
+static void log_defer_decode_args(char *fmt, char *args, int args_len, char *str, int max_str);
+static char *log_defer_parse_spec(char *p, log_defer_spec_t *s);
+
+// -----------------  API  -------------------------------------------------------
+
+// starts the log_defer_thread, which calls output with the formatted msgs;
+// log_defer_enabled returns true after this is called
+void log_defer_init(log_defer_output_t output)
+{
+    pthread_t tid;
+
+    if (log_defer_output != NULL) {
+        return;
+    }
+
+    log_defer_output = output;
+    __sync_synchronize();
+
+    // the log_defer_thread is not realtime, it inherits the caller's scheduling policy
+    pthread_create(&tid, NULL, log_defer_thread, NULL);
+    atexit(log_defer_flush);
+}
+
+bool log_defer_enabled(void)
+{
+    return log_defer_output != NULL;
+}
+
+// copies the msg to the caller's thread's ring; the msg is dropped if the ring is full
+void log_defer_msg(char *lvl, const char *func, uint64_t time_us, char *fmt, va_list ap)
+{
+    char             args[LOG_DEFER_MAX_ARGS_LEN] __attribute__((aligned(8)));
+    int              args_len, rec_len, contig;
+    uint64_t         head;
+    log_defer_ring_t *r;
+    log_defer_rec_t  *rec;
+
+    // get this thread's ring
+    r = log_defer_ring;
+    if (r == NULL) {
+        r = log_defer_ring = log_defer_ring_alloc();
+    }
+
+    // save the raw args
+    args_len = log_defer_encode_args(fmt, ap, args);
+    rec_len = LOG_DEFER_REC_HDR_LEN + LOG_DEFER_ALIGN(args_len);
+
+    // if the record does not fit at the end of the ring then it is
+    // preceded by a pad record, or by a gap too small for a record hdr
+    head = r->head;
+    contig = LOG_DEFER_RING_SIZE - (head % LOG_DEFER_RING_SIZE);
+    if (contig >= rec_len) {
+        contig = 0;
+    }
+    if (LOG_DEFER_RING_SIZE - (head - r->tail) < contig + rec_len) {
+        r->dropped++;
+        return;
+    }
+    if (contig >= LOG_DEFER_REC_HDR_LEN) {
+        rec = (log_defer_rec_t*)(r->buff + (head % LOG_DEFER_RING_SIZE));
+        rec->lvl = NULL;
+        rec->len = contig;
+    }
+    head += contig;
+
+    // copy the record to the ring, and publish it
+    rec = (log_defer_rec_t*)(r->buff + (head % LOG_DEFER_RING_SIZE));
+    rec->time_us  = time_us;
+    rec->lvl      = lvl;
+    rec->func     = func;
+    rec->fmt      = fmt;
+    rec->len      = rec_len;
+    rec->args_len = args_len;
+    memcpy((char*)rec + LOG_DEFER_REC_HDR_LEN, args, args_len);
+
+    __sync_synchronize();
+    r->head = head + rec_len;
+}
+
+// outputs the pending deferred msgs, in time order
+void log_defer_flush(void)
+{
+    static char       str[LOG_DEFER_MAX_STR];
+    log_defer_ring_t *r, *oldest;
+    log_defer_rec_t  *rec, *oldest_rec;
+    uint64_t          pos;
+
+    if (log_defer_output == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&log_defer_flush_mutex);
+
+    while (true) {
+        // find the ring whose next record is the oldest, skipping pad records
+        oldest = NULL;
+        oldest_rec = NULL;
+        for (r = log_defer_ring_list; r; r = r->next) {
+            while (r->tail != r->head) {
+                __sync_synchronize();
+                pos = r->tail % LOG_DEFER_RING_SIZE;
+                if (LOG_DEFER_RING_SIZE - pos < LOG_DEFER_REC_HDR_LEN) {
+                    r->tail += LOG_DEFER_RING_SIZE - pos;
+                    continue;
+                }
+                rec = (log_defer_rec_t*)(r->buff + pos);
+                if (rec->lvl == NULL) {
+                    r->tail += rec->len;
+                    continue;
+                }
+                if (oldest == NULL || rec->time_us < oldest_rec->time_us) {
+                    oldest = r;
+                    oldest_rec = rec;
+                }
+                break;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+
+        // format and output the msg, and free the record
+        rec = oldest_rec;
+        log_defer_decode_args(rec->fmt, (char*)rec + LOG_DEFER_REC_HDR_LEN, rec->args_len, str, sizeof(str));
+        log_defer_output(rec->lvl, rec->func, rec->time_us, str);
+        __sync_synchronize();
+        oldest->tail += rec->len;
+    }
+
+    // report dropped msgs; and free the orphaned rings whose msgs have all
+    // been output, the thread's last msgs may have been added after the
+    // loop above, so the head is checked after the state
+    for (r = log_defer_ring_list; r; r = r->next) {
+        uint64_t dropped = r->dropped;
+        if (dropped != r->dropped_reported) {
+            sprintf(str, "%lld log msgs dropped\n", (long long)(dropped - r->dropped_reported));
+            log_defer_output("WARN", __func__, log_defer_real_time_us(), str);
+            r->dropped_reported = dropped;
+        }
+        if (r->state == LOG_DEFER_RING_ORPHANED) {
+            __sync_synchronize();
+            if (r->tail == r->head) {
+                r->dropped = r->dropped_reported = 0;
+                __sync_synchronize();
+                r->state = LOG_DEFER_RING_FREE;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&log_defer_flush_mutex);
+}
+
+// -----------------  PRIVATE  ---------------------------------------------------
+
+static void *log_defer_thread(void *cx)
+{
+    while (true) {
+        log_defer_flush();
+        usleep(LOG_DEFER_FLUSH_INTVL_US);
+    }
+
+    return NULL;
+}
+
+static uint64_t log_defer_real_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return  ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+// reuses a free ring, or allocates a new ring; and registers the ring with
+// log_defer_ring_key, so that it is orphaned when the thread exits
+static log_defer_ring_t *log_defer_ring_alloc(void)
+{
+    log_defer_ring_t *r;
+
+    pthread_once(&log_defer_ring_key_once, log_defer_ring_key_create);
+
+    for (r = log_defer_ring_list; r; r = r->next) {
+        if (r->state == LOG_DEFER_RING_FREE &&
+            __sync_bool_compare_and_swap(&r->state, LOG_DEFER_RING_FREE, LOG_DEFER_RING_ACTIVE))
+        {
+            pthread_setspecific(log_defer_ring_key, r);
+            return r;
+        }
+    }
+
+    r = calloc(1, sizeof(log_defer_ring_t));
+    if (r == NULL) {
+        fprintf(stderr, "FATAL: failed to allocate log ring\n");
+        exit(1);
+    }
+
+    // add to the ring list, without a lock
+    do {
+        r->next = log_defer_ring_list;
+    } while (!__sync_bool_compare_and_swap(&log_defer_ring_list, r->next, r));
+
+    pthread_setspecific(log_defer_ring_key, r);
+    return r;
+}
+
+static void log_defer_ring_key_create(void)
+{
+    if (pthread_key_create(&log_defer_ring_key, log_defer_ring_orphan) != 0) {
+        fprintf(stderr, "FATAL: failed to create log ring key\n");
+        exit(1);
+    }
+}
+
+// called when a thread that has a ring exits; if the thread logs again, from
+// another key's destructor, then it gets another ring
+static void log_defer_ring_orphan(void *cx)
+{
+    log_defer_ring_t *r = cx;
+
+    log_defer_ring = NULL;
+    __sync_synchronize();
+    r->state = LOG_DEFER_RING_ORPHANED;
+}
+
+// copies the args to buff, using the fmt to determine their types;
+// returns the length of the args in buff
+static int log_defer_encode_args(char *fmt, va_list ap, char *buff)
+{
+    log_defer_spec_t s;
+    int len = 0, i, slen;
+    char *p, *str;
+
+    #define PUT(type, val) \
+        do { \
+            type _v = (val); \
+            if (len + sizeof(type) > LOG_DEFER_MAX_ARGS_LEN) goto done; \
+            memcpy(buff+len, &_v, sizeof(type)); \
+            len += LOG_DEFER_ALIGN(sizeof(type)); \
+        } while (0)
+
+    for (p = fmt; (p = strchr(p, '%')) != NULL; ) {
+        p = log_defer_parse_spec(p, &s);
+        for (i = 0; i < s.num_star; i++) {
+            PUT(int, va_arg(ap, int));
+        }
+
+        switch (s.arg_type) {
+        case LOG_DEFER_ARG_INT: {
+            char *lm = s.spec + strlen(s.spec) + 1;   // the length modifier follows the spec
+            long long v;
+            if      (strcmp(lm, "hh") == 0) v = (signed char)va_arg(ap, int);
+            else if (strcmp(lm, "h") == 0)  v = (short)va_arg(ap, int);
+            else if (strcmp(lm, "l") == 0)  v = va_arg(ap, long);
+            else if (strcmp(lm, "ll") == 0 || strcmp(lm, "q") == 0) v = va_arg(ap, long long);
+            else if (strcmp(lm, "j") == 0)  v = va_arg(ap, intmax_t);
+            else if (strcmp(lm, "z") == 0)  v = va_arg(ap, ssize_t);
+            else if (strcmp(lm, "t") == 0)  v = va_arg(ap, ptrdiff_t);
+            else                            v = va_arg(ap, int);
+            PUT(long long, v);
+            break; }
+        case LOG_DEFER_ARG_UINT: {
+            char *lm = s.spec + strlen(s.spec) + 1;
+            unsigned long long v;
+            if      (strcmp(lm, "hh") == 0) v = (unsigned char)va_arg(ap, unsigned int);
+            else if (strcmp(lm, "h") == 0)  v = (unsigned short)va_arg(ap, unsigned int);
+            else if (strcmp(lm, "l") == 0)  v = va_arg(ap, unsigned long);
+            else if (strcmp(lm, "ll") == 0 || strcmp(lm, "q") == 0) v = va_arg(ap, unsigned long long);
+            else if (strcmp(lm, "j") == 0)  v = va_arg(ap, uintmax_t);
+            else if (strcmp(lm, "z") == 0)  v = va_arg(ap, size_t);
+            else if (strcmp(lm, "t") == 0)  v = (size_t)va_arg(ap, ptrdiff_t);
+            else                            v = va_arg(ap, unsigned int);
+            PUT(unsigned long long, v);
+            break; }
+        case LOG_DEFER_ARG_CHAR:
+            PUT(int, va_arg(ap, int));
+            break;
+        case LOG_DEFER_ARG_DOUBLE:
+            PUT(double, va_arg(ap, double));
+            break;
+        case LOG_DEFER_ARG_LDOUBLE:
+            PUT(long double, va_arg(ap, long double));
+            break;
+        case LOG_DEFER_ARG_PTR:
+            PUT(void*, va_arg(ap, void*));
+            break;
+        case LOG_DEFER_ARG_STR:
+            str = va_arg(ap, char*);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            slen = strnlen(str, LOG_DEFER_MAX_STR_ARG-1);
+            if (len + slen + 1 > LOG_DEFER_MAX_ARGS_LEN) {
+                slen = LOG_DEFER_MAX_ARGS_LEN - len - 1;
+                if (slen < 0) goto done;
+            }
+            memcpy(buff+len, str, slen);
+            buff[len+slen] = '\0';
+            len += LOG_DEFER_ALIGN(slen + 1);
+            break;
+        case LOG_DEFER_ARG_NONE:
+            break;
+        default:
+            goto done;
+        }
+    }
+
+done:
+    return len < LOG_DEFER_MAX_ARGS_LEN ? len : LOG_DEFER_MAX_ARGS_LEN;
+}
+
+// formats the fmt with the args saved by log_defer_encode_args
+static void log_defer_decode_args(char *fmt, char *args, int args_len, char *str, int max_str)
+{
+    log_defer_spec_t s;
+    int len = 0, cnt = 0, n = 0, i, star[2];
+    char *p, *q, spec[40];
+
+    #define GET(type) \
+        ({ type _v = 0; \
+           if (len + sizeof(type) <= args_len) memcpy(&_v, args+len, sizeof(type)); \
+           len += LOG_DEFER_ALIGN(sizeof(type)); \
+           _v; })
+
+    #define FMT(v) \
+        (s.num_star == 0 ? snprintf(str+cnt, max_str-cnt, spec, v) : \
+         s.num_star == 1 ? snprintf(str+cnt, max_str-cnt, spec, star[0], v) : \
+                           snprintf(str+cnt, max_str-cnt, spec, star[0], star[1], v))
+
+    str[0] = '\0';
+    for (p = fmt; *p && cnt < max_str-1; p = q) {
+        // copy the text up to the next conversion spec
+        q = strchr(p, '%');
+        if (q == NULL) {
+            q = p + strlen(p);
+        }
+        n = snprintf(str+cnt, max_str-cnt, "%.*s", (int)(q-p), p);
+        cnt += (n < max_str-cnt ? n : max_str-cnt-1);
+        if (*q == '\0' || cnt >= max_str-1) {
+            break;
+        }
+
+        // format the conversion spec's arg
+        q = log_defer_parse_spec(q, &s);
+        if (s.arg_type == LOG_DEFER_ARG_INVALID) {
+            break;
+        }
+        for (i = 0; i < s.num_star; i++) {
+            star[i] = GET(int);
+        }
+        switch (s.arg_type) {
+        case LOG_DEFER_ARG_INT:
+        case LOG_DEFER_ARG_UINT:
+            // the value was saved as long long, so the spec's length modifier is ll
+            snprintf(spec, sizeof(spec), "%.*sll%c", (int)strlen(s.spec)-1, s.spec, s.spec[strlen(s.spec)-1]);
+            n = FMT(GET(long long));
+            break;
+        case LOG_DEFER_ARG_CHAR:
+            strcpy(spec, s.spec);
+            n = FMT(GET(int));
+            break;
+        case LOG_DEFER_ARG_DOUBLE:
+            strcpy(spec, s.spec);
+            n = FMT(GET(double));
+            break;
+        case LOG_DEFER_ARG_LDOUBLE:
+            snprintf(spec, sizeof(spec), "%.*sL%c", (int)strlen(s.spec)-1, s.spec, s.spec[strlen(s.spec)-1]);
+            n = FMT(GET(long double));
+            break;
+        case LOG_DEFER_ARG_PTR:
+            strcpy(spec, s.spec);
+            n = FMT(GET(void*));
+            break;
+        case LOG_DEFER_ARG_STR:
+            strcpy(spec, s.spec);
+            n = FMT(len < args_len ? args+len : "");
+            len += LOG_DEFER_ALIGN(strnlen(args+len, args_len-len) + 1);
+            break;
+        default:   // LOG_DEFER_ARG_NONE
+            n = (strcmp(s.spec, "%%") == 0 ? snprintf(str+cnt, max_str-cnt, "%%") : 0);
+            break;
+        }
+        cnt += (n < max_str-cnt ? n : max_str-cnt-1);
+    }
+}
+
+// parses the conversion spec at p, and returns a pointer to the char following it;
+// s->spec is set to the spec without its length modifier, followed by a '\0' and
+// the length modifier
+static char *log_defer_parse_spec(char *p, log_defer_spec_t *s)
+{
+    char *start = p, *lm_start, *lm_end;
+    int n;
+
+    memset(s, 0, sizeof(*s));
+    p++;
+
+    // flags, width and precision
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') { s->num_star++; p++; } else while (isdigit(*p)) p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') { s->num_star++; p++; } else while (isdigit(*p)) p++;
+    }
+
+    // length modifier
+    lm_start = p;
+    while (*p && strchr("hlLqjzt", *p)) p++;
+    lm_end = p;
+
+    // conversion
+    switch (*p) {
+    case 'd': case 'i':
+        s->arg_type = LOG_DEFER_ARG_INT; break;
+    case 'u': case 'o': case 'x': case 'X':
+        s->arg_type = LOG_DEFER_ARG_UINT; break;
+    case 'c':
+        s->arg_type = LOG_DEFER_ARG_CHAR; break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        s->arg_type = (*lm_start == 'L' ? LOG_DEFER_ARG_LDOUBLE : LOG_DEFER_ARG_DOUBLE); break;
+    case 's':
+        s->arg_type = LOG_DEFER_ARG_STR; break;
+    case 'p':
+        s->arg_type = LOG_DEFER_ARG_PTR; break;
+    case '%':
+        s->arg_type = LOG_DEFER_ARG_NONE; break;
+    default:
+        s->arg_type = LOG_DEFER_ARG_INVALID;
+        return p;
+    }
+    p++;
+
+    // the spec, without the length modifier, followed by the length modifier
+    if ((lm_start - start) + 1 + (lm_end - lm_start) + 2 > sizeof(s->spec)) {
+        s->arg_type = LOG_DEFER_ARG_INVALID;
+        return p;
+    }
+    n = lm_start - start;
+    memcpy(s->spec, start, n);
+    s->spec[n++] = p[-1];
+    s->spec[n++] = '\0';
+    memcpy(s->spec+n, lm_start, lm_end - lm_start);
+
+    return p;
+}
@@ -0,0 +1,45 @@
+#ifndef __LOG_DEFER_H__
+#define __LOG_DEFER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+// Notes:
+// - The deferred logging used by both the body's logmsg and the brain's
+//   log_msg. The caller's thread copies the time, lvl, func, fmt and the raw
+//   args to its thread's ring, and the log_defer_thread formats the msgs and
+//   calls the output routine that was registered by log_defer_init. This
+//   keeps vsnprintf and the output's stdio lock, or network send, off of the
+//   realtime and audio threads.
+// - The lvl, func and fmt args are saved as pointers, so they must not be
+//   freed or modified; this is the case for the INFO, etc. macros, which use
+//   string literals. The %s args are copied. func may be NULL.
+// - Each thread's ring is single producer (the thread) and single consumer
+//   (the log_defer_thread, or a caller of log_defer_flush, serialized by
+//   log_defer_flush_mutex). A msg is dropped, and counted, when the ring is
+//   full; log_defer_msg never blocks.
+// - The rings are allocated on a thread's first msg. When the thread exits
+//   its ring is freed, after its msgs are output, and is reused by another
+//   thread.
+// - The caller writes the msgs that are not deferred, such as FATAL, after
+//   calling log_defer_flush.
+
+#define LOG_DEFER_MAX_STR 10000   // max length of the formatted msg, including the '\0'
+
+typedef void (*log_defer_output_t)(char *lvl, const char *func, uint64_t time_us, char *str);
+
+void log_defer_init(log_defer_output_t output);
+bool log_defer_enabled(void);
+void log_defer_msg(char *lvl, const char *func, uint64_t time_us, char *fmt, va_list ap);
+void log_defer_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,33 +20,83 @@
 #include <math.h>
 
 #include "misc.h"
+#include "log_defer.h"
 
 // -----------------  LOGMSG  --------------------------------------------
 
+// Notes:
+// - After logmsg_init, logmsg is deferred, see log_defer.h; the log_defer_thread
+//   writes the msgs to stderr and calls the callback. This keeps vsnprintf,
+//   the stdio lock and the callback's network send off of the realtime threads.
+// - FATAL msgs, and msgs logged before logmsg_init, are written directly,
+//   after the pending deferred msgs.
+
 static void (*logmsg_cb)(char *str);
 
+static void logmsg_direct(char *lvl, const char *func, uint64_t time_us, char *str);
+static void logmsg_output(char *lvl, const char *func, uint64_t time_us, char *fmt, va_list ap) __attribute__ ((noinline));
+
 void logmsg_register_cb(void (*cb)(char *str))
 {
     logmsg_cb = cb;
 }
 
+void logmsg_init(void)
+{
+    log_defer_init(logmsg_direct);
+}
+
 void logmsg(char *lvl, const char *func, char *fmt, ...) 
 {
-    va_list ap;
+    va_list  ap;
+    uint64_t time_us;
+
+    time_us = get_real_time_us();
+
+    // not deferred: FATAL, because the caller exits; and before logmsg_init
+    if (!log_defer_enabled() || strcmp(lvl, "FATAL") == 0) {
+        logmsg_flush();
+        va_start(ap, fmt);
+        logmsg_output(lvl, func, time_us, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    va_start(ap, fmt);
+    log_defer_msg(lvl, func, time_us, fmt, ap);
+    va_end(ap);
+}
+
+// writes the pending deferred msgs, in time order
+void logmsg_flush(void)
+{
+    log_defer_flush();
+}
+
+// not inlined, so that the str is not on the stack of the deferred logmsg calls
+static void logmsg_output(char *lvl, const char *func, uint64_t time_us, char *fmt, va_list ap)
+{
+    char str[1000];
+
+    vsnprintf(str, sizeof(str), fmt, ap);
+    logmsg_direct(lvl, func, time_us, str);
+}
+
+static void logmsg_direct(char *lvl, const char *func, uint64_t time_us, char *msg_str)
+{
     char    str[1000];
     int     cnt;
     char    time_str[MAX_TIME_STR];
 
     // start by printing the time, lvl and func to str
-    cnt = sprintf(str, "%s %s %s: ",
-                  time2str(time_str, get_real_time_us(), false, true, true),
-                  lvl, 
-                  func);
-
-    // construct str
-    va_start(ap, fmt);
-    cnt += vsnprintf(str+cnt, sizeof(str)-cnt, fmt, ap);
-    va_end(ap);
+    cnt = snprintf(str, sizeof(str), "%s %s %s: %s",
+                   time2str(time_str, time_us, false, true, true),
+                   lvl, 
+                   func,
+                   msg_str);
+    if (cnt >= sizeof(str)) {
+        cnt = sizeof(str) - 1;
+    }
 
     // remove terminating newline char
     if (cnt > 0 && str[cnt-1] == '\n') {
@@ -344,3 +394,225 @@ double sanitize_heading(double hdg, double base)
     return hdg;
 }
 
+
+// -----------------  LOOP TIMING  ---------------------------------------
+
+// Notes:
+// - Each registered loop has histograms of its period (start to start) and
+//   work time (start to end). The buckets are log-linear, as in an HDR
+//   histogram: values less than LT_SUB_BUCKETS us are exact, and each power
+//   of 2 above that is split into LT_SUB_BUCKETS buckets, so the percentiles
+//   are within about 6%.
+// - A loop's histograms are updated only by the loop's thread, and are not
+//   locked. At the end of each LT_WINDOW_US window the stats are determined
+//   and published using a sequence count, and the histograms are cleared.
+// - loop_timing_idle is called when a loop is about to wait for a long
+//   or unknown time; the wait is not recorded as a period, and the partial
+//   window is published.
+
+#define LT_SUB_BUCKET_BITS  4
+#define LT_SUB_BUCKETS      (1 << LT_SUB_BUCKET_BITS)
+#define LT_MAX_BUCKET       (LT_SUB_BUCKETS * 23)   // values up to 2^26 us
+#define LT_WINDOW_US        5000000
+
+static struct loop_timing_s {
+    uint32_t              period_hist[LT_MAX_BUCKET];
+    uint32_t              work_hist[LT_MAX_BUCKET];
+    int                   period_count;
+    int                   work_count;
+    int                   late_count;
+    int                   period_max_us;
+    int                   work_max_us;
+    uint64_t              start_us;
+    uint64_t              window_start_us;
+    bool                  started;
+    volatile bool         registered;
+    volatile unsigned int seq;
+    loop_timing_stats_t   stats;
+} loop_timing_tbl[MAX_LOOP_TIMING];
+static int loop_timing_alloc;
+
+static void lt_record(uint32_t *hist, uint64_t us);
+static int lt_percentile(uint32_t *hist, int count, int max_us, int per_mille);
+static void lt_publish(struct loop_timing_s *lt, uint64_t now);
+
+int loop_timing_register(char *name, int expected_period_us)
+{
+    struct loop_timing_s *lt;
+    int handle;
+
+    handle = __sync_fetch_and_add(&loop_timing_alloc, 1);
+    if (handle >= MAX_LOOP_TIMING) {
+        FATAL("too many loops, %s\n", name);
+    }
+
+    lt = &loop_timing_tbl[handle];
+    strncpy(lt->stats.name, name, MAX_LOOP_TIMING_NAME-1);
+    lt->stats.expected_period_us = expected_period_us;
+    __sync_synchronize();
+    lt->registered = true;
+
+    return handle;
+}
+
+// called at the start of each loop iteration
+void loop_timing_start(int handle)
+{
+    loop_timing_start_at(handle, microsec_timer());
+}
+
+// same as loop_timing_start, for a caller that has just read the microsec_timer
+void loop_timing_start_at(int handle, uint64_t now)
+{
+    struct loop_timing_s *lt = &loop_timing_tbl[handle];
+    int period;
+
+    if (lt->window_start_us == 0) {
+        lt->window_start_us = now;
+    } else if (now - lt->window_start_us >= LT_WINDOW_US) {
+        lt_publish(lt, now);
+    }
+
+    if (lt->start_us != 0) {
+        period = now - lt->start_us;
+        lt_record(lt->period_hist, period);
+        lt->period_count++;
+        if (period > lt->period_max_us) {
+            lt->period_max_us = period;
+        }
+        if (lt->stats.expected_period_us > 0 && period > 2 * lt->stats.expected_period_us) {
+            lt->late_count++;
+        }
+    }
+
+    lt->start_us = now;
+    lt->started = true;
+}
+
+// called when the work of the loop iteration is done, before sleeping
+void loop_timing_end(int handle)
+{
+    struct loop_timing_s *lt = &loop_timing_tbl[handle];
+    int work;
+
+    if (!lt->started) {
+        return;
+    }
+
+    work = microsec_timer() - lt->start_us;
+    lt_record(lt->work_hist, work);
+    lt->work_count++;
+    if (work > lt->work_max_us) {
+        lt->work_max_us = work;
+    }
+    lt->started = false;
+}
+
+void loop_timing_idle(int handle)
+{
+    struct loop_timing_s *lt = &loop_timing_tbl[handle];
+
+    if (lt->period_count > 0 || lt->work_count > 0) {
+        lt_publish(lt, microsec_timer());
+    }
+    lt->start_us = 0;
+    lt->window_start_us = 0;
+    lt->started = false;
+}
+
+int loop_timing_get_max(void)
+{
+    return loop_timing_alloc < MAX_LOOP_TIMING ? loop_timing_alloc : MAX_LOOP_TIMING;
+}
+
+// returns -1 if the handle is not registered
+int loop_timing_get_stats(int handle, loop_timing_stats_t *stats)
+{
+    struct loop_timing_s *lt;
+    unsigned int seq;
+
+    if (handle < 0 || handle >= MAX_LOOP_TIMING || !loop_timing_tbl[handle].registered) {
+        return -1;
+    }
+    lt = &loop_timing_tbl[handle];
+
+    do {
+        seq = lt->seq;
+        __sync_synchronize();
+        *stats = lt->stats;
+        __sync_synchronize();
+    } while ((seq & 1) || seq != lt->seq);
+
+    return 0;
+}
+
+static void lt_record(uint32_t *hist, uint64_t us)
+{
+    int msb, idx;
+
+    if (us < LT_SUB_BUCKETS) {
+        idx = us;
+    } else {
+        msb = 63 - __builtin_clzll(us);
+        idx = (msb - LT_SUB_BUCKET_BITS + 1) * LT_SUB_BUCKETS +
+              ((us >> (msb - LT_SUB_BUCKET_BITS)) & (LT_SUB_BUCKETS - 1));
+        if (idx >= LT_MAX_BUCKET) {
+            idx = LT_MAX_BUCKET - 1;
+        }
+    }
+    hist[idx]++;
+}
+
+// returns the largest value in the bucket containing the percentile,
+// limited to max_us
+static int lt_percentile(uint32_t *hist, int count, int max_us, int per_mille)
+{
+    int idx, shift, sum = 0, target, value = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    target = ((int64_t)count * per_mille + 999) / 1000;
+    for (idx = 0; idx < LT_MAX_BUCKET; idx++) {
+        sum += hist[idx];
+        if (sum >= target) {
+            break;
+        }
+    }
+
+    if (idx < LT_SUB_BUCKETS) {
+        value = idx;
+    } else {
+        shift = idx / LT_SUB_BUCKETS - 1;
+        value = ((LT_SUB_BUCKETS + idx % LT_SUB_BUCKETS) << shift) + ((1 << shift) - 1);
+    }
+    return value < max_us ? value : max_us;
+}
+
+static void lt_publish(struct loop_timing_s *lt, uint64_t now)
+{
+    loop_timing_stats_t *s = &lt->stats;
+
+    lt->seq++;
+    __sync_synchronize();
+    s->window_us      = now - lt->window_start_us;
+    s->period_count   = lt->period_count;
+    s->late_count     = lt->late_count;
+    s->period_max_us  = lt->period_max_us;
+    s->period_p50_us  = lt_percentile(lt->period_hist, lt->period_count, lt->period_max_us, 500);
+    s->period_p99_us  = lt_percentile(lt->period_hist, lt->period_count, lt->period_max_us, 990);
+    s->period_p999_us = lt_percentile(lt->period_hist, lt->period_count, lt->period_max_us, 999);
+    s->work_count     = lt->work_count;
+    s->work_max_us    = lt->work_max_us;
+    s->work_p99_us    = lt_percentile(lt->work_hist, lt->work_count, lt->work_max_us, 990);
+    s->work_p999_us   = lt_percentile(lt->work_hist, lt->work_count, lt->work_max_us, 999);
+    __sync_synchronize();
+    lt->seq++;
+
+    memset(lt->period_hist, 0, sizeof(lt->period_hist));
+    memset(lt->work_hist, 0, sizeof(lt->work_hist));
+    lt->period_count = lt->work_count = lt->late_count = 0;
+    lt->period_max_us = lt->work_max_us = 0;
+    lt->window_start_us = now;
+}
@@ -92,7 +92,9 @@ extern "C" {
         } \
     } while (0)
 
+void logmsg_init(void);
 void logmsg(char * lvl, const char * func, char * fmt, ...) __attribute__ ((format (printf, 3, 4)));
+void logmsg_flush(void);
 void logmsg_register_cb(void (*cb)(char *str));
 
 // -----------------  TIME  --------------------------------------
@@ -132,6 +134,35 @@ typedef struct {
 double interpolate(interp_point_t *p, int n, double x);
 double sanitize_heading(double hdg, double base);
 
+// -----------------  LOOP TIMING  ---------------------------------------
+
+#define MAX_LOOP_TIMING       20
+#define MAX_LOOP_TIMING_NAME  16
+
+typedef struct {
+    char     name[MAX_LOOP_TIMING_NAME];
+    int      expected_period_us;  // 0 if the period is not fixed
+    int      window_us;           // duration of the window
+    int      period_count;
+    int      late_count;          // periods longer than twice the expected period
+    int      period_max_us;
+    int      period_p50_us;
+    int      period_p99_us;
+    int      period_p999_us;
+    int      work_count;
+    int      work_max_us;
+    int      work_p99_us;
+    int      work_p999_us;
+} loop_timing_stats_t;
+
+int loop_timing_register(char *name, int expected_period_us);
+void loop_timing_start(int handle);
+void loop_timing_start_at(int handle, uint64_t now);
+void loop_timing_end(int handle);
+void loop_timing_idle(int handle);
+int loop_timing_get_max(void);
+int loop_timing_get_stats(int handle, loop_timing_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
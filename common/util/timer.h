@@ -15,6 +15,7 @@ extern "C" {
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <hal.h>
 #else
 #include <linux/module.h>
 #endif
@@ -39,6 +40,13 @@ static inline int timer_init(void)
         return 0;
     }
 
+#ifndef __KERNEL__
+    // if using the hal backend then there are no timer regs to map
+    if (hal) {
+        return 0;
+    }
+#endif
+
 #ifndef __KERNEL__
     // verify bcm version
     rc = system("grep BCM2711 /proc/cpuinfo > /dev/null");
@@ -90,6 +98,12 @@ static inline uint64_t timer_get(void)
     unsigned int value;
     static uint64_t high_part;
 
+#ifndef __KERNEL__
+    if (hal) {
+        return hal->timer_get();
+    }
+#endif
+
     value = timer_regs[1];
 
     if (value < timer_last_value) {